@@ -119,6 +119,7 @@ workspace "librw"
 		system "windows"
 	filter { "platforms:linux*" }
 		system "linux"
+		links { "pthread" }
 
 	filter { "platforms:win*gl3" }
 		includedirs { path.join(_OPTIONS["sdl2dir"], "include") }
@@ -183,6 +184,15 @@ project "librw"
 		sysincludedirs { "tools/libRHI"}		
 		links { "libRHI" }
 		  
+project "bench"
+	kind "ConsoleApp"
+	targetdir (Bindir)
+	removeplatforms { "*gl3", "*d3d9", "ps2" }
+	files { "tools/bench/*" }
+	includedirs { "." }
+	libdirs { Libdir }
+	links { "librw" }
+
 project "dumprwtree"
 	kind "ConsoleApp"
 	targetdir (Bindir)
@@ -7,9 +7,11 @@
 
 #define PSEP_C '/'
 #define PSEP_S "/"
-#ifdef __unix__
+#if defined(__unix__) || defined(__APPLE__)
 #include <sys/types.h>
 #include <dirent.h>
+#elif defined(_WIN32)
+#include <io.h>
 #endif
 
 #include "rwbase.h"
@@ -687,6 +689,35 @@ correctPathCase(char *filename)
 #endif
 }
 
+int
+listDirectory(const char *path, void (*func)(const char *name, void *data), void *data)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	DIR *dir = opendir(path[0] ? path : ".");
+	if(dir == nil)
+		return 0;
+	struct dirent *ent;
+	while(ent = readdir(dir), ent != nil)
+		func(ent->d_name, data);
+	closedir(dir);
+	return 1;
+#elif defined(_WIN32)
+	char pattern[1024];
+	struct _finddata_t fd;
+	snprintf(pattern, sizeof(pattern), "%s*", path);
+	intptr_t h = _findfirst(pattern, &fd);
+	if(h == -1)
+		return 0;
+	do
+		func(fd.name, data);
+	while(_findnext(h, &fd) == 0);
+	_findclose(h);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 void
 makePath(char *filename)
 {
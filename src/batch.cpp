@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID 0
+
+namespace rw {
+
+/*
+ * Static batching.
+ * Atomics are sorted into batches of equal render state and vertex
+ * format in the same grid cell. Each batch becomes one geometry with
+ * the vertices transformed into the space of the new clump's frame.
+ * Whole atomics are merged, so every cell keeps a tight bounding sphere.
+ */
+
+enum { MAXBATCHVERTICES = 0xFFFF };
+
+#define FORMATFLAGS (Geometry::PRELIT | Geometry::NORMALS | Geometry::LIGHT | Geometry::MODULATE)
+
+struct BatchSource
+{
+	Atomic *atomic;
+	Matrix matrix;	// into clump space
+	int32 cell[3];
+	int32 batch;
+};
+
+static bool32
+canBatch(Atomic *atomic)
+{
+	Geometry *geo = atomic->geometry;
+	if(geo == nil || geo->flags & Geometry::NATIVE ||
+	   geo->numMorphTargets != 1 || geo->numTriangles == 0 ||
+	   geo->triangles == nil || geo->morphTargets[0].vertices == nil)
+		return 0;
+	if(skinGlobals.geoOffset && Skin::get(geo))
+		return 0;
+	if(lodGlobals.atomicOffset && AtomicLOD::get(atomic))
+		return 0;
+	return 1;
+}
+
+// Atomics that can go into the same geometry
+static bool32
+sameBatch(BatchSource *a, BatchSource *b)
+{
+	Atomic *aa = a->atomic, *ba = b->atomic;
+	Geometry *ag = aa->geometry, *bg = ba->geometry;
+	if(a->cell[0] != b->cell[0] || a->cell[1] != b->cell[1] || a->cell[2] != b->cell[2])
+		return 0;
+	if(aa->pipeline != ba->pipeline || aa->renderCB != ba->renderCB ||
+	   aa->getFlags() != ba->getFlags())
+		return 0;
+	if((ag->flags & FORMATFLAGS) != (bg->flags & FORMATFLAGS) ||
+	   ag->numTexCoordSets != bg->numTexCoordSets)
+		return 0;
+	if(matFXGlobals.atomicOffset &&
+	   *PLUGINOFFSET(int32, aa, matFXGlobals.atomicOffset) !=
+	   *PLUGINOFFSET(int32, ba, matFXGlobals.atomicOffset))
+		return 0;
+	return 1;
+}
+
+// Materials that can share a mesh
+static bool32
+sameMaterial(Material *a, Material *b)
+{
+	if(a == b)
+		return 1;
+	if(a->texture != b->texture || a->pipeline != b->pipeline ||
+	   !equal(a->color, b->color) ||
+	   a->surfaceProps.ambient != b->surfaceProps.ambient ||
+	   a->surfaceProps.specular != b->surfaceProps.specular ||
+	   a->surfaceProps.diffuse != b->surfaceProps.diffuse)
+		return 0;
+	if(matFXGlobals.materialOffset &&
+	   (MatFX::getEffects(a) || MatFX::getEffects(b)))
+		return 0;
+	if(uvAnimOffset && (UVAnim::exists(a) || UVAnim::exists(b)))
+		return 0;
+	return 1;
+}
+
+static Geometry*
+mergeGeometry(BatchSource *srcs, int32 numSrcs, int32 batch)
+{
+	int32 i, j, k;
+	int32 numVerts = 0, numTris = 0;
+	BatchSource *first = nil;
+	int32 *matMap = nil;
+	int32 maxMats = 0;
+
+	for(i = 0; i < numSrcs; i++)
+		if(srcs[i].batch == batch){
+			if(first == nil)
+				first = &srcs[i];
+			numVerts += srcs[i].atomic->geometry->numVertices;
+			numTris += srcs[i].atomic->geometry->numTriangles;
+		}
+	Geometry *fg = first->atomic->geometry;
+	uint32 flags = Geometry::POSITIONS | (fg->flags & FORMATFLAGS);
+	if(fg->numTexCoordSets > 0)
+		flags |= Geometry::TEXTURED;
+	if(fg->numTexCoordSets > 1)
+		flags |= Geometry::TEXTURED2;
+	Geometry *geo = Geometry::create(numVerts, numTris, flags | fg->numTexCoordSets<<16);
+	if(geo == nil)
+		return nil;
+
+	int32 vbase = 0;
+	Triangle *tri = geo->triangles;
+	MorphTarget *mt = &geo->morphTargets[0];
+	for(i = 0; i < numSrcs; i++){
+		if(srcs[i].batch != batch)
+			continue;
+		Geometry *src = srcs[i].atomic->geometry;
+		Matrix *m = &srcs[i].matrix;
+		int32 n = src->numVertices;
+
+		// mirroring transforms flip the winding
+		bool32 flip = dot(cross(m->right, m->up), m->at) < 0.0f;
+
+		V3d::transformPoints(&mt->vertices[vbase], src->morphTargets[0].vertices, n, m);
+		if(flags & Geometry::NORMALS){
+			V3d *nrm = &mt->normals[vbase];
+			if(src->morphTargets[0].normals){
+				// inverse transpose without the 1/det, normals are normalized anyway
+				Matrix nm;
+				float32 s = flip ? -1.0f : 1.0f;
+				nm.right = scale(cross(m->up, m->at), s);
+				nm.up = scale(cross(m->at, m->right), s);
+				nm.at = scale(cross(m->right, m->up), s);
+				V3d::transformVectors(nrm, src->morphTargets[0].normals, n, &nm);
+				for(j = 0; j < n; j++)
+					if(length(nrm[j]) > 0.0f)
+						nrm[j] = normalize(nrm[j]);
+			}else
+				memset(nrm, 0, n*sizeof(V3d));
+		}
+		if(flags & Geometry::PRELIT)
+			memcpy(&geo->colors[vbase], src->colors, n*sizeof(RGBA));
+		for(j = 0; j < geo->numTexCoordSets; j++)
+			memcpy(&geo->texCoords[j][vbase], src->texCoords[j], n*sizeof(TexCoords));
+
+		if(src->matList.numMaterials > maxMats){
+			maxMats = src->matList.numMaterials;
+			matMap = rwResizeT(int32, matMap, maxMats, MEMDUR_FUNCTION | ID_GEOMETRY);
+		}
+		for(j = 0; j < src->matList.numMaterials; j++){
+			Material *mat = src->matList.materials[j];
+			for(k = 0; k < geo->matList.numMaterials; k++)
+				if(sameMaterial(geo->matList.materials[k], mat))
+					break;
+			if(k == geo->matList.numMaterials)
+				k = geo->matList.appendMaterial(mat);
+			matMap[j] = k;
+		}
+
+		for(j = 0; j < src->numTriangles; j++){
+			Triangle *t = &src->triangles[j];
+			tri->v[0] = t->v[0] + vbase;
+			tri->v[1] = t->v[flip ? 2 : 1] + vbase;
+			tri->v[2] = t->v[flip ? 1 : 2] + vbase;
+			tri->matId = matMap[t->matId];
+			tri++;
+		}
+		vbase += n;
+	}
+	rwFree(matMap);
+
+	geo->buildMeshes();
+	geo->calculateBoundingSphere();
+	return geo;
+}
+
+static Clump*
+batchSources(BatchSource *srcs, int32 numSrcs, Frame *root, float32 cellSize)
+{
+	int32 i, j;
+	int32 numBatches = 0;
+	int32 *batchVerts = rwNewT(int32, numSrcs, MEMDUR_FUNCTION | ID_CLUMP);
+	int32 *batchFirst = rwNewT(int32, numSrcs, MEMDUR_FUNCTION | ID_CLUMP);
+
+	for(i = 0; i < numSrcs; i++){
+		V3d c;
+		V3d::transformPoints(&c, &srcs[i].atomic->boundingSphere.center, 1, &srcs[i].matrix);
+		if(cellSize > 0.0f){
+			srcs[i].cell[0] = (int32)floorf(c.x/cellSize);
+			srcs[i].cell[1] = (int32)floorf(c.y/cellSize);
+			srcs[i].cell[2] = (int32)floorf(c.z/cellSize);
+		}else
+			srcs[i].cell[0] = srcs[i].cell[1] = srcs[i].cell[2] = 0;
+	}
+
+	// put every atomic into the first batch it fits
+	for(i = 0; i < numSrcs; i++){
+		int32 n = srcs[i].atomic->geometry->numVertices;
+		for(j = 0; j < numBatches; j++)
+			if(batchVerts[j] + n <= MAXBATCHVERTICES &&
+			   sameBatch(&srcs[i], &srcs[batchFirst[j]]))
+				break;
+		if(j == numBatches){
+			batchFirst[numBatches] = i;
+			batchVerts[numBatches++] = 0;
+		}
+		srcs[i].batch = j;
+		batchVerts[j] += n;
+	}
+	rwFree(batchVerts);
+
+	Clump *clump = Clump::create();
+	clump->setFrame(root);
+	for(i = 0; i < numBatches; i++){
+		Geometry *geo = mergeGeometry(srcs, numSrcs, i);
+		if(geo == nil)
+			continue;
+		// takes over flags, pipeline and plugin data
+		Atomic *atomic = srcs[batchFirst[i]].atomic->clone();
+		atomic->setGeometry(geo, 0);
+		geo->destroy();
+		atomic->setFrame(root);
+		clump->addAtomic(atomic);
+	}
+	rwFree(batchFirst);
+	return clump;
+}
+
+static int32
+addSources(BatchSource *srcs, int32 n, Clump *clump, const Matrix *inv)
+{
+	FORLIST(lnk, clump->atomics){
+		Atomic *a = Atomic::fromClump(lnk);
+		if(!canBatch(a))
+			continue;
+		srcs[n].atomic = a;
+		Matrix::mult(&srcs[n].matrix, a->getFrame()->getLTM(), inv);
+		n++;
+	}
+	return n;
+}
+
+Clump*
+batchClump(Clump *clump, float32 cellSize, int32 *numSkipped)
+{
+	Matrix inv;
+	int32 total = clump->countAtomics();
+	BatchSource *srcs = rwNewT(BatchSource, total, MEMDUR_FUNCTION | ID_CLUMP);
+
+	Frame *srcRoot = clump->getFrame();
+	Matrix::invert(&inv, srcRoot->getLTM());
+	int32 n = addSources(srcs, 0, clump, &inv);
+	if(numSkipped)
+		*numSkipped = total - n;
+
+	Frame *root = Frame::create();
+	root->transform(srcRoot->getLTM(), COMBINEREPLACE);
+	Clump *ret = batchSources(srcs, n, root, cellSize);
+	rwFree(srcs);
+	return ret;
+}
+
+Clump*
+batchWorld(World *world, float32 cellSize, int32 *numSkipped)
+{
+	Matrix ident;
+	int32 total = 0;
+	FORLIST(lnk, world->clumps)
+		total += Clump::fromWorld(lnk)->countAtomics();
+	BatchSource *srcs = rwNewT(BatchSource, total, MEMDUR_FUNCTION | ID_CLUMP);
+
+	ident.setIdentity();
+	int32 n = 0;
+	FORLIST(lnk, world->clumps)
+		n = addSources(srcs, n, Clump::fromWorld(lnk), &ident);
+	if(numSkipped)
+		*numSkipped = total - n;
+
+	Clump *ret = batchSources(srcs, n, Frame::create(), cellSize);
+	rwFree(srcs);
+	return ret;
+}
+
+}
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+#include "rwsimd.h"
+
+#define PLUGIN_ID ID_BOUNDS
+
+namespace rw {
+
+BoundsGlobals boundsGlobals;
+
+#define GEOBOUNDS(geo) (*PLUGINOFFSET(GeometryBounds*, geo, boundsGlobals.geoOffset))
+
+static void
+freeBounds(GeometryBounds *b)
+{
+	if(b == nil)
+		return;
+	rwFree(b->meshBoxes);
+	rwFree(b);
+}
+
+static GeometryBounds*
+newBounds(int32 numMeshes)
+{
+	GeometryBounds *b = rwNewT(GeometryBounds, 1, MEMDUR_EVENT | ID_BOUNDS);
+	b->numMeshes = numMeshes;
+	b->meshBoxes = numMeshes ? rwNewT(BBox, numMeshes, MEMDUR_EVENT | ID_BOUNDS) : nil;
+	b->serialNum = -1;
+	b->totalIndices = 0;
+	b->indexChecksum = 0;
+	return b;
+}
+
+static void*
+createBounds(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(GeometryBounds*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyBounds(void *object, int32 offset, int32)
+{
+	freeBounds(*PLUGINOFFSET(GeometryBounds*, object, offset));
+	*PLUGINOFFSET(GeometryBounds*, object, offset) = nil;
+	return object;
+}
+
+static void*
+copyBounds(void *dst, void *src, int32 offset, int32)
+{
+	GeometryBounds *srcb = *PLUGINOFFSET(GeometryBounds*, src, offset);
+	*PLUGINOFFSET(GeometryBounds*, dst, offset) = nil;
+	if(srcb == nil)
+		return dst;
+	GeometryBounds *b = newBounds(srcb->numMeshes);
+	b->box = srcb->box;
+	if(b->numMeshes)
+		memcpy(b->meshBoxes, srcb->meshBoxes, b->numMeshes*sizeof(BBox));
+	// the copy gets new meshes, they're matched on first use
+	b->totalIndices = srcb->totalIndices;
+	b->indexChecksum = srcb->indexChecksum;
+	*PLUGINOFFSET(GeometryBounds*, dst, offset) = b;
+	return dst;
+}
+
+// Bounds that still match the geometry's meshes
+static GeometryBounds*
+findBounds(Geometry *geo)
+{
+	if(boundsGlobals.geoOffset == 0)
+		return nil;
+	GeometryBounds *b = GEOBOUNDS(geo);
+	MeshHeader *header = geo->meshHeader;
+	if(b == nil)
+		return nil;
+	if(header == nil)
+		return b->numMeshes == 0 ? b : nil;
+	if(b->serialNum < 0 && header->numMeshes == b->numMeshes &&
+	   header->totalIndices == b->totalIndices &&
+	   header->getIndexChecksum() == b->indexChecksum)
+		b->serialNum = header->serialNum;
+	if(b->serialNum != header->serialNum)
+		return nil;
+	return b;
+}
+
+static Stream*
+readBounds(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	destroyBounds(object, offset, 0);
+	int32 numMeshes = stream->readI32();
+	uint32 totalIndices = stream->readU32();
+	uint32 indexChecksum = stream->readU32();
+	if(numMeshes < 0 || numMeshes > 0xFFFF){
+		RWERROR((ERR_GENERAL, "invalid bounds"));
+		return nil;
+	}
+	GeometryBounds *b = newBounds(numMeshes);
+	b->totalIndices = totalIndices;
+	b->indexChecksum = indexChecksum;
+	stream->read32(&b->box, sizeof(BBox));
+	if(numMeshes)
+		stream->read32(b->meshBoxes, numMeshes*sizeof(BBox));
+	// the mesh header may not be read yet, it's matched on first use
+	*PLUGINOFFSET(GeometryBounds*, object, offset) = b;
+	return stream;
+}
+
+static Stream*
+writeBounds(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	GeometryBounds *b = *PLUGINOFFSET(GeometryBounds*, object, offset);
+	stream->writeI32(b->numMeshes);
+	stream->writeU32(b->totalIndices);
+	stream->writeU32(b->indexChecksum);
+	stream->write32(&b->box, sizeof(BBox));
+	if(b->numMeshes)
+		stream->write32(b->meshBoxes, b->numMeshes*sizeof(BBox));
+	return stream;
+}
+
+// Only bounds that were calculated or read are written,
+// they're not calculated here.
+static int32
+getSizeBounds(void *object, int32, int32)
+{
+	GeometryBounds *b = findBounds((Geometry*)object);
+	if(b == nil)
+		return 0;
+	return 12 + (1 + b->numMeshes)*sizeof(BBox);
+}
+
+void
+registerBoundsPlugin(void)
+{
+	boundsGlobals.geoOffset =
+	Geometry::registerPlugin(sizeof(GeometryBounds*), ID_BOUNDS,
+	                         createBounds, destroyBounds, copyBounds);
+	Geometry::registerPluginStream(ID_BOUNDS,
+	                               readBounds, writeBounds, getSizeBounds);
+}
+
+// Grow the box by the indexed points. Points are read as four
+// floats except for the last one.
+static void
+addIndexedPoints(BBox *box, V3d *points, int32 numPoints, uint16 *indices, uint32 n)
+{
+	using namespace simd;
+	F4 lo = set(box->inf.x, box->inf.y, box->inf.z, 0.0f);
+	F4 hi = set(box->sup.x, box->sup.y, box->sup.z, 0.0f);
+	const float32 *f = (const float32*)points;
+	int32 last = numPoints-1;
+	for(uint32 i = 0; i < n; i++){
+		int32 v = indices[i];
+		F4 p = v < last ? load(f+v*3) :
+			set(points[v].x, points[v].y, points[v].z, 0.0f);
+		lo = min(lo, p);
+		hi = max(hi, p);
+	}
+	float32 l[4], h[4];
+	store(l, lo);
+	store(h, hi);
+	box->inf.set(l[0], l[1], l[2]);
+	box->sup.set(h[0], h[1], h[2]);
+}
+
+GeometryBounds*
+GeometryBounds::calculate(Geometry *geo)
+{
+	int32 i, j;
+
+	if(boundsGlobals.geoOffset == 0)
+		return nil;
+	destroyBounds(geo, boundsGlobals.geoOffset, 0);
+	if(geo->numVertices == 0 || geo->numMorphTargets == 0 ||
+	   geo->morphTargets[0].vertices == nil)
+		return nil;
+
+	MeshHeader *header = geo->meshHeader;
+	GeometryBounds *b = newBounds(header ? header->numMeshes : 0);
+	for(i = 0; i < geo->numMorphTargets; i++){
+		BBox box;
+		box.calculate(geo->morphTargets[i].vertices, geo->numVertices);
+		if(i == 0)
+			b->box = box;
+		else{
+			b->box.addPoint(&box.inf);
+			b->box.addPoint(&box.sup);
+		}
+	}
+	if(header){
+		Mesh *m = header->getMeshes();
+		for(j = 0; j < b->numMeshes; j++){
+			BBox *box = &b->meshBoxes[j];
+			box->inf.set(FLT_MAX, FLT_MAX, FLT_MAX);
+			box->sup.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			if(m[j].indices == nil)
+				continue;
+			for(i = 0; i < geo->numMorphTargets; i++)
+				addIndexedPoints(box, geo->morphTargets[i].vertices,
+					geo->numVertices, m[j].indices, m[j].numIndices);
+		}
+		b->serialNum = header->serialNum;
+		b->totalIndices = header->totalIndices;
+		b->indexChecksum = header->getIndexChecksum();
+	}
+	GEOBOUNDS(geo) = b;
+	return b;
+}
+
+void
+GeometryBounds::destroy(Geometry *geo)
+{
+	if(boundsGlobals.geoOffset)
+		destroyBounds(geo, boundsGlobals.geoOffset, 0);
+}
+
+GeometryBounds*
+GeometryBounds::get(Geometry *geo)
+{
+	GeometryBounds *b = findBounds(geo);
+	if(b == nil)
+		b = GeometryBounds::calculate(geo);
+	return b;
+}
+
+bool32
+GeometryBounds::getWorldBBox(Atomic *atomic, BBox *box)
+{
+	Geometry *geo = atomic->geometry;
+	GeometryBounds *b = geo ? GeometryBounds::get(geo) : nil;
+	if(b == nil)
+		return 0;
+	Matrix *ltm = atomic->getFrame()->getRenderLTM();
+	V3d c = scale(add(b->box.inf, b->box.sup), 0.5f);
+	V3d e = scale(sub(b->box.sup, b->box.inf), 0.5f);
+	V3d::transformPoints(&c, &c, 1, ltm);
+	V3d we = {
+		fabsf(ltm->right.x)*e.x + fabsf(ltm->up.x)*e.y + fabsf(ltm->at.x)*e.z,
+		fabsf(ltm->right.y)*e.x + fabsf(ltm->up.y)*e.y + fabsf(ltm->at.y)*e.z,
+		fabsf(ltm->right.z)*e.x + fabsf(ltm->up.z)*e.y + fabsf(ltm->at.z)*e.z
+	};
+	box->inf = sub(c, we);
+	box->sup = add(c, we);
+	return 1;
+}
+
+}
@@ -14,6 +14,8 @@
 
 #include "rwengine.h"
 
+#include "rwsimd.h"
+
 #define PLUGIN_ID ID_CAMERA
 
 namespace rw {
@@ -446,6 +448,116 @@ namespace rw {
 		return res;
 	}
 
+	int32
+		Camera::frustumTestBBox(const BBox* box) const
+	{
+		int32 res = SPHEREINSIDE;
+		const FrustumPlane* p = this->frustumPlanes;
+		V3d far, near;
+		for (int32 i = 0; i < 6; i++) {
+			// corners furthest along and against the normal
+			far.x = p->closestX ? box->sup.x : box->inf.x;
+			far.y = p->closestY ? box->sup.y : box->inf.y;
+			far.z = p->closestZ ? box->sup.z : box->inf.z;
+			near.x = p->closestX ? box->inf.x : box->sup.x;
+			near.y = p->closestY ? box->inf.y : box->sup.y;
+			near.z = p->closestZ ? box->inf.z : box->sup.z;
+			if (dot(p->plane.normal, near) - p->plane.distance > 0.0f)
+				return SPHEREOUTSIDE;
+			if (dot(p->plane.normal, far) - p->plane.distance > 0.0f)
+				res = SPHEREBOUNDARY;
+			p++;
+		}
+		return res;
+	}
+
+	static void
+		writeResults(uint8* results, int32 outside, int32 boundary)
+	{
+		for (int32 j = 0; j < 4; j++)
+			results[j] = outside & (1 << j) ? Camera::SPHEREOUTSIDE :
+				boundary & (1 << j) ? Camera::SPHEREBOUNDARY :
+				Camera::SPHEREINSIDE;
+	}
+
+	void
+		Camera::frustumTestSpheres(int32 n, const float32* x, const float32* y,
+			const float32* z, const float32* radius, uint8* results) const
+	{
+		using namespace simd;
+		int32 i;
+		F4 nx[6], ny[6], nz[6], d[6];
+		for (i = 0; i < 6; i++) {
+			nx[i] = set1(this->frustumPlanes[i].plane.normal.x);
+			ny[i] = set1(this->frustumPlanes[i].plane.normal.y);
+			nz[i] = set1(this->frustumPlanes[i].plane.normal.z);
+			d[i] = set1(this->frustumPlanes[i].plane.distance);
+		}
+
+		for (i = 0; i + 4 <= n; i += 4) {
+			F4 cx = load(x + i);
+			F4 cy = load(y + i);
+			F4 cz = load(z + i);
+			F4 r = load(radius + i);
+			F4 outside = zero();
+			F4 boundary = zero();
+			for (int32 j = 0; j < 6; j++) {
+				F4 dist = sub(madd(nx[j], cx, madd(ny[j], cy, mul(nz[j], cz))), d[j]);
+				outside = or_(outside, cmplt(r, dist));
+				boundary = or_(boundary, cmpgt(add(r, dist), zero()));
+			}
+			writeResults(results + i, movemask(outside), movemask(boundary));
+		}
+
+		Sphere s;
+		for (; i < n; i++) {
+			s.center.set(x[i], y[i], z[i]);
+			s.radius = radius[i];
+			results[i] = this->frustumTestSphere(&s);
+		}
+	}
+
+	void
+		Camera::frustumTestBBoxes(int32 n, const float32* infx, const float32* infy,
+			const float32* infz, const float32* supx, const float32* supy,
+			const float32* supz, uint8* results) const
+	{
+		using namespace simd;
+		int32 i;
+		F4 nx[6], ny[6], nz[6], d[6];
+		for (i = 0; i < 6; i++) {
+			nx[i] = set1(this->frustumPlanes[i].plane.normal.x);
+			ny[i] = set1(this->frustumPlanes[i].plane.normal.y);
+			nz[i] = set1(this->frustumPlanes[i].plane.normal.z);
+			d[i] = set1(this->frustumPlanes[i].plane.distance);
+		}
+
+		for (i = 0; i + 4 <= n; i += 4) {
+			F4 ix = load(infx + i), iy = load(infy + i), iz = load(infz + i);
+			F4 sx = load(supx + i), sy = load(supy + i), sz = load(supz + i);
+			F4 outside = zero();
+			F4 boundary = zero();
+			for (int32 j = 0; j < 6; j++) {
+				// pick the corners without branching on the normal
+				F4 ax = mul(nx[j], ix), bx = mul(nx[j], sx);
+				F4 ay = mul(ny[j], iy), by = mul(ny[j], sy);
+				F4 az = mul(nz[j], iz), bz = mul(nz[j], sz);
+				F4 near = sub(add(add(min(ax, bx), min(ay, by)), min(az, bz)), d[j]);
+				F4 far = sub(add(add(max(ax, bx), max(ay, by)), max(az, bz)), d[j]);
+				outside = or_(outside, cmpgt(near, zero()));
+				boundary = or_(boundary, cmpgt(far, zero()));
+			}
+			writeResults(results + i, movemask(outside), movemask(boundary));
+		}
+
+		BBox box;
+		for (; i < n; i++) {
+			box.inf.set(infx[i], infy[i], infz[i]);
+			box.sup.set(supx[i], supy[i], supz[i]);
+			results[i] = this->frustumTestBBox(&box);
+		}
+	}
+
 	struct CameraChunkData
 	{
 		V2d viewWindow;
@@ -396,7 +396,6 @@ Clump::render(void)
 static void
 atomicSync(ObjectWithFrame *obj)
 {
-	// TODO: interpolate
 	obj->object.privateFlags |= Atomic::WORLDBOUNDDIRTY;
 }
 
@@ -82,7 +82,8 @@ calculateTextureSize(uint32 width, uint32 height, uint32 depth, uint32 format)
 }
 
 int vertFormatMap[] = {
-	-1, VERT_FLOAT2, VERT_FLOAT3, VERT_FLOAT4, VERT_ARGB, VERT_RGBA /* blend indices */
+	-1, VERT_FLOAT2, VERT_FLOAT3, VERT_FLOAT4, VERT_ARGB, VERT_RGBA /* blend indices */,
+	-1, -1, VERT_UBYTE4N, -1, VERT_NORMSHORT3 /* SHORT4N */, -1, -1, -1, -1, VERT_HALF2
 };
 
 void*
@@ -188,10 +189,9 @@ lockVertices(void *vertexBuffer, uint32 offset, uint32 size, uint32 flags)
 	vertbuf->Lock(offset, size, (void**)&verts, flags);
 	return verts;
 #else
-	(void)offset;
 	(void)size;
 	(void)flags;
-	return (uint8*)vertexBuffer;
+	return (uint8*)vertexBuffer + offset;
 #endif
 }
 
@@ -217,6 +217,9 @@ createTexture(int32 width, int32 height, int32 numlevels, uint32 usage, uint32 f
 		d3d9Globals.numTextures++;
 	return tex;
 #else
+	// automatic mipmaps only have the top level accessible
+	if(numlevels == 0)
+		numlevels = 1;
 	int32 w = width;
 	int32 h = height;
 	int32 size = 0;
@@ -433,6 +436,7 @@ rasterCreateTexture(Raster *raster)
 		RWERROR((ERR_NOTEXTURE));
 		return nil;
 	}
+	reportTextureSize(raster);
 	return raster;
 }
 
@@ -468,6 +472,7 @@ rasterCreateCameraTexture(Raster *raster)
 	}
 	d3d9Globals.numTextures++;
 	addVidmemRaster(raster);
+	reportTextureSize(raster);
 	return raster;
 }
 
@@ -722,13 +727,65 @@ imageFindRasterFormat(Image *img, int32 type,
 	return 1;
 }
 
+// Compress image into a raster allocated with allocateDXT.
+// A locked raster gets the locked level, it has to match the image.
+static bool32
+rasterFromImageDXT(Raster *raster, Image *image, int32 dxt)
+{
+	if(image->width != raster->width || image->height != raster->height){
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+	uint8 *dxtpixels = image->compressDXT(dxt, Image::dxtQuality);
+	if(dxtpixels == nil)
+		return 0;
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+	assert(raster->pixels);
+	memcpy(raster->pixels, dxtpixels, getDXTSize(dxt, image->width, image->height));
+	if(unlock)
+		raster->unlock(0);
+	rwFree(dxtpixels);
+	return 1;
+}
+
+// Memory layout of a raster's pixels for the row conversions
+static int32
+rasterConvFormat(int32 format)
+{
+	if(format & (Raster::PAL8 | Raster::PAL4))
+		return CONVFMT_8;
+	switch(format & 0xF00){
+	case Raster::C8888:
+	case Raster::C888:	// X8R8G8B8
+		return CONVFMT_BGRA8888;
+	case Raster::C1555:
+		return CONVFMT_ARGB1555;
+	case Raster::C555:
+		return CONVFMT_RGB555;
+	}
+	return -1;
+}
+
 bool32
 rasterFromImage(Raster *raster, Image *image)
 {
 	if((raster->type&0xF) != Raster::TEXTURE)
 		return 0;
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	D3dRaster *natras = GETD3DRASTEREXT(raster);
+	if(natras->customFormat)
+		switch(natras->format){
+		case D3DFMT_DXT1: return rasterFromImageDXT(raster, image, 1);
+		case D3DFMT_DXT3: return rasterFromImageDXT(raster, image, 3);
+		case D3DFMT_DXT5: return rasterFromImageDXT(raster, image, 5);
+		}
+
+	ConvRowFunc conv = nil;
 
 	// Unpalettize image if necessary but don't change original
 	Image *truecolimg = nil;
@@ -741,45 +798,13 @@ rasterFromImage(Raster *raster, Image *image)
 		image = truecolimg;
 	}
 
-	D3dRaster *natras = GETD3DRASTEREXT(raster);
 	int32 format = raster->format&(Raster::PAL8 | Raster::PAL4 | 0xF00);
-	switch(image->depth){
-	case 32:
-		if(format == Raster::C8888)
-			conv = conv_BGRA8888_from_RGBA8888;
-		else if(format == Raster::C888)
-			conv = conv_BGR888_from_RGB888;
-		else
-			goto err;
-		break;
-	case 24:
-		if(format == Raster::C8888)
-			conv = conv_BGRA8888_from_RGB888;
-		else if(format == Raster::C888)
-			conv = conv_BGR888_from_RGB888;
-		else
-			goto err;
-		break;
-	case 16:
-		if(format == Raster::C1555)
-			conv = conv_ARGB1555_from_ARGB1555;
-		else
-			goto err;
-		break;
-	case 8:
-		if(format == (Raster::PAL8 | Raster::C8888))
-			conv = conv_8_from_8;
-		else
-			goto err;
-		break;
-	case 4:
-		if(format == (Raster::PAL4 | Raster::C8888) ||
-		   format == (Raster::PAL8 | Raster::C8888))
-			conv = conv_8_from_8;
-		else
-			goto err;
-		break;
-	default:
+	// palettes are always C8888, PAL4 rasters only take 4 bit images
+	if((format & (Raster::PAL8 | Raster::PAL4) && (format & 0xF00) != Raster::C8888) ||
+	   (format & Raster::PAL4 && image->depth != 4))
+		goto err;
+	conv = getConvRow(rasterConvFormat(format), getImageConvFormat(image));
+	if(conv == nil){
 	err:
 fprintf(stderr, "%d %x\n", image->depth, format); fflush(stdout);
 		RWERROR((ERR_INVRASTER));
@@ -795,11 +820,7 @@ fprintf(stderr, "%d %x\n", image->depth, format); fflush(stdout);
 	if(pallength){
 		in = image->palette;
 		out = (uint8*)natras->palette;
-		for(int32 i = 0; i < pallength; i++){
-			conv_RGBA8888_from_RGBA8888(out, in);
-			in += 4;
-			out += 4;
-		}
+		convRow_RGBA8888_from_RGBA8888(out, in, pallength);
 	}
 
 	bool unlock = false;
@@ -812,20 +833,10 @@ fprintf(stderr, "%d %x\n", image->depth, format); fflush(stdout);
 	assert(pixels);
 	uint8 *imgpixels = image->pixels;
 
-	int x, y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
-	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(rasrow, imgrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
-		imgpixels += image->stride;
-		pixels += raster->stride;
-	}
+	convertPixels(pixels, raster->stride, imgpixels, image->stride,
+		image->width, image->height, conv);
 	if(unlock)
 		raster->unlock(0);
 
@@ -884,23 +895,16 @@ rasterToImage(Raster *raster)
 		return image;
 	}
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
 	switch(raster->format & 0xF00){
 	case Raster::C1555:
+	case Raster::C555:
 		depth = 16;
-		conv = conv_ARGB1555_from_ARGB1555;
 		break;
 	case Raster::C8888:
 		depth = 32;
-		conv = conv_RGBA8888_from_BGRA8888;
 		break;
 	case Raster::C888:
 		depth = 24;
-		conv = conv_RGB888_from_BGR888;
-		break;
-	case Raster::C555:
-		depth = 16;
-		conv = conv_ARGB1555_from_RGB555;
 		break;
 
 	default:
@@ -922,34 +926,22 @@ rasterToImage(Raster *raster)
 	uint8 *in, *out;
 	image = Image::create(raster->width, raster->height, depth);
 	image->allocate();
+	ConvRowFunc conv = getConvRow(getImageConvFormat(image), rasterConvFormat(raster->format));
+	assert(conv);
 
 	if(pallength){
 		out = image->palette;
 		in = (uint8*)natras->palette;
-		for(int32 i = 0; i < pallength; i++){
-			conv_RGBA8888_from_RGBA8888(out, in);
-			in += 4;
-			out += 4;
-		}
+		convRow_RGBA8888_from_RGBA8888(out, in, pallength);
 	}
 
 	uint8 *imgpixels = image->pixels;
 	uint8 *pixels = raster->pixels;
 
-	int x, y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
-	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(imgrow, rasrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
-		imgpixels += image->stride;
-		pixels += raster->stride;
-	}
+	convertPixels(imgpixels, image->stride, pixels, raster->stride,
+		image->width, image->height, conv);
 	image->compressPalette();
 
 	if(unlock)
@@ -973,6 +965,63 @@ getLevelSize(Raster *raster, int32 level)
 #endif
 }
 
+static uint32
+getTextureSize(Raster *raster, int32 firstLevel)
+{
+	uint32 size = 0;
+	int32 numLevels = rasterNumLevels(raster);
+	for(int32 i = firstLevel; i < numLevels; i++)
+		size += getLevelSize(raster, i);
+	return size;
+}
+
+void
+reportTextureSize(Raster *raster)
+{
+	TextureResidency::reportSize(raster, getTextureSize(raster, 0));
+}
+
+// Managed D3D9 textures keep all levels in system memory,
+// so they can drop the top levels from video memory with SetLOD.
+// Evicted textures are released and have to be filled again.
+bool32
+rasterSetResidency(Raster *raster, int32 firstLevel, int32 numLevels)
+{
+	D3dRaster *natras = GETD3DRASTEREXT(raster);
+	bool32 kept = 1;
+
+	if(raster->type != Raster::NORMAL && raster->type != Raster::TEXTURE)
+		return 0;
+#ifdef RW_D3D9
+	evictD3D9Raster(raster);
+#endif
+	if(firstLevel >= numLevels){
+		destroyTexture(natras->texture);
+		natras->texture = nil;
+		TextureResidency::reportSize(raster, 0);
+		return 0;
+	}
+	if(natras->texture == nil){
+		natras->texture = createTexture(raster->width, raster->height,
+		                                natras->autogenMipmap ? 0 : numLevels,
+		                                natras->autogenMipmap ? D3DUSAGE_AUTOGENMIPMAP : 0,
+		                                natras->format);
+		if(natras->texture == nil){
+			RWERROR((ERR_NOTEXTURE));
+			return 0;
+		}
+		kept = 0;
+	}
+#ifdef RW_D3D9
+	((IDirect3DTexture9*)natras->texture)->SetLOD(firstLevel);
+	TextureResidency::reportSize(raster, getTextureSize(raster, firstLevel));
+#else
+	// all levels stay in memory
+	TextureResidency::reportSize(raster, getTextureSize(raster, 0));
+#endif
+	return kept;
+}
+
 void
 allocateDXT(Raster *raster, int32 dxt, int32 numLevels, bool32 hasAlpha)
 {
@@ -998,6 +1047,7 @@ allocateDXT(Raster *raster, int32 dxt, int32 numLevels, bool32 hasAlpha)
 	                             ras->autogenMipmap ? D3DUSAGE_AUTOGENMIPMAP : 0,
 	                             ras->format);
 	raster->flags &= ~Raster::DONTALLOCATE;
+	reportTextureSize(raster);
 }
 
 void
@@ -1042,6 +1092,7 @@ destroyNativeRaster(void *object, int32 offset, int32)
 	case Raster::TEXTURE:
 	case Raster::CAMERATEXTURE:
 		destroyTexture(natras->texture);
+		TextureResidency::reportSize(raster, 0);
 		break;
 
 	case Raster::ZBUFFER:
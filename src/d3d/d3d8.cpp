@@ -34,6 +34,7 @@ driverOpen(void *o, int32, int32)
 	engine->driver[PLATFORM_D3D8]->imageFindRasterFormat = imageFindRasterFormat;
 	engine->driver[PLATFORM_D3D8]->rasterFromImage    = rasterFromImage;
 	engine->driver[PLATFORM_D3D8]->rasterToImage      = rasterToImage;
+	engine->driver[PLATFORM_D3D8]->rasterSetResidency = rasterSetResidency;
 	return o;
 }
 
@@ -257,6 +258,8 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	// TODO: allow for REINSTANCE
 	if(geo->instData)
 		return;
+	if(Geometry::optimizeOnInstance)
+		geo->optimizeVertexCache();
 	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 	MeshHeader *meshh = geo->meshHeader;
 	geo->instData = header;
@@ -33,7 +33,7 @@ defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
 	d3d::setRenderState(D3DRS_LIGHTING, !!(flags & rw::Geometry::LIGHT));
 
 	Frame *f = atomic->getFrame();
-	convMatrix(&world, f->getLTM());
+	convMatrix(&world, f->getRenderLTM());
 	d3ddevice->SetTransform(D3DTS_WORLD, (D3DMATRIX*)&world);
 
 	InstanceData *inst = header->inst;
@@ -45,6 +45,7 @@ driverOpen(void *o, int32, int32)
 	engine->driver[PLATFORM_D3D9]->imageFindRasterFormat = imageFindRasterFormat;
 	engine->driver[PLATFORM_D3D9]->rasterFromImage    = rasterFromImage;
 	engine->driver[PLATFORM_D3D9]->rasterToImage      = rasterToImage;
+	engine->driver[PLATFORM_D3D9]->rasterSetResidency = rasterSetResidency;
 	return o;
 }
 
@@ -344,6 +345,8 @@ registerNativeDataPlugin(void)
 static InstanceDataHeader*
 instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 {
+	if(Geometry::optimizeOnInstance)
+		geo->optimizeVertexCache();
 	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 	MeshHeader *meshh = geo->meshHeader;
 	header->platform = PLATFORM_D3D9;
@@ -415,7 +418,7 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	}else if(geo->lockedSinceInst)
 		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 1);
 
-	geo->lockedSinceInst = 0;
+	geo->resetLocks();
 }
 
 static void
@@ -484,6 +487,33 @@ ObjPipeline::create(void)
 	return pipe;
 }
 
+uint32
+getQuantizeFlags(void)
+{
+	uint32 quant = Geometry::quantizeOnInstance & ~Geometry::QUANTPOSITIONS;
+#ifdef RW_D3D9
+	uint32 dtcaps = d3d9Globals.caps.DeclTypes;
+	if((dtcaps & D3DDTCAPS_SHORT4N) == 0)
+		quant &= ~Geometry::QUANTNORMALS;
+	if((dtcaps & D3DDTCAPS_FLOAT16_2) == 0)
+		quant &= ~Geometry::QUANTTEXCOORDS;
+	if((dtcaps & D3DDTCAPS_UBYTE4N) == 0)
+		quant &= ~Geometry::QUANTWEIGHTS;
+#endif
+	return quant;
+}
+
+// Locks only the part of the buffer the spans cover.
+// The returned pointer is for the start of the buffer.
+uint8*
+lockVertexSpans(void *vertexBuffer, uint32 stride, VertexSpan *spans, int32 numSpans)
+{
+	uint32 first = spans[0].first;
+	uint32 end = spans[numSpans-1].first + spans[numSpans-1].count;
+	uint8 *verts = lockVertices(vertexBuffer, first*stride, (end-first)*stride, D3DLOCK_NOSYSLOCK);
+	return verts - first*stride;
+}
+
 void
 defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 {
@@ -498,6 +528,7 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 
 	if(!reinstance){
 		// Create declarations and buffers only the first time
+		uint32 quant = getQuantizeFlags();
 
 		assert(s->vertexBuffer == nil);
 		s->offset = 0;
@@ -530,25 +561,25 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			dcl[i].stream = 0;
 			dcl[i].offset = stride;
-			dcl[i].type = D3DDECLTYPE_FLOAT2;
+			dcl[i].type = quant & Geometry::QUANTTEXCOORDS ? D3DDECLTYPE_FLOAT16_2 : D3DDECLTYPE_FLOAT2;
 			dcl[i].method = D3DDECLMETHOD_DEFAULT;
 			dcl[i].usage = D3DDECLUSAGE_TEXCOORD;
 			dcl[i].usageIndex = (uint8)n;
 			i++;
 			s->geometryFlags |= 0x10 << n;
-			stride += 8;
+			stride += quant & Geometry::QUANTTEXCOORDS ? 4 : 8;
 		}
 
 		if(hasNormals){
 			dcl[i].stream = 0;
 			dcl[i].offset = stride;
-			dcl[i].type = D3DDECLTYPE_FLOAT3;
+			dcl[i].type = quant & Geometry::QUANTNORMALS ? D3DDECLTYPE_SHORT4N : D3DDECLTYPE_FLOAT3;
 			dcl[i].method = D3DDECLMETHOD_DEFAULT;
 			dcl[i].usage = D3DDECLUSAGE_NORMAL;
 			dcl[i].usageIndex = 0;
 			i++;
 			s->geometryFlags |= 0x4;
-			stride += 12;
+			stride += quant & Geometry::QUANTNORMALS ? 8 : 12;
 		}
 
 		// We expect some attributes to always be there, use the constant buffer as fallback
@@ -582,55 +613,84 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	}else
 		getDeclaration(header->vertexDeclaration, dcl);
 
-	uint8 *verts = lockVertices(s->vertexBuffer, 0, 0, D3DLOCK_NOSYSLOCK);
+	VertexSpan all, *spans;
+	int32 k, numSpans;
+	numSpans = geo->getLockedSpans(Geometry::LOCKALL, reinstance, &all, &spans);
+	if(numSpans == 0)
+		return;
+	uint8 *verts = lockVertexSpans(s->vertexBuffer, s->stride, spans, numSpans);
 
 	// Instance vertices
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	numSpans = geo->getLockedSpans(Geometry::LOCKVERTICES, reinstance, &all, &spans);
+	if(numSpans){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_POSITION || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++)
+			instV3d(vertFormatMap[dcl[i].type],
+				verts + dcl[i].offset + stride*spans[k].first,
+				geo->morphTargets[0].vertices + spans[k].first,
+				spans[k].count, stride);
 	}
 
 	// Instance prelight colors
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	numSpans = geo->getLockedSpans(Geometry::LOCKPRELIGHT, reinstance, &all, &spans);
+	if(isPrelit && numSpans){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_COLOR || dcl[i].usageIndex != 0; i++)
 			;
-		InstanceData *inst = header->inst;
-		uint32 n = header->numMeshes;
-		while(n--){
-			uint32 stride = header->vertexStream[dcl[i].stream].stride;
-			inst->vertexAlpha = instColor(vertFormatMap[dcl[i].type],
-				verts + dcl[i].offset + stride*inst->minVert,
-				geo->colors + inst->minVert,
-				inst->numVertices,
-				stride);
-			inst++;
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++){
+			InstanceData *inst = header->inst;
+			uint32 n = header->numMeshes;
+			while(n--){
+				// part of the span used by this mesh
+				uint32 first = spans[k].first;
+				uint32 end = first + spans[k].count;
+				if(first < inst->minVert)
+					first = inst->minVert;
+				if(end > inst->minVert+inst->numVertices)
+					end = inst->minVert+inst->numVertices;
+				if(first < end){
+					bool32 alpha = instColor(vertFormatMap[dcl[i].type],
+						verts + dcl[i].offset + stride*first,
+						geo->colors + first,
+						end - first, stride);
+					if(end - first == inst->numVertices)
+						inst->vertexAlpha = alpha;
+					else
+						inst->vertexAlpha |= alpha;
+				}
+				inst++;
+			}
 		}
 	}
 
 	// Instance tex coords
 	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != n; i++)
-				;
-			instTexCoords(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-				geo->texCoords[n],
-				header->totalNumVertex,
-				header->vertexStream[dcl[i].stream].stride);
-		}
+		numSpans = geo->getLockedSpans(Geometry::LOCKTEXCOORDS<<n, reinstance, &all, &spans);
+		if(numSpans == 0)
+			continue;
+		for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != n; i++)
+			;
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++)
+			instTexCoords(vertFormatMap[dcl[i].type],
+				verts + dcl[i].offset + stride*spans[k].first,
+				geo->texCoords[n] + spans[k].first,
+				spans[k].count, stride);
 	}
 
 	// Instance normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	numSpans = geo->getLockedSpans(Geometry::LOCKNORMALS, reinstance, &all, &spans);
+	if(hasNormals && numSpans){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_NORMAL || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++)
+			instV3d(vertFormatMap[dcl[i].type],
+				verts + dcl[i].offset + stride*spans[k].first,
+				geo->morphTargets[0].normals + spans[k].first,
+				spans[k].count, stride);
 	}
 	unlockVertices(s->vertexBuffer);
 }
@@ -756,6 +816,7 @@ readNativeTexture(Stream *stream)
 		assert(ext->texture);
 		raster->flags &= ~Raster::DONTALLOCATE;
 		ext->customFormat = 1;
+		reportTextureSize(raster);
 	}else if(flags & 2){
 		assert(0 && "Can't have cube maps yet");
 	}else{
@@ -168,7 +168,7 @@ matfxRenderCB_Shader(Atomic *atomic, InstanceDataHeader *header)
 	lastEnvFrame = nil;
 
 	vsBits = lightingCB_Shader(atomic);
-	uploadMatrices(atomic->getFrame()->getLTM());
+	uploadMatrices(atomic->getFrame()->getRenderLTM());
 
 	bool normals = !!(atomic->geometry->flags & Geometry::NORMALS);
 
@@ -10,6 +10,8 @@
 #include "../rwobjects.h"
 #include "../rwengine.h"
 #include "../rwrender.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
 #include "rwd3d.h"
 #include "rwd3d9.h"
 
@@ -25,10 +27,22 @@ void defaultRenderCB_Shader(Atomic *atomic, InstanceDataHeader *header) {}
 void
 drawInst_simple(d3d9::InstanceDataHeader *header, d3d9::InstanceData *inst)
 {
+	MeshletRange *ranges;
+	int32 n = Meshlets::getDrawRanges(inst - header->inst, &ranges);
+	if(n == 0)
+		return;
 	d3d::flushCache();
-	d3ddevice->DrawIndexedPrimitive((D3DPRIMITIVETYPE)header->primType, inst->baseIndex,
-	                                0, inst->numVertices,
-	                                inst->startIndex, inst->numPrimitives);
+	if(n < 0){
+		d3ddevice->DrawIndexedPrimitive((D3DPRIMITIVETYPE)header->primType, inst->baseIndex,
+		                                0, inst->numVertices,
+		                                inst->startIndex, inst->numPrimitives);
+		return;
+	}
+	for(int32 i = 0; i < n; i++)
+		d3ddevice->DrawIndexedPrimitive((D3DPRIMITIVETYPE)header->primType, inst->baseIndex,
+		                                0, inst->numVertices,
+		                                inst->startIndex + ranges[i].firstIndex,
+		                                ranges[i].numIndices/3);
 }
 
 // Emulate PS2 GS alpha test FB_ONLY case: failed alpha writes to frame- but not to depth buffer
@@ -87,7 +101,7 @@ defaultRenderCB_Fix(Atomic *atomic, InstanceDataHeader *header)
 	d3d::setRenderState(D3DRS_LIGHTING, lighting);
 
 	Frame *f = atomic->getFrame();
-	convMatrix(&world, f->getLTM());
+	convMatrix(&world, f->getRenderLTM());
 	d3ddevice->SetTransform(D3DTS_WORLD, (D3DMATRIX*)&world);
 
 	setStreamSource(0, header->vertexStream[0].vertexBuffer, 0, header->vertexStream[0].stride);
@@ -151,7 +165,7 @@ defaultRenderCB_Shader(Atomic *atomic, InstanceDataHeader *header)
 	setVertexDeclaration(header->vertexDeclaration);
 
 	vsBits = lightingCB_Shader(atomic);
-	uploadMatrices(atomic->getFrame()->getLTM());
+	uploadMatrices(atomic->getFrame()->getRenderLTM());
 
 	// Pick a shader
 	if((vsBits & VSLIGHT_MASK) == 0)
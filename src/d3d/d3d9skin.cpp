@@ -46,6 +46,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 
 	if(!reinstance){
 		// Create declarations and buffers only the first time
+		uint32 quant = getQuantizeFlags();
 
 		assert(s->vertexBuffer == nil);
 		s->offset = 0;
@@ -78,35 +79,35 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			dcl[i].stream = 0;
 			dcl[i].offset = stride;
-			dcl[i].type = D3DDECLTYPE_FLOAT2;
+			dcl[i].type = quant & Geometry::QUANTTEXCOORDS ? D3DDECLTYPE_FLOAT16_2 : D3DDECLTYPE_FLOAT2;
 			dcl[i].method = D3DDECLMETHOD_DEFAULT;
 			dcl[i].usage = D3DDECLUSAGE_TEXCOORD;
 			dcl[i].usageIndex = (uint8)n;
 			i++;
 			s->geometryFlags |= 0x10 << n;
-			stride += 8;
+			stride += quant & Geometry::QUANTTEXCOORDS ? 4 : 8;
 		}
 
 		if(hasNormals){
 			dcl[i].stream = 0;
 			dcl[i].offset = stride;
-			dcl[i].type = D3DDECLTYPE_FLOAT3;
+			dcl[i].type = quant & Geometry::QUANTNORMALS ? D3DDECLTYPE_SHORT4N : D3DDECLTYPE_FLOAT3;
 			dcl[i].method = D3DDECLMETHOD_DEFAULT;
 			dcl[i].usage = D3DDECLUSAGE_NORMAL;
 			dcl[i].usageIndex = 0;
 			i++;
 			s->geometryFlags |= 0x4;
-			stride += 12;
+			stride += quant & Geometry::QUANTNORMALS ? 8 : 12;
 		}
 
 		dcl[i].stream = 0;
 		dcl[i].offset = stride;
-		dcl[i].type = D3DDECLTYPE_FLOAT4;
+		dcl[i].type = quant & Geometry::QUANTWEIGHTS ? D3DDECLTYPE_UBYTE4N : D3DDECLTYPE_FLOAT4;
 		dcl[i].method = D3DDECLMETHOD_DEFAULT;
 		dcl[i].usage = D3DDECLUSAGE_BLENDWEIGHT;
 		dcl[i].usageIndex = 0;
 		i++;
-		stride += 16;
+		stride += quant & Geometry::QUANTWEIGHTS ? 4 : 16;
 
 		dcl[i].stream = 0;
 		dcl[i].offset = stride;
@@ -149,55 +150,84 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		getDeclaration(header->vertexDeclaration, dcl);
 
 	Skin *skin = Skin::get(geo);
-	uint8 *verts = lockVertices(s->vertexBuffer, 0, 0, D3DLOCK_NOSYSLOCK);
+	VertexSpan all, *spans;
+	int32 k, numSpans;
+	numSpans = geo->getLockedSpans(Geometry::LOCKALL, reinstance, &all, &spans);
+	if(numSpans == 0)
+		return;
+	uint8 *verts = lockVertexSpans(s->vertexBuffer, s->stride, spans, numSpans);
 
 	// Instance vertices
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	numSpans = geo->getLockedSpans(Geometry::LOCKVERTICES, reinstance, &all, &spans);
+	if(numSpans){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_POSITION || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++)
+			instV3d(vertFormatMap[dcl[i].type],
+				verts + dcl[i].offset + stride*spans[k].first,
+				geo->morphTargets[0].vertices + spans[k].first,
+				spans[k].count, stride);
 	}
 
 	// Instance prelight colors
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	numSpans = geo->getLockedSpans(Geometry::LOCKPRELIGHT, reinstance, &all, &spans);
+	if(isPrelit && numSpans){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_COLOR || dcl[i].usageIndex != 0; i++)
 			;
-		InstanceData *inst = header->inst;
-		uint32 n = header->numMeshes;
-		while(n--){
-			uint32 stride = header->vertexStream[dcl[i].stream].stride;
-			inst->vertexAlpha = instColor(vertFormatMap[dcl[i].type],
-				verts + dcl[i].offset + stride*inst->minVert,
-				geo->colors + inst->minVert,
-				inst->numVertices,
-				stride);
-			inst++;
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++){
+			InstanceData *inst = header->inst;
+			uint32 n = header->numMeshes;
+			while(n--){
+				// part of the span used by this mesh
+				uint32 first = spans[k].first;
+				uint32 end = first + spans[k].count;
+				if(first < inst->minVert)
+					first = inst->minVert;
+				if(end > inst->minVert+inst->numVertices)
+					end = inst->minVert+inst->numVertices;
+				if(first < end){
+					bool32 alpha = instColor(vertFormatMap[dcl[i].type],
+						verts + dcl[i].offset + stride*first,
+						geo->colors + first,
+						end - first, stride);
+					if(end - first == inst->numVertices)
+						inst->vertexAlpha = alpha;
+					else
+						inst->vertexAlpha |= alpha;
+				}
+				inst++;
+			}
 		}
 	}
 
 	// Instance tex coords
 	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != n; i++)
-				;
-			instTexCoords(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-				geo->texCoords[n],
-				header->totalNumVertex,
-				header->vertexStream[dcl[i].stream].stride);
-		}
+		numSpans = geo->getLockedSpans(Geometry::LOCKTEXCOORDS<<n, reinstance, &all, &spans);
+		if(numSpans == 0)
+			continue;
+		for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != n; i++)
+			;
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++)
+			instTexCoords(vertFormatMap[dcl[i].type],
+				verts + dcl[i].offset + stride*spans[k].first,
+				geo->texCoords[n] + spans[k].first,
+				spans[k].count, stride);
 	}
 
 	// Instance normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	numSpans = geo->getLockedSpans(Geometry::LOCKNORMALS, reinstance, &all, &spans);
+	if(hasNormals && numSpans){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_NORMAL || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		uint32 stride = header->vertexStream[dcl[i].stream].stride;
+		for(k = 0; k < numSpans; k++)
+			instV3d(vertFormatMap[dcl[i].type],
+				verts + dcl[i].offset + stride*spans[k].first,
+				geo->morphTargets[0].normals + spans[k].first,
+				spans[k].count, stride);
 	}
 
 	// Instance skin weights
@@ -296,7 +326,7 @@ skinRenderCB(Atomic *atomic, InstanceDataHeader *header)
 	setVertexDeclaration((IDirect3DVertexDeclaration9*)header->vertexDeclaration);
 
 	vsBits = lightingCB_Shader(atomic);
-	uploadMatrices(atomic->getFrame()->getLTM());
+	uploadMatrices(atomic->getFrame()->getRenderLTM());
 
 	uploadSkinMatrices(atomic);
 
@@ -461,6 +461,8 @@ setRasterStage(uint32 stage, Raster *raster)
 {
 	bool32 alpha;
 	D3dRaster *d3draster = nil;
+	if(raster)
+		TextureResidency::touch(raster);
 	if(raster != rwStateCache.texstage[stage].raster){
 		rwStateCache.texstage[stage].raster = raster;
 		if(raster){
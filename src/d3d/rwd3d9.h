@@ -81,6 +81,11 @@ public:
 	void (*renderCB)(Atomic *atomic, InstanceDataHeader *header);
 };
 
+// Geometry::quantizeOnInstance as far as the device supports it.
+// Positions are never quantized, the shaders can't decode them.
+uint32 getQuantizeFlags(void);
+// lock the part of a vertex buffer that Geometry::getLockedSpans returned
+uint8 *lockVertexSpans(void *vertexBuffer, uint32 stride, VertexSpan *spans, int32 numSpans);
 void defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
 void defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header);
 void defaultRenderCB_Fix(Atomic *atomic, InstanceDataHeader *header);
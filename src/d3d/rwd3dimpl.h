@@ -76,6 +76,8 @@ bool32 imageFindRasterFormat(Image *img, int32 type,
 	int32 *width, int32 *height, int32 *depth, int32 *format);
 bool32 rasterFromImage(Raster *raster, Image *image);
 Image *rasterToImage(Raster *raster);
+bool32 rasterSetResidency(Raster *raster, int32 firstLevel, int32 numLevels);
+void reportTextureSize(Raster *raster);
 
 }
 }
@@ -91,6 +91,9 @@ struct XboxRaster
 };
 
 int32 getLevelSize(Raster *raster, int32 level);
+// convert between linear and swizzled (Morton order) pixels
+void unswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp);
+void swizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp);
 
 extern int32 nativeRasterOffset;
 void registerNativeRaster(void);
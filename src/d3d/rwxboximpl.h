@@ -6,6 +6,9 @@ uint8 *rasterLock(Raster *raster, int32 level, int32 lockMode);
 void rasterUnlock(Raster*, int32);
 int32 rasterNumLevels(Raster *raster);
 Image *rasterToImage(Raster *raster);
+bool32 imageFindRasterFormat(Image *img, int32 type,
+	int32 *pWidth, int32 *pHeight, int32 *pDepth, int32 *pFormat);
+bool32 rasterFromImage(Raster *raster, Image *image);
 
 }
 }
@@ -9,6 +9,7 @@
 #include "../rwpipeline.h"
 #include "../rwobjects.h"
 #include "../rwengine.h"
+#include "../rwsimd.h"
 #include "rwxbox.h"
 
 #include "rwxboximpl.h"
@@ -29,6 +30,8 @@ driverOpen(void *o, int32, int32)
 	engine->driver[PLATFORM_XBOX]->rasterUnlock = rasterUnlock;
 	engine->driver[PLATFORM_XBOX]->rasterNumLevels = rasterNumLevels;
 	engine->driver[PLATFORM_XBOX]->rasterToImage = rasterToImage;
+	engine->driver[PLATFORM_XBOX]->imageFindRasterFormat = imageFindRasterFormat;
+	engine->driver[PLATFORM_XBOX]->rasterFromImage = rasterFromImage;
 
 	return o;
 }
@@ -202,6 +205,8 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	// TODO: allow for REINSTANCE (or not, xbox can't render)
 	if(geo->instData)
 		return;
+	if(Geometry::optimizeOnInstance)
+		geo->optimizeVertexCache();
 	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 	MeshHeader *meshh = geo->meshHeader;
 	geo->instData = header;
@@ -560,7 +565,7 @@ rasterSetFormat(Raster *raster)
 	}
 	natras->bpp = raster->depth/8;
 	natras->hasAlpha =  formatInfoRW[(raster->format >> 8) & 0xF].hasAlpha;
-	raster->stride = raster->width&natras->bpp;
+	raster->stride = raster->width*natras->bpp;
 }
 
 static Raster*
@@ -657,38 +662,247 @@ rasterNumLevels(Raster *raster)
 	return levels->numlevels;
 }
 
+/*
+ * Swizzled textures are in Morton order: the bits of u and v are
+ * interleaved, u first, until the smaller dimension runs out.
+ * The offsets of all columns and rows are deposited into their bits
+ * once per texture, a texel is then at u|v.
+ * 4x4 tiles are contiguous, 32 bit tiles are moved with 64 bit zips.
+ */
+
 static void
-unswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp)
+getMortonMasks(int32 w, int32 h, uint32 *maskU, uint32 *maskV)
 {
-	uint32 maskU = 0;
-	uint32 maskV = 0;
 	int32 i = 1;
 	int32 j = 1;
 	int32 c;
+	*maskU = 0;
+	*maskV = 0;
 	do{
 		c = 0;
 		if(i < w){
-			maskU |= j;
+			*maskU |= j;
 			j <<= 1;
 			c = j;
 		}
 		if(i < h){
-			maskV |= j;
+			*maskV |= j;
 			j <<= 1;
 			c = j;
 		}
 		i <<= 1;
 	}while(c);
-	int32 x, y, u, v;
-	v = 0;
+}
+
+// offsets of n consecutive coordinates deposited into the bits of mask
+static void
+depositBits(uint32 *offsets, int32 n, uint32 mask)
+{
+	uint32 u = 0;
+	for(int32 i = 0; i < n; i++){
+		offsets[i] = u;
+		u = (u - mask) & mask;
+	}
+}
+
+// linear to Morton if toMorton is set, otherwise the other way
+static void
+convertMorton(uint8 *linear, uint8 *morton, int32 w, int32 h, int32 bpp, bool32 toMorton)
+{
+	uint32 maskU, maskV;
+	int32 x, y;
+	getMortonMasks(w, h, &maskU, &maskV);
+	uint32 *offU = rwNewT(uint32, w+h, MEMDUR_FUNCTION | ID_DRIVER);
+	if(offU == nil){
+		RWERROR((ERR_ALLOC, (w+h)*sizeof(uint32)));
+		return;
+	}
+	uint32 *offV = offU + w;
+	depositBits(offU, w, maskU);
+	depositBits(offV, h, maskV);
+
+	if(bpp == 4 && w >= 4 && h >= 4){
+		using namespace simd;
+		for(y = 0; y < h; y += 4){
+			uint8 *row = &linear[y*w*4];
+			for(x = 0; x < w; x += 4){
+				uint8 *tile = &morton[(offU[x]|offV[y])*4];
+				uint8 *r = row + x*4;
+				if(toMorton){
+					I4 r0 = loadi(r);
+					I4 r1 = loadi(r + w*4);
+					I4 r2 = loadi(r + w*8);
+					I4 r3 = loadi(r + w*12);
+					storei(tile, ziplo64(r0, r1));
+					storei(tile+16, ziphi64(r0, r1));
+					storei(tile+32, ziplo64(r2, r3));
+					storei(tile+48, ziphi64(r2, r3));
+				}else{
+					I4 t0 = loadi(tile);
+					I4 t1 = loadi(tile+16);
+					I4 t2 = loadi(tile+32);
+					I4 t3 = loadi(tile+48);
+					storei(r, ziplo64(t0, t1));
+					storei(r + w*4, ziphi64(t0, t1));
+					storei(r + w*8, ziplo64(t2, t3));
+					storei(r + w*12, ziphi64(t2, t3));
+				}
+			}
+		}
+		rwFree(offU);
+		return;
+	}
+
 	for(y = 0; y < h; y++){
-		u = 0;
-		for(x = 0; x < w; x++){
-			memcpy(&dst[(y*w + x)*bpp], &src[(u|v)*bpp], bpp);
-			u = (u - maskU) & maskU;
+		uint32 v = offV[y];
+		switch(bpp){
+		case 1: {
+			uint8 *l = linear + y*w;
+			if(toMorton)
+				for(x = 0; x < w; x++) morton[offU[x]|v] = l[x];
+			else
+				for(x = 0; x < w; x++) l[x] = morton[offU[x]|v];
+			break;
+		}
+		case 2: {
+			uint16 *l = (uint16*)linear + y*w;
+			uint16 *m = (uint16*)morton;
+			if(toMorton)
+				for(x = 0; x < w; x++) m[offU[x]|v] = l[x];
+			else
+				for(x = 0; x < w; x++) l[x] = m[offU[x]|v];
+			break;
+		}
+		default:
+			for(x = 0; x < w; x++)
+				if(toMorton)
+					memcpy(&morton[(offU[x]|v)*bpp], &linear[(y*w + x)*bpp], bpp);
+				else
+					memcpy(&linear[(y*w + x)*bpp], &morton[(offU[x]|v)*bpp], bpp);
+			break;
 		}
-		v = (v - maskV) & maskV;
 	}
+	rwFree(offU);
+}
+
+void
+unswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp)
+{
+	convertMorton(dst, src, w, h, bpp, 0);
+}
+
+void
+swizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp)
+{
+	convertMorton(src, dst, w, h, bpp, 1);
+}
+
+bool32
+imageFindRasterFormat(Image *img, int32 type,
+	int32 *pWidth, int32 *pHeight, int32 *pDepth, int32 *pFormat)
+{
+	int32 depth, format;
+
+	assert((type&0xF) == Raster::TEXTURE);
+
+	depth = img->depth;
+	switch(depth){
+	case 32:
+		if(img->hasAlpha())
+			format = Raster::C8888;
+		else
+			format = Raster::C888;
+		break;
+	case 24:
+		format = Raster::C888;
+		depth = 32;
+		break;
+	case 16:
+		format = Raster::C1555;
+		break;
+	case 8:
+		format = Raster::PAL8 | Raster::C8888;
+		break;
+	case 4:
+		format = Raster::PAL4 | Raster::C8888;
+		break;
+	default:
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+
+	*pWidth = img->width;
+	*pHeight = img->height;
+	*pDepth = depth;
+	*pFormat = format | type;
+	return 1;
+}
+
+// Memory layout of a raster's pixels for the row conversions
+static int32
+rasterConvFormat(int32 format)
+{
+	if(format & (Raster::PAL8 | Raster::PAL4))
+		return CONVFMT_8;
+	switch(format & 0xF00){
+	case Raster::C8888:
+	case Raster::C888:	// X8R8G8B8
+		return CONVFMT_BGRA8888;
+	case Raster::C1555:
+		return CONVFMT_ARGB1555;
+	}
+	return -1;
+}
+
+// Only swizzled formats with power of two dimensions
+bool32
+rasterFromImage(Raster *raster, Image *image)
+{
+	XboxRaster *natras = GETXBOXRASTEREXT(raster);
+	ConvRowFunc conv = nil;
+	int32 format = raster->format&(Raster::PAL8 | Raster::PAL4 | 0xF00);
+	if(natras->customFormat)
+		goto err;
+	// palettes are always C8888
+	if((format & (Raster::PAL8 | Raster::PAL4)) == 0 ||
+	   (format & 0xF00) == Raster::C8888)
+		conv = getConvRow(rasterConvFormat(format), getImageConvFormat(image));
+	if(conv == nil ||
+	   image->width & (image->width-1) || image->height & (image->height-1)){
+	err:
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+
+	if(image->depth <= 8)
+		// bytes are BGRA unlike regular d3d!
+		convRow_BGRA8888_from_RGBA8888((uint8*)natras->palette, image->palette,
+			1<<image->depth);
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+	assert(image->width == raster->width);
+	assert(image->height == raster->height);
+
+	int32 stride = raster->width*natras->bpp;
+	uint8 *linear = rwNewT(uint8, stride*raster->height, MEMDUR_FUNCTION | ID_DRIVER);
+	if(linear == nil){
+		RWERROR((ERR_ALLOC, stride*raster->height));
+		if(unlock)
+			raster->unlock(0);
+		return 0;
+	}
+	convertPixels(linear, stride, image->pixels, image->stride,
+		image->width, image->height, conv);
+	swizzle(raster->pixels, linear, raster->width, raster->height, natras->bpp);
+	rwFree(linear);
+
+	if(unlock)
+		raster->unlock(0);
+	return 1;
 }
 
 Image*
@@ -778,11 +992,7 @@ rasterToImage(Raster *raster)
 		uint8 *out = image->palette;
 		uint8 *in = (uint8*)natras->palette;
 		// bytes are BGRA unlike regular d3d!
-		for(int32 i = 0; i < pallength; i++){
-			conv_BGRA8888_from_RGBA8888(out, in);
-			in += 4;
-			out += 4;
-		}
+		convRow_BGRA8888_from_RGBA8888(out, in, pallength);
 	}
 
 	uint8 *imgpixels = image->pixels;
@@ -793,25 +1003,15 @@ rasterToImage(Raster *raster)
 	assert(image->stride == raster->stride);
 	unswizzle(imgpixels, pixels, image->width, image->height, image->bpp);
 	// Fix RGB order
-	uint8 tmp;
-	if(depth > 8)
+	int32 format = raster->format & 0xF00;
+	if(depth > 8 && (format == Raster::C8888 || format == Raster::C888)){
+		ConvRowFunc swap = image->bpp == 4 ? convRow_BGRA8888_from_RGBA8888 :
+			convRow_BGR888_from_RGB888;
 		for(int32 y = 0; y < image->height; y++){
-			uint8 *imgrow = imgpixels;
-		//	uint8 *rasrow = pixels;
-			for(int32 x = 0; x < image->width; x++){
-				switch(raster->format & 0xF00){
-				case Raster::C8888:
-				case Raster::C888:
-					tmp = imgrow[0];
-					imgrow[0] = imgrow[2];
-					imgrow[2] = tmp;
-					imgrow += image->bpp;
-					break;
-				}
-			}
+			swap(imgpixels, imgpixels, image->width);
 			imgpixels += image->stride;
-		//	pixels += raster->stride;
 		}
+	}
 	image->compressPalette();
 
 	if(unlock)
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#define PLUGIN_ID ID_DEDUP
+
+namespace rw {
+
+/*
+ * Asset deduplication.
+ * Geometry and native texture chunks are read into memory and hashed
+ * before they're parsed. If an object made from the same data is still
+ * alive it is shared instead of making a new one: geometries get another
+ * reference, native textures get a new Texture with the same raster.
+ * Entries go away when their object is destroyed or locked for writing.
+ */
+
+struct DedupEntry
+{
+	uint64 hash;
+	uint32 size;
+	void *object;	// Geometry or Raster
+	DedupEntry *next;
+	// for textures that share the raster
+	char name[32];
+	char mask[32];
+	uint32 filterAddressing;
+};
+
+struct RasterDedup
+{
+	DedupEntry *entry;
+	int32 numShared;	// textures beyond the first one
+};
+
+enum { NUMBUCKETS = 256 };
+
+static struct
+{
+	bool32 enabled;
+	bool32 busy;	// parsing data that wasn't found
+	DedupEntry *geometries[NUMBUCKETS];
+	DedupEntry *rasters[NUMBUCKETS];
+	AssetDedup::Stats stats;
+	int32 geoOffset;
+	int32 rasterOffset;
+} dedup;
+
+#define GEODEDUP(geo) (*PLUGINOFFSET(DedupEntry*, geo, dedup.geoOffset))
+#define RASTERDEDUP(raster) PLUGINOFFSET(RasterDedup, raster, dedup.rasterOffset)
+
+// 64 bit MurmurHash2
+static uint64
+hashData(const uint8 *data, uint32 len)
+{
+	const uint64 m = 0xC6A4A7935BD1E995ULL;
+	uint64 h = 0x8445D61A4E774912ULL ^ (len*m);
+	uint64 k;
+	uint32 i;
+	for(i = 0; i+8 <= len; i += 8){
+		memcpy(&k, data+i, 8);
+		k *= m;
+		k ^= k >> 47;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	if(i < len){
+		k = 0;
+		memcpy(&k, data+i, len-i);
+		h ^= k;
+		h *= m;
+	}
+	h ^= h >> 47;
+	h *= m;
+	h ^= h >> 47;
+	return h;
+}
+
+static DedupEntry*
+addEntry(DedupEntry **table, uint64 hash, uint32 size, void *object)
+{
+	DedupEntry *e = rwNewT(DedupEntry, 1, MEMDUR_EVENT | ID_DEDUP);
+	memset(e, 0, sizeof(DedupEntry));
+	e->hash = hash;
+	e->size = size;
+	e->object = object;
+	e->next = table[hash % NUMBUCKETS];
+	table[hash % NUMBUCKETS] = e;
+	return e;
+}
+
+static void
+removeEntry(DedupEntry **table, DedupEntry *e)
+{
+	DedupEntry **p;
+	for(p = &table[e->hash % NUMBUCKETS]; *p; p = &(*p)->next)
+		if(*p == e){
+			*p = e->next;
+			break;
+		}
+	rwFree(e);
+}
+
+// Append a whole chunk, header included
+static bool32
+readRawChunk(Stream *stream, uint8 **data, uint32 *size, uint32 *capacity, uint32 *type)
+{
+	uint8 header[12];
+	if(stream->read8(header, 12) != 12)
+		return 0;
+	*type = header[0] | header[1]<<8 | header[2]<<16 | (uint32)header[3]<<24;
+	uint32 len = header[4] | header[5]<<8 | header[6]<<16 | (uint32)header[7]<<24;
+	if(len > 0x10000000)
+		return 0;
+	if(*size + 12 + len > *capacity){
+		*capacity = *size + 12 + len;
+		*data = rwResizeT(uint8, *data, *capacity, MEMDUR_FUNCTION | ID_DEDUP);
+	}
+	memcpy(*data + *size, header, 12);
+	if(stream->read8(*data + *size + 12, len) != len)
+		return 0;
+	*size += 12 + len;
+	return 1;
+}
+
+static void*
+createGeometryDedup(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(DedupEntry*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyGeometryDedup(void *object, int32 offset, int32)
+{
+	DedupEntry *e = *PLUGINOFFSET(DedupEntry*, object, offset);
+	if(e)
+		removeEntry(dedup.geometries, e);
+	*PLUGINOFFSET(DedupEntry*, object, offset) = nil;
+	return object;
+}
+
+static void*
+copyGeometryDedup(void *dst, void*, int32 offset, int32)
+{
+	*PLUGINOFFSET(DedupEntry*, dst, offset) = nil;
+	return dst;
+}
+
+static void*
+createRasterDedup(void *object, int32 offset, int32)
+{
+	RasterDedup *d = PLUGINOFFSET(RasterDedup, object, offset);
+	d->entry = nil;
+	d->numShared = 0;
+	return object;
+}
+
+static void*
+destroyRasterDedup(void *object, int32 offset, int32)
+{
+	RasterDedup *d = PLUGINOFFSET(RasterDedup, object, offset);
+	if(d->entry)
+		removeEntry(dedup.rasters, d->entry);
+	d->entry = nil;
+	return object;
+}
+
+static void*
+copyRasterDedup(void *dst, void*, int32 offset, int32)
+{
+	return createRasterDedup(dst, offset, 0);
+}
+
+void
+AssetDedup::registerModule(void)
+{
+	dedup.geoOffset = Geometry::registerPlugin(sizeof(DedupEntry*), ID_DEDUP,
+		createGeometryDedup, destroyGeometryDedup, copyGeometryDedup);
+	dedup.rasterOffset = Raster::registerPlugin(sizeof(RasterDedup), ID_DEDUP,
+		createRasterDedup, destroyRasterDedup, copyRasterDedup);
+}
+
+void AssetDedup::setEnabled(bool32 enable) { dedup.enabled = enable; }
+bool32 AssetDedup::isEnabled(void) { return dedup.enabled && !dedup.busy; }
+void AssetDedup::getStats(Stats *stats) { *stats = dedup.stats; }
+void AssetDedup::resetStats(void) { memset(&dedup.stats, 0, sizeof(Stats)); }
+
+// Materials of the same data only get the same textures
+// if their names are looked up in a dictionary with the same rasters.
+static bool32
+sameTextures(Geometry *geo)
+{
+	for(int32 i = 0; i < geo->matList.numMaterials; i++){
+		Texture *tex = geo->matList.materials[i]->texture;
+		if(tex == nil)
+			continue;
+		Texture *found = Texture::findCB(tex->name);
+		if(found == nil){
+			if(tex->dict)
+				return 0;
+		}else if(found->raster != tex->raster ||
+		         found->filterAddressing != tex->filterAddressing)
+			return 0;
+	}
+	return 1;
+}
+
+Geometry*
+AssetDedup::readGeometry(Stream *stream)
+{
+	uint8 *data = nil;
+	uint32 size = 0, capacity = 0, type;
+	DedupEntry *e;
+	Geometry *geo;
+
+	// struct, material list and extension
+	do{
+		if(!readRawChunk(stream, &data, &size, &capacity, &type)){
+			RWERROR((ERR_CHUNK, "GEOMETRY"));
+			rwFree(data);
+			return nil;
+		}
+	}while(type != ID_EXTENSION);
+
+	uint64 hash = hashData(data, size);
+	dedup.stats.numGeometries++;
+	dedup.stats.geometryBytes += size;
+	for(e = dedup.geometries[hash % NUMBUCKETS]; e; e = e->next){
+		geo = (Geometry*)e->object;
+		if(e->hash == hash && e->size == size && sameTextures(geo)){
+			geo->addRef();
+			dedup.stats.numSharedGeometries++;
+			dedup.stats.geometryBytesSaved += size;
+			rwFree(data);
+			return geo;
+		}
+	}
+
+	StreamMemory mem;
+	mem.open(data, size);
+	dedup.busy = 1;
+	geo = Geometry::streamRead(&mem);
+	dedup.busy = 0;
+	mem.close();
+	rwFree(data);
+	if(geo)
+		GEODEDUP(geo) = addEntry(dedup.geometries, hash, size, geo);
+	return geo;
+}
+
+Texture*
+AssetDedup::readTexture(Stream *stream)
+{
+	uint8 *data = nil;
+	uint32 size = 0, capacity = 0, type;
+	DedupEntry *e;
+	Texture *tex;
+
+	// everything up to the extension, which is read by the caller
+	for(;;){
+		uint32 start = size;
+		if(!readRawChunk(stream, &data, &size, &capacity, &type)){
+			RWERROR((ERR_CHUNK, "TEXTURENATIVE"));
+			rwFree(data);
+			return nil;
+		}
+		if(type == ID_EXTENSION){
+			stream->seek(-(int32)(size - start));
+			size = start;
+			break;
+		}
+	}
+
+	uint64 hash = hashData(data, size);
+	dedup.stats.numTextures++;
+	dedup.stats.textureBytes += size;
+	for(e = dedup.rasters[hash % NUMBUCKETS]; e; e = e->next){
+		if(e->hash != hash || e->size != size)
+			continue;
+		Raster *raster = (Raster*)e->object;
+		tex = Texture::create(raster);
+		if(tex == nil)
+			break;
+		strncpy(tex->name, e->name, 32);
+		strncpy(tex->mask, e->mask, 32);
+		tex->filterAddressing = e->filterAddressing;
+		RASTERDEDUP(raster)->numShared++;
+		dedup.stats.numSharedTextures++;
+		dedup.stats.textureBytesSaved += size;
+		rwFree(data);
+		return tex;
+	}
+
+	StreamMemory mem;
+	mem.open(data, size);
+	dedup.busy = 1;
+	tex = Texture::streamReadNative(&mem);
+	dedup.busy = 0;
+	mem.close();
+	rwFree(data);
+	if(tex && tex->raster && RASTERDEDUP(tex->raster)->entry == nil){
+		e = addEntry(dedup.rasters, hash, size, tex->raster);
+		memcpy(e->name, tex->name, 32);
+		memcpy(e->mask, tex->mask, 32);
+		e->filterAddressing = tex->filterAddressing;
+		RASTERDEDUP(tex->raster)->entry = e;
+	}
+	return tex;
+}
+
+bool32
+AssetDedup::releaseRaster(Raster *raster)
+{
+	RasterDedup *d = RASTERDEDUP(raster);
+	if(d->numShared == 0)
+		return 0;
+	d->numShared--;
+	return 1;
+}
+
+void
+AssetDedup::forget(Geometry *geo)
+{
+	destroyGeometryDedup(geo, dedup.geoOffset, 0);
+}
+
+void
+AssetDedup::forget(Raster *raster)
+{
+	destroyRasterDedup(raster, dedup.rasterOffset, 0);
+}
+
+}
@@ -215,6 +215,9 @@ Engine::init(MemoryFunctions *memfuncs)
 	Image::registerModule();
 	Raster::registerModule();
 	Texture::registerModule();
+	Texture::registerAsyncModule();
+	TextureResidency::registerModule();
+	AssetDedup::registerModule();
 
 	// TODO: reset all allocation counts here. or maybe do that in modules?
 	Frame::numAllocated = 0;
@@ -263,6 +266,7 @@ Engine::open(EngineOpenParams *p)
 	engine->filefuncs.rwfread = (size_t (*)(void*, size_t, size_t, void*))fread;
 	engine->filefuncs.rwfwrite = (size_t (*)(const void*, size_t, size_t, void*))fwrite;
 	engine->filefuncs.rwfeof = (int (*)(void*))feof;
+	engine->filefuncs.rwlistdir = listDirectory;
 
 	// Initialize device
 	// Device and possibly OS specific!
@@ -296,6 +300,7 @@ Engine::open(EngineOpenParams *p)
 		engine->driver[i]->imageFindRasterFormat = null::imageFindRasterFormat;
 		engine->driver[i]->rasterFromImage = null::rasterFromImage;
 		engine->driver[i]->rasterToImage = null::rasterToImage;
+		engine->driver[i]->rasterSetResidency = nil;
 	}
 
 	Engine::state = Opened;
@@ -338,6 +343,7 @@ Engine::term(void)
 	}
 
 	PluginList::close();
+	termJobThreads();
 
 	// This has to be reset because it won't be opened again otherwise
 	// TODO: maybe reset more stuff here?
@@ -371,6 +377,8 @@ Engine::stop(void)
 		return;
 	}
 
+	// loader threads may still use the modules
+	Texture::stopAsync();
 	for(uint i = 0; i < NUM_PLATFORMS; i++)
 		Driver::s_plglist[i].destruct(rw::engine->driver[i]);
 	Engine::s_plglist.destruct(engine);
@@ -8,10 +8,27 @@ namespace rw {
 
 static Error error;
 
+#ifndef RW_PS2
+#define THREADLOCAL thread_local
+#else
+#define THREADLOCAL
+#endif
+
+static THREADLOCAL Error *capture;
+
 void
 setError(Error *e)
 {
-	error = *e;
+	if(capture)
+		*capture = *e;
+	else
+		error = *e;
+}
+
+void
+captureErrors(Error *e)
+{
+	capture = e;
 }
 
 Error*
@@ -36,7 +53,7 @@ char*
 dbgsprint(uint32 code, ...)
 {
 	va_list ap;
-	static char strbuf[512];
+	static THREADLOCAL char strbuf[512];
 
 	if(code & 0x80000000)
 		code &= ~0x80000000;
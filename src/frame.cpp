@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "rwbase.h"
@@ -16,8 +17,43 @@ namespace rw {
 int32 Frame::numAllocated;
 
 PluginList Frame::s_plglist(sizeof(Frame));
+
+// Subtrees whose LTMs are synched in parallel
+struct SyncJob
+{
+	Frame *frame;
+	uint8 hierarchyFlags;
+};
+static bool32 parallelSync;
+static SyncJob *syncJobs;
+static int32 numSyncJobs;
+static int32 maxSyncJobs;
+
+// Interpolated frames and the ones that have to be blended
+static FrameInterp **interpFrames;
+static int32 numInterpFrames;
+static int32 maxInterpFrames;
+static FrameInterp **movingFrames;
+static int32 numMovingFrames;
+static int32 maxMovingFrames;
+
 static void *frameOpen(void *object, int32 offset, int32 size) { engine->frameDirtyList.init(); return object; }
-static void *frameClose(void *object, int32 offset, int32 size) { return object; }
+static void *frameClose(void *object, int32 offset, int32 size)
+{
+	rwFree(syncJobs);
+	syncJobs = nil;
+	numSyncJobs = 0;
+	maxSyncJobs = 0;
+	rwFree(interpFrames);
+	interpFrames = nil;
+	numInterpFrames = 0;
+	maxInterpFrames = 0;
+	rwFree(movingFrames);
+	movingFrames = nil;
+	numMovingFrames = 0;
+	maxMovingFrames = 0;
+	return object;
+}
 
 void
 Frame::registerModule(void)
@@ -39,6 +75,9 @@ Frame::create(void)
 	f->child = nil;
 	f->next = nil;
 	f->root = f;
+	f->hierarchy = nil;
+	f->hierarchyIndex = 0;
+	f->interp = nil;
 	f->matrix.setIdentity();
 	f->ltm.setIdentity();
 	s_plglist.construct(f);
@@ -58,12 +97,18 @@ Frame::destroy(void)
 	FORLIST(lnk, this->objectList)
 		ObjectWithFrame::fromFrame(lnk)->setFrame(nil);
 	s_plglist.destruct(this);
+	if(this->hierarchy)
+		this->hierarchy->destroy();
+	if(this->interp)
+		this->setInterpolation(0);
 	if(this->getParent())
 		this->removeChild();
 	if(this->object.privateFlags & Frame::HIERARCHYSYNC)
 		this->inDirtyList.remove();
-	for(Frame *f = this->child; f; f = f->next)
+	for(Frame *f = this->child; f; f = f->next){
 		f->object.parent = nil;
+		f->setHierarchyRoot(f);
+	}
 	rwFree(this);
 	numAllocated--;
 }
@@ -78,6 +123,10 @@ Frame::destroyHierarchy(void)
 	}
 	assert(this->objectList.isEmpty());
 	s_plglist.destruct(this);
+	if(this->hierarchy)
+		this->hierarchy->destroy();
+	if(this->interp)
+		this->setInterpolation(0);
 	if(this->object.privateFlags & Frame::HIERARCHYSYNC)
 		this->inDirtyList.remove();
 	rwFree(this);
@@ -89,6 +138,9 @@ Frame::addChild(Frame *child, bool32 append)
 	Frame *c;
 	if(child->getParent())
 		child->removeChild();
+	// only roots can have compiled hierarchies
+	if(child->hierarchy)
+		child->releaseHierarchy();
 	if(append){
 		if(this->child == nil)
 			this->child = child;
@@ -104,7 +156,9 @@ Frame::addChild(Frame *child, bool32 append)
 	child->object.parent = this;
 	child->root = this->root;
 	for(c = child->child; c; c = c->next)
-		c->setHierarchyRoot(this);
+		c->setHierarchyRoot(this->root);
+	if(this->root->hierarchy)
+		this->root->hierarchy->needsRebuild = 1;
 	// If the child was a root, remove from dirty list
 	if(child->object.privateFlags & Frame::HIERARCHYSYNC){
 		child->inDirtyList.remove();
@@ -127,6 +181,8 @@ Frame::removeChild(void)
 		child->next = this->next;
 	}
 	this->object.parent = this->next = nil;
+	if(this->root->hierarchy)
+		this->root->hierarchy->needsRebuild = 1;
 	// give the hierarchy a new root
 	this->setHierarchyRoot(this);
 	this->updateObjects();
@@ -223,6 +279,11 @@ syncRecurse(Frame *frame, uint8 hierarchyFlags)
 void
 Frame::syncHierarchyLTM(void)
 {
+	if(this->hierarchy){
+		this->hierarchy->syncLTM();
+		this->object.privateFlags &= ~Frame::SYNCLTM;
+		return;
+	}
 	// Sync root's LTM
 	if(this->object.privateFlags & Frame::SUBTREESYNCLTM)
 		this->ltm = this->matrix;
@@ -235,19 +296,134 @@ Frame::syncHierarchyLTM(void)
 Matrix*
 Frame::getLTM(void)
 {
+	FrameHierarchy *hier = this->root->hierarchy;
+	if(hier){
+		if(this->root->object.privateFlags & Frame::HIERARCHYSYNCLTM ||
+		   hier->needsRebuild)
+			this->root->syncHierarchyLTM();
+		return &hier->ltms[this->hierarchyIndex];
+	}
 	if(this->root->object.privateFlags & Frame::HIERARCHYSYNCLTM)
 		this->root->syncHierarchyLTM();
 	return &this->ltm;
 }
 
+/* Synch LTM of a single frame and its subtree, but not its siblings */
+static void
+syncLTMSubtree(void *data, int32 i)
+{
+	SyncJob *job = &((SyncJob*)data)[i];
+	Frame *frame = job->frame;
+	uint8 hierarchyFlags = job->hierarchyFlags | frame->object.privateFlags;
+	if(frame->hierarchy){
+		// root of a compiled hierarchy
+		frame->hierarchy->syncLTM();
+		return;
+	}
+	if(hierarchyFlags & Frame::SUBTREESYNCLTM){
+		Matrix::mult(&frame->ltm, &frame->matrix,
+		             &frame->getParent()->ltm);
+		frame->object.privateFlags &= ~Frame::SUBTREESYNCLTM;
+	}
+	syncLTMRecurse(frame->child, hierarchyFlags);
+}
+
+static void
+addSyncJob(Frame *frame, uint8 hierarchyFlags)
+{
+	if(numSyncJobs >= maxSyncJobs){
+		maxSyncJobs = maxSyncJobs ? maxSyncJobs*2 : 64;
+		syncJobs = rwResizeT(SyncJob, syncJobs, maxSyncJobs, MEMDUR_GLOBAL | ID_FRAMELIST);
+	}
+	syncJobs[numSyncJobs].frame = frame;
+	syncJobs[numSyncJobs].hierarchyFlags = hierarchyFlags;
+	numSyncJobs++;
+}
+
+/* Split hierarchies near the root so that large ones
+ * are spread over multiple jobs as well. */
+enum { SYNCSPLITDEPTH = 2 };
+
+static void
+addSyncJobs(Frame *frame, uint8 hierarchyFlags, int32 depth)
+{
+	uint8 flags;
+	for(; frame; frame = frame->next){
+		if(depth == 0 || frame->child == nil){
+			addSyncJob(frame, hierarchyFlags);
+			continue;
+		}
+		// sync this frame here, its children become jobs
+		flags = hierarchyFlags | frame->object.privateFlags;
+		if(flags & Frame::SUBTREESYNCLTM){
+			Matrix::mult(&frame->ltm, &frame->matrix,
+			             &frame->getParent()->ltm);
+			frame->object.privateFlags &= ~Frame::SUBTREESYNCLTM;
+		}
+		addSyncJobs(frame->child, flags, depth-1);
+	}
+}
+
+/* Synch all dirty frames in two passes:
+ * first the LTMs of all hierarchies in parallel,
+ * then the attached objects serially. */
+static void
+syncDirtyParallel(void)
+{
+	Frame *frame;
+	uint8 flags;
+
+	// Roots are synched here, the subtrees below
+	// them are independent of each other.
+	numSyncJobs = 0;
+	FORLIST(lnk, engine->frameDirtyList){
+		frame = LLLinkGetData(lnk, Frame, inDirtyList);
+		flags = frame->object.privateFlags;
+		if(flags & Frame::HIERARCHYSYNCLTM){
+			if(frame->hierarchy){
+				// rebuilding allocates, can't do that in a job
+				if(frame->hierarchy->needsRebuild)
+					frame->hierarchy->rebuild();
+				addSyncJob(frame, flags);
+				continue;
+			}
+			if(flags & Frame::SUBTREESYNCLTM)
+				frame->ltm = frame->matrix;
+			addSyncJobs(frame->child, flags, SYNCSPLITDEPTH);
+		}
+	}
+	parallelFor(syncLTMSubtree, syncJobs, numSyncJobs);
+
+	// Sync callbacks aren't necessarily thread safe
+	FORLIST(lnk, engine->frameDirtyList){
+		frame = LLLinkGetData(lnk, Frame, inDirtyList);
+		FORLIST(lnk, frame->objectList)
+			ObjectWithFrame::fromFrame(lnk)->sync();
+		syncObjRecurse(frame->child);
+		// all clean now
+		frame->object.privateFlags &= ~(Frame::SYNCLTM | Frame::SYNCOBJ);
+	}
+	engine->frameDirtyList.init();
+}
+
 /* Synch all dirty frames; LTMs and objects */
 void
 Frame::syncDirty(void)
 {
 	Frame *frame;
+	if(parallelSync && getNumJobThreads() > 1){
+		syncDirtyParallel();
+		return;
+	}
 	FORLIST(lnk, engine->frameDirtyList){
 		frame = LLLinkGetData(lnk, Frame, inDirtyList);
-		if(frame->object.privateFlags & Frame::HIERARCHYSYNCLTM){
+		if(frame->hierarchy){
+			if(frame->object.privateFlags & Frame::HIERARCHYSYNCLTM)
+				frame->hierarchy->syncLTM();
+			FORLIST(lnk, frame->objectList)
+				ObjectWithFrame::fromFrame(lnk)->sync();
+			syncObjRecurse(frame->child);
+		}else if(frame->object.privateFlags & Frame::HIERARCHYSYNCLTM){
 			// Sync root's LTM
 			if(frame->object.privateFlags & Frame::SUBTREESYNCLTM)
 				frame->ltm = frame->matrix;
@@ -268,6 +444,18 @@ Frame::syncDirty(void)
 	engine->frameDirtyList.init();
 }
 
+void
+Frame::setParallelSync(bool32 enable)
+{
+	parallelSync = enable;
+}
+
+bool32
+Frame::getParallelSync(void)
+{
+	return parallelSync;
+}
+
 void
 Frame::rotate(const V3d *axis, float32 angle, CombineOp op)
 {
@@ -305,6 +493,15 @@ Frame::updateObjects(void)
 	this->root->object.privateFlags |= HIERARCHYSYNC;
 	// Mark subtree as dirty as well
 	this->object.privateFlags |= SUBTREESYNC;
+
+	FrameHierarchy *hier = this->root->hierarchy;
+	if(hier && !hier->needsRebuild){
+		if(this->hierarchyIndex < hier->numFrames &&
+		   hier->frames[this->hierarchyIndex] == this)
+			hier->dirty[this->hierarchyIndex] |= FrameHierarchy::MATRIXDIRTY;
+		else
+			hier->needsRebuild = 1;
+	}
 }
 
 void
@@ -315,6 +512,257 @@ Frame::setHierarchyRoot(Frame *root)
 		child->setHierarchyRoot(root);
 }
 
+/*
+ * Compiled hierarchies
+ */
+
+FrameHierarchy*
+Frame::compileHierarchy(void)
+{
+	Frame *root = this->root;
+	if(root->hierarchy)
+		return root->hierarchy;
+	root->hierarchy = FrameHierarchy::create(root);
+	// LTMs have to be calculated in the new storage
+	if(root->hierarchy)
+		root->updateObjects();
+	return root->hierarchy;
+}
+
+void
+Frame::releaseHierarchy(void)
+{
+	FrameHierarchy *hier = this->root->hierarchy;
+	if(hier == nil)
+		return;
+	// LTMs live in the frames again
+	if(hier->needsRebuild)
+		hier->root->updateObjects();
+	else
+		for(int32 i = 0; i < hier->numFrames; i++)
+			hier->frames[i]->ltm = hier->ltms[i];
+	hier->destroy();
+}
+
+FrameHierarchy*
+FrameHierarchy::create(Frame *root)
+{
+	FrameHierarchy *hier = rwNewT(FrameHierarchy, 1, MEMDUR_EVENT | ID_FRAMELIST);
+	hier->root = root;
+	hier->numFrames = 0;
+	hier->maxFrames = 0;
+	hier->needsRebuild = 1;
+	hier->frames = nil;
+	hier->parents = nil;
+	hier->dirty = nil;
+	hier->matrices = nil;
+	hier->ltms = nil;
+	return hier;
+}
+
+void
+FrameHierarchy::destroy(void)
+{
+	this->root->hierarchy = nil;
+	rwFree(this->frames);
+	rwFree(this->parents);
+	rwFree(this->dirty);
+	rwFree(this->matrices);
+	rwFree(this->ltms);
+	rwFree(this);
+}
+
+static int32
+flattenRecurse(FrameHierarchy *hier, Frame *frame, int32 parent, int32 n)
+{
+	for(; frame; frame = frame->next){
+		int32 i = n++;
+		hier->frames[i] = frame;
+		hier->parents[i] = parent;
+		frame->hierarchyIndex = i;
+		n = flattenRecurse(hier, frame->child, i, n);
+	}
+	return n;
+}
+
+void
+FrameHierarchy::rebuild(void)
+{
+	int32 n = this->root->count();
+	if(n > this->maxFrames){
+		this->maxFrames = n;
+		this->frames = rwResizeT(Frame*, this->frames, n, MEMDUR_EVENT | ID_FRAMELIST);
+		this->parents = rwResizeT(int32, this->parents, n, MEMDUR_EVENT | ID_FRAMELIST);
+		this->dirty = rwResizeT(uint8, this->dirty, n, MEMDUR_EVENT | ID_FRAMELIST);
+		this->matrices = rwResizeT(Matrix, this->matrices, n, MEMDUR_EVENT | ID_FRAMELIST);
+		this->ltms = rwResizeT(Matrix, this->ltms, n, MEMDUR_EVENT | ID_FRAMELIST);
+	}
+	this->frames[0] = this->root;
+	this->parents[0] = -1;
+	this->root->hierarchyIndex = 0;
+	this->numFrames = flattenRecurse(this, this->root->child, 0, 1);
+	assert(this->numFrames == n);
+	memset(this->dirty, MATRIXDIRTY, n);
+	this->needsRebuild = 0;
+}
+
+/* Parents come before children, so one pass is enough */
+void
+FrameHierarchy::syncLTM(void)
+{
+	int32 i, p;
+	if(this->needsRebuild)
+		this->rebuild();
+
+	if(this->dirty[0] & MATRIXDIRTY){
+		this->matrices[0] = this->root->matrix;
+		this->root->object.privateFlags &= ~Frame::SUBTREESYNCLTM;
+	}
+	if(this->dirty[0])
+		this->ltms[0] = this->matrices[0];
+	for(i = 1; i < this->numFrames; i++){
+		p = this->parents[i];
+		if(this->dirty[p])
+			this->dirty[i] |= LTMDIRTY;
+		if(this->dirty[i] & MATRIXDIRTY){
+			this->matrices[i] = this->frames[i]->matrix;
+			this->frames[i]->object.privateFlags &= ~Frame::SUBTREESYNCLTM;
+		}
+		if(this->dirty[i])
+			Matrix::mult(&this->ltms[i], &this->matrices[i], &this->ltms[p]);
+	}
+	memset(this->dirty, 0, this->numFrames);
+}
+
+/*
+ * Interpolation
+ */
+
+void
+Frame::setInterpolation(bool32 enable)
+{
+	FrameInterp *fi;
+	if(enable){
+		if(this->interp)
+			return;
+		fi = rwNewT(FrameInterp, 1, MEMDUR_EVENT | ID_FRAMELIST);
+		fi->frame = this;
+		fi->moving = 0;
+		fi->cur = *this->getLTM();
+		fi->prev = fi->cur;
+		fi->render = fi->cur;
+		if(numInterpFrames >= maxInterpFrames){
+			maxInterpFrames = maxInterpFrames ? maxInterpFrames*2 : 64;
+			interpFrames = rwResizeT(FrameInterp*, interpFrames, maxInterpFrames, MEMDUR_GLOBAL | ID_FRAMELIST);
+		}
+		fi->index = numInterpFrames;
+		interpFrames[numInterpFrames++] = fi;
+		this->interp = fi;
+	}else{
+		fi = this->interp;
+		if(fi == nil)
+			return;
+		// the list of moving frames is rebuilt every step,
+		// so we only have to make sure we're not in it anymore
+		for(int32 i = 0; i < numMovingFrames; i++)
+			if(movingFrames[i] == fi){
+				movingFrames[i] = movingFrames[--numMovingFrames];
+				break;
+			}
+		interpFrames[fi->index] = interpFrames[--numInterpFrames];
+		interpFrames[fi->index]->index = fi->index;
+		rwFree(fi);
+		this->interp = nil;
+	}
+}
+
+static bool32
+equalLTM(const Matrix *a, const Matrix *b)
+{
+	return equal(a->right, b->right) && equal(a->up, b->up) &&
+		equal(a->at, b->at) && equal(a->pos, b->pos);
+}
+
+void
+Frame::storeInterpolationStep(void)
+{
+	FrameInterp *fi;
+	numMovingFrames = 0;
+	for(int32 i = 0; i < numInterpFrames; i++){
+		fi = interpFrames[i];
+		fi->prev = fi->cur;
+		fi->cur = *fi->frame->getLTM();
+		fi->moving = !equalLTM(&fi->prev, &fi->cur);
+		if(fi->moving){
+			if(numMovingFrames >= maxMovingFrames){
+				maxMovingFrames = maxMovingFrames ? maxMovingFrames*2 : 64;
+				movingFrames = rwResizeT(FrameInterp*, movingFrames, maxMovingFrames, MEMDUR_GLOBAL | ID_FRAMELIST);
+			}
+			movingFrames[numMovingFrames++] = fi;
+		}else
+			fi->render = fi->cur;
+	}
+}
+
+/* Interpolate rotation with slerp, translation and scale linearly.
+ * Frames scaled to nothing have no rotation, their matrices are just lerped. */
+static void
+interpolateLTM(Matrix *dst, const Matrix *a, const Matrix *b, float32 t)
+{
+	Matrix ra, rb;
+	V3d sa, sb;
+	sa.set(length(a->right), length(a->up), length(a->at));
+	sb.set(length(b->right), length(b->up), length(b->at));
+	if(sa.x < 1e-6f || sa.y < 1e-6f || sa.z < 1e-6f ||
+	   sb.x < 1e-6f || sb.y < 1e-6f || sb.z < 1e-6f){
+		dst->right = lerp(a->right, b->right, t);
+		dst->up = lerp(a->up, b->up, t);
+		dst->at = lerp(a->at, b->at, t);
+		dst->pos = lerp(a->pos, b->pos, t);
+		dst->update();
+		return;
+	}
+	ra.right = scale(a->right, 1.0f/sa.x);
+	ra.up = scale(a->up, 1.0f/sa.y);
+	ra.at = scale(a->at, 1.0f/sa.z);
+	rb.right = scale(b->right, 1.0f/sb.x);
+	rb.up = scale(b->up, 1.0f/sb.y);
+	rb.at = scale(b->at, 1.0f/sb.z);
+	Quat q = slerp(ra.getRotation(), rb.getRotation(), t);
+	Matrix::makeRotation(dst, normalize(q));
+	V3d s = lerp(sa, sb, t);
+	dst->right = scale(dst->right, s.x);
+	dst->up = scale(dst->up, s.y);
+	dst->at = scale(dst->at, s.z);
+	dst->pos = lerp(a->pos, b->pos, t);
+	dst->update();
+}
+
+enum { INTERPBATCHSIZE = 128 };
+
+static void
+interpolateJob(void *data, int32 i)
+{
+	float32 alpha = *(float32*)data;
+	int32 start = i*INTERPBATCHSIZE;
+	int32 end = start+INTERPBATCHSIZE;
+	if(end > numMovingFrames)
+		end = numMovingFrames;
+	for(i = start; i < end; i++){
+		FrameInterp *fi = movingFrames[i];
+		interpolateLTM(&fi->render, &fi->prev, &fi->cur, alpha);
+	}
+}
+
+void
+Frame::interpolate(float32 alpha)
+{
+	if(alpha < 0.0f) alpha = 0.0f;
+	if(alpha > 1.0f) alpha = 1.0f;
+	parallelFor(interpolateJob, &alpha,
+		(numMovingFrames+INTERPBATCHSIZE-1)/INTERPBATCHSIZE);
+}
+
 static Frame*
 cloneRecurse(Frame *old, Frame *newroot)
 {
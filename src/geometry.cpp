@@ -10,6 +10,8 @@
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
 
 #define PLUGIN_ID ID_GEOMETRY
 
@@ -78,6 +80,9 @@ Geometry::create(int32 numVerts, int32 numTris, uint32 flags)
 
 	geo->matList.init();
 	geo->lockedSinceInst = 0;
+	geo->lockedRangeFlags = 0;
+	geo->numDirtySpans = 0;
+	geo->dirtySpans = nil;
 	geo->meshHeader = nil;
 	geo->instData = nil;
 	geo->refCount = 1;
@@ -98,6 +103,7 @@ Geometry::destroy(void)
 		rwFree(this->morphTargets);
 		// Also frees indices
 		rwFree(this->meshHeader);
+		rwFree(this->dirtySpans);
 		this->matList.deinit();
 		rwFree(this);
 		numAllocated--;
@@ -107,13 +113,111 @@ Geometry::destroy(void)
 void
 Geometry::lock(int32 lockFlags)
 {
+	AssetDedup::forget(this);
 	lockedSinceInst |= lockFlags;
+	lockedRangeFlags &= ~lockFlags;
+	if(lockFlags & LOCKVERTICES)
+		GeometryBounds::destroy(this);
 	if(lockFlags & LOCKPOLYGONS){
 		rwFree(this->meshHeader);
 		this->meshHeader = nil;
 	}
 }
 
+// Dirty spans closer than this are uploaded as one
+enum { SPANMERGEGAP = 32, MAXDIRTYSPANS = 16 };
+
+static void
+addDirtySpan(Geometry *geo, int32 first, int32 count)
+{
+	VertexSpan *s = geo->dirtySpans;
+	int32 n = geo->numDirtySpans;
+	int32 i, j;
+	int32 end = first + count;
+
+	if(s == nil)
+		s = geo->dirtySpans = rwNewT(VertexSpan, MAXDIRTYSPANS+1, MEMDUR_EVENT | ID_GEOMETRY);
+	// replace all spans that are near by their union
+	for(i = 0; i < n && s[i].first+s[i].count + SPANMERGEGAP < first; i++)
+		;
+	for(j = i; j < n && s[j].first <= end + SPANMERGEGAP; j++){
+		if(s[j].first < first)
+			first = s[j].first;
+		if(s[j].first+s[j].count > end)
+			end = s[j].first+s[j].count;
+	}
+	memmove(&s[i+1], &s[j], (n-j)*sizeof(VertexSpan));
+	s[i].first = first;
+	s[i].count = end - first;
+	n += 1 - (j-i);
+
+	// too many, merge the two closest
+	if(n > MAXDIRTYSPANS){
+		int32 gap, minGap = 0x7FFFFFFF;
+		for(j = 0; j < n-1; j++){
+			gap = s[j+1].first - (s[j].first+s[j].count);
+			if(gap < minGap){
+				minGap = gap;
+				i = j;
+			}
+		}
+		s[i].count = s[i+1].first+s[i+1].count - s[i].first;
+		memmove(&s[i+1], &s[i+2], (n-i-2)*sizeof(VertexSpan));
+		n--;
+	}
+	geo->numDirtySpans = n;
+}
+
+// Like lock but only the vertices in the range changed,
+// so reinstancing can rewrite and upload just those.
+void
+Geometry::lockRange(int32 lockFlags, int32 firstVertex, int32 count)
+{
+	if(firstVertex < 0){
+		count += firstVertex;
+		firstVertex = 0;
+	}
+	if(firstVertex + count > this->numVertices)
+		count = this->numVertices - firstVertex;
+	if(lockFlags & LOCKPOLYGONS || count >= this->numVertices){
+		lock(lockFlags);
+		return;
+	}
+	AssetDedup::forget(this);
+	if(lockFlags & LOCKVERTICES)
+		GeometryBounds::destroy(this);
+	// no point when already locked as a whole
+	lockFlags &= ~(lockedSinceInst & ~lockedRangeFlags);
+	if(count <= 0 || lockFlags == 0)
+		return;
+	lockedSinceInst |= lockFlags;
+	lockedRangeFlags |= lockFlags;
+	addDirtySpan(this, firstVertex, count);
+}
+
+int32
+Geometry::getLockedSpans(int32 lockFlags, bool32 reinstance, VertexSpan *all, VertexSpan **spans)
+{
+	all->first = 0;
+	all->count = this->numVertices;
+	*spans = all;
+	if(!reinstance || lockedSinceInst & ~lockedRangeFlags & lockFlags)
+		return 1;
+	if(lockedRangeFlags & lockFlags){
+		*spans = this->dirtySpans;
+		return this->numDirtySpans;
+	}
+	return 0;
+}
+
+void
+Geometry::resetLocks(void)
+{
+	lockedSinceInst = 0;
+	lockedRangeFlags = 0;
+	numDirtySpans = 0;
+}
+
 void
 Geometry::unlock(void)
 {
@@ -139,6 +243,8 @@ Geometry::streamRead(Stream *stream)
 	MaterialList *ret;
 	static SurfaceProperties reset = { 1.0f, 1.0f, 1.0f };
 
+	if(AssetDedup::isEnabled())
+		return AssetDedup::readGeometry(stream);
 	if(!findChunk(stream, ID_STRUCT, nil, &version)){
 		RWERROR((ERR_CHUNK, "STRUCT"));
 		return nil;
@@ -356,6 +462,8 @@ Geometry::calculateBoundingSphere(void)
 		MorphTarget *m = &this->morphTargets[i];
 		m->boundingSphere = m->calculateBoundingSphere();
 	}
+	// boxes are calculated again when they're needed
+	GeometryBounds::destroy(this);
 }
 
 bool32
@@ -687,21 +795,7 @@ Sphere
 MorphTarget::calculateBoundingSphere(void) const
 {
 	Sphere sphere;
-	V3d min = {  1000000.0f,  1000000.0f,  1000000.0f };
-	V3d max = { -1000000.0f, -1000000.0f, -1000000.0f };
-	V3d *v = this->vertices;
-	for(int32 j = 0; j < this->parent->numVertices; j++){
-		if(v->x > max.x) max.x = v->x;
-		if(v->x < min.x) min.x = v->x;
-		if(v->y > max.y) max.y = v->y;
-		if(v->y < min.y) min.y = v->y;
-		if(v->z > max.z) max.z = v->z;
-		if(v->z < min.z) min.z = v->z;
-		v++;
-	}
-	sphere.center = scale(add(min, max), 1/2.0f);
-	max = sub(max, sphere.center);
-	sphere.radius = length(max);
+	sphere.calculate(this->vertices, this->parent->numVertices);
 	return sphere;
 }
 
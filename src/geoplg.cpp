@@ -232,6 +232,24 @@ MeshHeader::guessNumTriangles(void)
 		return this->totalIndices/3;
 }
 
+// FNV-1a over the mesh sizes and indices. Lets data that was
+// streamed separately check it still belongs to these meshes.
+// 0 for native meshes.
+uint32
+MeshHeader::getIndexChecksum(void)
+{
+	Mesh *m = this->getMeshes();
+	uint32 h = 0x811C9DC5;
+	if(this->numMeshes == 0 || m->indices == nil)
+		return 0;
+	for(int32 i = 0; i < this->numMeshes; i++){
+		h = (h ^ m[i].numIndices) * 0x01000193;
+		for(uint32 j = 0; j < m[i].numIndices; j++)
+			h = (h ^ m[i].indices[j]) * 0x01000193;
+	}
+	return h;
+}
+
 // Native Data
 
 static void*
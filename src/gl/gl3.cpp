@@ -34,6 +34,9 @@ driverOpen(void *o, int32, int32)
 	engine->driver[PLATFORM_GL3]->imageFindRasterFormat = imageFindRasterFormat;
 	engine->driver[PLATFORM_GL3]->rasterFromImage    = rasterFromImage;
 	engine->driver[PLATFORM_GL3]->rasterToImage      = rasterToImage;
+#ifdef RW_OPENGL
+	engine->driver[PLATFORM_GL3]->rasterSetResidency = rasterSetResidency;
+#endif
 
 	return o;
 }
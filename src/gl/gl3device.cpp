@@ -135,6 +135,8 @@ int32 u_lightColor;
 
 int32 u_matColor;
 int32 u_surfProps;
+int32 u_quantScale;
+int32 u_quantOffset;
 
 Shader *defaultShader, *defaultShader_noAT;
 Shader *defaultShader_fullLight, *defaultShader_fullLight_noAT;
@@ -580,6 +582,8 @@ static void
 setRasterStageOnly(uint32 stage, Raster *raster)
 {
 	bool32 alpha;
+	if(raster)
+		TextureResidency::touch(raster);
 	if(raster != rwStateCache.texstage[stage].raster){
 		rwStateCache.texstage[stage].raster = raster;
 		setActiveTexture(stage);
@@ -614,6 +618,8 @@ static void
 setRasterStage(uint32 stage, Raster *raster)
 {
 	bool32 alpha;
+	if(raster)
+		TextureResidency::touch(raster);
 	if(raster != rwStateCache.texstage[stage].raster){
 		rwStateCache.texstage[stage].raster = raster;
 		setActiveTexture(stage);
@@ -1822,6 +1828,8 @@ initOpenGL(void)
 #endif
 	u_matColor = registerUniform("u_matColor", UNIFORM_VEC4);
 	u_surfProps = registerUniform("u_surfProps", UNIFORM_VEC4);
+	u_quantScale = registerUniform("u_quantScale", UNIFORM_VEC4);
+	u_quantOffset = registerUniform("u_quantOffset", UNIFORM_VEC4);
 
 	// for im2d
 	registerUniform("u_xform", UNIFORM_VEC4);
@@ -50,6 +50,8 @@ destroyNativeData(void *object, int32, int32)
 static InstanceDataHeader*
 instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 {
+	if(Geometry::optimizeOnInstance)
+		geo->optimizeVertexCache();
 	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 	MeshHeader *meshh = geo->meshHeader;
 	geo->instData = header;
@@ -85,6 +87,10 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	header->vertexBuffer = nil;
 	header->numAttribs = 0;
 	header->attribDesc = nil;
+	header->quantScale[0] = header->quantScale[1] = header->quantScale[2] = 1.0f;
+	header->quantScale[3] = 0.0f;
+	header->quantOffset[0] = header->quantOffset[1] = header->quantOffset[2] = 0.0f;
+	header->quantOffset[3] = 0.0f;
 	header->ibo = 0;
 	header->vbo = 0;
 
@@ -126,7 +132,7 @@ instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	}else if(geo->lockedSinceInst)
 		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 1);
 
-	geo->lockedSinceInst = 0;
+	geo->resetLocks();
 }
 
 static void
@@ -167,6 +173,62 @@ ObjPipeline::create(void)
 	return pipe;
 }
 
+// Half floats need GL 3 or GLES 3
+uint32
+getQuantizeFlags(void)
+{
+	uint32 quant = Geometry::quantizeOnInstance;
+	if(gl3Caps.glversion < 30)
+		quant &= ~Geometry::QUANTTEXCOORDS;
+	return quant;
+}
+
+void
+instPositions(InstanceDataHeader *header, AttribDesc *a, V3d *src, int32 first, int32 count)
+{
+	uint8 *dst = header->vertexBuffer + a->offset + first*a->stride;
+	src += first;
+	if(a->type == GL_SHORT){
+		// quantization range is over all positions
+		assert(first == 0 && count == (int32)header->totalNumVertex);
+		V3d scale, offset;
+		getQuantization(src, count, &scale, &offset);
+		instQuantV3d(dst, src, count, a->stride, &scale, &offset);
+		header->quantScale[0] = scale.x/32767.0f;
+		header->quantScale[1] = scale.y/32767.0f;
+		header->quantScale[2] = scale.z/32767.0f;
+		header->quantOffset[0] = offset.x;
+		header->quantOffset[1] = offset.y;
+		header->quantOffset[2] = offset.z;
+	}else
+		instV3d(VERT_FLOAT3, dst, src, count, a->stride);
+}
+
+// The whole buffer when instancing, only the spans when reinstancing
+void
+uploadVertices(InstanceDataHeader *header, bool32 reinstance, VertexSpan *spans, int32 numSpans)
+{
+	uint32 stride = header->attribDesc[0].stride;
+	if(reinstance){
+		glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
+		for(int32 i = 0; i < numSpans; i++)
+			glBufferSubData(GL_ARRAY_BUFFER, spans[i].first*stride, spans[i].count*stride,
+			                header->vertexBuffer + spans[i].first*stride);
+		return;
+	}
+#ifdef RW_GL_USE_VAOS
+	glBindVertexArray(header->vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
+#endif
+	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
+	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*stride,
+	             header->vertexBuffer, GL_STATIC_DRAW);
+#ifdef RW_GL_USE_VAOS
+	setAttribPointers(header->attribDesc, header->numAttribs);
+	glBindVertexArray(0);
+#endif
+}
+
 void
 defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 {
@@ -178,6 +240,7 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance){
 		AttribDesc tmpAttribs[12];
 		uint32 stride;
+		uint32 quant = getQuantizeFlags();
 
 		//
 		// Create attribute descriptions
@@ -188,21 +251,36 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		// Positions
 		a->index = ATTRIB_POS;
 		a->size = 3;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
 		a->offset = stride;
-		stride += 12;
+		if(quant & Geometry::QUANTPOSITIONS){
+			// not normalized, the scale includes that
+			a->type = GL_SHORT;
+			a->normalized = GL_FALSE;
+			stride += 8;
+		}else{
+			a->type = GL_FLOAT;
+			a->normalized = GL_FALSE;
+			stride += 12;
+		}
 		a++;
 
 		// Normals
-		// TODO: compress
 		if(hasNormals){
 			a->index = ATTRIB_NORMAL;
-			a->size = 3;
-			a->type = GL_FLOAT;
-			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 12;
+			if(quant & Geometry::QUANTNORMALS){
+				// octahedral
+				a->size = 2;
+				a->type = GL_SHORT;
+				a->normalized = GL_FALSE;
+				stride += 4;
+				header->quantOffset[3] = 1.0f;
+			}else{
+				a->size = 3;
+				a->type = GL_FLOAT;
+				a->normalized = GL_FALSE;
+				stride += 12;
+			}
 			a++;
 		}
 
@@ -221,10 +299,15 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			a->index = ATTRIB_TEXCOORDS0+n;
 			a->size = 2;
-			a->type = GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 8;
+			if(quant & Geometry::QUANTTEXCOORDS){
+				a->type = GL_HALF_FLOAT;
+				stride += 4;
+			}else{
+				a->type = GL_FLOAT;
+				stride += 8;
+			}
 			a++;
 		}
 
@@ -250,63 +333,89 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	//
 
 	uint8 *verts = header->vertexBuffer;
+	VertexSpan all, *spans;
+	int32 i, n;
+	bool32 wholeBuffer = 0;
 
 	// Positions
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	n = geo->getLockedSpans(Geometry::LOCKVERTICES, reinstance, &all, &spans);
+	if(n){
 		for(a = attribs; a->index != ATTRIB_POS; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex, a->stride);
+		if(a->type == GL_SHORT && spans != &all){
+			spans = &all;
+			n = 1;
+			wholeBuffer = 1;
+		}
+		for(i = 0; i < n; i++)
+			instPositions(header, a, geo->morphTargets[0].vertices,
+				spans[i].first, spans[i].count);
 	}
 
 	// Normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	n = geo->getLockedSpans(Geometry::LOCKNORMALS, reinstance, &all, &spans);
+	if(hasNormals && n){
 		for(a = attribs; a->index != ATTRIB_NORMAL; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex, a->stride);
+		for(i = 0; i < n; i++)
+			instV3d(a->type == GL_SHORT ? VERT_OCTNORM : VERT_FLOAT3,
+				verts + a->offset + a->stride*spans[i].first,
+				geo->morphTargets[0].normals + spans[i].first,
+				spans[i].count, a->stride);
 	}
 
 	// Prelighting
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	n = geo->getLockedSpans(Geometry::LOCKPRELIGHT, reinstance, &all, &spans);
+	if(isPrelit && n){
 		for(a = attribs; a->index != ATTRIB_COLOR; a++)
 			;
-		int n = header->numMeshes;
-		InstanceData *inst = header->inst;
-		while(n--){
-			assert(inst->minVert != 0xFFFFFFFF);
-			inst->vertexAlpha = instColor(VERT_RGBA,
-				verts + a->offset + a->stride*inst->minVert,
-				geo->colors + inst->minVert,
-				inst->numVertices, a->stride);
-			inst++;
+		for(i = 0; i < n; i++){
+			int32 m = header->numMeshes;
+			InstanceData *inst = header->inst;
+			while(m--){
+				assert(inst->minVert != 0xFFFFFFFF);
+				// part of the span used by this mesh
+				int32 first = spans[i].first;
+				int32 end = first + spans[i].count;
+				if(first < (int32)inst->minVert)
+					first = inst->minVert;
+				if(end > (int32)(inst->minVert+inst->numVertices))
+					end = inst->minVert+inst->numVertices;
+				if(first < end){
+					bool32 alpha = instColor(VERT_RGBA,
+						verts + a->offset + a->stride*first,
+						geo->colors + first,
+						end - first, a->stride);
+					if(end - first == inst->numVertices)
+						inst->vertexAlpha = alpha;
+					else
+						inst->vertexAlpha |= alpha;
+				}
+				inst++;
+			}
 		}
 	}
 
 	// Texture coordinates
-	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+n; a++)
-				;
-			instTexCoords(VERT_FLOAT2, verts + a->offset,
-				geo->texCoords[n],
-				header->totalNumVertex, a->stride);
-		}
+	for(int32 t = 0; t < geo->numTexCoordSets; t++){
+		n = geo->getLockedSpans(Geometry::LOCKTEXCOORDS<<t, reinstance, &all, &spans);
+		if(n == 0)
+			continue;
+		for(a = attribs; a->index != ATTRIB_TEXCOORDS0+t; a++)
+			;
+		for(i = 0; i < n; i++)
+			instTexCoords(a->type == GL_HALF_FLOAT ? VERT_HALF2 : VERT_FLOAT2,
+				verts + a->offset + a->stride*spans[i].first,
+				geo->texCoords[t] + spans[i].first,
+				spans[i].count, a->stride);
 	}
 
-#ifdef RW_GL_USE_VAOS
-	glBindVertexArray(header->vao);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
-#endif
-	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
-	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
-	             header->vertexBuffer, GL_STATIC_DRAW);
-#ifdef RW_GL_USE_VAOS
-	setAttribPointers(header->attribDesc, header->numAttribs);
-	glBindVertexArray(0);
-#endif
+	n = geo->getLockedSpans(Geometry::LOCKALL, reinstance, &all, &spans);
+	if(wholeBuffer){
+		spans = &all;
+		n = 1;
+	}
+	uploadVertices(header, reinstance, spans, n);
 }
 
 void
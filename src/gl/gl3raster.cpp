@@ -55,8 +55,77 @@ getLevelSize(Raster *raster, int32 level)
 	return s*h;
 }
 
+void evictRaster(Raster *raster);
+
 #ifdef RW_OPENGL
 
+// Size in video memory of all levels from firstLevel on.
+// Autogenerated mipmaps count as well.
+static uint32
+getTextureSize(Raster *raster, int32 firstLevel)
+{
+	Gl3Raster *natras = GETGL3RASTEREXT(raster);
+	int32 w = raster->width;
+	int32 h = raster->height;
+	int32 blockSize = 0;
+	uint32 size = 0;
+	switch(natras->internalFormat){
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		blockSize = 8;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		blockSize = 16;
+		break;
+	}
+	for(int32 i = 0; ; i++){
+		if(i >= firstLevel)
+			size += blockSize ? ((w+3)/4)*((h+3)/4)*blockSize : w*h*natras->bpp;
+		if(natras->autogenMipmap ? w == 1 && h == 1 : i+1 >= natras->numLevels)
+			break;
+		if(w > 1) w /= 2;
+		if(h > 1) h /= 2;
+	}
+	return size;
+}
+
+// Dropped levels are set to 0x0 images and have to be uploaded again,
+// evicted textures get a new texture object.
+bool32
+rasterSetResidency(Raster *raster, int32 firstLevel, int32 numLevels)
+{
+	Gl3Raster *natras = GETGL3RASTEREXT(raster);
+	uint32 prev;
+	int32 i;
+
+	if(raster->type != Raster::NORMAL && raster->type != Raster::TEXTURE)
+		return 0;
+	evictRaster(raster);
+	if(firstLevel >= numLevels){
+		glDeleteTextures(1, &natras->texid);
+		natras->texid = 0;
+		TextureResidency::reportSize(raster, 0);
+		return 0;
+	}
+	if(natras->texid == 0){
+		glGenTextures(1, &natras->texid);
+		prev = bindTexture(natras->texid);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, natras->numLevels-1);
+		natras->filterMode = 0;
+		natras->addressU = 0;
+		natras->addressV = 0;
+	}else
+		prev = bindTexture(natras->texid);
+	for(i = 0; i < firstLevel; i++)
+		glTexImage2D(GL_TEXTURE_2D, i, natras->internalFormat,
+		             0, 0, 0, natras->format, natras->type, nil);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, firstLevel);
+	bindTexture(prev);
+	TextureResidency::reportSize(raster, getTextureSize(raster, firstLevel));
+	return 0;
+}
+
 static Raster*
 rasterCreateTexture(Raster *raster)
 {
@@ -133,6 +202,7 @@ rasterCreateTexture(Raster *raster)
 	natras->maxAnisotropy = 1;
 
 	bindTexture(prev);
+	TextureResidency::reportSize(raster, getTextureSize(raster, 0));
 	return raster;
 }
 
@@ -195,6 +265,7 @@ rasterCreateCameraTexture(Raster *raster)
 	natras->maxAnisotropy = 1;
 
 	bindTexture(prev);
+	TextureResidency::reportSize(raster, getTextureSize(raster, 0));
 
 
 	glGenFramebuffers(1, &natras->fbo);
@@ -328,6 +399,7 @@ allocateDXT(Raster *raster, int32 dxt, int32 numLevels, bool32 hasAlpha)
 	natras->addressU = 0;
 	natras->addressV = 0;
 	natras->maxAnisotropy = 1;
+	TextureResidency::reportSize(raster, getTextureSize(raster, 0));
 
 	bindTexture(prev);
 
@@ -635,13 +707,75 @@ imageFindRasterFormat(Image *img, int32 type,
 	return 1;
 }
 
+#ifdef RW_OPENGL
+// Compress image into a raster allocated with allocateDXT.
+// GL rasters are stored bottom up so the blocks are flipped.
+static bool32
+rasterFromImageDXT(Raster *raster, Image *image)
+{
+	Gl3Raster *natras = GETGL3RASTEREXT(raster);
+	int32 dxt;
+	switch(natras->internalFormat){
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: dxt = 1; break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: dxt = 3; break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: dxt = 5; break;
+	default:
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+	if(image->width != raster->width || image->height != raster->height){
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+	uint8 *dxtpixels = image->compressDXT(dxt, Image::dxtQuality);
+	if(dxtpixels == nil)
+		return 0;
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+	assert(raster->pixels);
+	flipDXT(dxt, raster->pixels, dxtpixels, image->width, image->height);
+	if(unlock)
+		raster->unlock(0);
+	rwFree(dxtpixels);
+	return 1;
+}
+#endif
+
+// Memory layout of a raster's pixels for the row conversions
+static int32
+rasterConvFormat(int32 format)
+{
+	// GLES only has RGBA textures
+	if(gl3Caps.gles)
+		return CONVFMT_RGBA8888;
+	switch(format & 0xF00){
+	case Raster::C8888:
+		return CONVFMT_RGBA8888;
+	case Raster::C888:
+		return CONVFMT_RGB888;
+	case Raster::C1555:
+		return CONVFMT_RGBA5551;
+	}
+	return -1;
+}
+
 bool32
 rasterFromImage(Raster *raster, Image *image)
 {
 	if((raster->type&0xF) != Raster::TEXTURE)
 		return 0;
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+#ifdef RW_OPENGL
+	if(GETGL3RASTEREXT(raster)->isCompressed)
+		return rasterFromImageDXT(raster, image);
+#endif
+
+	ConvRowFunc conv = nil;
 
 	// Unpalettize image if necessary but don't change original
 	Image *truecolimg = nil;
@@ -655,42 +789,8 @@ rasterFromImage(Raster *raster, Image *image)
 	}
 
 	Gl3Raster *natras = GETGL3RASTEREXT(raster);
-	int32 format = raster->format&0xF00;
-	assert(!natras->isCompressed);
-	switch(image->depth){
-	case 32:
-		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_RGBA8888;
-		else if(format == Raster::C8888)
-			conv = conv_RGBA8888_from_RGBA8888;
-		else if(format == Raster::C888)
-			conv = conv_RGB888_from_RGB888;
-		else
-			goto err;
-		break;
-	case 24:
-		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_RGB888;
-		else if(format == Raster::C8888)
-			conv = conv_RGBA8888_from_RGB888;
-		else if(format == Raster::C888)
-			conv = conv_RGB888_from_RGB888;
-		else
-			goto err;
-		break;
-	case 16:
-		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_ARGB1555;
-		else if(format == Raster::C1555)
-			conv = conv_RGBA5551_from_ARGB1555;
-		else
-			goto err;
-		break;
-
-	case 8:
-	case 4:
-	default:
-	err:
+	conv = getConvRow(rasterConvFormat(raster->format), getImageConvFormat(image));
+	if(conv == nil){
 		RWERROR((ERR_INVRASTER));
 		return 0;
 	}
@@ -707,17 +807,11 @@ rasterFromImage(Raster *raster, Image *image)
 	assert(pixels);
 	uint8 *imgpixels = image->pixels + (image->height-1)*image->stride;
 
-	int x, y;
+	int y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
 	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(rasrow, imgrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
+		conv(pixels, imgpixels, image->width);
 		imgpixels -= image->stride;
 		pixels += raster->stride;
 	}
@@ -749,19 +843,15 @@ rasterToImage(Raster *raster)
 		return nil;
 	}
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
 	switch(raster->format & 0xF00){
 	case Raster::C1555:
 		depth = 16;
-		conv = conv_ARGB1555_from_RGBA5551;
 		break;
 	case Raster::C8888:
 		depth = 32;
-		conv = conv_RGBA8888_from_RGBA8888;
 		break;
 	case Raster::C888:
 		depth = 24;
-		conv = conv_RGB888_from_RGB888;
 		break;
 
 	default:
@@ -781,22 +871,24 @@ rasterToImage(Raster *raster)
 		
 	uint8 *in, *out;
 	image = Image::create(raster->width, raster->height, depth);
+	ConvRowFunc conv = getConvRow(getImageConvFormat(image), rasterConvFormat(raster->format));
+	if(conv == nil){
+		RWERROR((ERR_INVRASTER));
+		image->destroy();
+		if(unlock)
+			raster->unlock(0);
+		return nil;
+	}
 	image->allocate();
 
 	uint8 *imgpixels = image->pixels + (image->height-1)*image->stride;
 	uint8 *pixels = raster->pixels;
 
-	int x, y;
+	int y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
 	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(imgrow, rasrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
+		conv(imgpixels, pixels, image->width);
 		imgpixels -= image->stride;
 		pixels += raster->stride;
 	}
@@ -818,8 +910,6 @@ createNativeRaster(void *object, int32 offset, int32)
 	return object;
 }
 
-void evictRaster(Raster *raster);
-
 static void*
 destroyNativeRaster(void *object, int32 offset, int32)
 {
@@ -827,6 +917,7 @@ destroyNativeRaster(void *object, int32 offset, int32)
 	Gl3Raster *natras = PLUGINOFFSET(Gl3Raster, object, offset);
 #ifdef RW_OPENGL
 	evictRaster(raster);
+	TextureResidency::reportSize(raster, 0);
 	switch(raster->type){
 	case Raster::NORMAL:
 	case Raster::TEXTURE:
@@ -9,6 +9,8 @@
 #include "../rwengine.h"
 #include "../rwpipeline.h"
 #include "../rwobjects.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
 #ifdef RW_OPENGL
 #include "rwgl3.h"
 #include "rwgl3shader.h"
@@ -23,9 +25,19 @@ namespace gl3 {
 void
 drawInst_simple(InstanceDataHeader *header, InstanceData *inst)
 {
+	MeshletRange *ranges;
+	int32 n = Meshlets::getDrawRanges(inst - header->inst, &ranges);
+	if(n == 0)
+		return;
 	flushCache();
-	glDrawElements(header->primType, inst->numIndex,
-	               GL_UNSIGNED_SHORT, (void*)(uintptr)inst->offset);
+	if(n < 0){
+		glDrawElements(header->primType, inst->numIndex,
+		               GL_UNSIGNED_SHORT, (void*)(uintptr)inst->offset);
+		return;
+	}
+	for(int32 i = 0; i < n; i++)
+		glDrawElements(header->primType, ranges[i].numIndices, GL_UNSIGNED_SHORT,
+		               (void*)(uintptr)(inst->offset + ranges[i].firstIndex*2));
 }
 
 // Emulate PS2 GS alpha test FB_ONLY case: failed alpha writes to frame- but not to depth buffer
@@ -100,6 +112,8 @@ setupVertexInput(InstanceDataHeader *header)
 	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
 	setAttribPointers(header->attribDesc, header->numAttribs);
 #endif
+	setUniform(u_quantScale, header->quantScale);
+	setUniform(u_quantOffset, header->quantOffset);
 }
 
 void
@@ -150,7 +164,7 @@ defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
 	Material *m;
 
 	uint32 flags = atomic->geometry->flags;
-	setWorldMatrix(atomic->getFrame()->getLTM());
+	setWorldMatrix(atomic->getFrame()->getRenderLTM());
 	int32 vsBits = lightingCB(atomic);
 
 	setupVertexInput(header);
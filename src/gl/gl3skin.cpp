@@ -39,6 +39,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	if(!reinstance){
 		AttribDesc tmpAttribs[14];
 		uint32 stride;
+		uint32 quant = getQuantizeFlags();
 
 		//
 		// Create attribute descriptions
@@ -49,21 +50,36 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		// Positions
 		a->index = ATTRIB_POS;
 		a->size = 3;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
 		a->offset = stride;
-		stride += 12;
+		if(quant & Geometry::QUANTPOSITIONS){
+			// not normalized, the scale includes that
+			a->type = GL_SHORT;
+			a->normalized = GL_FALSE;
+			stride += 8;
+		}else{
+			a->type = GL_FLOAT;
+			a->normalized = GL_FALSE;
+			stride += 12;
+		}
 		a++;
 
 		// Normals
-		// TODO: compress
 		if(hasNormals){
 			a->index = ATTRIB_NORMAL;
-			a->size = 3;
-			a->type = GL_FLOAT;
-			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 12;
+			if(quant & Geometry::QUANTNORMALS){
+				// octahedral
+				a->size = 2;
+				a->type = GL_SHORT;
+				a->normalized = GL_FALSE;
+				stride += 4;
+				header->quantOffset[3] = 1.0f;
+			}else{
+				a->size = 3;
+				a->type = GL_FLOAT;
+				a->normalized = GL_FALSE;
+				stride += 12;
+			}
 			a++;
 		}
 
@@ -82,20 +98,31 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			a->index = ATTRIB_TEXCOORDS0+n;
 			a->size = 2;
-			a->type = GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 8;
+			if(quant & Geometry::QUANTTEXCOORDS){
+				a->type = GL_HALF_FLOAT;
+				stride += 4;
+			}else{
+				a->type = GL_FLOAT;
+				stride += 8;
+			}
 			a++;
 		}
 
 		// Weights
 		a->index = ATTRIB_WEIGHTS;
 		a->size = 4;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
 		a->offset = stride;
-		stride += 16;
+		if(quant & Geometry::QUANTWEIGHTS){
+			a->type = GL_UNSIGNED_BYTE;
+			a->normalized = GL_TRUE;
+			stride += 4;
+		}else{
+			a->type = GL_FLOAT;
+			a->normalized = GL_FALSE;
+			stride += 16;
+		}
 		a++;
 
 		// Indices
@@ -130,43 +157,60 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	//
 
 	uint8 *verts = header->vertexBuffer;
+	VertexSpan all, *spans;
+	int32 i, n;
+	bool32 wholeBuffer = 0;
 
 	// Positions
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	n = geo->getLockedSpans(Geometry::LOCKVERTICES, reinstance, &all, &spans);
+	if(n){
 		for(a = attribs; a->index != ATTRIB_POS; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex, a->stride);
+		if(a->type == GL_SHORT && spans != &all){
+			spans = &all;
+			n = 1;
+			wholeBuffer = 1;
+		}
+		for(i = 0; i < n; i++)
+			instPositions(header, a, geo->morphTargets[0].vertices,
+				spans[i].first, spans[i].count);
 	}
 
 	// Normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	n = geo->getLockedSpans(Geometry::LOCKNORMALS, reinstance, &all, &spans);
+	if(hasNormals && n){
 		for(a = attribs; a->index != ATTRIB_NORMAL; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex, a->stride);
+		for(i = 0; i < n; i++)
+			instV3d(a->type == GL_SHORT ? VERT_OCTNORM : VERT_FLOAT3,
+				verts + a->offset + a->stride*spans[i].first,
+				geo->morphTargets[0].normals + spans[i].first,
+				spans[i].count, a->stride);
 	}
 
 	// Prelighting
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	n = geo->getLockedSpans(Geometry::LOCKPRELIGHT, reinstance, &all, &spans);
+	if(isPrelit && n){
 		for(a = attribs; a->index != ATTRIB_COLOR; a++)
 			;
-		instColor(VERT_RGBA, verts + a->offset,
-			  geo->colors,
-			  header->totalNumVertex, a->stride);
+		for(i = 0; i < n; i++)
+			instColor(VERT_RGBA, verts + a->offset + a->stride*spans[i].first,
+				  geo->colors + spans[i].first,
+				  spans[i].count, a->stride);
 	}
 
 	// Texture coordinates
-	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+n; a++)
-				;
-			instTexCoords(VERT_FLOAT2, verts + a->offset,
-				geo->texCoords[n],
-				header->totalNumVertex, a->stride);
-		}
+	for(int32 t = 0; t < geo->numTexCoordSets; t++){
+		n = geo->getLockedSpans(Geometry::LOCKTEXCOORDS<<t, reinstance, &all, &spans);
+		if(n == 0)
+			continue;
+		for(a = attribs; a->index != ATTRIB_TEXCOORDS0+t; a++)
+			;
+		for(i = 0; i < n; i++)
+			instTexCoords(a->type == GL_HALF_FLOAT ? VERT_HALF2 : VERT_FLOAT2,
+				verts + a->offset + a->stride*spans[i].first,
+				geo->texCoords[t] + spans[i].first,
+				spans[i].count, a->stride);
 	}
 
 	// Weights
@@ -174,7 +218,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(a = attribs; a->index != ATTRIB_WEIGHTS; a++)
 			;
 		float *w = skin->weights;
-		instV4d(VERT_FLOAT4, verts + a->offset,
+		instV4d(a->type == GL_UNSIGNED_BYTE ? VERT_UBYTE4N : VERT_FLOAT4, verts + a->offset,
 			(V4d*)w,
 			header->totalNumVertex, a->stride);
 	}
@@ -189,17 +233,12 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 			  header->totalNumVertex, a->stride);
 	}
 
-#ifdef RW_GL_USE_VAOS
-	glBindVertexArray(header->vao);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
-#endif
-	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
-	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
-	             header->vertexBuffer, GL_STATIC_DRAW);
-#ifdef RW_GL_USE_VAOS
-	setAttribPointers(header->attribDesc, header->numAttribs);
-	glBindVertexArray(0);
-#endif
+	n = geo->getLockedSpans(Geometry::LOCKALL, reinstance, &all, &spans);
+	if(wholeBuffer){
+		spans = &all;
+		n = 1;
+	}
+	uploadVertices(header, reinstance, spans, n);
 }
 
 void
@@ -254,7 +293,7 @@ skinRenderCB(Atomic *atomic, InstanceDataHeader *header)
 	Material *m;
 
 	uint32 flags = atomic->geometry->flags;
-	setWorldMatrix(atomic->getFrame()->getLTM());
+	setWorldMatrix(atomic->getFrame()->getRenderLTM());
 	int32 vsBits = lightingCB(atomic);
 
 	setupVertexInput(header);
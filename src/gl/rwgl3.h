@@ -60,6 +60,8 @@ enum AttribIndices
 // default uniform indices
 extern int32 u_matColor;
 extern int32 u_surfProps;
+extern int32 u_quantScale;
+extern int32 u_quantOffset;
 
 struct InstanceData
 {
@@ -83,6 +85,10 @@ struct InstanceDataHeader : rw::InstanceDataHeader
 	AttribDesc *attribDesc;
 	uint32      totalNumIndex;
 	uint32      totalNumVertex;
+	// decoding of quantized positions and normals,
+	// quantOffset[3] is 1 for octahedral normals
+	float32     quantScale[4];
+	float32     quantOffset[4];
 
 	uint32      ibo;
 	uint32      vbo;		// or 2?
@@ -229,6 +235,12 @@ public:
 void defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
 void defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header);
 void defaultRenderCB(Atomic *atomic, InstanceDataHeader *header);
+// Geometry::quantizeOnInstance as far as it's supported
+uint32 getQuantizeFlags(void);
+// fills FLOAT3 or quantized SHORT positions, the latter only all at once
+void instPositions(InstanceDataHeader *header, AttribDesc *a, V3d *src, int32 first, int32 count);
+// whole vertex buffer or, when reinstancing, only the spans
+void uploadVertices(InstanceDataHeader *header, bool32 reinstance, VertexSpan *spans, int32 numSpans);
 int32 lightingCB(Atomic *atomic);
 int32 lightingCB(void);
 
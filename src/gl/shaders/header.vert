@@ -72,6 +72,8 @@ uniform vec4 u_lightColor[MAX_LIGHTS];
 
 uniform vec4 u_matColor;
 uniform vec4 u_surfProps;	// amb, spec, diff, extra
+uniform vec4 u_quantScale;
+uniform vec4 u_quantOffset;	// w: octahedral normals
 
 #define surfAmbient (u_surfProps.x)
 #define surfSpecular (u_surfProps.y)
@@ -122,6 +124,24 @@ vec3 DoDynamicLight(vec3 V, vec3 N)
 	return color;
 }
 
+// Quantized instance data
+vec3 DecodePos(vec3 p)
+{
+	return p*u_quantScale.xyz + u_quantOffset.xyz;
+}
+
+vec3 DecodeNormal(vec3 n)
+{
+	if(u_quantOffset.w == 0.0)
+		return n;
+	n.xy /= 32767.0;
+	n.z = 1.0 - abs(n.x) - abs(n.y);
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 float DoFog(float w)
 {
 	return clamp((w - u_fogEnd)*u_fogRange, u_fogDisable, 1.0);
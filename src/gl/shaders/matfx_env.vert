@@ -13,9 +13,9 @@ VSOUT float v_fog;
 void
 main(void)
 {
-	vec4 Vertex = u_world * vec4(in_pos, 1.0);
+	vec4 Vertex = u_world * vec4(DecodePos(in_pos), 1.0);
 	gl_Position = u_proj * u_view * Vertex;
-	vec3 Normal = mat3(u_world) * in_normal;
+	vec3 Normal = mat3(u_world) * DecodeNormal(in_normal);
 
 	v_tex0 = in_tex0;
 	v_tex1 = (u_texMatrix * vec4(Normal, 1.0)).xy;
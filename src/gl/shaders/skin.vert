@@ -9,11 +9,13 @@ VSOUT float v_fog;
 void
 main(void)
 {
+	vec3 Pos = DecodePos(in_pos);
+	vec3 Nrm = DecodeNormal(in_normal);
 	vec3 SkinVertex = vec3(0.0, 0.0, 0.0);
 	vec3 SkinNormal = vec3(0.0, 0.0, 0.0);
 	for(int i = 0; i < 4; i++){
-		SkinVertex += (u_boneMatrices[int(in_indices[i])] * vec4(in_pos, 1.0)).xyz * in_weights[i];
-		SkinNormal += (mat3(u_boneMatrices[int(in_indices[i])]) * in_normal) * in_weights[i];
+		SkinVertex += (u_boneMatrices[int(in_indices[i])] * vec4(Pos, 1.0)).xyz * in_weights[i];
+		SkinNormal += (mat3(u_boneMatrices[int(in_indices[i])]) * Nrm) * in_weights[i];
 	}
 
 	vec4 Vertex = u_world * vec4(SkinVertex, 1.0);
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -15,11 +17,32 @@
 #include "d3d/rwd3d8.h"
 #include "d3d/rwd3d9.h"
 
+#include "rwsimd.h"
+
+#ifndef RW_PS2
+#include <mutex>
+#endif
+
 #define PLUGIN_ID ID_IMAGE
 
 namespace rw {
 
 int32 Image::numAllocated;
+int32 Image::dxtQuality = Image::DXTRANGEFIT;
+
+// The texture loader threads create and destroy images too
+#ifndef RW_PS2
+static std::mutex countMutex;
+#endif
+
+static void
+countImages(int32 n)
+{
+#ifndef RW_PS2
+	std::lock_guard<std::mutex> lock(countMutex);
+#endif
+	Image::numAllocated += n;
+}
 
 struct FileAssociation
 {
@@ -28,10 +51,19 @@ struct FileAssociation
 	void (*write)(Image *image, const char *filename);
 };
 
+// File names in one search path directory
+struct DirCache
+{
+	char *path;	// search path with separators and case fixed
+	char **names;	// hash table by lower case name, nil if not listed
+	uint32 mask;
+};
+
 struct ImageGlobals
 {
 	char *searchPaths;
 	int numSearchPaths;
+	DirCache *dirCaches;
 	FileAssociation fileFormats[10];
 	int numFileFormats;
 };
@@ -55,7 +87,7 @@ Image::create(int32 width, int32 height, int32 depth)
 		RWERROR((ERR_ALLOC, sizeof(Image)));
 		return nil;
 	}
-	numAllocated++;
+	countImages(1);
 	img->flags = 0;
 	img->width = width;
 	img->height = height;
@@ -72,7 +104,7 @@ Image::destroy(void)
 {
 	this->free();
 	rwFree(this);
-	numAllocated--;
+	countImages(-1);
 }
 
 void
@@ -111,218 +143,722 @@ Image::setPixels(uint8 *pixels)
 	this->flags |= 1;
 }
 
-void
-decompressDXT1(uint8 *adst, int32 w, int32 h, uint8 *src)
+/*
+ * DXT decompression.
+ * Every block is decoded into 16 RGBA texels first and then copied
+ * to the image, clipped to its size. The color lookup is done
+ * four texels at a time.
+ */
+
+// 5 and 6 bit color components expanded to 8 bits
+static uint8 expand5[32] = {
+	0, 8, 16, 24, 32, 41, 49, 57, 65, 74, 82, 90, 98, 106, 115, 123, 131,
+	139, 148, 156, 164, 172, 180, 189, 197, 205, 213, 222, 230, 238, 246,
+	255
+};
+static uint8 expand6[64] = {
+	0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60, 64, 68,
+	72, 76, 80, 85, 89, 93, 97, 101, 105, 109, 113, 117, 121, 125, 129,
+	133, 137, 141, 145, 149, 153, 157, 161, 165, 170, 174, 178, 182, 186,
+	190, 194, 198, 202, 206, 210, 214, 218, 222, 226, 230, 234, 238, 242,
+	246, 250, 255
+};
+
+// Calculate the four block colors. DXT3 always uses four colors.
+static void
+dxtColors(uint8 (*c)[4], uint32 col0, uint32 col1, bool32 threeColor)
 {
-	/* j loops through old texels
-	 * x and y loop through new texels */
-	int32 x = 0, y = 0;
-	uint32 c[4][4];
-	uint8 idx[16];
-	uint8 (*dst)[4] = (uint8(*)[4])adst;
-	for(int32 j = 0; j < w*h/2; j += 8){
-		/* calculate colors */
-		uint32 col0 = *((uint16*)&src[j+0]);
-		uint32 col1 = *((uint16*)&src[j+2]);
-		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
-		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
-		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
-		c[0][3] = 0xFF;
-
-		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
-		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
-		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
-		c[1][3] = 0xFF;
-		if(col0 > col1){
-			c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
-			c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
-			c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
-			c[2][3] = 0xFF;
-
-			c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
-			c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
-			c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
-			c[3][3] = 0xFF;
-		}else{
-			c[2][0] = (c[0][0] + c[1][0])/2;
-			c[2][1] = (c[0][1] + c[1][1])/2;
-			c[2][2] = (c[0][2] + c[1][2])/2;
-			c[2][3] = 0xFF;
-
-			c[3][0] = 0x00;
-			c[3][1] = 0x00;
-			c[3][2] = 0x00;
-			c[3][3] = 0x00;
+	c[0][0] = expand5[(col0>>11) & 0x1F];
+	c[0][1] = expand6[(col0>> 5) & 0x3F];
+	c[0][2] = expand5[ col0      & 0x1F];
+	c[0][3] = 0xFF;
+
+	c[1][0] = expand5[(col1>>11) & 0x1F];
+	c[1][1] = expand6[(col1>> 5) & 0x3F];
+	c[1][2] = expand5[ col1      & 0x1F];
+	c[1][3] = 0xFF;
+	if(!threeColor || col0 > col1){
+		c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
+		c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
+		c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
+		c[2][3] = 0xFF;
+
+		c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
+		c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
+		c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
+		c[3][3] = 0xFF;
+	}else{
+		c[2][0] = (c[0][0] + c[1][0])/2;
+		c[2][1] = (c[0][1] + c[1][1])/2;
+		c[2][2] = (c[0][2] + c[1][2])/2;
+		c[2][3] = 0xFF;
+
+		c[3][0] = 0x00;
+		c[3][1] = 0x00;
+		c[3][2] = 0x00;
+		c[3][3] = 0x00;
+	}
+}
+
+// Calculate the eight DXT5 alpha values
+static void
+dxt5Alphas(uint32 *a, uint32 a0, uint32 a1)
+{
+	a[0] = a0;
+	a[1] = a1;
+	if(a[0] > a[1]){
+		a[2] = (6*a[0] + 1*a[1])/7;
+		a[3] = (5*a[0] + 2*a[1])/7;
+		a[4] = (4*a[0] + 3*a[1])/7;
+		a[5] = (3*a[0] + 4*a[1])/7;
+		a[6] = (2*a[0] + 5*a[1])/7;
+		a[7] = (1*a[0] + 6*a[1])/7;
+	}else{
+		a[2] = (4*a[0] + 1*a[1])/5;
+		a[3] = (3*a[0] + 2*a[1])/5;
+		a[4] = (2*a[0] + 3*a[1])/5;
+		a[5] = (1*a[0] + 4*a[1])/5;
+		a[6] = 0;
+		a[7] = 0xFF;
+	}
+}
+
+// Look up the colors of all 16 texels from the 2 bit indices
+// and write them as four rows of four texels.
+// Each lane picks its 2 bits out of the row byte and compares
+// them against all four possible values.
+// For DXT3 and DXT5 the block alpha is or'ed in, the colors'
+// alpha has to be 0 then.
+static void
+dxtColorBlock(uint8 *dst, int32 stride, uint8 (*c)[4], uint32 indices, uint8 (*alpha)[4])
+{
+	using namespace simd;
+	uint32 cols[4];
+	memcpy(cols, c, sizeof(cols));
+	I4 c0 = set1i(cols[0]);
+	I4 c1 = set1i(cols[1]);
+	I4 c2 = set1i(cols[2]);
+	I4 c3 = set1i(cols[3]);
+	I4 lanemask = seti(3, 3<<2, 3<<4, 3<<6);
+	I4 k0 = set1i(0);
+	I4 k1 = seti(1, 1<<2, 1<<4, 1<<6);
+	I4 k2 = seti(2, 2<<2, 2<<4, 2<<6);
+	for(int32 l = 0; l < 4; l++){
+		I4 bits = andi(set1i(indices >> 8*l), lanemask);
+		I4 r = ori(ori(andi(cmpeqi(bits, k0), c0),
+		               andi(cmpeqi(bits, k1), c1)),
+		           ori(andi(cmpeqi(bits, k2), c2),
+		               andi(cmpeqi(bits, lanemask), c3)));
+		if(alpha)
+			r = ori(r, loadi(alpha[l*4]));
+		storei(dst + l*stride, r);
+	}
+}
+
+// decode into the image directly or into a temporary block at the edges
+#define DXTBLOCKDST(x, y) \
+	bool32 full = x+4 <= w && y+4 <= h; \
+	uint8 *bdst = full ? &dst[(y*w + x)*4] : blk[0]; \
+	int32 bstride = full ? w*4 : 16;
+
+static void
+dxtPutBlock(uint8 *dst, int32 w, int32 h, int32 x, int32 y, uint8 (*blk)[4])
+{
+	int32 bw = w-x < 4 ? w-x : 4;
+	int32 bh = h-y < 4 ? h-y : 4;
+	for(int32 l = 0; l < bh; l++)
+		memcpy(&dst[((y+l)*w + x)*4], blk[l*4], bw*4);
+}
+
+// decode one row of blocks starting at pixel row y
+static void
+decompressDXT1Row(uint8 *dst, int32 w, int32 h, int32 y, uint8 *src)
+{
+	uint8 c[4][4];
+	uint8 blk[16][4];
+	for(int32 x = 0; x < w; x += 4){
+		DXTBLOCKDST(x, y)
+		uint32 col0 = *((uint16*)&src[0]);
+		uint32 col1 = *((uint16*)&src[2]);
+		dxtColors(c, col0, col1, 1);
+		dxtColorBlock(bdst, bstride, c, *((uint32*)&src[4]), nil);
+		if(!full)
+			dxtPutBlock(dst, w, h, x, y, blk);
+		src += 8;
+	}
+}
+
+static void
+decompressDXT3Row(uint8 *dst, int32 w, int32 h, int32 y, uint8 *src)
+{
+	uint8 c[4][4];
+	uint8 blk[16][4];
+	uint8 alpha[16][4];
+	memset(alpha, 0, sizeof(alpha));
+	for(int32 x = 0; x < w; x += 4){
+		DXTBLOCKDST(x, y)
+		uint32 col0 = *((uint16*)&src[8]);
+		uint32 col1 = *((uint16*)&src[10]);
+		dxtColors(c, col0, col1, 0);
+		c[0][3] = c[1][3] = c[2][3] = c[3][3] = 0;
+		for(int32 k = 0; k < 16; k += 2){
+			uint32 a = src[k/2];
+			alpha[k][3] = (a & 0xF)*17;
+			alpha[k+1][3] = (a >> 4)*17;
 		}
+		dxtColorBlock(bdst, bstride, c, *((uint32*)&src[12]), alpha);
+		if(!full)
+			dxtPutBlock(dst, w, h, x, y, blk);
+		src += 16;
+	}
+}
 
-		/* make index list */
-		uint32 indices = *((uint32*)&src[j+4]);
+static void
+decompressDXT5Row(uint8 *dst, int32 w, int32 h, int32 y, uint8 *src)
+{
+	uint8 c[4][4];
+	uint8 blk[16][4];
+	uint8 alpha[16][4];
+	uint32 a[8];
+	memset(alpha, 0, sizeof(alpha));
+	for(int32 x = 0; x < w; x += 4){
+		DXTBLOCKDST(x, y)
+		uint32 col0 = *((uint16*)&src[8]);
+		uint32 col1 = *((uint16*)&src[10]);
+		dxtColors(c, col0, col1, 1);
+		c[0][3] = c[1][3] = c[2][3] = c[3][3] = 0;
+
+		dxt5Alphas(a, src[0], src[1]);
+		// 48 bits of 3 bit indices
+		uint64 alphas = 0;
+		for(int32 k = 7; k >= 2; k--)
+			alphas = alphas<<8 | src[k];
 		for(int32 k = 0; k < 16; k++){
-			idx[k] = indices & 0x3;
-			indices >>= 2;
+			alpha[k][3] = a[alphas & 0x7];
+			alphas >>= 3;
 		}
+		dxtColorBlock(bdst, bstride, c, *((uint32*)&src[12]), alpha);
+		if(!full)
+			dxtPutBlock(dst, w, h, x, y, blk);
+		src += 16;
+	}
+}
 
-		/* write bytes */
-		for(uint32 l = 0; l < 4; l++)
-			for(uint32 k = 0; k < 4; k++){
-				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
-				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
-				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
-				dst[(y+l)*w + x+k][3] = c[idx[l*4+k]][3];
-			}
-		x += 4;
-		if(x >= w){
-			y += 4;
-			x = 0;
-		}
+static void
+decompressDXTRow(int32 type, uint8 *dst, int32 w, int32 h, int32 y, uint8 *src)
+{
+	switch(type){
+	case 1:
+		decompressDXT1Row(dst, w, h, y, src);
+		break;
+	case 3:
+		decompressDXT3Row(dst, w, h, y, src);
+		break;
+	case 5:
+		decompressDXT5Row(dst, w, h, y, src);
+		break;
 	}
 }
 
+void
+decompressDXT1(uint8 *adst, int32 w, int32 h, uint8 *src)
+{
+	int32 stride = (w+3)/4 * 8;
+	for(int32 y = 0; y < h; y += 4, src += stride)
+		decompressDXT1Row(adst, w, h, y, src);
+}
+
 void
 decompressDXT3(uint8 *adst, int32 w, int32 h, uint8 *src)
 {
-	/* j loops through old texels
-	 * x and y loop through new texels */
-	int32 x = 0, y = 0;
-	uint32 c[4][4];
-	uint8 idx[16];
-	uint8 a[16];
-	uint8 (*dst)[4] = (uint8(*)[4])adst;
-	for(int32 j = 0; j < w*h; j += 16){
-		/* calculate colors */
-		uint32 col0 = *((uint16*)&src[j+8]);
-		uint32 col1 = *((uint16*)&src[j+10]);
-		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
-		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
-		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
-
-		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
-		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
-		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
+	int32 stride = (w+3)/4 * 16;
+	for(int32 y = 0; y < h; y += 4, src += stride)
+		decompressDXT3Row(adst, w, h, y, src);
+}
 
-		c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
-		c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
-		c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
+void
+decompressDXT5(uint8 *adst, int32 w, int32 h, uint8 *src)
+{
+	int32 stride = (w+3)/4 * 16;
+	for(int32 y = 0; y < h; y += 4, src += stride)
+		decompressDXT5Row(adst, w, h, y, src);
+}
 
-		c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
-		c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
-		c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
+// block rows per job
+#define DXTJOBROWS 8
 
-		/* make index list */
-		uint32 indices = *((uint32*)&src[j+12]);
-		for(int32 k = 0; k < 16; k++){
-			idx[k] = indices & 0x3;
-			indices >>= 2;
+struct DXTJob
+{
+	int32 type;
+	uint8 *dst;
+	int32 w, h;
+	uint8 *src;
+	int32 stride;	// bytes per row of blocks
+	int32 numRows;
+};
+
+static void
+decompressDXTJob(void *data, int32 i)
+{
+	DXTJob *job = (DXTJob*)data;
+	int32 row = i*DXTJOBROWS;
+	int32 end = row+DXTJOBROWS < job->numRows ? row+DXTJOBROWS : job->numRows;
+	for(; row < end; row++)
+		decompressDXTRow(job->type, job->dst, job->w, job->h, row*4,
+		                 job->src + row*job->stride);
+}
+
+void
+decompressDXT(int32 type, uint8 *dst, int32 w, int32 h, uint8 *src)
+{
+	DXTJob job;
+	job.type = type;
+	job.dst = dst;
+	job.w = w;
+	job.h = h;
+	job.src = src;
+	job.stride = (w+3)/4 * (type == 1 ? 8 : 16);
+	job.numRows = (h+3)/4;
+	int32 numJobs = (job.numRows+DXTJOBROWS-1)/DXTJOBROWS;
+	// small images aren't worth waking up the threads
+	if(w*h < 128*128)
+		for(int32 i = 0; i < numJobs; i++)
+			decompressDXTJob(&job, i);
+	else
+		parallelFor(decompressDXTJob, &job, numJobs);
+}
+
+int32
+getDXTSize(int32 type, int32 w, int32 h)
+{
+	return ((w+3)/4) * ((h+3)/4) * (type == 1 ? 8 : 16);
+}
+
+/*
+ * DXT compression.
+ * Block colors are fit along the principal axis of the texels, either
+ * from the extent of the texels along it (range fit) or by trying all
+ * ordered clusterings of the texels along the axis (cluster fit).
+ * Indices are always picked against the palette the decoder computes,
+ * so compressed images round-trip through the functions above.
+ */
+
+static uint32
+dxtQuantize(float32 r, float32 g, float32 b)
+{
+	int32 ir = (int32)(r*31.0f/255.0f + 0.5f);
+	int32 ig = (int32)(g*63.0f/255.0f + 0.5f);
+	int32 ib = (int32)(b*31.0f/255.0f + 0.5f);
+	ir = ir < 0 ? 0 : ir > 31 ? 31 : ir;
+	ig = ig < 0 ? 0 : ig > 63 ? 63 : ig;
+	ib = ib < 0 ? 0 : ib > 31 ? 31 : ib;
+	return ir<<11 | ig<<5 | ib;
+}
+
+// Pick the nearest of the first numColors palette entries for all
+// texels in the mask, four texels at a time. The others get index 3.
+// Returns the squared error.
+static float32
+dxtColorIndices(uint8 (*blk)[4], uint8 (*c)[4], int32 numColors, uint32 mask, uint32 *indices)
+{
+	using namespace simd;
+	float32 err = 0.0f;
+	uint32 bits = 0;
+	float32 e[4], idx[4];
+	for(int32 i = 0; i < 16; i += 4){
+		F4 r = set(blk[i][0], blk[i+1][0], blk[i+2][0], blk[i+3][0]);
+		F4 g = set(blk[i][1], blk[i+1][1], blk[i+2][1], blk[i+3][1]);
+		F4 b = set(blk[i][2], blk[i+1][2], blk[i+2][2], blk[i+3][2]);
+		F4 best = set1(1.0e30f);
+		F4 bestIdx = zero();
+		for(int32 k = 0; k < numColors; k++){
+			F4 dr = sub(r, set1(c[k][0]));
+			F4 dg = sub(g, set1(c[k][1]));
+			F4 db = sub(b, set1(c[k][2]));
+			F4 d = madd(dr, dr, madd(dg, dg, mul(db, db)));
+			F4 closer = cmplt(d, best);
+			best = select(closer, d, best);
+			bestIdx = select(closer, set1((float32)k), bestIdx);
 		}
-		uint64 alphas = *((uint64*)&src[j+0]);
-		for(int32 k = 0; k < 16; k++){
-			a[k] = (alphas & 0xF)*17;
-			alphas >>= 4;
+		store(e, best);
+		store(idx, bestIdx);
+		for(int32 j = 0; j < 4; j++)
+			if(mask & 1<<(i+j)){
+				bits |= (uint32)idx[j] << 2*(i+j);
+				err += e[j];
+			}else
+				bits |= 3 << 2*(i+j);
+	}
+	*indices = bits;
+	return err;
+}
+
+// Encode a color block from two endpoints. Opaque blocks use four
+// colors and col0 > col1, blocks with transparent texels (not in
+// the mask) use three colors and col0 <= col1.
+static float32
+dxtEncodeColors(uint8 *dst, uint8 (*blk)[4], uint32 mask, uint32 col0, uint32 col1)
+{
+	uint8 c[4][4];
+	uint32 indices, tmp;
+	int32 numColors;
+	bool32 transparent = mask != 0xFFFF;
+	if(transparent ? col0 > col1 : col0 < col1){
+		tmp = col0;
+		col0 = col1;
+		col1 = tmp;
+	}
+	numColors = transparent ? 3 : 4;
+	// the decoder would switch to three colors
+	if(col0 == col1 && !transparent)
+		numColors = 1;
+	dxtColors(c, col0, col1, 1);
+	float32 err = dxtColorIndices(blk, c, numColors, mask, &indices);
+	dst[0] = col0;
+	dst[1] = col0>>8;
+	dst[2] = col1;
+	dst[3] = col1>>8;
+	dst[4] = indices;
+	dst[5] = indices>>8;
+	dst[6] = indices>>16;
+	dst[7] = indices>>24;
+	return err;
+}
+
+// Mean and principal axis of the texels in the mask
+static void
+dxtAxis(uint8 (*blk)[4], uint32 mask, float32 *mean, float32 *axis)
+{
+	float32 n = 0.0f;
+	float32 cov[6];
+	int32 i;
+	mean[0] = mean[1] = mean[2] = 0.0f;
+	axis[0] = axis[1] = axis[2] = 0.0f;
+	for(i = 0; i < 16; i++)
+		if(mask & 1<<i){
+			mean[0] += blk[i][0];
+			mean[1] += blk[i][1];
+			mean[2] += blk[i][2];
+			n += 1.0f;
 		}
+	if(n == 0.0f)
+		return;
+	mean[0] /= n;
+	mean[1] /= n;
+	mean[2] /= n;
 
-		/* write bytes */
-		for(uint32 l = 0; l < 4; l++)
-			for(uint32 k = 0; k < 4; k++){
-				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
-				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
-				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
-				dst[(y+l)*w + x+k][3] = a[l*4+k];
-			}
-		x += 4;
-		if(x >= w){
-			y += 4;
-			x = 0;
+	memset(cov, 0, sizeof(cov));
+	for(i = 0; i < 16; i++)
+		if(mask & 1<<i){
+			float32 r = blk[i][0] - mean[0];
+			float32 g = blk[i][1] - mean[1];
+			float32 b = blk[i][2] - mean[2];
+			cov[0] += r*r;
+			cov[1] += r*g;
+			cov[2] += r*b;
+			cov[3] += g*g;
+			cov[4] += g*b;
+			cov[5] += b*b;
 		}
+
+	// power iteration
+	float32 v[3] = { 1.0f, 1.0f, 1.0f };
+	for(i = 0; i < 8; i++){
+		float32 x = cov[0]*v[0] + cov[1]*v[1] + cov[2]*v[2];
+		float32 y = cov[1]*v[0] + cov[3]*v[1] + cov[4]*v[2];
+		float32 z = cov[2]*v[0] + cov[4]*v[1] + cov[5]*v[2];
+		float32 m = fabsf(x) > fabsf(y) ? fabsf(x) : fabsf(y);
+		m = fabsf(z) > m ? fabsf(z) : m;
+		if(m == 0.0f)
+			return;
+		v[0] = x/m;
+		v[1] = y/m;
+		v[2] = z/m;
 	}
+	float32 len = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+	axis[0] = v[0]/len;
+	axis[1] = v[1]/len;
+	axis[2] = v[2]/len;
 }
 
-void
-decompressDXT5(uint8 *adst, int32 w, int32 h, uint8 *src)
+static float32
+dxtRangeFit(uint8 *dst, uint8 (*blk)[4], uint32 mask, float32 *mean, float32 *axis)
 {
-	/* j loops through old texels
-	 * x and y loop through new texels */
-	int32 x = 0, y = 0;
-	uint32 c[4][4];
-	uint32 a[8];
-	uint8 idx[16];
-	uint8 aidx[16];
-	uint8 (*dst)[4] = (uint8(*)[4])adst;
-	for(int32 j = 0; j < w*h; j += 16){
-		/* calculate colors */
-		uint32 col0 = *((uint16*)&src[j+8]);
-		uint32 col1 = *((uint16*)&src[j+10]);
-		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
-		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
-		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
-
-		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
-		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
-		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
-		if(col0 > col1){
-			c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
-			c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
-			c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
-
-			c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
-			c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
-			c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
-		}else{
-			c[2][0] = (c[0][0] + c[1][0])/2;
-			c[2][1] = (c[0][1] + c[1][1])/2;
-			c[2][2] = (c[0][2] + c[1][2])/2;
+	float32 lo = 0.0f, hi = 0.0f;
+	for(int32 i = 0; i < 16; i++)
+		if(mask & 1<<i){
+			float32 t = (blk[i][0]-mean[0])*axis[0] +
+				(blk[i][1]-mean[1])*axis[1] +
+				(blk[i][2]-mean[2])*axis[2];
+			lo = t < lo ? t : lo;
+			hi = t > hi ? t : hi;
+		}
+	uint32 col0 = dxtQuantize(mean[0] + axis[0]*hi, mean[1] + axis[1]*hi, mean[2] + axis[2]*hi);
+	uint32 col1 = dxtQuantize(mean[0] + axis[0]*lo, mean[1] + axis[1]*lo, mean[2] + axis[2]*lo);
+	return dxtEncodeColors(dst, blk, mask, col0, col1);
+}
+
+// Weights of the least squares fit for every split of 16 sorted
+// texels into four runs with weights 1, 2/3, 1/3 and 0 towards the
+// first endpoint. Only depends on the run lengths.
+struct DXTClusterSplit
+{
+	uint8 i, j, k;
+	float32 alpha2, beta2, alphabeta;
+	float32 factor;
+};
+static DXTClusterSplit dxtSplits[969];
+static int32 dxtNumSplits;
 
-			c[3][0] = 0x00;
-			c[3][1] = 0x00;
-			c[3][2] = 0x00;
+static void
+dxtInitSplits(void)
+{
+	int32 i, j, k, n = 0;
+	if(dxtNumSplits)
+		return;
+	for(i = 0; i <= 16; i++)
+	for(j = i; j <= 16; j++)
+	for(k = j; k <= 16; k++){
+		float32 n0 = i, n1 = j-i, n2 = k-j, n3 = 16-k;
+		DXTClusterSplit *sp = &dxtSplits[n];
+		sp->alpha2 = n0 + n1*(4.0f/9.0f) + n2*(1.0f/9.0f);
+		sp->beta2 = n3 + n1*(1.0f/9.0f) + n2*(4.0f/9.0f);
+		sp->alphabeta = (n1 + n2)*(2.0f/9.0f);
+		float32 det = sp->alpha2*sp->beta2 - sp->alphabeta*sp->alphabeta;
+		// all texels in the same endpoint's runs, no unique solution
+		if(det < 1.0e-4f)
+			continue;
+		sp->factor = 1.0f/det;
+		sp->i = i;
+		sp->j = j;
+		sp->k = k;
+		n++;
+	}
+	dxtNumSplits = n;
+}
+
+// Only for opaque blocks. Texels are sorted along the axis, for every
+// split the least squares endpoints are calculated, rounded to 565
+// and their error is calculated. The lanes are the color channels.
+static float32
+dxtClusterFit(uint8 *dst, uint8 (*blk)[4], float32 *mean, float32 *axis)
+{
+	using namespace simd;
+	int32 order[16];
+	float32 dots[16];
+	float32 sums[17][4];
+	float32 best[2][4];
+	float32 bestErr = 1.0e30f;
+	float32 e[4];
+	int32 i, j;
+
+	for(i = 0; i < 16; i++){
+		dots[i] = (blk[i][0]-mean[0])*axis[0] +
+			(blk[i][1]-mean[1])*axis[1] +
+			(blk[i][2]-mean[2])*axis[2];
+		for(j = i; j > 0 && dots[order[j-1]] > dots[i]; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+	memset(sums[0], 0, sizeof(sums[0]));
+	for(i = 0; i < 16; i++){
+		sums[i+1][0] = sums[i][0] + blk[order[i]][0];
+		sums[i+1][1] = sums[i][1] + blk[order[i]][1];
+		sums[i+1][2] = sums[i][2] + blk[order[i]][2];
+		sums[i+1][3] = 0.0f;
+	}
+
+	F4 total = load(sums[16]);
+	F4 twothirds = set1(2.0f/3.0f);
+	F4 onethird = set1(1.0f/3.0f);
+	F4 zero4 = zero();
+	F4 max255 = set1(255.0f);
+	F4 half = set1(0.5f);
+	F4 grid = set(31.0f/255.0f, 63.0f/255.0f, 31.0f/255.0f, 0.0f);
+	F4 gridinv = set(255.0f/31.0f, 255.0f/63.0f, 255.0f/31.0f, 0.0f);
+	F4 eps = set1(0.001f);
+	for(i = 0; i < dxtNumSplits; i++){
+		DXTClusterSplit *sp = &dxtSplits[i];
+		F4 si = load(sums[sp->i]);
+		F4 sj = load(sums[sp->j]);
+		F4 sk = load(sums[sp->k]);
+		F4 s1 = sub(sj, si);
+		F4 s2 = sub(sk, sj);
+		F4 ax = madd(s1, twothirds, madd(s2, onethird, si));
+		F4 bx = madd(s1, onethird, madd(s2, twothirds, sub(total, sk)));
+		F4 alpha2 = set1(sp->alpha2);
+		F4 beta2 = set1(sp->beta2);
+		F4 alphabeta = set1(sp->alphabeta);
+		F4 factor = set1(sp->factor);
+		F4 a = mul(sub(mul(ax, beta2), mul(bx, alphabeta)), factor);
+		F4 b = mul(sub(mul(bx, alpha2), mul(ax, alphabeta)), factor);
+		// round to what the decoder will see
+		a = min(max(a, zero4), max255);
+		b = min(max(b, zero4), max255);
+		a = tofloat(toint(madd(tofloat(toint(madd(a, grid, half))), gridinv, eps)));
+		b = tofloat(toint(madd(tofloat(toint(madd(b, grid, half))), gridinv, eps)));
+		F4 err = add(madd(mul(a, a), alpha2, mul(mul(b, b), beta2)),
+			mul(set1(2.0f), sub(mul(mul(a, b), alphabeta), add(mul(a, ax), mul(b, bx)))));
+		store(e, err);
+		float32 sum = e[0] + e[1] + e[2];
+		if(sum < bestErr){
+			bestErr = sum;
+			store(best[0], a);
+			store(best[1], b);
 		}
+	}
+	if(bestErr == 1.0e30f)
+		return 1.0e30f;
+	return dxtEncodeColors(dst, blk, 0xFFFF,
+		dxtQuantize(best[0][0], best[0][1], best[0][2]),
+		dxtQuantize(best[1][0], best[1][1], best[1][2]));
+}
 
-		a[0] = src[j+0];
-		a[1] = src[j+1];
-		if(a[0] > a[1]){
-			a[2] = (6*a[0] + 1*a[1])/7;
-			a[3] = (5*a[0] + 2*a[1])/7;
-			a[4] = (4*a[0] + 3*a[1])/7;
-			a[5] = (3*a[0] + 4*a[1])/7;
-			a[6] = (2*a[0] + 5*a[1])/7;
-			a[7] = (1*a[0] + 6*a[1])/7;
-		}else{
-			a[2] = (4*a[0] + 1*a[1])/5;
-			a[3] = (3*a[0] + 2*a[1])/5;
-			a[4] = (2*a[0] + 3*a[1])/5;
-			a[5] = (1*a[0] + 4*a[1])/5;
-			a[6] = 0;
-			a[7] = 0xFF;
+static void
+dxtEncodeColorBlock(uint8 *dst, uint8 (*blk)[4], uint32 mask, int32 quality)
+{
+	float32 mean[3], axis[3];
+	uint8 tmp[8];
+	dxtAxis(blk, mask, mean, axis);
+	float32 err = dxtRangeFit(dst, blk, mask, mean, axis);
+	if(quality == Image::DXTCLUSTERFIT && mask == 0xFFFF && err > 0.0f &&
+	   dxtClusterFit(tmp, blk, mean, axis) < err)
+		memcpy(dst, tmp, 8);
+}
+
+static void
+dxt3EncodeAlpha(uint8 *dst, uint8 (*blk)[4])
+{
+	for(int32 k = 0; k < 16; k += 2)
+		dst[k/2] = (blk[k][3]+8)/17 | ((blk[k+1][3]+8)/17)<<4;
+}
+
+static uint32
+dxt5AlphaIndices(uint8 (*blk)[4], uint32 *a, uint64 *bits)
+{
+	uint32 err = 0;
+	*bits = 0;
+	for(int32 k = 0; k < 16; k++){
+		uint32 best = 0, bestErr = ~0u;
+		for(uint32 i = 0; i < 8; i++){
+			int32 d = (int32)blk[k][3] - (int32)a[i];
+			if((uint32)(d*d) < bestErr){
+				bestErr = d*d;
+				best = i;
+			}
 		}
+		*bits |= (uint64)best << 3*k;
+		err += bestErr;
+	}
+	return err;
+}
 
-		/* make index list */
-		uint32 indices = *((uint32*)&src[j+12]);
-		for(int32 k = 0; k < 16; k++){
-			idx[k] = indices & 0x3;
-			indices >>= 2;
+// Try eight interpolated values between the extremes and, for better
+// quality, six values between the extremes other than 0 and 255.
+static void
+dxt5EncodeAlpha(uint8 *dst, uint8 (*blk)[4], int32 quality)
+{
+	uint32 a[8];
+	uint32 lo = 255, hi = 0, lo6 = 255, hi6 = 0;
+	uint64 bits, bits6;
+	for(int32 k = 0; k < 16; k++){
+		uint32 v = blk[k][3];
+		lo = v < lo ? v : lo;
+		hi = v > hi ? v : hi;
+		if(v != 0 && v != 255){
+			lo6 = v < lo6 ? v : lo6;
+			hi6 = v > hi6 ? v : hi6;
 		}
-		// only 6 indices
-		uint64 alphas = *((uint64*)&src[j+2]);
-		for(int32 k = 0; k < 16; k++){
-			aidx[k] = alphas & 0x7;
-			alphas >>= 3;
+	}
+	dxt5Alphas(a, hi, lo);
+	uint32 err = dxt5AlphaIndices(blk, a, &bits);
+	dst[0] = hi;
+	dst[1] = lo;
+	if(quality == Image::DXTCLUSTERFIT && err > 0){
+		if(lo6 > hi6)
+			lo6 = hi6 = 0;
+		dxt5Alphas(a, lo6, hi6);
+		if(dxt5AlphaIndices(blk, a, &bits6) < err){
+			bits = bits6;
+			dst[0] = lo6;
+			dst[1] = hi6;
 		}
+	}
+	for(int32 k = 2; k < 8; k++){
+		dst[k] = bits;
+		bits >>= 8;
+	}
+}
 
-		/* write bytes */
-		for(uint32 l = 0; l < 4; l++)
-			for(uint32 k = 0; k < 4; k++){
-				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
-				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
-				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
-				dst[(y+l)*w + x+k][3] = a[aidx[l*4+k]];
+// encode one row of blocks starting at pixel row y
+static void
+compressDXTRow(int32 type, int32 quality, uint8 *dst, int32 w, int32 h, int32 y, uint8 *src, int32 stride)
+{
+	uint8 blk[16][4];
+	for(int32 x = 0; x < w; x += 4){
+		// repeat the last row and column at the edges
+		for(int32 l = 0; l < 4; l++){
+			int32 sy = y+l < h ? y+l : h-1;
+			for(int32 k = 0; k < 4; k++){
+				int32 sx = x+k < w ? x+k : w-1;
+				memcpy(blk[l*4+k], &src[sy*stride + sx*4], 4);
 			}
-		x += 4;
-		if(x >= w){
-			y += 4;
-			x = 0;
+		}
+		if(type == 1){
+			uint32 mask = 0;
+			for(int32 k = 0; k < 16; k++)
+				if(blk[k][3] >= 128)
+					mask |= 1<<k;
+			dxtEncodeColorBlock(dst, blk, mask, quality);
+			dst += 8;
+		}else{
+			if(type == 3)
+				dxt3EncodeAlpha(dst, blk);
+			else
+				dxt5EncodeAlpha(dst, blk, quality);
+			dxtEncodeColorBlock(dst+8, blk, 0xFFFF, quality);
+			dst += 16;
 		}
 	}
 }
 
+struct DXTCompressJob
+{
+	int32 type;
+	int32 quality;
+	uint8 *dst;
+	int32 w, h;
+	uint8 *src;
+	int32 stride;
+	int32 numRows;
+};
+
+static void
+compressDXTJob(void *data, int32 i)
+{
+	DXTCompressJob *job = (DXTCompressJob*)data;
+	int32 dststride = getDXTSize(job->type, job->w, 4);
+	for(int32 row = i*DXTJOBROWS; row < (i+1)*DXTJOBROWS && row < job->numRows; row++)
+		compressDXTRow(job->type, job->quality, job->dst + row*dststride,
+		               job->w, job->h, row*4, job->src, job->stride);
+}
+
+void
+compressDXT(int32 type, int32 quality, uint8 *dst, int32 w, int32 h, uint8 *src, int32 stride)
+{
+	DXTCompressJob job;
+	job.type = type;
+	job.quality = quality;
+	job.dst = dst;
+	job.w = w;
+	job.h = h;
+	job.src = src;
+	job.stride = stride;
+	job.numRows = (h+3)/4;
+	dxtInitSplits();
+	parallelFor(compressDXTJob, &job, (job.numRows+DXTJOBROWS-1)/DXTJOBROWS);
+}
+
 // not strictly image but related
 
 // flip a DXT 2-bit block
@@ -548,17 +1084,380 @@ Image::setPixelsDXT(int32 type, uint8 *pixels)
 {
 	switch(type){
 	case 1:
-		decompressDXT1(this->pixels, this->width, this->height, pixels);
-		break;
 	case 3:
-		decompressDXT3(this->pixels, this->width, this->height, pixels);
-		break;
 	case 5:
-		decompressDXT5(this->pixels, this->width, this->height, pixels);
+		decompressDXT(type, this->pixels, this->width, this->height, pixels);
 		break;
 	}
 }
 
+uint8*
+Image::compressDXT(int32 type, int32 quality)
+{
+	Image *img = this;
+	if(this->depth != 32){
+		// convert a copy, don't change the original
+		img = Image::create(this->width, this->height, this->depth);
+		img->pixels = this->pixels;
+		img->stride = this->stride;
+		img->palette = this->palette;
+		img->convertTo32();
+	}
+	uint8 *dst = rwNewT(uint8, getDXTSize(type, this->width, this->height), MEMDUR_EVENT | ID_IMAGE);
+	if(dst)
+		rw::compressDXT(type, quality, dst, img->width, img->height, img->pixels, img->stride);
+	else
+		RWERROR((ERR_ALLOC, getDXTSize(type, this->width, this->height)));
+	if(img != this)
+		img->destroy();
+	return dst;
+}
+
+/*
+ * Mipmap generation.
+ * A level is resampled separably in floating point, first all source
+ * rows horizontally, then every destination row vertically. Both passes
+ * are spread over the job threads. The four channels of a texel are the
+ * four lanes of a vector. With sRGB the color channels are filtered in
+ * linear space, alpha always is.
+ */
+
+int32 Image::mipmapFilter = Image::MIPBOX;
+bool32 Image::mipmapSRGB = 0;
+int32 Image::mipmapAlphaRef = 0;
+
+#define MIPJOBROWS 16
+#define KAISERWIDTH 3.0f
+#define KAISERALPHA 4.0f
+
+static float32 srgbToLinear[256];
+static float32 srgbThresholds[256];	// linear value half way to the next code
+static uint8 srgbBuckets[4096];	// first code a linear bucket can round to
+static bool32 srgbTablesDone;
+
+static void
+initSRGBTables(void)
+{
+	int32 i, code;
+	if(srgbTablesDone)
+		return;
+	for(i = 0; i < 256; i++){
+		float32 c = i/255.0f;
+		srgbToLinear[i] = c <= 0.04045f ? c/12.92f : powf((c+0.055f)/1.055f, 2.4f);
+		c = (i+0.5f)/255.0f;
+		srgbThresholds[i] = i == 255 ? 2.0f :
+			c <= 0.04045f ? c/12.92f : powf((c+0.055f)/1.055f, 2.4f);
+	}
+	code = 0;
+	for(i = 0; i < 4096; i++){
+		while(srgbThresholds[code] < i/4096.0f)
+			code++;
+		srgbBuckets[i] = code;
+	}
+	srgbTablesDone = 1;
+}
+
+static uint8
+linearToSRGB(float32 l)
+{
+	int32 i = (int32)(l*4096.0f);
+	if(i <= 0) return 0;
+	if(i > 4095) return 255;
+	int32 c = srgbBuckets[i];
+	while(l > srgbThresholds[c])
+		c++;
+	return c;
+}
+
+static float32
+besselI0(float32 x)
+{
+	float32 sum = 1.0f, term = 1.0f;
+	for(int32 k = 1; k < 20; k++){
+		term *= x/(2.0f*k);
+		sum += term*term;
+	}
+	return sum;
+}
+
+static float32
+kaiser(float32 x)
+{
+	float32 t = x/KAISERWIDTH;
+	if(t <= -1.0f || t >= 1.0f)
+		return 0.0f;
+	float32 sinc = x == 0.0f ? 1.0f : sinf((float32)M_PI*x)/((float32)M_PI*x);
+	return sinc * besselI0(KAISERALPHA*sqrtf(1.0f-t*t))/besselI0(KAISERALPHA);
+}
+
+// Filter weights of one axis. Destination texel i sums up
+// num[i] source texels starting at first[i].
+struct MipAxis
+{
+	int32 *first;
+	int32 *num;
+	float32 *weights;	// maxTaps for every destination texel
+	int32 maxTaps;
+};
+
+static void
+makeMipAxis(MipAxis *axis, int32 filter, int32 src, int32 dst)
+{
+	float32 scale = (float32)src/dst;
+	float32 support = filter == Image::MIPKAISER ? KAISERWIDTH*scale : 0.5f*scale;
+	axis->maxTaps = (int32)ceilf(2.0f*support) + 3;
+	if(axis->maxTaps > src)
+		axis->maxTaps = src;
+	axis->first = rwNewT(int32, 2*dst, MEMDUR_FUNCTION | ID_IMAGE);
+	axis->num = axis->first + dst;
+	axis->weights = rwNewT(float32, dst*axis->maxTaps, MEMDUR_FUNCTION | ID_IMAGE);
+	memset(axis->weights, 0, dst*axis->maxTaps*sizeof(float32));
+	for(int32 i = 0; i < dst; i++){
+		float32 center = (i+0.5f)*scale;
+		int32 lo = (int32)floorf(center - support);
+		int32 hi = (int32)ceilf(center + support);
+		int32 first = lo < 0 ? 0 : lo;
+		int32 last = hi > src-1 ? src-1 : hi;
+		float32 *w = &axis->weights[i*axis->maxTaps];
+		float32 sum = 0.0f;
+		for(int32 s = lo; s <= hi; s++){
+			float32 f;
+			if(filter == Image::MIPKAISER)
+				f = kaiser((s+0.5f-center)/scale);
+			else{
+				// overlap of the texel with the box
+				float32 a = center-support > s ? center-support : s;
+				float32 b = center+support < s+1 ? center+support : s+1;
+				f = b > a ? b-a : 0.0f;
+			}
+			// clamp to edge
+			int32 t = s < first ? first : s > last ? last : s;
+			w[t-first] += f;
+			sum += f;
+		}
+		// drop taps that don't contribute
+		int32 skip = 0;
+		while(first+skip < last && w[skip] == 0.0f)
+			skip++;
+		while(last > first+skip && w[last-first] == 0.0f)
+			last--;
+		for(int32 s = skip; s <= last-first; s++)
+			w[s-skip] = w[s]/sum;
+		axis->first[i] = first+skip;
+		axis->num[i] = last-first-skip+1;
+	}
+}
+
+struct MipJob
+{
+	uint8 *src;
+	int32 srcw, srch, srcstride;
+	Image *dst;
+	float32 *tmp;	// horizontally filtered rows, srch x dstw texels
+	float32 *rows;	// one source row per job, jobs don't allocate
+	MipAxis ax, ay;
+	bool32 srgb;
+};
+
+static void
+mipHorizontalJob(void *data, int32 i)
+{
+	using namespace simd;
+	MipJob *job = (MipJob*)data;
+	int32 dstw = job->dst->width;
+	float32 *row = job->rows + i*job->srcw*4;
+	for(int32 y = i*MIPJOBROWS; y < (i+1)*MIPJOBROWS && y < job->srch; y++){
+		uint8 *in = job->src + y*job->srcstride;
+		if(job->srgb)
+			for(int32 x = 0; x < job->srcw; x++, in += 4)
+				store(&row[x*4], set(srgbToLinear[in[0]], srgbToLinear[in[1]],
+					srgbToLinear[in[2]], in[3]/255.0f));
+		else
+			for(int32 x = 0; x < job->srcw; x++, in += 4)
+				store(&row[x*4], mul(set(in[0], in[1], in[2], in[3]), set1(1.0f/255.0f)));
+		float32 *out = job->tmp + y*dstw*4;
+		for(int32 x = 0; x < dstw; x++){
+			float32 *w = &job->ax.weights[x*job->ax.maxTaps];
+			float32 *t = &row[job->ax.first[x]*4];
+			F4 sum = zero();
+			for(int32 k = 0; k < job->ax.num[x]; k++)
+				sum = madd(load(t + k*4), set1(w[k]), sum);
+			store(out + x*4, sum);
+		}
+	}
+}
+
+static void
+mipVerticalJob(void *data, int32 i)
+{
+	using namespace simd;
+	MipJob *job = (MipJob*)data;
+	Image *dst = job->dst;
+	int32 dstw = dst->width;
+	F4 zero4 = zero();
+	F4 one = set1(1.0f);
+	F4 max255 = set1(255.0f);
+	F4 half = set1(0.5f);
+	int32 c[4];
+	float32 f[4];
+	for(int32 y = i*MIPJOBROWS; y < (i+1)*MIPJOBROWS && y < dst->height; y++){
+		float32 *w = &job->ay.weights[y*job->ay.maxTaps];
+		float32 *rows = job->tmp + job->ay.first[y]*dstw*4;
+		int32 num = job->ay.num[y];
+		uint8 *out = dst->pixels + y*dst->stride;
+		for(int32 x = 0; x < dstw; x++, out += 4){
+			F4 sum = zero();
+			for(int32 k = 0; k < num; k++)
+				sum = madd(load(rows + (k*dstw + x)*4), set1(w[k]), sum);
+			sum = min(max(sum, zero4), one);
+			if(job->srgb){
+				store(f, sum);
+				out[0] = linearToSRGB(f[0]);
+				out[1] = linearToSRGB(f[1]);
+				out[2] = linearToSRGB(f[2]);
+				out[3] = (uint8)(f[3]*255.0f + 0.5f);
+			}else{
+				storei(c, toint(madd(sum, max255, half)));
+				out[0] = c[0];
+				out[1] = c[1];
+				out[2] = c[2];
+				out[3] = c[3];
+			}
+		}
+	}
+}
+
+Image*
+Image::createMipmap(int32 filter, bool32 srgb)
+{
+	Image *img = this;
+	if(this->depth != 32){
+		// convert a copy, don't change the original
+		img = Image::create(this->width, this->height, this->depth);
+		img->pixels = this->pixels;
+		img->stride = this->stride;
+		img->palette = this->palette;
+		img->convertTo32();
+	}
+
+	MipJob job;
+	int32 numJobs = (img->height+MIPJOBROWS-1)/MIPJOBROWS;
+	job.src = img->pixels;
+	job.srcw = img->width;
+	job.srch = img->height;
+	job.srcstride = img->stride;
+	job.srgb = srgb;
+	job.dst = Image::create(this->width > 1 ? this->width/2 : 1,
+		this->height > 1 ? this->height/2 : 1, 32);
+	job.dst->allocate();
+	job.tmp = rwNewT(float32, job.srch*job.dst->width*4, MEMDUR_FUNCTION | ID_IMAGE);
+	job.rows = rwNewT(float32, numJobs*job.srcw*4, MEMDUR_FUNCTION | ID_IMAGE);
+	if(job.tmp == nil || job.rows == nil){
+		RWERROR((ERR_ALLOC, (job.srch*job.dst->width + numJobs*job.srcw)*4*sizeof(float32)));
+		rwFree(job.tmp);
+		rwFree(job.rows);
+		job.dst->destroy();
+		job.dst = nil;
+		goto out;
+	}
+	makeMipAxis(&job.ax, filter, job.srcw, job.dst->width);
+	makeMipAxis(&job.ay, filter, job.srch, job.dst->height);
+	if(srgb)
+		initSRGBTables();
+
+	parallelFor(mipHorizontalJob, &job, numJobs);
+	parallelFor(mipVerticalJob, &job, (job.dst->height+MIPJOBROWS-1)/MIPJOBROWS);
+
+	rwFree(job.tmp);
+	rwFree(job.rows);
+	rwFree(job.ax.first);
+	rwFree(job.ax.weights);
+	rwFree(job.ay.first);
+	rwFree(job.ay.weights);
+out:
+	if(img != this)
+		img->destroy();
+	return job.dst;
+}
+
+// Fraction of texels that pass an alpha test against alphaRef
+float32
+Image::getAlphaCoverage(int32 alphaRef)
+{
+	if(this->depth != 32)
+		return 1.0f;
+	int32 n = 0;
+	for(int32 y = 0; y < this->height; y++){
+		uint8 *p = this->pixels + y*this->stride;
+		for(int32 x = 0; x < this->width; x++)
+			n += p[x*4+3] >= alphaRef;
+	}
+	return (float32)n/(this->width*this->height);
+}
+
+// Scale alpha so that the given fraction of texels passes an alpha test
+// against alphaRef. Alpha tested textures otherwise fade away with
+// smaller mip levels.
+void
+Image::scaleAlphaCoverage(int32 alphaRef, float32 coverage)
+{
+	int32 hist[256];
+	int32 x, y, t, n;
+	if(this->depth != 32 || alphaRef <= 0)
+		return;
+	memset(hist, 0, sizeof(hist));
+	for(y = 0; y < this->height; y++){
+		uint8 *p = this->pixels + y*this->stride;
+		for(x = 0; x < this->width; x++)
+			hist[p[x*4+3]]++;
+	}
+	// find the threshold t that lets the closest number of texels pass
+	int32 target = (int32)(coverage*this->width*this->height + 0.5f);
+	int32 best = 255, bestDiff = 0x7FFFFFFF;
+	n = 0;
+	for(t = 255; t >= 1; t--){
+		n += hist[t];
+		int32 diff = n > target ? n-target : target-n;
+		if(diff < bestDiff){
+			bestDiff = diff;
+			best = t;
+		}
+	}
+	if(best == alphaRef)
+		return;
+	// t maps to at least alphaRef, t-1 to less
+	float32 scale = alphaRef/(best-0.5f);
+	uint8 map[256];
+	for(t = 0; t < 256; t++){
+		int32 a = (int32)(t*scale);
+		map[t] = a > 255 ? 255 : a;
+	}
+	for(y = 0; y < this->height; y++){
+		uint8 *p = this->pixels + y*this->stride;
+		for(x = 0; x < this->width; x++)
+			p[x*4+3] = map[p[x*4+3]];
+	}
+}
+
+int32
+Image::generateMipmaps(Image **levels, int32 maxLevels, int32 filter, bool32 srgb, int32 alphaRef)
+{
+	float32 coverage = 0.0f;
+	if(alphaRef > 0)
+		coverage = this->getAlphaCoverage(alphaRef);
+	Image *img = this;
+	int32 n;
+	for(n = 0; n < maxLevels && (img->width > 1 || img->height > 1); n++){
+		img = img->createMipmap(filter, srgb);
+		if(img == nil)
+			break;
+		if(alphaRef > 0)
+			img->scaleAlphaCoverage(alphaRef, coverage);
+		levels[n] = img;
+	}
+	return n;
+}
+
 void
 Image::setPalette(uint8 *palette)
 {
@@ -630,7 +1529,6 @@ Image::convertTo32(void)
 	int32 newstride = this->width*4;
 	uint8 *newpixels;
 
-	void (*fun)(uint8 *out, uint8 *in) = nil;
 	switch(this->depth){
 	case 4:
 	case 8:
@@ -638,28 +1536,15 @@ Image::convertTo32(void)
 		this->unpalettize(true);
 		return;
 	case 16:
-		fun = conv_RGBA8888_from_ARGB1555;
-		break;
 	case 24:
-		fun = conv_RGBA8888_from_RGB888;
 		break;
 	default:
 		return;
 	}
+	ConvRowFunc fun = getConvRow(CONVFMT_RGBA8888, getImageConvFormat(this));
 
 	newpixels = rwNewT(uint8, newstride*this->height, MEMDUR_EVENT | ID_IMAGE);
-	uint8 *pixels32 = newpixels;
-	for(int y = 0; y < this->height; y++){
-		uint8 *line = pixels;
-		uint8 *newline = newpixels;
-		for(int x = 0; x < this->width; x++){
-			fun(newline, line);
-			line += this->bpp;
-			newline += 4;
-		}
-		pixels += this->stride;
-		newpixels += newstride;
-	}
+	convertPixels(newpixels, newstride, pixels, this->stride, this->width, this->height, fun);
 
 	this->free();
 	this->depth = 32;
@@ -667,11 +1552,11 @@ Image::convertTo32(void)
 	this->stride = newstride;
 	this->pixels = nil;
 	this->palette = nil;
-	this->setPixels(pixels32);
+	this->setPixels(newpixels);
 }
 
 void
-Image::palettize(int32 depth)
+Image::palettize(int32 depth, bool32 dither)
 {
 	RGBA colors[256];
 	ColorQuant quant;
@@ -685,8 +1570,7 @@ Image::palettize(int32 depth)
 
 	newstride = this->width;
 	newpixels = rwNewT(uint8, newstride*this->height, MEMDUR_EVENT | ID_IMAGE);
-	// TODO: maybe do floyd-steinberg dithering?
-	quant.matchImage(newpixels, newstride, this);
+	quant.matchImage(newpixels, newstride, this, dither);
 
 	this->free();
 	this->depth = depth;
@@ -894,11 +1778,115 @@ Image::extractMask(void)
 	return img;
 }
 
+/*
+ * Directory listings of the search paths are cached so file names
+ * can be resolved without touching the file system. Files are found
+ * case-insensitively by their name with extension.
+ */
+
+static uint32
+hashNameCI(const char *s)
+{
+	uint32 h = 2166136261u;
+	for(; *s; s++){
+		h ^= tolower((uint8)*s);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+struct DirListing
+{
+	char **names;
+	int32 num;
+	int32 max;
+};
+
+static void
+addDirEntry(const char *name, void *data)
+{
+	DirListing *l = (DirListing*)data;
+	if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return;
+	if(l->num >= l->max){
+		l->max = l->max ? l->max*2 : 64;
+		l->names = rwResizeT(char*, l->names, l->max, MEMDUR_FUNCTION | ID_IMAGE);
+	}
+	l->names[l->num++] = rwStrdup(name, MEMDUR_EVENT | ID_IMAGE);
+}
+
+static void
+freeDirCache(DirCache *c)
+{
+	if(c->names){
+		for(uint32 i = 0; i <= c->mask; i++)
+			rwFree(c->names[i]);
+		rwFree(c->names);
+	}
+	c->names = nil;
+	c->mask = 0;
+}
+
+static void
+buildDirCache(DirCache *c)
+{
+	DirListing l = { nil, 0, 0 };
+	freeDirCache(c);
+	if(engine->filefuncs.rwlistdir == nil ||
+	   !engine->filefuncs.rwlistdir(c->path, addDirEntry, &l)){
+		for(int32 i = 0; i < l.num; i++)
+			rwFree(l.names[i]);
+		rwFree(l.names);
+		return;
+	}
+	uint32 size = 16;
+	while(size < (uint32)l.num*2)
+		size *= 2;
+	c->mask = size-1;
+	c->names = rwNewT(char*, size, MEMDUR_EVENT | ID_IMAGE);
+	memset(c->names, 0, size*sizeof(char*));
+	for(int32 i = 0; i < l.num; i++){
+		uint32 j = hashNameCI(l.names[i]) & c->mask;
+		while(c->names[j] && strcmp_ci(c->names[j], l.names[i]) != 0)
+			j = (j+1) & c->mask;
+		// keep the first of names that only differ in case
+		if(c->names[j])
+			rwFree(l.names[i]);
+		else
+			c->names[j] = l.names[i];
+	}
+	rwFree(l.names);
+}
+
+static const char*
+findInDirCache(DirCache *c, const char *name)
+{
+	uint32 j = hashNameCI(name) & c->mask;
+	while(c->names[j]){
+		if(strcmp_ci(c->names[j], name) == 0)
+			return c->names[j];
+		j = (j+1) & c->mask;
+	}
+	return nil;
+}
+
+static void
+freeDirCaches(ImageGlobals *g)
+{
+	for(int i = 0; i < g->numSearchPaths; i++){
+		freeDirCache(&g->dirCaches[i]);
+		rwFree(g->dirCaches[i].path);
+	}
+	rwFree(g->dirCaches);
+	g->dirCaches = nil;
+}
+
 void
 Image::setSearchPath(const char *path)
 {
 	char *p, *end;
 	ImageGlobals *g = PLUGINOFFSET(ImageGlobals, engine, imageModuleOffset);
+	freeDirCaches(g);
 	rwFree(g->searchPaths);
 	g->numSearchPaths = 0;
 	if(path)
@@ -914,6 +1902,36 @@ Image::setSearchPath(const char *path)
 		g->numSearchPaths++;
 		p = end;
 	}
+
+	g->dirCaches = rwNewT(DirCache, g->numSearchPaths, MEMDUR_EVENT | ID_IMAGE);
+	p = g->searchPaths;
+	for(int i = 0; i < g->numSearchPaths; i++){
+		DirCache *c = &g->dirCaches[i];
+		size_t len = strlen(p);
+		c->names = nil;
+		c->mask = 0;
+		c->path = nil;
+		// paths are prepended to file names, so only directories can be listed
+		if(len == 0 || p[len-1] == '/' || p[len-1] == '\\'){
+			c->path = rwNewT(char, len+2, MEMDUR_EVENT | ID_IMAGE);
+			strcpy(c->path, p);
+			makePath(c->path);
+			len = strlen(c->path);
+			if(len > 0 && c->path[len-1] != '/' && c->path[len-1] != '\\')
+				strcat(c->path, "/");
+			buildDirCache(c);
+		}
+		p += strlen(p) + 1;
+	}
+}
+
+void
+Image::invalidateSearchPathCache(void)
+{
+	ImageGlobals *g = PLUGINOFFSET(ImageGlobals, engine, imageModuleOffset);
+	for(int i = 0; i < g->numSearchPaths; i++)
+		if(g->dirCaches[i].path)
+			buildDirCache(&g->dirCaches[i]);
 }
 
 void
@@ -945,8 +1963,26 @@ Image::getFilename(const char *name)
 		}
 		rwFree(s);
 		return nil;
-	}else
-		for(int i = 0; i < g->numSearchPaths; i++){
+	}else{
+		// names with directories have to be probed
+		bool32 plainName = strpbrk(name, "/\\") == nil;
+		for(int i = 0; i < g->numSearchPaths; i++, p += strlen(p) + 1){
+			DirCache *c = &g->dirCaches[i];
+			if(plainName && c->names){
+				const char *file = findInDirCache(c, name);
+				if(file == nil)
+					continue;
+				s = (char*)rwMalloc(strlen(c->path)+strlen(file)+1, MEMDUR_EVENT | ID_IMAGE);
+				if(s == nil){
+					RWERROR((ERR_ALLOC, strlen(c->path)+strlen(file)+1));
+					return nil;
+				}
+				strcpy(s, c->path);
+				strcat(s, file);
+				printf("found %s\n", name);
+				return s;
+			}
+
 			s = (char*)rwMalloc(strlen(p)+len, MEMDUR_EVENT | ID_IMAGE);
 			if(s == nil){
 				RWERROR((ERR_ALLOC, strlen(p)+len));
@@ -962,8 +1998,8 @@ Image::getFilename(const char *name)
 				return s;
 			}
 			rwFree(s);
-			p += strlen(p) + 1;
 		}
+	}
 	return nil;
 }
 
@@ -1041,6 +2077,7 @@ imageOpen(void *object, int32 offset, int32 size)
 	ImageGlobals *g = PLUGINOFFSET(ImageGlobals, engine, imageModuleOffset);
 	g->searchPaths = nil;
 	g->numSearchPaths = 0;
+	g->dirCaches = nil;
 	g->numFileFormats = 0;
 	return object;
 }
@@ -1050,6 +2087,7 @@ imageClose(void *object, int32 offset, int32 size)
 {
 	ImageGlobals *g = PLUGINOFFSET(ImageGlobals, engine, imageModuleOffset);
 	int i;
+	freeDirCaches(g);
 	rwFree(g->searchPaths);
 	g->searchPaths = nil;
 	g->numSearchPaths = 0;
@@ -1071,6 +2109,18 @@ Image::registerModule(void)
  * Color Quantization
  */
 
+// Nodes are allocated in blocks, freed nodes are kept for reuse
+#define QUANTBLOCKSIZE 1024
+// Direct mapped caches of exact colors
+#define QUANTCACHESIZE 4096
+
+struct ColorQuant::NodeBlock
+{
+	NodeBlock *next;
+	int32 numUsed;
+	Node nodes[QUANTBLOCKSIZE];
+};
+
 // An address for a single level is 4 bits.
 // Since we have 8 bpp that is 32 bits to address any tree node.
 // The lower bits address the higher level tree nodes.
@@ -1098,23 +2148,53 @@ makeTreeAddr(RGBA color)
 	return addr;
 }
 
-void
-ColorQuant::Node::destroy(void)
+static uint32
+quantHash(uint32 color)
 {
-	int i;
-	for(i = 0; i < 16; i++)
-		if(this->children[i])
-			this->children[i]->destroy();
-	if(this->link.next)
-		this->link.remove();
-	rwFree(this);
+	return (color * 2654435761u) >> 20;	// 12 bits
+}
+
+// Convert one row of any depth to RGBA8888
+static void
+quantConvertRow(uint8 *dst, Image *img, int32 y)
+{
+	uint8 *p = img->pixels + y*img->stride;
+	int32 x;
+	switch(img->depth){
+	case 4: case 8:
+		for(x = 0; x < img->width; x++)
+			memcpy(&dst[x*4], &img->palette[p[x]*4], 4);
+		break;
+	case 32:
+		memcpy(dst, p, img->width*4);
+		break;
+	case 24:
+		convRow_RGBA8888_from_RGB888(dst, p, img->width);
+		break;
+	case 16:
+		convRow_RGBA8888_from_ARGB1555(dst, p, img->width);
+		break;
+	default: assert(0 && "invalid depth");
+	}
 }
 
 ColorQuant::Node*
 ColorQuant::createNode(int32 level)
 {
 	int i;
-	ColorQuant::Node *node = rwNewT(ColorQuant::Node, 1, MEMDUR_EVENT | ID_IMAGE);
+	ColorQuant::Node *node;
+	if(this->freeNodes){
+		node = this->freeNodes;
+		this->freeNodes = node->parent;
+	}else{
+		if(this->blocks == nil || this->blocks->numUsed == QUANTBLOCKSIZE){
+			NodeBlock *blk = rwNewT(NodeBlock, 1, MEMDUR_FUNCTION | ID_IMAGE);
+			blk->next = this->blocks;
+			blk->numUsed = 0;
+			this->blocks = blk;
+		}
+		node = &this->blocks->nodes[this->blocks->numUsed++];
+	}
 	node->parent = nil;
 	for(i = 0; i < 16; i++)
 		node->children[i] = nil;
@@ -1125,12 +2205,29 @@ ColorQuant::createNode(int32 level)
 	node->numPixels = 0;
 	node->link.init();
 
-	if(level == 0)
+	if(level == 0){
 		this->leaves.append(&node->link);
+		this->numLeaves++;
+	}
 
 	return node;
 }
 
+void
+ColorQuant::destroyNode(Node *node)
+{
+	int i;
+	for(i = 0; i < 16; i++)
+		if(node->children[i])
+			this->destroyNode(node->children[i]);
+	if(node->link.next){
+		node->link.remove();
+		this->numLeaves--;
+	}
+	node->parent = this->freeNodes;
+	this->freeNodes = node;
+}
+
 ColorQuant::Node*
 ColorQuant::getNode(ColorQuant::Node *root, uint32 addr, int32 level)
 {
@@ -1171,12 +2268,13 @@ ColorQuant::reduceNode(Node *node)
 			node->b += node->children[i]->b;
 			node->a += node->children[i]->a;
 			node->numPixels += node->children[i]->numPixels;
-			node->children[i]->destroy();
+			this->destroyNode(node->children[i]);
 			node->children[i] = nil;
 		}
 	assert(node->link.next == nil);
 	assert(node->link.prev == nil);
 	this->leaves.append(&node->link);
+	this->numLeaves++;
 }
 
 void
@@ -1193,13 +2291,24 @@ void
 ColorQuant::init(void)
 {
 	this->leaves.init();
+	this->numLeaves = 0;
+	this->blocks = nil;
+	this->freeNodes = nil;
+	this->numColors = 0;
 	this->root = this->createNode(QUANTDEPTH);
 }
 
 void
 ColorQuant::destroy(void)
 {
-	this->root->destroy();
+	NodeBlock *blk, *next;
+	for(blk = this->blocks; blk; blk = next){
+		next = blk->next;
+		rwFree(blk);
+	}
+	this->blocks = nil;
+	this->freeNodes = nil;
+	this->root = nil;
 }
 
 void
@@ -1218,46 +2327,42 @@ ColorQuant::findColor(RGBA color)
 	return node->numPixels;
 }
 
+struct QuantNodeCache
+{
+	uint32 color;
+	ColorQuant::Node *node;
+};
+
 void
 ColorQuant::addImage(Image *img)
 {
 	RGBA col;
-	uint8 rgba[4];
-	uint8 *pixels = img->pixels;
+	uint8 *row = rwNewT(uint8, img->width*4, MEMDUR_FUNCTION | ID_IMAGE);
+	// leaves don't change while adding so they can be cached
+	QuantNodeCache *cache = rwNewT(QuantNodeCache, QUANTCACHESIZE, MEMDUR_FUNCTION | ID_IMAGE);
+	memset(cache, 0, QUANTCACHESIZE*sizeof(QuantNodeCache));
 	for(int y = 0; y < img->height; y++){
-		uint8 *line = pixels;
+		quantConvertRow(row, img, y);
 		for(int x = 0; x < img->width; x++){
-			uint8 *p = line;
-			switch(img->depth){
-			case 4: case 8:
-				conv_RGBA8888_from_RGBA8888(rgba, &img->palette[p[0]*4]);
-				break;
-			case 32:
-				conv_RGBA8888_from_RGBA8888(rgba, p);
-				break;
-			case 24:
-				conv_RGBA8888_from_RGB888(rgba, p);
-				break;
-			case 16:
-				conv_RGBA8888_from_ARGB1555(rgba, p);
-				break;
-			default: assert(0 && "invalid depth");
+			uint32 c;
+			memcpy(&c, &row[x*4], 4);
+			QuantNodeCache *e = &cache[quantHash(c)];
+			memcpy(&col, &row[x*4], 4);
+			if(e->node == nil || e->color != c){
+				e->color = c;
+				e->node = this->getNode(root, makeTreeAddr(col), QUANTDEPTH);
 			}
-			col.red = rgba[0];
-			col.green = rgba[1];
-			col.blue = rgba[2];
-			col.alpha = rgba[3];
-			this->addColor(col);
-			line += img->bpp;
+			e->node->addColor(col);
 		}
-		pixels += img->stride;
 	}
+	rwFree(cache);
+	rwFree(row);
 }
 
 void
 ColorQuant::makePalette(int32 numColors, RGBA *colors)
 {
-	while(this->leaves.count() > numColors){
+	while(this->numLeaves > numColors){
 		Node *n = LLLinkGetData(this->leaves.link.next, Node, link);
 		this->reduceNode(n->parent);
 	}
@@ -1273,50 +2378,109 @@ ColorQuant::makePalette(int32 numColors, RGBA *colors)
 		colors[i].green = n->g;
 		colors[i].blue = n->b;
 		colors[i].alpha = n->a;
+		this->palette[i] = colors[i];
 		n->numPixels = i++;
 	}
+	this->numColors = i;
+}
+
+// Palette as structure of arrays, padded to a multiple of 4
+// with colors that are never closest.
+struct QuantPalette
+{
+	float32 r[256], g[256], b[256], a[256];
+	int32 num;
+};
+
+static int32
+quantNearest(QuantPalette *pal, uint8 *c)
+{
+	using namespace simd;
+	F4 r = set1(c[0]);
+	F4 g = set1(c[1]);
+	F4 b = set1(c[2]);
+	F4 a = set1(c[3]);
+	F4 best = set1(1.0e30f);
+	F4 bestIdx = zero();
+	F4 idx = set(0.0f, 1.0f, 2.0f, 3.0f);
+	F4 four = set1(4.0f);
+	for(int32 i = 0; i < pal->num; i += 4){
+		F4 dr = sub(load(&pal->r[i]), r);
+		F4 dg = sub(load(&pal->g[i]), g);
+		F4 db = sub(load(&pal->b[i]), b);
+		F4 da = sub(load(&pal->a[i]), a);
+		F4 d = madd(dr, dr, madd(dg, dg, madd(db, db, mul(da, da))));
+		F4 closer = cmplt(d, best);
+		best = select(closer, d, best);
+		bestIdx = select(closer, idx, bestIdx);
+		idx = add(idx, four);
+	}
+	float32 e[4], ei[4];
+	store(e, best);
+	store(ei, bestIdx);
+	int32 k = 0;
+	for(int32 j = 1; j < 4; j++)
+		if(e[j] < e[k] || (e[j] == e[k] && ei[j] < ei[k]))
+			k = j;
+	return (int32)ei[k];
 }
 
 void
-ColorQuant::matchImage(uint8 *dstPixels, uint32 dstStride, Image *img)
+ColorQuant::matchImage(uint8 *dstPixels, uint32 dstStride, Image *img, bool32 dither)
 {
-	RGBA col;
-	uint8 rgba[4];
-	uint8 *pixels = img->pixels;
+	static const int8 bayer[4][4] = {
+		{  0,  8,  2, 10 },
+		{ 12,  4, 14,  6 },
+		{  3, 11,  1,  9 },
+		{ 15,  7, 13,  5 }
+	};
+	QuantPalette *pal = rwNewT(QuantPalette, 1, MEMDUR_FUNCTION | ID_IMAGE);
+	int32 i;
+	for(i = 0; i < this->numColors; i++){
+		pal->r[i] = this->palette[i].red;
+		pal->g[i] = this->palette[i].green;
+		pal->b[i] = this->palette[i].blue;
+		pal->a[i] = this->palette[i].alpha;
+	}
+	pal->num = (this->numColors+3) & ~3;
+	for(; i < pal->num; i++){
+		pal->r[i] = pal->g[i] = pal->b[i] = 1.0e10f;
+		pal->a[i] = 0.0f;
+	}
+	// dither strength relative to the distance of palette colors
+	int32 spread = this->numColors <= 16 ? 48 : 24;
+
+	uint32 *cacheColors = rwNewT(uint32, QUANTCACHESIZE, MEMDUR_FUNCTION | ID_IMAGE);
+	int16 *cacheIndices = rwNewT(int16, QUANTCACHESIZE, MEMDUR_FUNCTION | ID_IMAGE);
+	for(i = 0; i < QUANTCACHESIZE; i++)
+		cacheIndices[i] = -1;
+	uint8 *row = rwNewT(uint8, img->width*4, MEMDUR_FUNCTION | ID_IMAGE);
 	for(int y = 0; y < img->height; y++){
-		uint8 *line = pixels;
-		uint8 *dline = dstPixels;
+		quantConvertRow(row, img, y);
+		if(dither)
+			for(int x = 0; x < img->width; x++){
+				int32 d = (bayer[y&3][x&3]*2 - 15) * spread / 32;
+				for(int32 j = 0; j < 3; j++){
+					int32 c = row[x*4+j] + d;
+					row[x*4+j] = c < 0 ? 0 : c > 255 ? 255 : c;
+				}
+			}
+		uint8 *d = dstPixels + y*dstStride;
 		for(int x = 0; x < img->width; x++){
-			uint8 *p = line;
-			uint8 *d = dline;
-			switch(img->depth){
-			case 4: case 8:
-				conv_RGBA8888_from_RGBA8888(rgba, &img->palette[p[0]*4]);
-				break;
-			case 32:
-				conv_RGBA8888_from_RGBA8888(rgba, p);
-				break;
-			case 24:
-				conv_RGBA8888_from_RGB888(rgba, p);
-				break;
-			case 16:
-				conv_RGBA8888_from_ARGB1555(rgba, p);
-				break;
-			default: assert(0 && "invalid depth");
+			uint32 c;
+			memcpy(&c, &row[x*4], 4);
+			uint32 h = quantHash(c);
+			if(cacheIndices[h] < 0 || cacheColors[h] != c){
+				cacheColors[h] = c;
+				cacheIndices[h] = quantNearest(pal, &row[x*4]);
 			}
-			
-			col.red = rgba[0];
-			col.green = rgba[1];
-			col.blue = rgba[2];
-			col.alpha = rgba[3];
-			*d = this->findColor(col);
-
-			line += img->bpp;
-			dline++;
+			d[x] = cacheIndices[h];
 		}
-		pixels += img->stride;
-		dstPixels += dstStride;
 	}
+	rwFree(row);
+	rwFree(cacheIndices);
+	rwFree(cacheColors);
+	rwFree(pal);
 }
 
 
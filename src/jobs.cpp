@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#ifndef RW_PS2
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#define RW_JOBTHREADS
+#endif
+
+#define PLUGIN_ID 0
+
+namespace rw {
+
+static void
+serialParallelFor(JobFunc func, void *data, int32 n)
+{
+	for(int32 i = 0; i < n; i++)
+		func(data, i);
+}
+
+static int32
+serialGetNumThreads(void)
+{
+	return 1;
+}
+
+JobFunctions serialJobfuncs = {
+	serialParallelFor,
+	serialGetNumThreads
+};
+
+JobFunctions Engine::jobfuncs = {
+	serialParallelFor,
+	serialGetNumThreads
+};
+
+#ifdef RW_JOBTHREADS
+
+/*
+ * A simple pool of worker threads. All threads, including the caller,
+ * pull job indices from one shared counter until none are left,
+ * so threads that finish early just take more of the remaining work.
+ * Only one batch is in flight at a time; parallelFor calls from inside
+ * a job or from a second thread while a batch runs are done serially.
+ */
+
+enum { MAXJOBTHREADS = 64 };
+
+struct JobBatch
+{
+	JobFunc func;
+	void *data;
+	int32 numJobs;
+	std::atomic<int32> nextJob;
+};
+
+struct JobPool
+{
+	std::mutex mutex;
+	std::mutex callerMutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::thread threads[MAXJOBTHREADS];
+	int32 numThreads;	// worker threads, not including the caller
+	bool started;
+	bool quit;
+
+	// only changed with mutex held
+	JobBatch *batch;
+	uint32 generation;
+	int32 numBusy;
+
+	~JobPool(void) { termJobThreads(); }
+};
+static JobPool pool;
+static thread_local bool inJob;
+
+static void
+runJobs(JobBatch *batch)
+{
+	int32 i;
+	inJob = true;
+	while(i = batch->nextJob.fetch_add(1), i < batch->numJobs)
+		batch->func(batch->data, i);
+	inJob = false;
+}
+
+static void
+workerMain(void)
+{
+	JobBatch *batch;
+	uint32 seen = 0;
+
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	for(;;){
+		while(!pool.quit && pool.generation == seen)
+			pool.wake.wait(lock);
+		if(pool.quit)
+			return;
+		seen = pool.generation;
+		// we may have woken up too late
+		batch = pool.batch;
+		if(batch == nil)
+			continue;
+		// the caller won't return before we're done with the batch
+		pool.numBusy++;
+		lock.unlock();
+
+		runJobs(batch);
+
+		lock.lock();
+		if(--pool.numBusy == 0)
+			pool.done.notify_all();
+	}
+}
+
+static void
+startThreads(void)
+{
+	int32 n;
+	if(pool.started)
+		return;
+	n = std::thread::hardware_concurrency();
+	n = n > 1 ? n-1 : 0;
+	if(n > MAXJOBTHREADS)
+		n = MAXJOBTHREADS;
+	pool.quit = false;
+	pool.batch = nil;
+	pool.generation = 0;
+	pool.numBusy = 0;
+	pool.numThreads = n;
+	for(int32 i = 0; i < n; i++)
+		pool.threads[i] = std::thread(workerMain);
+	pool.started = true;
+}
+
+static void
+threadedParallelFor(JobFunc func, void *data, int32 n)
+{
+	if(n <= 1 || inJob){
+		serialParallelFor(func, data, n);
+		return;
+	}
+	std::unique_lock<std::mutex> caller(pool.callerMutex, std::try_to_lock);
+	if(!caller.owns_lock()){
+		serialParallelFor(func, data, n);
+		return;
+	}
+	startThreads();
+	if(pool.numThreads == 0){
+		serialParallelFor(func, data, n);
+		return;
+	}
+
+	JobBatch batch;
+	batch.func = func;
+	batch.data = data;
+	batch.numJobs = n;
+	batch.nextJob = 0;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.batch = &batch;
+		pool.generation++;
+	}
+	pool.wake.notify_all();
+
+	// help out
+	runJobs(&batch);
+
+	// all jobs are taken now, wait for the ones still running
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	while(pool.numBusy > 0)
+		pool.done.wait(lock);
+	pool.batch = nil;
+}
+
+// Threads a parallelFor from here would use. Jobs and callers
+// that find a batch in flight run serially.
+static int32
+threadedGetNumThreads(void)
+{
+	if(inJob)
+		return 1;
+	std::unique_lock<std::mutex> caller(pool.callerMutex, std::try_to_lock);
+	if(!caller.owns_lock())
+		return 1;
+	startThreads();
+	return pool.numThreads+1;
+}
+
+JobFunctions threadedJobfuncs = {
+	threadedParallelFor,
+	threadedGetNumThreads
+};
+
+void
+termJobThreads(void)
+{
+	std::lock_guard<std::mutex> caller(pool.callerMutex);
+	if(!pool.started)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.quit = true;
+	}
+	pool.wake.notify_all();
+	for(int32 i = 0; i < pool.numThreads; i++)
+		pool.threads[i].join();
+	pool.numThreads = 0;
+	pool.started = false;
+}
+
+#else
+
+JobFunctions threadedJobfuncs = {
+	serialParallelFor,
+	serialGetNumThreads
+};
+
+void termJobThreads(void) { }
+
+#endif
+
+}
@@ -0,0 +1,901 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID ID_LOD
+
+namespace rw {
+
+LODGlobals lodGlobals = { 0, 1.0f };
+
+/*
+ * Quadric error metric simplification.
+ * Vertices with the same position form a group. An edge is collapsed by
+ * moving one group onto the other (half edge collapse), so no vertices
+ * or attributes are made up. Every vertex of the moving group has to be
+ * connected to a vertex of the other group, which makes texture seams,
+ * normal creases and material boundaries collapse only along themselves.
+ * Edges on borders and seams get extra quadrics to keep their shape.
+ */
+
+enum {
+	MAXWEDGES = 16,		// vertices of one group that can be moved
+	MAXNEIGHBOURS = 64
+};
+#define BORDERWEIGHT 10.0f
+
+struct Quadric
+{
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+};
+
+static void
+addPlane(Quadric *q, double a, double b, double c, double d, double w)
+{
+	q->a00 += w*a*a; q->a01 += w*a*b; q->a02 += w*a*c; q->a03 += w*a*d;
+	q->a11 += w*b*b; q->a12 += w*b*c; q->a13 += w*b*d;
+	q->a22 += w*c*c; q->a23 += w*c*d;
+	q->a33 += w*d*d;
+}
+
+static void
+addQuadric(Quadric *dst, const Quadric *src)
+{
+	dst->a00 += src->a00; dst->a01 += src->a01; dst->a02 += src->a02; dst->a03 += src->a03;
+	dst->a11 += src->a11; dst->a12 += src->a12; dst->a13 += src->a13;
+	dst->a22 += src->a22; dst->a23 += src->a23;
+	dst->a33 += src->a33;
+}
+
+static double
+evalQuadric(const Quadric *q, const V3d *p)
+{
+	double x = p->x, y = p->y, z = p->z;
+	double e = q->a00*x*x + 2.0*q->a01*x*y + 2.0*q->a02*x*z + 2.0*q->a03*x +
+		q->a11*y*y + 2.0*q->a12*y*z + 2.0*q->a13*y +
+		q->a22*z*z + 2.0*q->a23*z +
+		q->a33;
+	return e < 0.0 ? 0.0 : e;
+}
+
+struct Collapse
+{
+	double cost;
+	int32 from, to;		// groups
+	uint32 stamp;		// of from when this was found
+};
+
+struct Simplifier
+{
+	Geometry *geo;
+	Skin *skin;
+	int32 numVertices;
+	int32 numTriangles;
+	int32 numLive;
+	V3d *pos;
+	Triangle *tris;
+	uint8 *dead;
+
+	// groups are identified by their first vertex
+	int32 *group;
+	int32 *nextInGroup;	// circular
+	Quadric *quadrics;
+	float32 *areas;
+	uint32 *stamps;
+	uint8 *collapsed;
+	int32 **groupTris;
+	int32 *numGroupTris;
+	int32 *maxGroupTris;
+
+	Collapse *heap;
+	int32 heapSize, maxHeap;
+	float32 skinScale;
+
+	bool32 init(Geometry *geo);
+	void deinit(void);
+	void simplify(int32 targetTriangles);
+	Geometry *makeGeometry(void);
+
+	void addGroupTri(int32 g, int32 t);
+	void findGroups(void);
+	void makeQuadrics(void);
+	float32 skinDifference(int32 a, int32 b);
+	bool32 mapWedges(int32 from, int32 to, int32 *wfrom, int32 *wto, int32 *n);
+	bool32 flips(int32 from, int32 to);
+	bool32 findBest(int32 g, Collapse *c);
+	void push(Collapse *c);
+	bool32 pop(Collapse *c);
+	void collapse(int32 from, int32 to, int32 *wfrom, int32 *wto, int32 n);
+	void update(int32 g);
+};
+
+void
+Simplifier::addGroupTri(int32 g, int32 t)
+{
+	if(this->numGroupTris[g] == this->maxGroupTris[g]){
+		int32 n = this->maxGroupTris[g] ? this->maxGroupTris[g]*2 : 8;
+		this->groupTris[g] = rwResizeT(int32, this->groupTris[g], n, MEMDUR_FUNCTION | ID_GEOMETRY);
+		this->maxGroupTris[g] = n;
+	}
+	this->groupTris[g][this->numGroupTris[g]++] = t;
+}
+
+// Put vertices with the same position into groups
+void
+Simplifier::findGroups(void)
+{
+	int32 i, n = this->numVertices;
+	uint32 size = 16;
+	while(size < (uint32)n*2)
+		size *= 2;
+	int32 *table = rwNewT(int32, size, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(uint32 j = 0; j < size; j++)
+		table[j] = -1;
+	for(i = 0; i < n; i++){
+		uint32 bits[3];
+		memcpy(bits, &this->pos[i], sizeof(bits));
+		uint32 h = (bits[0]*73856093u) ^ (bits[1]*19349663u) ^ (bits[2]*83492791u);
+		for(h &= size-1; table[h] >= 0; h = (h+1) & (size-1))
+			if(memcmp(&this->pos[table[h]], &this->pos[i], sizeof(V3d)) == 0)
+				break;
+		if(table[h] < 0){
+			table[h] = i;
+			this->group[i] = i;
+			this->nextInGroup[i] = i;
+		}else{
+			int32 g = table[h];
+			this->group[i] = g;
+			this->nextInGroup[i] = this->nextInGroup[g];
+			this->nextInGroup[g] = i;
+		}
+	}
+	rwFree(table);
+}
+
+void
+Simplifier::makeQuadrics(void)
+{
+	int32 i, j, k;
+	memset(this->quadrics, 0, this->numVertices*sizeof(Quadric));
+	memset(this->areas, 0, this->numVertices*sizeof(float32));
+	for(i = 0; i < this->numTriangles; i++){
+		if(this->dead[i])
+			continue;
+		uint16 *v = this->tris[i].v;
+		V3d p0 = this->pos[v[0]];
+		V3d n = cross(sub(this->pos[v[1]], p0), sub(this->pos[v[2]], p0));
+		float32 len = length(n);
+		if(len == 0.0f)
+			continue;
+		float32 a = n.x/len, b = n.y/len, c = n.z/len;
+		float32 d = -(a*p0.x + b*p0.y + c*p0.z);
+		for(j = 0; j < 3; j++){
+			int32 g = this->group[v[j]];
+			addPlane(&this->quadrics[g], a, b, c, d, len*0.5f);
+			this->areas[g] += len/6.0f;
+		}
+
+		// Edges that don't continue into a triangle with the same
+		// vertices and material are borders or seams.
+		for(j = 0; j < 3; j++){
+			int32 va = v[j], vb = v[(j+1)%3];
+			int32 ga = this->group[va];
+			int32 *list = this->groupTris[ga];
+			bool32 smooth = 0;
+			for(k = 0; k < this->numGroupTris[ga] && !smooth; k++){
+				Triangle *t = &this->tris[list[k]];
+				if(list[k] == i || t->matId != this->tris[i].matId)
+					continue;
+				for(int32 l = 0; l < 3; l++)
+					if(t->v[l] == vb && t->v[(l+1)%3] == va)
+						smooth = 1;
+			}
+			if(smooth)
+				continue;
+			V3d e = sub(this->pos[vb], this->pos[va]);
+			V3d en = cross(e, n);
+			float32 elen = length(en);
+			if(elen == 0.0f)
+				continue;
+			float32 ea = en.x/elen, eb = en.y/elen, ec = en.z/elen;
+			float32 ed = -(ea*this->pos[va].x + eb*this->pos[va].y + ec*this->pos[va].z);
+			float32 w = BORDERWEIGHT*dot(e, e);
+			addPlane(&this->quadrics[ga], ea, eb, ec, ed, w);
+			addPlane(&this->quadrics[this->group[vb]], ea, eb, ec, ed, w);
+		}
+	}
+}
+
+bool32
+Simplifier::init(Geometry *geo)
+{
+	int32 i, j;
+
+	if(geo->flags & Geometry::NATIVE || geo->numTriangles == 0 ||
+	   geo->morphTargets[0].vertices == nil)
+		return 0;
+	memset(this, 0, sizeof(*this));
+	this->geo = geo;
+	this->skin = skinGlobals.geoOffset ? Skin::get(geo) : nil;
+	if(this->skin && (this->skin->indices == nil || this->skin->weights == nil))
+		this->skin = nil;
+	int32 nv = this->numVertices = geo->numVertices;
+	int32 nt = this->numTriangles = geo->numTriangles;
+	this->pos = geo->morphTargets[0].vertices;
+	this->tris = rwNewT(Triangle, nt, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memcpy(this->tris, geo->triangles, nt*sizeof(Triangle));
+	this->dead = rwNewT(uint8, nt, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->group = rwNewT(int32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->nextInGroup = rwNewT(int32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->quadrics = rwNewT(Quadric, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->areas = rwNewT(float32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->stamps = rwNewT(uint32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->collapsed = rwNewT(uint8, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->groupTris = rwNewT(int32*, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->numGroupTris = rwNewT(int32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->maxGroupTris = rwNewT(int32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(this->stamps, 0, nv*sizeof(uint32));
+	memset(this->collapsed, 0, nv);
+	memset(this->groupTris, 0, nv*sizeof(int32*));
+	memset(this->numGroupTris, 0, nv*sizeof(int32));
+	memset(this->maxGroupTris, 0, nv*sizeof(int32));
+
+	this->findGroups();
+	this->numLive = 0;
+	for(i = 0; i < nt; i++){
+		uint16 *v = this->tris[i].v;
+		this->dead[i] = v[0] >= nv || v[1] >= nv || v[2] >= nv ||
+			this->group[v[0]] == this->group[v[1]] ||
+			this->group[v[1]] == this->group[v[2]] ||
+			this->group[v[2]] == this->group[v[0]];
+		if(this->dead[i])
+			continue;
+		this->numLive++;
+		for(j = 0; j < 3; j++)
+			this->addGroupTri(this->group[v[j]], i);
+	}
+	this->makeQuadrics();
+
+	// A complete change of bones costs as much as moving
+	// a vertex by a tenth of the model's size
+	if(this->skin){
+		Sphere s = geo->morphTargets[0].calculateBoundingSphere();
+		this->skinScale = 0.1f*2.0f*s.radius;
+		this->skinScale *= this->skinScale;
+	}
+
+	this->maxHeap = nv;
+	this->heap = rwNewT(Collapse, this->maxHeap, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->heapSize = 0;
+	for(i = 0; i < nv; i++){
+		Collapse c;
+		if(this->group[i] == i && this->numGroupTris[i] && this->findBest(i, &c))
+			this->push(&c);
+	}
+	return 1;
+}
+
+void
+Simplifier::deinit(void)
+{
+	for(int32 i = 0; i < this->numVertices; i++)
+		rwFree(this->groupTris[i]);
+	rwFree(this->tris);
+	rwFree(this->dead);
+	rwFree(this->group);
+	rwFree(this->nextInGroup);
+	rwFree(this->quadrics);
+	rwFree(this->areas);
+	rwFree(this->stamps);
+	rwFree(this->collapsed);
+	rwFree(this->groupTris);
+	rwFree(this->numGroupTris);
+	rwFree(this->maxGroupTris);
+	rwFree(this->heap);
+}
+
+// 0 for the same bones and weights, 1 for completely different ones
+float32
+Simplifier::skinDifference(int32 a, int32 b)
+{
+	float32 *wa = &this->skin->weights[a*4];
+	float32 *wb = &this->skin->weights[b*4];
+	uint8 *ia = &this->skin->indices[a*4];
+	uint8 *ib = &this->skin->indices[b*4];
+	float32 diff = 0.0f;
+	int32 i, j;
+	for(i = 0; i < 4; i++){
+		float32 w = 0.0f;
+		for(j = 0; j < 4; j++)
+			if(ib[j] == ia[i])
+				w += wb[j];
+		diff += fabsf(wa[i] - w);
+	}
+	for(i = 0; i < 4; i++){
+		for(j = 0; j < 4; j++)
+			if(ia[j] == ib[i])
+				break;
+		if(j == 4)
+			diff += wb[i];
+	}
+	return diff*0.5f;
+}
+
+// Find which vertex of group 'to' each used vertex of group 'from' moves to
+bool32
+Simplifier::mapWedges(int32 from, int32 to, int32 *wfrom, int32 *wto, int32 *n)
+{
+	int32 i, j, k;
+	int32 *list = this->groupTris[from];
+	*n = 0;
+	for(i = 0; i < this->numGroupTris[from]; i++){
+		if(this->dead[list[i]])
+			continue;
+		uint16 *v = this->tris[list[i]].v;
+		for(j = 0; j < 3; j++){
+			if(this->group[v[j]] != from)
+				continue;
+			int32 target = -1;
+			for(k = 0; k < 3; k++)
+				if(this->group[v[k]] == to)
+					target = v[k];
+			for(k = 0; k < *n; k++)
+				if(wfrom[k] == v[j])
+					break;
+			if(k == *n){
+				if(*n == MAXWEDGES)
+					return 0;
+				wfrom[k] = v[j];
+				wto[k] = target;
+				(*n)++;
+			}else if(target >= 0){
+				if(wto[k] >= 0 && wto[k] != target)
+					return 0;	// would have to split
+				wto[k] = target;
+			}
+		}
+	}
+	for(k = 0; k < *n; k++)
+		if(wto[k] < 0)
+			return 0;	// not connected, attributes would change
+	return *n > 0;
+}
+
+// Would moving the group flip any of its triangles?
+bool32
+Simplifier::flips(int32 from, int32 to)
+{
+	int32 *list = this->groupTris[from];
+	for(int32 i = 0; i < this->numGroupTris[from]; i++){
+		if(this->dead[list[i]])
+			continue;
+		uint16 *v = this->tris[list[i]].v;
+		V3d p[3], q[3];
+		bool32 hasTo = 0;
+		for(int32 j = 0; j < 3; j++){
+			int32 g = this->group[v[j]];
+			p[j] = q[j] = this->pos[v[j]];
+			if(g == from)
+				q[j] = this->pos[to];
+			else if(g == to)
+				hasTo = 1;
+		}
+		if(hasTo)
+			continue;	// collapses
+		V3d n0 = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+		V3d n1 = cross(sub(q[1], q[0]), sub(q[2], q[0]));
+		if(dot(n0, n1) <= 0.0f)
+			return 1;
+	}
+	return 0;
+}
+
+bool32
+Simplifier::findBest(int32 g, Collapse *c)
+{
+	int32 neighbours[MAXNEIGHBOURS];
+	int32 wfrom[MAXWEDGES], wto[MAXWEDGES];
+	int32 numNeighbours = 0;
+	int32 i, j, k, n;
+
+	int32 *list = this->groupTris[g];
+	for(i = 0; i < this->numGroupTris[g]; i++){
+		if(this->dead[list[i]])
+			continue;
+		uint16 *v = this->tris[list[i]].v;
+		for(j = 0; j < 3; j++){
+			int32 ng = this->group[v[j]];
+			if(ng == g)
+				continue;
+			for(k = 0; k < numNeighbours; k++)
+				if(neighbours[k] == ng)
+					break;
+			if(k == numNeighbours && numNeighbours < MAXNEIGHBOURS)
+				neighbours[numNeighbours++] = ng;
+		}
+	}
+
+	c->cost = -1.0;
+	for(i = 0; i < numNeighbours; i++){
+		int32 to = neighbours[i];
+		double cost = evalQuadric(&this->quadrics[g], &this->pos[to]);
+		if(this->skin)
+			cost += (double)(this->skinDifference(g, to)*this->skinScale*this->areas[g]);
+		if(c->cost >= 0.0 && cost >= c->cost)
+			continue;
+		if(!this->mapWedges(g, to, wfrom, wto, &n) || this->flips(g, to))
+			continue;
+		c->cost = cost;
+		c->from = g;
+		c->to = to;
+	}
+	c->stamp = this->stamps[g];
+	return c->cost >= 0.0;
+}
+
+void
+Simplifier::push(Collapse *c)
+{
+	if(this->heapSize == this->maxHeap){
+		this->maxHeap *= 2;
+		this->heap = rwResizeT(Collapse, this->heap, this->maxHeap, MEMDUR_FUNCTION | ID_GEOMETRY);
+	}
+	int32 i = this->heapSize++;
+	while(i > 0){
+		int32 parent = (i-1)/2;
+		if(this->heap[parent].cost <= c->cost)
+			break;
+		this->heap[i] = this->heap[parent];
+		i = parent;
+	}
+	this->heap[i] = *c;
+}
+
+bool32
+Simplifier::pop(Collapse *c)
+{
+	if(this->heapSize == 0)
+		return 0;
+	*c = this->heap[0];
+	Collapse last = this->heap[--this->heapSize];
+	int32 i = 0;
+	for(;;){
+		int32 child = 2*i+1;
+		if(child >= this->heapSize)
+			break;
+		if(child+1 < this->heapSize && this->heap[child+1].cost < this->heap[child].cost)
+			child++;
+		if(last.cost <= this->heap[child].cost)
+			break;
+		this->heap[i] = this->heap[child];
+		i = child;
+	}
+	this->heap[i] = last;
+	return 1;
+}
+
+void
+Simplifier::collapse(int32 from, int32 to, int32 *wfrom, int32 *wto, int32 n)
+{
+	int32 i, j, k;
+	int32 *list = this->groupTris[from];
+	for(i = 0; i < this->numGroupTris[from]; i++){
+		int32 t = list[i];
+		if(this->dead[t])
+			continue;
+		uint16 *v = this->tris[t].v;
+		bool32 hasTo = 0;
+		for(j = 0; j < 3; j++){
+			if(this->group[v[j]] == to)
+				hasTo = 1;
+			else if(this->group[v[j]] == from)
+				for(k = 0; k < n; k++)
+					if(wfrom[k] == v[j]){
+						v[j] = wto[k];
+						break;
+					}
+		}
+		if(hasTo){
+			this->dead[t] = 1;
+			this->numLive--;
+		}else
+			this->addGroupTri(to, t);
+	}
+	addQuadric(&this->quadrics[to], &this->quadrics[from]);
+	this->areas[to] += this->areas[from];
+	this->collapsed[from] = 1;
+	this->numGroupTris[from] = 0;
+
+	// drop dead triangles from the list
+	list = this->groupTris[to];
+	for(i = 0, j = 0; i < this->numGroupTris[to]; i++)
+		if(!this->dead[list[i]])
+			list[j++] = list[i];
+	this->numGroupTris[to] = j;
+}
+
+// Find new collapses for the group and everything around it
+void
+Simplifier::update(int32 g)
+{
+	int32 groups[MAXNEIGHBOURS+1];
+	int32 numGroups = 0;
+	int32 i, j, k;
+	Collapse c;
+
+	groups[numGroups++] = g;
+	int32 *list = this->groupTris[g];
+	for(i = 0; i < this->numGroupTris[g]; i++){
+		uint16 *v = this->tris[list[i]].v;
+		for(j = 0; j < 3; j++){
+			int32 ng = this->group[v[j]];
+			for(k = 0; k < numGroups; k++)
+				if(groups[k] == ng)
+					break;
+			if(k == numGroups && numGroups <= MAXNEIGHBOURS)
+				groups[numGroups++] = ng;
+		}
+	}
+	for(i = 0; i < numGroups; i++){
+		this->stamps[groups[i]]++;
+		if(this->findBest(groups[i], &c))
+			this->push(&c);
+	}
+}
+
+void
+Simplifier::simplify(int32 targetTriangles)
+{
+	int32 wfrom[MAXWEDGES], wto[MAXWEDGES];
+	int32 n;
+	Collapse c;
+
+	while(this->numLive > targetTriangles && this->pop(&c)){
+		if(this->collapsed[c.from] || c.stamp != this->stamps[c.from])
+			continue;
+		// things may have changed around 'to'
+		if(this->collapsed[c.to] ||
+		   !this->mapWedges(c.from, c.to, wfrom, wto, &n) ||
+		   this->flips(c.from, c.to)){
+			this->stamps[c.from]++;
+			if(this->findBest(c.from, &c))
+				this->push(&c);
+			continue;
+		}
+		this->collapse(c.from, c.to, wfrom, wto, n);
+		this->update(c.to);
+	}
+}
+
+// Make a new geometry of the remaining triangles and the vertices they use
+Geometry*
+Simplifier::makeGeometry(void)
+{
+	Geometry *src = this->geo;
+	int32 i, j;
+
+	int32 *map = rwNewT(int32, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < this->numVertices; i++)
+		map[i] = -1;
+	int32 numVerts = 0;
+	for(i = 0; i < this->numTriangles; i++)
+		if(!this->dead[i])
+			for(j = 0; j < 3; j++)
+				if(map[this->tris[i].v[j]] < 0)
+					map[this->tris[i].v[j]] = numVerts++;
+
+	Geometry *geo = Geometry::create(numVerts, this->numLive,
+		src->flags | src->numTexCoordSets<<16);
+	if(geo == nil){
+		rwFree(map);
+		return nil;
+	}
+	geo->addMorphTargets(src->numMorphTargets-1);
+	Triangle *tri = geo->triangles;
+	for(i = 0; i < this->numTriangles; i++)
+		if(!this->dead[i]){
+			for(j = 0; j < 3; j++)
+				tri->v[j] = map[this->tris[i].v[j]];
+			tri->matId = this->tris[i].matId;
+			tri++;
+		}
+	for(i = 0; i < this->numVertices; i++){
+		int32 d = map[i];
+		if(d < 0)
+			continue;
+		for(j = 0; j < src->numMorphTargets; j++){
+			MorphTarget *smt = &src->morphTargets[j];
+			MorphTarget *dmt = &geo->morphTargets[j];
+			if(smt->vertices)
+				dmt->vertices[d] = smt->vertices[i];
+			if(smt->normals)
+				dmt->normals[d] = smt->normals[i];
+		}
+		if(src->colors)
+			geo->colors[d] = src->colors[i];
+		for(j = 0; j < src->numTexCoordSets; j++)
+			geo->texCoords[j][d] = src->texCoords[j][i];
+	}
+	for(j = 0; j < src->numMorphTargets; j++)
+		geo->morphTargets[j].boundingSphere = src->morphTargets[j].boundingSphere;
+	for(j = 0; j < src->matList.numMaterials; j++)
+		geo->matList.appendMaterial(src->matList.materials[j]);
+
+	if(this->skin){
+		Skin *skin = rwNewT(Skin, 1, MEMDUR_EVENT | ID_SKIN);
+		skin->init(this->skin->numBones, this->skin->numUsedBones, numVerts);
+		skin->numWeights = this->skin->numWeights;
+		skin->legacyType = this->skin->legacyType;
+		memcpy(skin->usedBones, this->skin->usedBones, skin->numUsedBones);
+		memcpy(skin->inverseMatrices, this->skin->inverseMatrices, skin->numBones*64);
+		for(i = 0; i < this->numVertices; i++)
+			if(map[i] >= 0){
+				memcpy(&skin->indices[map[i]*4], &this->skin->indices[i*4], 4);
+				memcpy(&skin->weights[map[i]*4], &this->skin->weights[i*4], 16);
+			}
+		*PLUGINOFFSET(Skin*, geo, skinGlobals.geoOffset) = skin;
+	}
+	rwFree(map);
+
+	geo->buildMeshes();
+	return geo;
+}
+
+Geometry*
+simplifyGeometry(Geometry *geo, float32 ratio)
+{
+	Simplifier s;
+	if(!s.init(geo))
+		return nil;
+	s.simplify((int32)(geo->numTriangles*ratio));
+	Geometry *ret = s.makeGeometry();
+	s.deinit();
+	return ret;
+}
+
+/*
+ * Atomic LOD
+ */
+
+static void*
+createAtomicLOD(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(AtomicLOD*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyAtomicLOD(void *object, int32 offset, int32)
+{
+	AtomicLOD *lod = *PLUGINOFFSET(AtomicLOD*, object, offset);
+	if(lod){
+		for(int32 i = 0; i < lod->numLevels; i++)
+			lod->geometries[i]->destroy();
+		rwFree(lod);
+		*PLUGINOFFSET(AtomicLOD*, object, offset) = nil;
+	}
+	return object;
+}
+
+static void*
+copyAtomicLOD(void *dst, void *src, int32 offset, int32)
+{
+	AtomicLOD *srclod = *PLUGINOFFSET(AtomicLOD*, src, offset);
+	if(srclod == nil)
+		return dst;
+	AtomicLOD *lod = rwNewT(AtomicLOD, 1, MEMDUR_EVENT | ID_LOD);
+	*lod = *srclod;
+	for(int32 i = 0; i < lod->numLevels; i++)
+		lod->geometries[i]->addRef();
+	*PLUGINOFFSET(AtomicLOD*, dst, offset) = lod;
+	// keep the bounding sphere of the full geometry
+	((Atomic*)dst)->boundingSphere = ((Atomic*)src)->boundingSphere;
+	return dst;
+}
+
+// The geometry that is currently set is part of the clump,
+// the other levels are written here.
+static Stream*
+readAtomicLOD(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	Atomic *atomic = (Atomic*)object;
+	int32 i;
+	destroyAtomicLOD(object, offset, 0);
+	AtomicLOD *lod = rwNewT(AtomicLOD, 1, MEMDUR_EVENT | ID_LOD);
+	memset(lod, 0, sizeof(AtomicLOD));
+	lod->numLevels = stream->readI32();
+	lod->currentLevel = stream->readI32();
+	if(lod->numLevels < 1 || lod->numLevels > AtomicLOD::MAXLEVELS ||
+	   lod->currentLevel < 0 || lod->currentLevel >= lod->numLevels){
+		RWERROR((ERR_GENERAL, "invalid LOD chain"));
+		rwFree(lod);
+		return nil;
+	}
+	stream->read32(lod->minScreenSize, lod->numLevels*4);
+	stream->read32(&lod->boundingSphere, sizeof(Sphere));
+	for(i = 0; i < lod->numLevels; i++){
+		if(i == lod->currentLevel){
+			lod->geometries[i] = atomic->geometry;
+			atomic->geometry->addRef();
+			continue;
+		}
+		if(!findChunk(stream, ID_GEOMETRY, nil, nil) ||
+		   (lod->geometries[i] = Geometry::streamRead(stream)) == nil){
+			RWERROR((ERR_CHUNK, "GEOMETRY"));
+			lod->numLevels = i;
+			*PLUGINOFFSET(AtomicLOD*, object, offset) = lod;
+			destroyAtomicLOD(object, offset, 0);
+			return nil;
+		}
+	}
+	atomic->boundingSphere = lod->boundingSphere;
+	*PLUGINOFFSET(AtomicLOD*, object, offset) = lod;
+	return stream;
+}
+
+static Stream*
+writeAtomicLOD(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	AtomicLOD *lod = *PLUGINOFFSET(AtomicLOD*, object, offset);
+	stream->writeI32(lod->numLevels);
+	stream->writeI32(lod->currentLevel);
+	stream->write32(lod->minScreenSize, lod->numLevels*4);
+	stream->write32(&lod->boundingSphere, sizeof(Sphere));
+	for(int32 i = 0; i < lod->numLevels; i++)
+		if(i != lod->currentLevel)
+			lod->geometries[i]->streamWrite(stream);
+	return stream;
+}
+
+static int32
+getSizeAtomicLOD(void *object, int32 offset, int32)
+{
+	AtomicLOD *lod = *PLUGINOFFSET(AtomicLOD*, object, offset);
+	if(lod == nil)
+		return 0;
+	int32 size = 8 + lod->numLevels*4 + sizeof(Sphere);
+	for(int32 i = 0; i < lod->numLevels; i++)
+		if(i != lod->currentLevel)
+			size += 12 + lod->geometries[i]->streamGetSize();
+	return size;
+}
+
+void
+registerLODPlugin(void)
+{
+	lodGlobals.atomicOffset =
+	Atomic::registerPlugin(sizeof(AtomicLOD*), ID_LOD,
+	                       createAtomicLOD, destroyAtomicLOD, copyAtomicLOD);
+	Atomic::registerPluginStream(ID_LOD,
+	                             readAtomicLOD, writeAtomicLOD, getSizeAtomicLOD);
+}
+
+bool32
+AtomicLOD::build(Atomic *atomic, int32 numLevels, const float32 *ratios)
+{
+	Simplifier s;
+	Geometry *geo;
+	int32 i;
+
+	AtomicLOD::destroy(atomic);
+	if(numLevels > MAXLEVELS-1)
+		numLevels = MAXLEVELS-1;
+	if(atomic->geometry == nil || !s.init(atomic->geometry))
+		return 0;
+	AtomicLOD *lod = rwNewT(AtomicLOD, 1, MEMDUR_EVENT | ID_LOD);
+	memset(lod, 0, sizeof(AtomicLOD));
+	lod->geometries[0] = atomic->geometry;
+	atomic->geometry->addRef();
+	lod->minScreenSize[0] = 0.0f;
+	lod->boundingSphere = atomic->boundingSphere;
+	lod->numLevels = 1;
+	// every level continues where the last one stopped
+	for(i = 0; i < numLevels; i++){
+		s.simplify((int32)(atomic->geometry->numTriangles*ratios[i]));
+		geo = s.makeGeometry();
+		if(geo == nil)
+			break;
+		lod->geometries[lod->numLevels] = geo;
+		// same number of triangles per screen area as the full
+		// geometry has when it covers half the view
+		lod->minScreenSize[lod->numLevels] = 0.5f*sqrtf(ratios[i]);
+		lod->numLevels++;
+	}
+	s.deinit();
+	*PLUGINOFFSET(AtomicLOD*, atomic, lodGlobals.atomicOffset) = lod;
+	return 1;
+}
+
+void
+AtomicLOD::destroy(Atomic *atomic)
+{
+	AtomicLOD *lod = get(atomic);
+	if(lod == nil)
+		return;
+	if(lod->currentLevel != 0)
+		atomic->setGeometry(lod->geometries[0], Atomic::SAMEBOUNDINGSPHERE);
+	if(lod->renderCB)
+		atomic->setRenderCB(lod->renderCB);
+	destroyAtomicLOD(atomic, lodGlobals.atomicOffset, 0);
+}
+
+void
+AtomicLOD::setScreenSize(Atomic *atomic, int32 level, float32 size)
+{
+	AtomicLOD *lod = get(atomic);
+	if(lod && level > 0 && level < lod->numLevels)
+		lod->minScreenSize[level] = size;
+}
+
+float32
+AtomicLOD::getScreenSize(Atomic *atomic, Camera *cam)
+{
+	Sphere *s = atomic->getWorldBoundingSphere();
+	if(cam->projection == Camera::PARALLEL)
+		return s->radius/cam->viewWindow.y;
+	V3d d = sub(s->center, cam->getFrame()->getLTM()->pos);
+	float32 dist = length(d);
+	if(dist <= s->radius)
+		return 1000.0f;
+	return s->radius/(dist*cam->viewWindow.y);
+}
+
+int32
+AtomicLOD::select(Atomic *atomic, Camera *cam)
+{
+	AtomicLOD *lod = get(atomic);
+	if(lod == nil || cam == nil)
+		return 0;
+	float32 size = getScreenSize(atomic, cam) / lodGlobals.bias;
+	int32 level = 0;
+	while(level+1 < lod->numLevels && size < lod->minScreenSize[level+1])
+		level++;
+	if(level != lod->currentLevel){
+		atomic->setGeometry(lod->geometries[level], Atomic::SAMEBOUNDINGSPHERE);
+		lod->currentLevel = level;
+	}
+	return level;
+}
+
+static void
+lodRenderCB(Atomic *atomic)
+{
+	AtomicLOD *lod = AtomicLOD::get(atomic);
+	AtomicLOD::select(atomic, (Camera*)engine->currentCamera);
+	lod->renderCB(atomic);
+}
+
+void
+AtomicLOD::hookRender(Atomic *atomic)
+{
+	AtomicLOD *lod = get(atomic);
+	if(lod == nil || atomic->renderCB == lodRenderCB)
+		return;
+	lod->renderCB = atomic->renderCB;
+	atomic->renderCB = lodRenderCB;
+}
+
+void
+AtomicLOD::unhookRender(Atomic *atomic)
+{
+	AtomicLOD *lod = get(atomic);
+	if(lod == nil || atomic->renderCB != lodRenderCB)
+		return;
+	atomic->setRenderCB(lod->renderCB);
+}
+
+}
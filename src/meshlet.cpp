@@ -0,0 +1,688 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwrender.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID ID_MESHLET
+
+namespace rw {
+
+MeshletGlobals meshletGlobals;
+
+/*
+ * Meshlets.
+ * The triangles of every trilist mesh are grouped into small connected
+ * clusters that are stored one after another in the mesh's indices.
+ * Each cluster has a bounding sphere and a cone that contains its
+ * face normals. Before an atomic is drawn the clusters are tested
+ * against the camera's frustum and the cone against the camera position;
+ * the pipelines then only draw the index ranges of visible clusters.
+ * All of this happens in the geometry's space, so clusters don't
+ * have to be transformed.
+ */
+
+static struct
+{
+	// set between beginDraw and endDraw
+	Geometry *geometry;
+	int32 numMeshes;
+	int32 *firstRange;	// per mesh and one more
+	MeshletRange *ranges;
+	int32 rangeCapacity;
+	int32 meshCapacity;
+	MeshletStats stats;
+} drawState;
+
+#define GEOMESHLETS(geo) (*PLUGINOFFSET(Meshlets*, geo, meshletGlobals.geoOffset))
+
+static void
+freeMeshlets(Meshlets *m)
+{
+	if(m == nil)
+		return;
+	rwFree(m->meshlets);
+	rwFree(m->firstMeshlet);
+	rwFree(m);
+}
+
+static Meshlets*
+newMeshlets(int32 numMeshes, int32 numMeshlets)
+{
+	Meshlets *m = rwNewT(Meshlets, 1, MEMDUR_EVENT | ID_MESHLET);
+	m->numMeshes = numMeshes;
+	m->numMeshlets = numMeshlets;
+	m->meshlets = rwNewT(Meshlet, numMeshlets, MEMDUR_EVENT | ID_MESHLET);
+	m->firstMeshlet = rwNewT(int32, numMeshes+1, MEMDUR_EVENT | ID_MESHLET);
+	m->serialNum = -1;
+	m->totalIndices = 0;
+	m->indexChecksum = 0;
+	return m;
+}
+
+static void*
+createMeshlets(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(Meshlets*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyMeshlets(void *object, int32 offset, int32)
+{
+	Meshlets *m = *PLUGINOFFSET(Meshlets*, object, offset);
+	if(drawState.geometry == object)
+		Meshlets::endDraw();
+	freeMeshlets(m);
+	*PLUGINOFFSET(Meshlets*, object, offset) = nil;
+	return object;
+}
+
+static void*
+copyMeshlets(void *dst, void *src, int32 offset, int32)
+{
+	Meshlets *srcm = *PLUGINOFFSET(Meshlets*, src, offset);
+	*PLUGINOFFSET(Meshlets*, dst, offset) = nil;
+	if(srcm == nil)
+		return dst;
+	Meshlets *m = newMeshlets(srcm->numMeshes, srcm->numMeshlets);
+	memcpy(m->meshlets, srcm->meshlets, m->numMeshlets*sizeof(Meshlet));
+	memcpy(m->firstMeshlet, srcm->firstMeshlet, (m->numMeshes+1)*sizeof(int32));
+	// the copy gets new meshes, they're matched on first use
+	m->totalIndices = srcm->totalIndices;
+	m->indexChecksum = srcm->indexChecksum;
+	*PLUGINOFFSET(Meshlets*, dst, offset) = m;
+	return dst;
+}
+
+static Stream*
+readMeshlets(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	destroyMeshlets(object, offset, 0);
+	int32 numMeshes = stream->readI32();
+	int32 numMeshlets = stream->readI32();
+	uint32 totalIndices = stream->readU32();
+	uint32 indexChecksum = stream->readU32();
+	if(numMeshes < 0 || numMeshes > 0xFFFF || numMeshlets < 0){
+		RWERROR((ERR_GENERAL, "invalid meshlets"));
+		return nil;
+	}
+	Meshlets *m = newMeshlets(numMeshes, numMeshlets);
+	m->totalIndices = totalIndices;
+	m->indexChecksum = indexChecksum;
+	stream->read32(m->firstMeshlet, (numMeshes+1)*4);
+	stream->read32(m->meshlets, numMeshlets*sizeof(Meshlet));
+	for(int32 i = 0; i < numMeshes; i++)
+		if(m->firstMeshlet[i] < 0 || m->firstMeshlet[i] > m->firstMeshlet[i+1]){
+			RWERROR((ERR_GENERAL, "invalid meshlets"));
+			freeMeshlets(m);
+			return nil;
+		}
+	if(m->firstMeshlet[numMeshes] != numMeshlets){
+		RWERROR((ERR_GENERAL, "invalid meshlets"));
+		freeMeshlets(m);
+		return nil;
+	}
+	// the mesh header may not be read yet, it's matched on first use
+	*PLUGINOFFSET(Meshlets*, object, offset) = m;
+	return stream;
+}
+
+static Stream*
+writeMeshlets(Stream *stream, int32, void *object, int32 offset, int32)
+{
+	Meshlets *m = *PLUGINOFFSET(Meshlets*, object, offset);
+	stream->writeI32(m->numMeshes);
+	stream->writeI32(m->numMeshlets);
+	stream->writeU32(m->totalIndices);
+	stream->writeU32(m->indexChecksum);
+	stream->write32(m->firstMeshlet, (m->numMeshes+1)*4);
+	stream->write32(m->meshlets, m->numMeshlets*sizeof(Meshlet));
+	return stream;
+}
+
+static int32
+getSizeMeshlets(void *object, int32, int32)
+{
+	Meshlets *m = Meshlets::get((Geometry*)object);
+	if(m == nil)
+		return 0;
+	return 16 + (m->numMeshes+1)*4 + m->numMeshlets*sizeof(Meshlet);
+}
+
+static void*
+meshletOpen(void *object, int32, int32)
+{
+	return object;
+}
+
+static void*
+meshletClose(void *object, int32, int32)
+{
+	Meshlets::endDraw();
+	rwFree(drawState.ranges);
+	rwFree(drawState.firstRange);
+	drawState.ranges = nil;
+	drawState.firstRange = nil;
+	drawState.rangeCapacity = 0;
+	drawState.meshCapacity = 0;
+	return object;
+}
+
+// vertex cache optimization rewrites the indices
+static void
+remapMeshlets(Geometry *geo, const uint16 *)
+{
+	Meshlets::destroy(geo);
+}
+
+void
+registerMeshletPlugin(void)
+{
+	Engine::registerPlugin(0, ID_MESHLET, meshletOpen, meshletClose);
+	meshletGlobals.geoOffset =
+	Geometry::registerPlugin(sizeof(Meshlets*), ID_MESHLET,
+	                         createMeshlets, destroyMeshlets, copyMeshlets);
+	Geometry::registerPluginStream(ID_MESHLET,
+	                               readMeshlets, writeMeshlets, getSizeMeshlets);
+	Geometry::registerVertexRemapCB(remapMeshlets);
+}
+
+/*
+ * Building
+ */
+
+enum { MAXCANDIDATES = 512 };
+
+struct MeshletBuilder
+{
+	V3d *pos;
+	int32 numVertices;
+	float32 faceSign;	// makes face normals point to the front
+
+	// vertex to triangle adjacency of the current mesh
+	int32 *adjFirst;
+	int32 *adjTris;
+	int32 *vertMeshlet;	// last meshlet a vertex was put into
+	uint8 *used;
+	int32 *candidateMeshlet;	// last meshlet a triangle was a candidate of
+	V3d *centroids;
+
+	int32 tris[Meshlets::MAXTRIANGLES];
+	int32 numTris;
+	int32 verts[Meshlets::MAXVERTICES];
+	int32 numVerts;
+	int32 candidates[MAXCANDIDATES];
+	int32 numCandidates;
+	V3d center;
+	int32 id;
+
+	void addTriangle(uint16 *indices, int32 t);
+	int32 newVertices(uint16 *indices, int32 t);
+	void makeBounds(uint16 *indices, Meshlet *m);
+};
+
+int32
+MeshletBuilder::newVertices(uint16 *indices, int32 t)
+{
+	int32 n = 0;
+	for(int32 j = 0; j < 3; j++)
+		if(this->vertMeshlet[indices[t*3+j]] != this->id)
+			n++;
+	return n;
+}
+
+void
+MeshletBuilder::addTriangle(uint16 *indices, int32 t)
+{
+	int32 j, k;
+	this->used[t] = 1;
+	this->tris[this->numTris++] = t;
+	this->center = add(this->center, scale(sub(this->centroids[t], this->center), 1.0f/this->numTris));
+	for(j = 0; j < 3; j++){
+		int32 v = indices[t*3+j];
+		if(this->vertMeshlet[v] == this->id)
+			continue;
+		this->vertMeshlet[v] = this->id;
+		this->verts[this->numVerts++] = v;
+		// neighbours of new vertices become candidates
+		for(k = this->adjFirst[v]; k < this->adjFirst[v+1]; k++){
+			int32 c = this->adjTris[k];
+			if(this->used[c] || this->candidateMeshlet[c] == this->id ||
+			   this->numCandidates == MAXCANDIDATES)
+				continue;
+			this->candidateMeshlet[c] = this->id;
+			this->candidates[this->numCandidates++] = c;
+		}
+	}
+}
+
+void
+MeshletBuilder::makeBounds(uint16 *indices, Meshlet *m)
+{
+	int32 i;
+	V3d points[Meshlets::MAXVERTICES];
+	for(i = 0; i < this->numVerts; i++)
+		points[i] = this->pos[this->verts[i]];
+	m->bound.calculate(points, this->numVerts);
+
+	// cone around the face normals
+	V3d normals[Meshlets::MAXTRIANGLES];
+	V3d axis = { 0.0f, 0.0f, 0.0f };
+	int32 n = 0;
+	for(i = 0; i < this->numTris; i++){
+		uint16 *v = &indices[this->tris[i]*3];
+		V3d p0 = this->pos[v[0]];
+		V3d fn = cross(sub(this->pos[v[1]], p0), sub(this->pos[v[2]], p0));
+		float32 len = length(fn);
+		if(len == 0.0f)
+			continue;
+		normals[n] = scale(fn, this->faceSign/len);
+		axis = add(axis, normals[n]);
+		n++;
+	}
+	m->coneCutoff = 1.0f;
+	m->coneAxis.set(0.0f, 0.0f, 0.0f);
+	if(n == 0 || length(axis) == 0.0f)
+		return;
+	axis = normalize(axis);
+	float32 mindp = 1.0f;
+	for(i = 0; i < n; i++){
+		float32 d = dot(normals[i], axis);
+		if(d < mindp)
+			mindp = d;
+	}
+	// normals spread over more than a half space, can't cull
+	if(mindp <= 0.1f)
+		return;
+	m->coneAxis = axis;
+	// sine of the normal cone's half angle
+	m->coneCutoff = sqrtf(1.0f - mindp*mindp);
+}
+
+// Face normals from the winding are compared with the vertex normals
+// to find which winding faces the front.
+static float32
+findFaceSign(Geometry *geo)
+{
+	MorphTarget *mt = &geo->morphTargets[0];
+	if(mt->normals == nil)
+		return 1.0f;
+	float32 sum = 0.0f;
+	for(int32 i = 0; i < geo->numTriangles; i++){
+		uint16 *v = geo->triangles[i].v;
+		V3d p0 = mt->vertices[v[0]];
+		V3d fn = cross(sub(mt->vertices[v[1]], p0), sub(mt->vertices[v[2]], p0));
+		sum += dot(fn, add(add(mt->normals[v[0]], mt->normals[v[1]]), mt->normals[v[2]]));
+	}
+	return sum < 0.0f ? -1.0f : 1.0f;
+}
+
+bool32
+Meshlets::build(Geometry *geo)
+{
+	MeshletBuilder b;
+	int32 i, j, k;
+
+	Meshlets::destroy(geo);
+	MeshHeader *header = geo->meshHeader;
+	if(geo->flags & Geometry::NATIVE || header == nil || header->flags != 0 ||
+	   header->numMeshes == 0 || geo->numMorphTargets != 1 ||
+	   geo->morphTargets[0].vertices == nil || geo->triangles == nil)
+		return 0;
+	// bounds of the bind pose are useless
+	if(skinGlobals.geoOffset && Skin::get(geo))
+		return 0;
+
+	b.pos = geo->morphTargets[0].vertices;
+	b.numVertices = geo->numVertices;
+	b.faceSign = findFaceSign(geo);
+	b.adjFirst = rwNewT(int32, b.numVertices+1, MEMDUR_FUNCTION | ID_MESHLET);
+	b.adjTris = rwNewT(int32, header->totalIndices, MEMDUR_FUNCTION | ID_MESHLET);
+	b.vertMeshlet = rwNewT(int32, b.numVertices, MEMDUR_FUNCTION | ID_MESHLET);
+	b.used = rwNewT(uint8, header->totalIndices/3, MEMDUR_FUNCTION | ID_MESHLET);
+	b.candidateMeshlet = rwNewT(int32, header->totalIndices/3, MEMDUR_FUNCTION | ID_MESHLET);
+	b.centroids = rwNewT(V3d, header->totalIndices/3, MEMDUR_FUNCTION | ID_MESHLET);
+	uint16 *newIndices = rwNewT(uint16, header->totalIndices, MEMDUR_FUNCTION | ID_MESHLET);
+	// at worst one meshlet per triangle
+	Meshlet *meshlets = rwNewT(Meshlet, header->totalIndices/3 + 1, MEMDUR_FUNCTION | ID_MESHLET);
+	int32 *firstMeshlet = rwNewT(int32, header->numMeshes+1, MEMDUR_FUNCTION | ID_MESHLET);
+	int32 numMeshlets = 0;
+	for(i = 0; i < b.numVertices; i++)
+		b.vertMeshlet[i] = -1;
+	b.id = 0;
+
+	uint32 indexBase = 0;
+	Mesh *mesh = header->getMeshes();
+	for(int32 mi = 0; mi < header->numMeshes; mi++, mesh++){
+		uint16 *indices = mesh->indices;
+		int32 numTris = mesh->numIndices/3;
+		firstMeshlet[mi] = numMeshlets;
+
+		memset(b.adjFirst, 0, (b.numVertices+1)*sizeof(int32));
+		for(i = 0; i < numTris*3; i++)
+			b.adjFirst[indices[i]+1]++;
+		for(i = 0; i < b.numVertices; i++)
+			b.adjFirst[i+1] += b.adjFirst[i];
+		for(i = 0; i < numTris; i++){
+			for(j = 0; j < 3; j++){
+				int32 v = indices[i*3+j];
+				b.adjTris[b.adjFirst[v]++] = i;
+			}
+			b.centroids[i] = scale(add(add(b.pos[indices[i*3]], b.pos[indices[i*3+1]]),
+				b.pos[indices[i*3+2]]), 1.0f/3.0f);
+			b.used[i] = 0;
+			b.candidateMeshlet[i] = -1;
+		}
+		// undo the increments of the fill loop
+		for(i = b.numVertices; i > 0; i--)
+			b.adjFirst[i] = b.adjFirst[i-1];
+		b.adjFirst[0] = 0;
+
+		uint32 numOut = 0;
+		int32 seed = 0;
+		for(;;){
+			while(seed < numTris && b.used[seed])
+				seed++;
+			if(seed == numTris)
+				break;
+
+			b.id++;
+			b.numTris = 0;
+			b.numVerts = 0;
+			b.numCandidates = 0;
+			b.center.set(0.0f, 0.0f, 0.0f);
+			b.addTriangle(indices, seed);
+			while(b.numTris < MAXTRIANGLES){
+				// prefer triangles that add few vertices, then close ones
+				int32 best = -1;
+				int32 bestNew = 4;
+				float32 bestDist = 0.0f;
+				for(k = 0; k < b.numCandidates; k++){
+					int32 t = b.candidates[k];
+					int32 n = b.newVertices(indices, t);
+					// vertices only get more, so these never fit again
+					if(b.used[t] || b.numVerts + n > MAXVERTICES){
+						b.candidates[k--] = b.candidates[--b.numCandidates];
+						continue;
+					}
+					V3d d = sub(b.centroids[t], b.center);
+					float32 dist = dot(d, d);
+					if(n < bestNew || (n == bestNew && dist < bestDist)){
+						best = t;
+						bestNew = n;
+						bestDist = dist;
+					}
+				}
+				if(best < 0)
+					break;
+				b.addTriangle(indices, best);
+			}
+
+			Meshlet *m = &meshlets[numMeshlets++];
+			m->firstIndex = numOut;
+			m->numIndices = b.numTris*3;
+			for(i = 0; i < b.numTris; i++)
+				for(j = 0; j < 3; j++)
+					newIndices[indexBase + numOut++] = indices[b.tris[i]*3+j];
+			b.makeBounds(indices, m);
+		}
+		indexBase += numTris*3;
+		// keep what isn't a whole triangle
+		for(i = numTris*3; i < (int32)mesh->numIndices; i++)
+			newIndices[indexBase++] = indices[i];
+	}
+	firstMeshlet[header->numMeshes] = numMeshlets;
+
+	// reallocating gives the meshes a new serial number
+	// so instanced data is rebuilt
+	geo->allocateMeshes(header->numMeshes, header->totalIndices, 0);
+	header = geo->meshHeader;
+	memcpy(header->getMeshes()->indices, newIndices, header->totalIndices*sizeof(uint16));
+
+	// triangles follow the mesh order so buildMeshes keeps it
+	if((uint32)geo->numTriangles*3 == header->totalIndices){
+		Triangle *tri = geo->triangles;
+		mesh = header->getMeshes();
+		for(i = 0; i < header->numMeshes; i++){
+			uint16 matId = geo->matList.findIndex(mesh[i].material);
+			for(j = 0; j+2 < (int32)mesh[i].numIndices; j += 3){
+				tri->v[0] = mesh[i].indices[j+0];
+				tri->v[1] = mesh[i].indices[j+1];
+				tri->v[2] = mesh[i].indices[j+2];
+				tri->matId = matId;
+				tri++;
+			}
+		}
+	}
+
+	Meshlets *ml = newMeshlets(header->numMeshes, numMeshlets);
+	memcpy(ml->meshlets, meshlets, numMeshlets*sizeof(Meshlet));
+	memcpy(ml->firstMeshlet, firstMeshlet, (header->numMeshes+1)*sizeof(int32));
+	ml->serialNum = header->serialNum;
+	ml->totalIndices = header->totalIndices;
+	ml->indexChecksum = header->getIndexChecksum();
+	GEOMESHLETS(geo) = ml;
+
+	rwFree(b.adjFirst);
+	rwFree(b.adjTris);
+	rwFree(b.vertMeshlet);
+	rwFree(b.used);
+	rwFree(b.candidateMeshlet);
+	rwFree(b.centroids);
+	rwFree(newIndices);
+	rwFree(meshlets);
+	rwFree(firstMeshlet);
+	return 1;
+}
+
+void
+Meshlets::destroy(Geometry *geo)
+{
+	destroyMeshlets(geo, meshletGlobals.geoOffset, 0);
+}
+
+// Meshlets that still match the geometry's meshes
+Meshlets*
+Meshlets::get(Geometry *geo)
+{
+	if(meshletGlobals.geoOffset == 0)
+		return nil;
+	Meshlets *m = GEOMESHLETS(geo);
+	MeshHeader *header = geo->meshHeader;
+	if(m == nil || header == nil)
+		return nil;
+	if(m->serialNum < 0 && header->numMeshes == m->numMeshes &&
+	   header->totalIndices == m->totalIndices &&
+	   header->getIndexChecksum() == m->indexChecksum)
+		m->serialNum = header->serialNum;
+	if(m->serialNum != header->serialNum)
+		return nil;
+	return m;
+}
+
+/*
+ * Culling
+ */
+
+static void
+addRange(uint32 first, uint32 count)
+{
+	int32 mesh = drawState.numMeshes-1;
+	int32 n = drawState.firstRange[mesh+1];
+	// merge with the last range of the same mesh
+	if(n > drawState.firstRange[mesh]){
+		MeshletRange *r = &drawState.ranges[n-1];
+		if(r->firstIndex + r->numIndices == first){
+			r->numIndices += count;
+			return;
+		}
+	}
+	drawState.ranges[n].firstIndex = first;
+	drawState.ranges[n].numIndices = count;
+	drawState.firstRange[mesh+1]++;
+}
+
+static bool32
+boxOutside(Plane *planes, BBox *box)
+{
+	V3d c = scale(add(box->inf, box->sup), 0.5f);
+	V3d e = scale(sub(box->sup, box->inf), 0.5f);
+	for(int32 i = 0; i < 6; i++){
+		V3d n = planes[i].normal;
+		float32 r = fabsf(n.x)*e.x + fabsf(n.y)*e.y + fabsf(n.z)*e.z;
+		if(dot(n, c) - planes[i].distance > r)
+			return 1;
+	}
+	return 0;
+}
+
+int32
+Meshlets::beginDraw(Atomic *atomic, Camera *cam, int32 cullMode)
+{
+	int32 i, j;
+
+	Meshlets::endDraw();
+	Geometry *geo = atomic->geometry;
+	Meshlets *ml = geo ? Meshlets::get(geo) : nil;
+	if(ml == nil || cam == nil)
+		return -1;
+
+	// one more range per mesh for indices after the meshlets
+	if(ml->numMeshlets + ml->numMeshes > drawState.rangeCapacity){
+		drawState.rangeCapacity = ml->numMeshlets + ml->numMeshes;
+		rwFree(drawState.ranges);
+		drawState.ranges = rwNewT(MeshletRange, drawState.rangeCapacity, MEMDUR_EVENT | ID_MESHLET);
+	}
+	if(ml->numMeshes+1 > drawState.meshCapacity){
+		drawState.meshCapacity = ml->numMeshes+1;
+		rwFree(drawState.firstRange);
+		drawState.firstRange = rwNewT(int32, ml->numMeshes+1, MEMDUR_EVENT | ID_MESHLET);
+	}
+
+	// frustum planes and camera position in geometry space
+	Matrix *ltm = atomic->getFrame()->getRenderLTM();
+	Plane planes[6];
+	for(i = 0; i < 6; i++){
+		Plane *p = &cam->frustumPlanes[i].plane;
+		V3d n = { dot(p->normal, ltm->right), dot(p->normal, ltm->up), dot(p->normal, ltm->at) };
+		float32 len = length(n);
+		if(len == 0.0f)
+			return -1;
+		planes[i].normal = scale(n, 1.0f/len);
+		planes[i].distance = (p->distance - dot(p->normal, ltm->pos))/len;
+	}
+	Matrix inv;
+	V3d camPos;
+	Matrix::invert(&inv, ltm);
+	V3d::transformPoints(&camPos, &cam->getFrame()->getLTM()->pos, 1, &inv);
+
+	// backface test like the rasterizer does it
+	float32 coneSign = 0.0f;
+	if(cullMode == CULLBACK)
+		coneSign = 1.0f;
+	else if(cullMode == CULLFRONT)
+		coneSign = -1.0f;
+	// mirroring flips the winding on screen
+	if(dot(cross(ltm->right, ltm->up), ltm->at) < 0.0f)
+		coneSign = 0.0f;
+	if(cam->projection == Camera::PARALLEL)
+		coneSign = 0.0f;
+
+	// whole meshes are culled by their boxes first
+	GeometryBounds *bounds = GeometryBounds::get(geo);
+	if(bounds && bounds->numMeshes != ml->numMeshes)
+		bounds = nil;
+
+	drawState.geometry = geo;
+	drawState.numMeshes = 0;
+	drawState.firstRange[0] = 0;
+	int32 numTris = 0;
+	MeshletStats *stats = &drawState.stats;
+	Mesh *mesh = geo->meshHeader->getMeshes();
+	for(i = 0; i < ml->numMeshes; i++){
+		drawState.numMeshes = i+1;
+		drawState.firstRange[i+1] = drawState.firstRange[i];
+		if(bounds && boxOutside(planes, &bounds->meshBoxes[i])){
+			for(j = ml->firstMeshlet[i]; j < ml->firstMeshlet[i+1]; j++){
+				stats->numMeshlets++;
+				stats->numFrustumCulled++;
+				stats->numTriangles += ml->meshlets[j].numIndices/3;
+			}
+			continue;
+		}
+		for(j = ml->firstMeshlet[i]; j < ml->firstMeshlet[i+1]; j++){
+			Meshlet *m = &ml->meshlets[j];
+			stats->numMeshlets++;
+			stats->numTriangles += m->numIndices/3;
+			int32 k;
+			for(k = 0; k < 6; k++)
+				if(dot(planes[k].normal, m->bound.center) - planes[k].distance > m->bound.radius)
+					break;
+			if(k < 6){
+				stats->numFrustumCulled++;
+				continue;
+			}
+			if(coneSign != 0.0f && m->coneCutoff < 1.0f){
+				V3d d = sub(m->bound.center, camPos);
+				if(coneSign*dot(d, m->coneAxis) >= m->coneCutoff*length(d) + m->bound.radius){
+					stats->numConeCulled++;
+					continue;
+				}
+			}
+			addRange(m->firstIndex, m->numIndices);
+			numTris += m->numIndices/3;
+		}
+		// indices after the meshlets
+		uint32 end = ml->firstMeshlet[i+1] > ml->firstMeshlet[i] ?
+			ml->meshlets[ml->firstMeshlet[i+1]-1].firstIndex +
+			ml->meshlets[ml->firstMeshlet[i+1]-1].numIndices : 0;
+		if(mesh[i].numIndices > end){
+			addRange(end, mesh[i].numIndices - end);
+			numTris += (mesh[i].numIndices - end)/3;
+		}
+	}
+	stats->numDrawnTriangles += numTris;
+	return numTris;
+}
+
+void
+Meshlets::endDraw(void)
+{
+	drawState.geometry = nil;
+	drawState.numMeshes = 0;
+}
+
+int32
+Meshlets::getDrawRanges(int32 meshIndex, MeshletRange **ranges)
+{
+	if(drawState.geometry == nil || meshIndex >= drawState.numMeshes)
+		return -1;
+	*ranges = &drawState.ranges[drawState.firstRange[meshIndex]];
+	return drawState.firstRange[meshIndex+1] - drawState.firstRange[meshIndex];
+}
+
+void
+Meshlets::renderCB(Atomic *atomic)
+{
+	int32 n = Meshlets::beginDraw(atomic, (Camera*)engine->currentCamera,
+		GetRenderState(CULLMODE));
+	if(n != 0)
+		Atomic::defaultRenderCB(atomic);
+	Meshlets::endDraw();
+}
+
+void Meshlets::getStats(MeshletStats *stats) { *stats = drawState.stats; }
+void Meshlets::resetStats(void) { memset(&drawState.stats, 0, sizeof(MeshletStats)); }
+
+}
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+#include "rwsimd.h"
+
+#define PLUGIN_ID ID_MORPH
+
+namespace rw {
+
+MorphGlobals morphGlobals;
+
+/*
+ * Morph target blending.
+ * The blend goes into a scratch buffer that is swapped in for the
+ * geometry's first morph target while the pipeline reinstances it.
+ * Only positions and normals are marked as locked, so the other
+ * attributes aren't packed again.
+ */
+
+enum { BLENDJOBSIZE = 4096 };	// vertices
+
+// Shared by all atomics, blends are instanced right away
+static V3d *scratch;
+static int32 scratchSize;
+
+#define BLENDATOMIC(geo) (*PLUGINOFFSET(Atomic*, geo, morphGlobals.geoOffset))
+
+struct BlendJob
+{
+	float32 *dst;
+	const float32 *a;
+	const float32 *b;
+	int32 n;	// floats
+	float32 alpha;
+};
+
+static void
+blendFloats(float32 *dst, const float32 *a, const float32 *b, int32 n, float32 alpha)
+{
+	using namespace simd;
+	int32 i;
+	F4 t = set1(alpha);
+	for(i = 0; i+4 <= n; i += 4){
+		F4 va = load(a+i);
+		store(dst+i, madd(sub(load(b+i), va), t, va));
+	}
+	for(; i < n; i++)
+		dst[i] = a[i] + (b[i]-a[i])*alpha;
+}
+
+static void
+blendJob(void *data, int32 i)
+{
+	BlendJob *job = (BlendJob*)data;
+	int32 start = i*BLENDJOBSIZE*3;
+	int32 n = job->n - start;
+	if(n > BLENDJOBSIZE*3)
+		n = BLENDJOBSIZE*3;
+	blendFloats(job->dst+start, job->a+start, job->b+start, n, job->alpha);
+}
+
+void
+Morph::blend(V3d *dst, const V3d *a, const V3d *b, int32 n, float32 alpha)
+{
+	BlendJob job;
+	job.dst = (float32*)dst;
+	job.a = (const float32*)a;
+	job.b = (const float32*)b;
+	job.n = n*3;
+	job.alpha = alpha;
+	// small meshes aren't worth waking up the threads
+	if(n <= BLENDJOBSIZE)
+		blendFloats(job.dst, job.a, job.b, job.n, alpha);
+	else
+		parallelFor(blendJob, &job, (n+BLENDJOBSIZE-1)/BLENDJOBSIZE);
+}
+
+static Morph*
+getOrCreate(Atomic *atomic)
+{
+	Morph *morph = Morph::get(atomic);
+	if(morph == nil){
+		morph = rwNewT(Morph, 1, MEMDUR_EVENT | ID_MORPH);
+		if(morph == nil){
+			RWERROR((ERR_ALLOC, sizeof(Morph)));
+			return nil;
+		}
+		memset(morph, 0, sizeof(Morph));
+		*PLUGINOFFSET(Morph*, atomic, morphGlobals.atomicOffset) = morph;
+	}
+	return morph;
+}
+
+bool32
+Morph::setAnimation(Atomic *atomic, Animation *anim)
+{
+	if(anim->interpInfo->id != INTERPID){
+		RWERROR((ERR_GENERAL, "not a morph animation"));
+		return 0;
+	}
+	Morph *morph = getOrCreate(atomic);
+	if(morph == nil)
+		return 0;
+	if(morph->interp == nil){
+		morph->interp = AnimInterpolator::create(1, sizeof(MorphInterpFrame));
+		if(morph->interp == nil)
+			return 0;
+	}
+	if(!morph->interp->setCurrentAnim(anim))
+		return 0;
+	morph->interp->applyCB(morph, morph->interp->getInterpFrame(0));
+	return 1;
+}
+
+void
+Morph::addTime(Atomic *atomic, float32 t)
+{
+	Morph *morph = Morph::get(atomic);
+	if(morph == nil || morph->interp == nil || morph->interp->currentAnim == nil)
+		return;
+	morph->interp->addTime(t);
+	morph->interp->applyCB(morph, morph->interp->getInterpFrame(0));
+}
+
+void
+Morph::setTargets(Atomic *atomic, int32 target1, int32 target2, float32 alpha)
+{
+	Morph *morph = getOrCreate(atomic);
+	if(morph == nil)
+		return;
+	morph->target1 = target1;
+	morph->target2 = target2;
+	morph->alpha = alpha;
+}
+
+// Sphere around both
+static void
+mergeSpheres(Sphere *dst, const Sphere *a, const Sphere *b)
+{
+	V3d d = sub(b->center, a->center);
+	float32 dist = length(d);
+	if(dist + b->radius <= a->radius){
+		*dst = *a;
+		return;
+	}
+	if(dist + a->radius <= b->radius){
+		*dst = *b;
+		return;
+	}
+	float32 r = (dist + a->radius + b->radius)/2.0f;
+	dst->center = add(a->center, scale(d, (r - a->radius)/dist));
+	dst->radius = r;
+}
+
+void
+Morph::applyUpdate(Atomic *atomic)
+{
+	Morph *morph = Morph::get(atomic);
+	Geometry *geo = atomic->geometry;
+	if(morph == nil || geo == nil || geo->flags & Geometry::NATIVE ||
+	   geo->numMorphTargets < 2)
+		return;
+
+	int32 t1 = morph->target1;
+	int32 t2 = morph->target2;
+	float32 alpha = morph->alpha;
+	if(t1 < 0 || t1 >= geo->numMorphTargets ||
+	   t2 < 0 || t2 >= geo->numMorphTargets){
+		RWERROR((ERR_GENERAL, "morph target out of range"));
+		return;
+	}
+	if(alpha < 0.0f) alpha = 0.0f;
+	if(alpha > 1.0f) alpha = 1.0f;
+	if(geo == morph->blendGeometry && BLENDATOMIC(geo) == atomic &&
+	   geo->instData && !geo->lockedSinceInst &&
+	   t1 == morph->blendTarget1 && t2 == morph->blendTarget2 &&
+	   alpha == morph->blendAlpha)
+		return;
+
+	int32 n = geo->numVertices;
+	MorphTarget *mt1 = &geo->morphTargets[t1];
+	MorphTarget *mt2 = &geo->morphTargets[t2];
+	bool32 normals = (geo->flags & Geometry::NORMALS) && mt1->normals && mt2->normals;
+	int32 size = normals ? 2*n : n;
+	if(size > scratchSize){
+		V3d *s = rwResizeT(V3d, scratch, size, MEMDUR_GLOBAL | ID_MORPH);
+		if(s == nil){
+			RWERROR((ERR_ALLOC, size*sizeof(V3d)));
+			return;
+		}
+		scratch = s;
+		scratchSize = size;
+	}
+	MorphTarget *mt = &geo->morphTargets[0];
+	V3d *vertices = mt->vertices;
+	V3d *nrm = mt->normals;
+	Morph::blend(scratch, mt1->vertices, mt2->vertices, n, alpha);
+	mt->vertices = scratch;
+	if(normals){
+		Morph::blend(scratch+n, mt1->normals, mt2->normals, n, alpha);
+		mt->normals = scratch+n;
+	}
+
+	// morph targets are never range locked
+	geo->lockedSinceInst |= Geometry::LOCKVERTICES | Geometry::LOCKNORMALS;
+	geo->lockedRangeFlags &= ~(Geometry::LOCKVERTICES | Geometry::LOCKNORMALS);
+	atomic->getPipeline()->instance(atomic);
+	mt->vertices = vertices;
+	mt->normals = nrm;
+
+	mergeSpheres(&atomic->boundingSphere, &mt1->boundingSphere, &mt2->boundingSphere);
+	atomic->object.object.privateFlags |= Atomic::WORLDBOUNDDIRTY;
+
+	BLENDATOMIC(geo) = atomic;
+	morph->blendGeometry = geo;
+	morph->blendTarget1 = t1;
+	morph->blendTarget2 = t2;
+	morph->blendAlpha = alpha;
+}
+
+void
+Morph::destroy(Atomic *atomic)
+{
+	Morph *morph = Morph::get(atomic);
+	if(morph == nil)
+		return;
+	if(morph->interp)
+		morph->interp->destroy();
+	rwFree(morph);
+	*PLUGINOFFSET(Morph*, atomic, morphGlobals.atomicOffset) = nil;
+}
+
+/*
+ * Interpolator
+ */
+
+static void
+morphApplyCB(void *result, void *frame)
+{
+	Morph *morph = (Morph*)result;
+	MorphInterpFrame *f = (MorphInterpFrame*)frame;
+	morph->target1 = f->target1;
+	morph->target2 = f->target2;
+	morph->alpha = f->alpha;
+}
+
+static void
+morphInterpCB(void *vout, void *vin1, void *vin2, float32 t, void*)
+{
+	MorphInterpFrame *out = (MorphInterpFrame*)vout;
+	MorphKeyFrame *in1 = (MorphKeyFrame*)vin1;
+	MorphKeyFrame *in2 = (MorphKeyFrame*)vin2;
+	out->target1 = in1->target;
+	out->target2 = in2->target;
+	if(in2->time > in1->time)
+		out->alpha = (t - in1->time)/(in2->time - in1->time);
+	else
+		out->alpha = 0.0f;
+}
+
+static void
+morphFrameRead(Stream *stream, Animation *anim)
+{
+	MorphKeyFrame *frames = (MorphKeyFrame*)anim->keyframes;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		frames[i].time = stream->readF32();
+		frames[i].target = stream->readI32();
+		int32 prev = stream->readI32();
+		frames[i].prev = prev < 0 ? nil : &frames[prev];
+	}
+}
+
+static void
+morphFrameWrite(Stream *stream, Animation *anim)
+{
+	MorphKeyFrame *frames = (MorphKeyFrame*)anim->keyframes;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		stream->writeF32(frames[i].time);
+		stream->writeI32(frames[i].target);
+		stream->writeI32(frames[i].prev ? frames[i].prev - frames : -1);
+	}
+}
+
+static uint32
+morphFrameGetSize(Animation *anim)
+{
+	return anim->numFrames*(4 + 4 + 4);
+}
+
+static void*
+morphOpen(void *object, int32, int32)
+{
+	AnimInterpolatorInfo *info = rwNewT(AnimInterpolatorInfo, 1, MEMDUR_GLOBAL | ID_MORPH);
+	info->id = Morph::INTERPID;
+	info->interpKeyFrameSize = sizeof(MorphInterpFrame);
+	info->animKeyFrameSize = sizeof(MorphKeyFrame);
+	info->customDataSize = 0;
+	info->applyCB = morphApplyCB;
+	info->blendCB = nil;
+	info->interpCB = morphInterpCB;
+	info->addCB = nil;
+	info->mulRecipCB = nil;
+	info->streamRead = morphFrameRead;
+	info->streamWrite = morphFrameWrite;
+	info->streamGetSize = morphFrameGetSize;
+	AnimInterpolatorInfo::registerInterp(info);
+	return object;
+}
+
+static void*
+morphClose(void *object, int32, int32)
+{
+	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(Morph::INTERPID));
+	rwFree(scratch);
+	scratch = nil;
+	scratchSize = 0;
+	return object;
+}
+
+/*
+ * Atomic plugin
+ */
+
+static void*
+createMorph(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(Morph*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyMorph(void *object, int32, int32)
+{
+	Morph::destroy((Atomic*)object);
+	return object;
+}
+
+static void*
+copyMorph(void *dst, void *src, int32 offset, int32)
+{
+	Morph *srcmorph = *PLUGINOFFSET(Morph*, src, offset);
+	if(srcmorph == nil)
+		return dst;
+	Morph *morph = rwNewT(Morph, 1, MEMDUR_EVENT | ID_MORPH);
+	if(morph == nil){
+		RWERROR((ERR_ALLOC, sizeof(Morph)));
+		*PLUGINOFFSET(Morph*, dst, offset) = nil;
+		return dst;
+	}
+	*morph = *srcmorph;
+	morph->interp = nil;
+	*PLUGINOFFSET(Morph*, dst, offset) = morph;
+	if(srcmorph->interp && srcmorph->interp->currentAnim){
+		Morph::setAnimation((Atomic*)dst, srcmorph->interp->currentAnim);
+		Morph::addTime((Atomic*)dst, srcmorph->interp->currentTime);
+	}
+	return dst;
+}
+
+/*
+ * Geometry plugin
+ */
+
+static void*
+createBlendAtomic(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(Atomic*, object, offset) = nil;
+	return object;
+}
+
+// A copy is instanced again
+static void*
+copyBlendAtomic(void *dst, void *, int32 offset, int32)
+{
+	*PLUGINOFFSET(Atomic*, dst, offset) = nil;
+	return dst;
+}
+
+void
+registerMorphPlugin(void)
+{
+	Engine::registerPlugin(0, ID_MORPH, morphOpen, morphClose);
+	morphGlobals.atomicOffset =
+	Atomic::registerPlugin(sizeof(Morph*), ID_MORPH,
+	                       createMorph, destroyMorph, copyMorph);
+	morphGlobals.geoOffset =
+	Geometry::registerPlugin(sizeof(Atomic*), ID_MORPH,
+	                         createBlendAtomic, nil, copyBlendAtomic);
+}
+
+}
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#include "rwsimd.h"
+
+#define PLUGIN_ID ID_OCCLUSION
+
+namespace rw {
+
+using namespace simd;
+
+OcclusionGlobals occlusionGlobals;
+
+// Screen space triangle, all equations are in pixels.
+// A pixel is covered if all three edge functions are >= 0.
+struct OcclusionBuffer::ScreenTri
+{
+	float32 ea[3], eb[3], ec[3];	// edge i: ea*x + eb*y + ec
+	float32 dx, dy, d0;		// depth plane
+	int32 minx, miny, maxx, maxy;
+};
+
+static void*
+createAtomicOcclusion(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(int32, object, offset) = 0;
+	return object;
+}
+
+static void*
+copyAtomicOcclusion(void *dst, void *src, int32 offset, int32)
+{
+	*PLUGINOFFSET(int32, dst, offset) = *PLUGINOFFSET(int32, src, offset);
+	return dst;
+}
+
+void
+registerOcclusionPlugin(void)
+{
+	occlusionGlobals.atomicOffset =
+	Atomic::registerPlugin(sizeof(int32), ID_OCCLUSION,
+	                       createAtomicOcclusion, nil, copyAtomicOcclusion);
+}
+
+OcclusionBuffer*
+OcclusionBuffer::create(int32 width, int32 height)
+{
+	OcclusionBuffer *ob = rwNewT(OcclusionBuffer, 1, MEMDUR_EVENT | ID_OCCLUSION);
+	if(ob == nil){
+		RWERROR((ERR_ALLOC, sizeof(OcclusionBuffer)));
+		return nil;
+	}
+	memset(ob, 0, sizeof(OcclusionBuffer));
+	ob->tilesX = (width + TILEWIDTH-1) / TILEWIDTH;
+	ob->tilesY = (height + TILEHEIGHT-1) / TILEHEIGHT;
+	ob->width = ob->tilesX*TILEWIDTH;
+	ob->height = ob->tilesY*TILEHEIGHT;
+	ob->depth = rwNewT(float32, ob->width*ob->height, MEMDUR_EVENT | ID_OCCLUSION);
+	ob->tileMin = rwNewT(float32, ob->tilesX*ob->tilesY, MEMDUR_EVENT | ID_OCCLUSION);
+	ob->binStart = rwNewT(int32, ob->tilesX*ob->tilesY+1, MEMDUR_EVENT | ID_OCCLUSION);
+	if(ob->depth == nil || ob->tileMin == nil || ob->binStart == nil){
+		RWERROR((ERR_ALLOC, ob->width*ob->height*sizeof(float32)));
+		ob->destroy();
+		return nil;
+	}
+	memset(ob->depth, 0, ob->width*ob->height*sizeof(float32));
+	memset(ob->tileMin, 0, ob->tilesX*ob->tilesY*sizeof(float32));
+	return ob;
+}
+
+void
+OcclusionBuffer::destroy(void)
+{
+	rwFree(this->depth);
+	rwFree(this->tileMin);
+	rwFree(this->binStart);
+	rwFree(this->binTris);
+	rwFree(this->tris);
+	rwFree(this->verts);
+	rwFree(this);
+}
+
+void
+OcclusionBuffer::begin(Camera *cam)
+{
+	this->camera = cam;
+	this->viewMatrix = cam->viewMatrix;
+	this->projection = cam->projection;
+	this->nearPlane = cam->nearPlane;
+	this->farPlane = cam->farPlane;
+	this->numTris = 0;
+	this->numTested = 0;
+	this->numOccluded = 0;
+}
+
+// Project a point that was transformed by the view matrix to pixels.
+// Depth is 1/z for perspective cameras so it can be interpolated linearly.
+static void
+projectPoint(OcclusionBuffer *ob, const V3d *v, float32 *sx, float32 *sy, float32 *d)
+{
+	if(ob->projection == Camera::PERSPECTIVE){
+		float32 recip = 1.0f/v->z;
+		*sx = v->x*recip*ob->width;
+		*sy = v->y*recip*ob->height;
+		*d = recip;
+	}else{
+		*sx = v->x*ob->width;
+		*sy = v->y*ob->height;
+		*d = ob->farPlane - v->z;
+	}
+}
+
+static void
+setupTriangle(OcclusionBuffer *ob, const V3d *v0, const V3d *v1, const V3d *v2)
+{
+	float32 x[3], y[3], d[3];
+	projectPoint(ob, v0, &x[0], &y[0], &d[0]);
+	projectPoint(ob, v1, &x[1], &y[1], &d[1]);
+	projectPoint(ob, v2, &x[2], &y[2], &d[2]);
+
+	float32 area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+	if(area == 0.0f)
+		return;
+
+	float32 fminx = x[0], fmaxx = x[0];
+	float32 fminy = y[0], fmaxy = y[0];
+	for(int32 i = 1; i < 3; i++){
+		fminx = x[i] < fminx ? x[i] : fminx;
+		fmaxx = x[i] > fmaxx ? x[i] : fmaxx;
+		fminy = y[i] < fminy ? y[i] : fminy;
+		fmaxy = y[i] > fmaxy ? y[i] : fmaxy;
+	}
+	if(fmaxx < 0.0f || fmaxy < 0.0f || fminx >= ob->width || fminy >= ob->height)
+		return;
+
+	if(ob->numTris >= ob->maxTris){
+		ob->maxTris = ob->maxTris ? ob->maxTris*2 : 256;
+		ob->tris = rwResizeT(OcclusionBuffer::ScreenTri, ob->tris, ob->maxTris, MEMDUR_EVENT | ID_OCCLUSION);
+	}
+	OcclusionBuffer::ScreenTri *t = &ob->tris[ob->numTris++];
+
+	// make the edge functions positive on the inside
+	float32 s = area < 0.0f ? -1.0f : 1.0f;
+	for(int32 i = 0; i < 3; i++){
+		int32 j = i == 2 ? 0 : i+1;
+		t->ea[i] = -(y[j]-y[i])*s;
+		t->eb[i] = (x[j]-x[i])*s;
+		t->ec[i] = ((y[j]-y[i])*x[i] - (x[j]-x[i])*y[i])*s;
+	}
+	float32 recip = 1.0f/area;
+	t->dx = ((d[1]-d[0])*(y[2]-y[0]) - (d[2]-d[0])*(y[1]-y[0]))*recip;
+	t->dy = ((d[2]-d[0])*(x[1]-x[0]) - (d[1]-d[0])*(x[2]-x[0]))*recip;
+	t->d0 = d[0] - t->dx*x[0] - t->dy*y[0];
+
+	t->minx = fminx < 0.0f ? 0 : (int32)fminx;
+	t->miny = fminy < 0.0f ? 0 : (int32)fminy;
+	t->maxx = fmaxx >= ob->width ? ob->width-1 : (int32)fmaxx;
+	t->maxy = fmaxy >= ob->height ? ob->height-1 : (int32)fmaxy;
+}
+
+static V3d
+clipPoint(const V3d *a, const V3d *b, float32 z)
+{
+	float32 t = (z - a->z)/(b->z - a->z);
+	V3d v;
+	v.x = a->x + (b->x - a->x)*t;
+	v.y = a->y + (b->y - a->y)*t;
+	v.z = z;
+	return v;
+}
+
+// clip against the near plane, this can give a quad
+static void
+addTriangle(OcclusionBuffer *ob, const V3d *v0, const V3d *v1, const V3d *v2)
+{
+	const V3d *in[3] = { v0, v1, v2 };
+	V3d out[4];
+	int32 n = 0;
+	float32 z = ob->nearPlane;
+
+	for(int32 i = 0; i < 3; i++){
+		const V3d *a = in[i];
+		const V3d *b = in[i == 2 ? 0 : i+1];
+		bool32 ain = a->z >= z;
+		bool32 bin = b->z >= z;
+		if(ain)
+			out[n++] = *a;
+		if(ain != bin)
+			out[n++] = clipPoint(a, b, z);
+	}
+	if(n < 3)
+		return;
+	setupTriangle(ob, &out[0], &out[1], &out[2]);
+	if(n == 4)
+		setupTriangle(ob, &out[0], &out[2], &out[3]);
+}
+
+void
+OcclusionBuffer::addOccluder(Atomic *atomic)
+{
+	Geometry *geo = atomic->geometry;
+	if(geo == nil || geo->flags & Geometry::NATIVE ||
+	   geo->triangles == nil || geo->numMorphTargets == 0)
+		return;
+
+	if(geo->numVertices > this->maxVerts){
+		this->maxVerts = geo->numVertices;
+		this->verts = rwResizeT(V3d, this->verts, this->maxVerts, MEMDUR_EVENT | ID_OCCLUSION);
+	}
+	Matrix m;
+	Matrix::mult(&m, atomic->getFrame()->getLTM(), &this->viewMatrix);
+	V3d::transformPoints(this->verts, geo->morphTargets[0].vertices, geo->numVertices, &m);
+
+	for(int32 i = 0; i < geo->numTriangles; i++){
+		Triangle *t = &geo->triangles[i];
+		addTriangle(this, &this->verts[t->v[0]], &this->verts[t->v[1]], &this->verts[t->v[2]]);
+	}
+}
+
+void
+OcclusionBuffer::addOccluders(World *world)
+{
+	FORLIST(lnk, world->clumps){
+		Clump *c = Clump::fromWorld(lnk);
+		FORLIST(alnk, c->atomics){
+			Atomic *a = Atomic::fromClump(alnk);
+			if(isOccluder(a))
+				this->addOccluder(a);
+		}
+	}
+}
+
+static void
+rasterTile(void *data, int32 tile)
+{
+	OcclusionBuffer *ob = (OcclusionBuffer*)data;
+	int32 x0 = (tile % ob->tilesX)*OcclusionBuffer::TILEWIDTH;
+	int32 y0 = (tile / ob->tilesX)*OcclusionBuffer::TILEHEIGHT;
+	int32 x1 = x0 + OcclusionBuffer::TILEWIDTH-1;
+	int32 y1 = y0 + OcclusionBuffer::TILEHEIGHT-1;
+	int32 x, y;
+	F4 zero4 = zero();
+	F4 laneoff = set(0.5f, 1.5f, 2.5f, 3.5f);
+
+	for(y = y0; y <= y1; y++)
+		memset(&ob->depth[y*ob->width + x0], 0, OcclusionBuffer::TILEWIDTH*sizeof(float32));
+
+	for(int32 i = ob->binStart[tile]; i < ob->binStart[tile+1]; i++){
+		OcclusionBuffer::ScreenTri *t = &ob->tris[ob->binTris[i]];
+		int32 minx = t->minx > x0 ? t->minx : x0;
+		int32 maxx = t->maxx < x1 ? t->maxx : x1;
+		int32 miny = t->miny > y0 ? t->miny : y0;
+		int32 maxy = t->maxy < y1 ? t->maxy : y1;
+		minx &= ~3;
+
+		F4 ea0 = set1(t->ea[0]), ea1 = set1(t->ea[1]), ea2 = set1(t->ea[2]);
+		F4 dx = set1(t->dx);
+		for(y = miny; y <= maxy; y++){
+			float32 fy = y + 0.5f;
+			F4 row0 = set1(t->eb[0]*fy + t->ec[0]);
+			F4 row1 = set1(t->eb[1]*fy + t->ec[1]);
+			F4 row2 = set1(t->eb[2]*fy + t->ec[2]);
+			F4 rowd = set1(t->dy*fy + t->d0);
+			float32 *dst = &ob->depth[y*ob->width];
+			for(x = minx; x <= maxx; x += 4){
+				F4 px = add(set1((float32)x), laneoff);
+				F4 out = or_(or_(cmplt(madd(ea0, px, row0), zero4),
+				                 cmplt(madd(ea1, px, row1), zero4)),
+				             cmplt(madd(ea2, px, row2), zero4));
+				if(movemask(out) == 0xF)
+					continue;
+				F4 old = load(&dst[x]);
+				F4 d = max(old, madd(dx, px, rowd));
+				store(&dst[x], select(out, old, d));
+			}
+		}
+	}
+
+	F4 m = load(&ob->depth[y0*ob->width + x0]);
+	for(y = y0; y <= y1; y++)
+		for(x = x0; x <= x1; x += 4)
+			m = min(m, load(&ob->depth[y*ob->width + x]));
+	float32 f[4];
+	store(f, m);
+	f[0] = f[0] < f[1] ? f[0] : f[1];
+	f[2] = f[2] < f[3] ? f[2] : f[3];
+	ob->tileMin[tile] = f[0] < f[2] ? f[0] : f[2];
+}
+
+void
+OcclusionBuffer::rasterize(void)
+{
+	int32 i, tx, ty;
+	int32 numTiles = this->tilesX*this->tilesY;
+	int32 *bins = this->binStart;
+
+	// count, then sort triangles into tile bins
+	memset(bins, 0, (numTiles+1)*sizeof(int32));
+	for(i = 0; i < this->numTris; i++){
+		ScreenTri *t = &this->tris[i];
+		for(ty = t->miny/TILEHEIGHT; ty <= t->maxy/TILEHEIGHT; ty++)
+			for(tx = t->minx/TILEWIDTH; tx <= t->maxx/TILEWIDTH; tx++)
+				bins[ty*this->tilesX + tx + 1]++;
+	}
+	for(i = 0; i < numTiles; i++)
+		bins[i+1] += bins[i];
+	if(bins[numTiles] > this->maxBinTris){
+		this->maxBinTris = bins[numTiles];
+		this->binTris = rwResizeT(int32, this->binTris, this->maxBinTris, MEMDUR_EVENT | ID_OCCLUSION);
+	}
+	for(i = 0; i < this->numTris; i++){
+		ScreenTri *t = &this->tris[i];
+		for(ty = t->miny/TILEHEIGHT; ty <= t->maxy/TILEHEIGHT; ty++)
+			for(tx = t->minx/TILEWIDTH; tx <= t->maxx/TILEWIDTH; tx++)
+				this->binTris[bins[ty*this->tilesX + tx]++] = i;
+	}
+	// filling moved every start to the next bin
+	for(i = numTiles; i > 0; i--)
+		bins[i] = bins[i-1];
+	bins[0] = 0;
+
+	parallelFor(rasterTile, this, numTiles);
+}
+
+bool32
+OcclusionBuffer::testBBox(const BBox *box)
+{
+	Matrix *m = &this->viewMatrix;
+	F4 x = set(box->inf.x, box->sup.x, box->inf.x, box->sup.x);
+	F4 y = set(box->inf.y, box->inf.y, box->sup.y, box->sup.y);
+	F4 z0 = set1(box->inf.z);
+	F4 z1 = set1(box->sup.z);
+
+	// transform the 8 corners, 4 at a time
+	F4 bx = madd(set1(m->right.x), x, madd(set1(m->up.x), y, set1(m->pos.x)));
+	F4 by = madd(set1(m->right.y), x, madd(set1(m->up.y), y, set1(m->pos.y)));
+	F4 bz = madd(set1(m->right.z), x, madd(set1(m->up.z), y, set1(m->pos.z)));
+	F4 ax = set1(m->at.x), ay = set1(m->at.y), az = set1(m->at.z);
+	F4 cx0 = madd(ax, z0, bx), cx1 = madd(ax, z1, bx);
+	F4 cy0 = madd(ay, z0, by), cy1 = madd(ay, z1, by);
+	F4 cz0 = madd(az, z0, bz), cz1 = madd(az, z1, bz);
+
+	F4 zmin4 = min(cz0, cz1);
+	float32 f[4];
+	store(f, zmin4);
+	float32 zmin = f[0];
+	for(int32 i = 1; i < 4; i++)
+		zmin = f[i] < zmin ? f[i] : zmin;
+
+	this->numTested++;
+	// crossing the near plane, can't say anything
+	if(zmin <= this->nearPlane)
+		return 1;
+
+	F4 u0, u1, v0, v1;
+	float32 dobj;
+	if(this->projection == Camera::PERSPECTIVE){
+		float32 z[8], r[8];
+		store(z, cz0);
+		store(z+4, cz1);
+		for(int32 i = 0; i < 8; i++)
+			r[i] = 1.0f/z[i];
+		F4 rz0 = load(r), rz1 = load(r+4);
+		u0 = mul(cx0, rz0); u1 = mul(cx1, rz1);
+		v0 = mul(cy0, rz0); v1 = mul(cy1, rz1);
+		dobj = 1.0f/zmin;
+	}else{
+		u0 = cx0; u1 = cx1;
+		v0 = cy0; v1 = cy1;
+		dobj = this->farPlane - zmin;
+		if(dobj <= 0.0f)
+			goto occluded;
+	}
+
+	{
+		float32 umin[4], umax[4], vmin[4], vmax[4];
+		store(umin, min(u0, u1));
+		store(umax, max(u0, u1));
+		store(vmin, min(v0, v1));
+		store(vmax, max(v0, v1));
+		for(int32 i = 1; i < 4; i++){
+			umin[0] = umin[i] < umin[0] ? umin[i] : umin[0];
+			umax[0] = umax[i] > umax[0] ? umax[i] : umax[0];
+			vmin[0] = vmin[i] < vmin[0] ? vmin[i] : vmin[0];
+			vmax[0] = vmax[i] > vmax[0] ? vmax[i] : vmax[0];
+		}
+		float32 fx0 = umin[0]*this->width;
+		float32 fx1 = umax[0]*this->width;
+		float32 fy0 = vmin[0]*this->height;
+		float32 fy1 = vmax[0]*this->height;
+		// not on screen at all
+		if(fx1 < 0.0f || fy1 < 0.0f || fx0 >= this->width || fy0 >= this->height)
+			goto occluded;
+		// Occluders are sampled at pixel centers so they can cover
+		// pixels they only partly overlap. Grow the rectangle by
+		// a pixel to be conservative.
+		fx0 -= 1.0f; fy0 -= 1.0f;
+		fx1 += 1.0f; fy1 += 1.0f;
+		int32 px0 = fx0 < 0.0f ? 0 : (int32)fx0;
+		int32 py0 = fy0 < 0.0f ? 0 : (int32)fy0;
+		int32 px1 = fx1 >= this->width ? this->width-1 : (int32)fx1;
+		int32 py1 = fy1 >= this->height ? this->height-1 : (int32)fy1;
+
+		F4 d4 = set1(dobj);
+		F4 fpx0 = set1((float32)px0 - 0.5f);
+		F4 fpx1 = set1((float32)px1 + 0.5f);
+		F4 laneoff = set(0.0f, 1.0f, 2.0f, 3.0f);
+		for(int32 ty = py0/TILEHEIGHT; ty <= py1/TILEHEIGHT; ty++)
+		for(int32 tx = px0/TILEWIDTH; tx <= px1/TILEWIDTH; tx++){
+			// all of the tile is in front of the object
+			if(this->tileMin[ty*this->tilesX + tx] >= dobj)
+				continue;
+			int32 x0 = tx*TILEWIDTH, x1 = x0 + TILEWIDTH-1;
+			int32 y0 = ty*TILEHEIGHT, y1 = y0 + TILEHEIGHT-1;
+			// some pixel in the tile is behind the object
+			if(x0 >= px0 && x1 <= px1 && y0 >= py0 && y1 <= py1)
+				return 1;
+			x0 = x0 > px0 ? x0 : px0;
+			x1 = x1 < px1 ? x1 : px1;
+			y0 = y0 > py0 ? y0 : py0;
+			y1 = y1 < py1 ? y1 : py1;
+			for(int32 y = y0; y <= y1; y++){
+				float32 *src = &this->depth[y*this->width];
+				for(int32 x = x0 & ~3; x <= x1; x += 4){
+					F4 px = add(set1((float32)x), laneoff);
+					F4 inside = and_(cmpgt(px, fpx0), cmplt(px, fpx1));
+					if(movemask(and_(inside, cmplt(load(&src[x]), d4))))
+						return 1;
+				}
+			}
+		}
+	}
+occluded:
+	this->numOccluded++;
+	return 0;
+}
+
+bool32
+OcclusionBuffer::testSphere(const Sphere *sphere)
+{
+	BBox box;
+	box.inf.x = sphere->center.x - sphere->radius;
+	box.inf.y = sphere->center.y - sphere->radius;
+	box.inf.z = sphere->center.z - sphere->radius;
+	box.sup.x = sphere->center.x + sphere->radius;
+	box.sup.y = sphere->center.y + sphere->radius;
+	box.sup.z = sphere->center.z + sphere->radius;
+	return this->testBBox(&box);
+}
+
+bool32
+OcclusionBuffer::testAtomic(Atomic *atomic)
+{
+	BBox box;
+	if(!GeometryBounds::getWorldBBox(atomic, &box))
+		return this->testSphere(atomic->getWorldBoundingSphere());
+	// both contain the atomic, so does the overlap
+	Sphere *s = atomic->getWorldBoundingSphere();
+	box.inf.x = box.inf.x > s->center.x - s->radius ? box.inf.x : s->center.x - s->radius;
+	box.inf.y = box.inf.y > s->center.y - s->radius ? box.inf.y : s->center.y - s->radius;
+	box.inf.z = box.inf.z > s->center.z - s->radius ? box.inf.z : s->center.z - s->radius;
+	box.sup.x = box.sup.x < s->center.x + s->radius ? box.sup.x : s->center.x + s->radius;
+	box.sup.y = box.sup.y < s->center.y + s->radius ? box.sup.y : s->center.y + s->radius;
+	box.sup.z = box.sup.z < s->center.z + s->radius ? box.sup.z : s->center.z + s->radius;
+	return this->testBBox(&box);
+}
+
+void
+OcclusionBuffer::renderWorld(World *world)
+{
+	FORLIST(lnk, world->clumps){
+		Clump *c = Clump::fromWorld(lnk);
+		FORLIST(alnk, c->atomics){
+			Atomic *a = Atomic::fromClump(alnk);
+			if((a->object.object.flags & Atomic::RENDER) == 0)
+				continue;
+			if(this->camera->frustumTestSphere(a->getWorldBoundingSphere()) == Camera::SPHEREOUTSIDE)
+				continue;
+			if(!isOccluder(a) && !this->testAtomic(a))
+				continue;
+			a->render();
+		}
+	}
+}
+
+}
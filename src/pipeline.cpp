@@ -2,18 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwplg.h"
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
+#include "rwsimd.h"
 
 #define COLOR_ARGB(a,r,g,b) \
     ((uint32)((((a)&0xff)<<24)|(((r)&0xff)<<16)|(((g)&0xff)<<8)|((b)&0xff)))
 
 namespace rw {
 
+uint32 Geometry::quantizeOnInstance;
+
 static void nothing(ObjPipeline *, Atomic*) {}
 
 void
@@ -44,8 +48,27 @@ ObjPipeline::destroy(void)
 void
 findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
 {
+	using namespace simd;
 	uint32 min = 0xFFFFFFFF;
 	uint32 max = 0;
+	// eight indices at a time, then the rest
+	if(numIndices >= 8){
+		uint16 lo[8], hi[8];
+		I4 vmin = set1i(-1);
+		I4 vmax = set1i(0);
+		for(; numIndices >= 8; numIndices -= 8){
+			I4 v = loadi(indices);
+			vmin = minu16(vmin, v);
+			vmax = maxu16(vmax, v);
+			indices += 8;
+		}
+		storei(lo, vmin);
+		storei(hi, vmax);
+		for(int32 i = 0; i < 8; i++){
+			if(lo[i] < min) min = lo[i];
+			if(hi[i] > max) max = hi[i];
+		}
+	}
 	while(numIndices--){
 		if(*indices < min)
 			min = *indices;
@@ -65,82 +88,377 @@ findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, i
 		*numVertices = num;
 }
 
+// helper functions for quantized formats
+
+// Round to nearest, half away from zero
+static simd::I4
+roundi(simd::F4 a)
+{
+	using namespace simd;
+	return toint(add(a, select(cmplt(a, zero()), set1(-0.5f), set1(0.5f))));
+}
+
+// Four vertices as x, y and z vectors.
+// Reads 4 bytes past the last vertex.
+static void
+loadV3d4(const V3d *v, simd::F4 &x, simd::F4 &y, simd::F4 &z)
+{
+	using namespace simd;
+	F4 w;
+	x = load(&v[0].x);
+	y = load(&v[1].x);
+	z = load(&v[2].x);
+	w = load(&v[3].x);
+	transpose(x, y, z, w);
+}
+
+// Finite floats to half floats in the low 16 bits, rounded to nearest even
+static simd::I4
+toHalf(simd::F4 f)
+{
+	using namespace simd;
+	I4 sign = srli(andi(asint(f), set1i(0x80000000)), 16);
+	F4 a = min(abs(f), set1(65504.0f));
+	I4 ai = asint(a);
+	// denormals: let the float adder do the rounding
+	I4 den = addi(asint(add(a, set1(0.5f))), set1i(-(126<<23)));
+	// normals: rebias the exponent
+	I4 odd = andi(srli(ai, 13), set1i(1));
+	I4 nrm = srli(addi(addi(ai, set1i(0xFFF - (112<<23))), odd), 13);
+	F4 isDen = cmplt(a, set1(1.0f/16384.0f));
+	return ori(asint(select(isDen, asfloat(den), asfloat(nrm))), sign);
+}
+
+static float32
+fromHalf(uint16 h)
+{
+	uint32 s = (h & 0x8000) << 16;
+	uint32 e = (h >> 10) & 0x1F;
+	uint32 m = h & 0x3FF;
+	uint32 bits;
+	float32 f;
+	if(e == 0){
+		f = m/16777216.0f;
+		return s ? -f : f;
+	}
+	if(e == 31)
+		bits = s | 0x7F800000 | m<<13;
+	else
+		bits = s | (e+112)<<23 | m<<13;
+	memcpy(&f, &bits, 4);
+	return f;
+}
+
+// n vertices of up to four, (v-offset)*scale as normalized shorts
+static void
+quantV3d4(uint8 *dst, const V3d *src, uint32 n, uint32 stride,
+	simd::F4 ox, simd::F4 oy, simd::F4 oz, simd::F4 sx, simd::F4 sy, simd::F4 sz)
+{
+	using namespace simd;
+	int32 q[3][4];
+	F4 x, y, z;
+	F4 lo = set1(-32767.0f);
+	F4 hi = set1(32767.0f);
+	loadV3d4(src, x, y, z);
+	storei(q[0], roundi(min(max(mul(sub(x, ox), sx), lo), hi)));
+	storei(q[1], roundi(min(max(mul(sub(y, oy), sy), lo), hi)));
+	storei(q[2], roundi(min(max(mul(sub(z, oz), sz), lo), hi)));
+	for(uint32 i = 0; i < n; i++){
+		int16 *d = (int16*)dst;
+		d[0] = q[0][i];
+		d[1] = q[1][i];
+		d[2] = q[2][i];
+		d[3] = 0;
+		dst += stride;
+	}
+}
+
+// n vertices of up to four, octahedral encoding
+static void
+octV3d4(uint8 *dst, const V3d *src, uint32 n, uint32 stride)
+{
+	using namespace simd;
+	int32 q[2][4];
+	F4 x, y, z;
+	F4 one = set1(1.0f);
+	F4 mone = set1(-1.0f);
+	loadV3d4(src, x, y, z);
+	// project onto the octahedron
+	F4 l = add(add(abs(x), abs(y)), abs(z));
+	F4 inv = div(one, max(l, set1(1e-20f)));
+	x = mul(x, inv);
+	y = mul(y, inv);
+	// and fold the lower half over the diagonals
+	F4 fx = mul(sub(one, abs(y)), select(cmplt(x, zero()), mone, one));
+	F4 fy = mul(sub(one, abs(x)), select(cmplt(y, zero()), mone, one));
+	F4 lower = cmplt(z, zero());
+	x = select(lower, fx, x);
+	y = select(lower, fy, y);
+	storei(q[0], roundi(mul(x, set1(32767.0f))));
+	storei(q[1], roundi(mul(y, set1(32767.0f))));
+	for(uint32 i = 0; i < n; i++){
+		int16 *d = (int16*)dst;
+		d[0] = q[0][i];
+		d[1] = q[1][i];
+		dst += stride;
+	}
+}
+
+void
+getQuantization(V3d *src, uint32 numVertices, V3d *quantScale, V3d *quantOffset)
+{
+	BBox box;
+	if(numVertices == 0){
+		quantScale->set(1.0f, 1.0f, 1.0f);
+		quantOffset->set(0.0f, 0.0f, 0.0f);
+		return;
+	}
+	box.calculate(src, numVertices);
+	*quantOffset = scale(add(box.inf, box.sup), 0.5f);
+	*quantScale = scale(sub(box.sup, box.inf), 0.5f);
+}
+
+void
+instQuantV3d(uint8 *dst, V3d *src, uint32 numVertices, uint32 stride, const V3d *scale, const V3d *offset)
+{
+	using namespace simd;
+	uint32 i;
+	V3d tmp[5];
+	if(src == nil){
+		for(i = 0; i < numVertices; i++)
+			memset(dst + i*stride, 0, 8);
+		return;
+	}
+	F4 ox = set1(offset->x);
+	F4 oy = set1(offset->y);
+	F4 oz = set1(offset->z);
+	// flat boxes only have the offset
+	F4 sx = set1(scale->x != 0.0f ? 32767.0f/scale->x : 0.0f);
+	F4 sy = set1(scale->y != 0.0f ? 32767.0f/scale->y : 0.0f);
+	F4 sz = set1(scale->z != 0.0f ? 32767.0f/scale->z : 0.0f);
+	// the loads read past the vertices, do the last ones from a copy
+	for(i = 0; i+4 < numVertices; i += 4)
+		quantV3d4(dst + i*stride, &src[i], 4, stride, ox, oy, oz, sx, sy, sz);
+	if(i < numVertices){
+		memset(tmp, 0, sizeof(tmp));
+		memcpy(tmp, &src[i], (numVertices-i)*sizeof(V3d));
+		quantV3d4(dst + i*stride, tmp, numVertices-i, stride, ox, oy, oz, sx, sy, sz);
+	}
+}
+
+static void
+instOctV3d(uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
+{
+	uint32 i;
+	V3d tmp[5];
+	if(src == nil){
+		for(i = 0; i < numVertices; i++)
+			memset(dst + i*stride, 0, 4);
+		return;
+	}
+	for(i = 0; i+4 < numVertices; i += 4)
+		octV3d4(dst + i*stride, &src[i], 4, stride);
+	if(i < numVertices){
+		memset(tmp, 0, sizeof(tmp));
+		memcpy(tmp, &src[i], (numVertices-i)*sizeof(V3d));
+		octV3d4(dst + i*stride, tmp, numVertices-i, stride);
+	}
+}
+
+// Interleaving and deinterleaving of vertex attributes.
+// Packing and swizzling is done four vertices at a time,
+// the scattered reads and writes remain scalar.
+// Plain float copies are not vectorized: loading four vertices and
+// shuffling them into per-vertex stores measured slower than one
+// memcpy per vertex, in cache and out.
+
+static void
+copyStrided(uint8 *dst, uint32 dstStride, const uint8 *src, uint32 srcStride, uint32 size, uint32 n)
+{
+	if(dstStride == size && srcStride == size){
+		memcpy(dst, src, size*n);
+		return;
+	}
+	for(uint32 i = 0; i < n; i++){
+		memcpy(dst, src, size);
+		dst += dstStride;
+		src += srcStride;
+	}
+}
+
+static void
+fillStrided(uint8 *dst, uint32 stride, const void *value, uint32 size, uint32 n)
+{
+	for(uint32 i = 0; i < n; i++){
+		memcpy(dst, value, size);
+		dst += stride;
+	}
+}
+
+// Four normals, 11:11:10 packing
+static void
+compNormV3d4(uint32 *dst, const V3d *src)
+{
+	using namespace simd;
+	F4 x, y, z;
+	loadV3d4(src, x, y, z);
+	I4 ix = andi(toint(mul(x, set1(1023.0f))), set1i(0x7FF));
+	I4 iy = andi(toint(mul(y, set1(1023.0f))), set1i(0x7FF));
+	I4 iz = andi(toint(mul(z, set1(511.0f))), set1i(0x3FF));
+	storei(dst, ori(ori(ix, slli(iy, 11)), slli(iz, 22)));
+}
+
+static void
+instCompNormV3d(uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
+{
+	uint32 i, j;
+	uint32 q[4];
+	V3d tmp[5];
+	// last full block would read past the end
+	for(i = 0; i+4 < numVertices; i += 4){
+		compNormV3d4(q, &src[i]);
+		*(uint32*)dst = q[0]; dst += stride;
+		*(uint32*)dst = q[1]; dst += stride;
+		*(uint32*)dst = q[2]; dst += stride;
+		*(uint32*)dst = q[3]; dst += stride;
+	}
+	if(i < numVertices){
+		memset(tmp, 0, sizeof(tmp));
+		memcpy(tmp, &src[i], (numVertices-i)*sizeof(V3d));
+		compNormV3d4(q, tmp);
+		for(j = 0; i+j < numVertices; j++)
+			*(uint32*)(dst + j*stride) = q[j];
+	}
+}
+
+// Four normals into x, y and z
+static void
+uncompNormV3d4(const uint32 *p, float32 *x, float32 *y, float32 *z)
+{
+	using namespace simd;
+	I4 v = loadi(p);
+	// sign extending shifts
+	store(x, div(tofloat(srai(slli(v, 21), 21)), set1(1023.0f)));
+	store(y, div(tofloat(srai(slli(v, 10), 21)), set1(1023.0f)));
+	store(z, div(tofloat(srai(v, 22)), set1(511.0f)));
+}
+
+static void
+uninstCompNormV3d(V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
+{
+	uint32 i, j;
+	uint32 p[4];
+	float32 x[4], y[4], z[4];
+	for(i = 0; i+4 <= numVertices; i += 4){
+		p[0] = *(uint32*)src; src += stride;
+		p[1] = *(uint32*)src; src += stride;
+		p[2] = *(uint32*)src; src += stride;
+		p[3] = *(uint32*)src; src += stride;
+		uncompNormV3d4(p, x, y, z);
+		for(j = 0; j < 4; j++)
+			dst[i+j].set(x[j], y[j], z[j]);
+	}
+	if(i < numVertices){
+		memset(p, 0, sizeof(p));
+		for(j = 0; i+j < numVertices; j++)
+			p[j] = *(uint32*)(src + j*stride);
+		uncompNormV3d4(p, x, y, z);
+		for(j = 0; i+j < numVertices; j++)
+			dst[i+j].set(x[j], y[j], z[j]);
+	}
+}
+
+// RGBA in memory to BGRA, four at a time
+static simd::I4
+swapRB(simd::I4 v)
+{
+	using namespace simd;
+	I4 mask = set1i(0xFF);
+	return ori(andi(v, set1i(0xFF00FF00)),
+	           ori(andi(srli(v, 16), mask), slli(andi(v, mask), 16)));
+}
+
 void
 instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride)
 {
 	if(type == VERT_FLOAT4)
+		copyStrided(dst, stride, (uint8*)src, 16, 16, numVertices);
+	else if(type == VERT_UBYTE4N){
+		using namespace simd;
+		int32 q[4];
 		for(uint32 i = 0; i < numVertices; i++){
-			memcpy(dst, src, 16);
+			F4 w = min(max(load(&src->x), zero()), set1(1.0f));
+			storei(q, roundi(mul(w, set1(255.0f))));
+			// rounding must not change the sum, put the error on the largest weight
+			int32 sum = q[0] + q[1] + q[2] + q[3];
+			if(sum != 0 && sum != 255){
+				int32 k = 0;
+				for(int32 j = 1; j < 4; j++)
+					if(q[j] > q[k])
+						k = j;
+				q[k] += 255 - sum;
+				q[k] = q[k] < 0 ? 0 : q[k] > 255 ? 255 : q[k];
+			}
+			dst[0] = q[0];
+			dst[1] = q[1];
+			dst[2] = q[2];
+			dst[3] = q[3];
 			dst += stride;
 			src++;
 		}
-	else
+	}else
 		assert(0 && "unsupported instV4d type");
 }
 
 void
 instV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
 {
-	if(src == nullptr)
-	{
-		if(type == VERT_FLOAT3) 
-		{
-			V3d defaultValue = {0,0,0};
-			for(uint32 i = 0; i < numVertices; i++) {
-				memcpy(dst, &defaultValue, 12);
-				dst += stride;
-				src++;
-			}
-		}
-		else if(type == VERT_COMPNORM)
-		{
-			assert(0 && "unsupported VERT_COMPNORM type");
-		}
-	} 
-	else 
-	{
-		if(type == VERT_FLOAT3)
-			for(uint32 i = 0; i < numVertices; i++) {
-				memcpy(dst, src, 12);
-				dst += stride;
-				src++;
-			}
-		else if(type == VERT_COMPNORM)
-			for(uint32 i = 0; i < numVertices; i++) {
-				uint32 n = ((((uint32)(src->z * 511.0f)) & 0x3ff) << 22) | ((((uint32)(src->y * 1023.0f)) & 0x7ff) << 11) |
-					   ((((uint32)(src->x * 1023.0f)) & 0x7ff) << 0);
-				*(uint32 *)dst = n;
-				dst += stride;
-				src++;
-			}
-		else
-			assert(0 && "unsupported instV3d type");
-	}
+	if(type == VERT_NORMSHORT3){
+		static V3d one = { 1.0f, 1.0f, 1.0f };
+		static V3d zero = { 0.0f, 0.0f, 0.0f };
+		instQuantV3d(dst, src, numVertices, stride, &one, &zero);
+	}else if(type == VERT_OCTNORM)
+		instOctV3d(dst, src, numVertices, stride);
+	else if(type == VERT_FLOAT3){
+		if(src == nil){
+			V3d defaultValue = { 0.0f, 0.0f, 0.0f };
+			fillStrided(dst, stride, &defaultValue, 12, numVertices);
+		}else
+			copyStrided(dst, stride, (uint8*)src, 12, 12, numVertices);
+	}else if(type == VERT_COMPNORM){
+		assert(src && "unsupported VERT_COMPNORM default");
+		instCompNormV3d(dst, src, numVertices, stride);
+	}else
+		assert(0 && "unsupported instV3d type");
 }
 
 void
 uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
 {
 	if(type == VERT_FLOAT3)
+		copyStrided((uint8*)dst, 12, src, stride, 12, numVertices);
+	else if(type == VERT_COMPNORM)
+		uninstCompNormV3d(dst, src, numVertices, stride);
+	else if(type == VERT_NORMSHORT3)
 		for(uint32 i = 0; i < numVertices; i++){
-			memcpy(dst, src, 12);
+			int16 *s = (int16*)src;
+			dst->x = s[0] < -32767 ? -1.0f : s[0] / 32767.0f;
+			dst->y = s[1] < -32767 ? -1.0f : s[1] / 32767.0f;
+			dst->z = s[2] < -32767 ? -1.0f : s[2] / 32767.0f;
 			src += stride;
 			dst++;
 		}
-	else if(type == VERT_COMPNORM)
+	else if(type == VERT_OCTNORM)
 		for(uint32 i = 0; i < numVertices; i++){
-			uint32 n = *(uint32*)src;
-			int32 normal[3];
-			normal[0] = n & 0x7FF;
-			normal[1] = (n >> 11) & 0x7FF;
-			normal[2] = (n >> 22) & 0x3FF;
-			// sign extend
-			if(normal[0] & 0x400) normal[0] |= ~0x7FF;
-			if(normal[1] & 0x400) normal[1] |= ~0x7FF;
-			if(normal[2] & 0x200) normal[2] |= ~0x3FF;
-			dst->x = normal[0] / 1023.0f;
-			dst->y = normal[1] / 1023.0f;
-			dst->z = normal[2] / 511.0f;
+			int16 *s = (int16*)src;
+			V3d n;
+			n.x = s[0] / 32767.0f;
+			n.y = s[1] / 32767.0f;
+			n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+			float32 t = n.z < 0.0f ? -n.z : 0.0f;
+			n.x += n.x >= 0.0f ? -t : t;
+			n.y += n.y >= 0.0f ? -t : t;
+			*dst = length(n) > 0.0f ? normalize(n) : n;
 			src += stride;
 			dst++;
 		}
@@ -148,77 +466,134 @@ uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
 		assert(0 && "unsupported uninstV3d type");
 }
 
-void
-instTexCoords(int type, uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
+static void
+instHalfTexCoords(uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
 {
-	assert(type == VERT_FLOAT2);
-	for(uint32 i = 0; i < numVertices; i++){
-		if (src != nullptr) 
-		{
-			memcpy(dst, src, 8);
-			dst += stride;
-			src++;
+	using namespace simd;
+	uint32 i, j, n;
+	uint32 h[4];
+	TexCoords tmp[4];
+	if(src == nil){
+		// 0, 1
+		for(i = 0; i < numVertices; i++)
+			*(uint32*)(dst + i*stride) = 0x3C000000;
+		return;
+	}
+	for(i = 0; i < numVertices; i += 4){
+		TexCoords *tc = &src[i];
+		n = numVertices-i < 4 ? numVertices-i : 4;
+		if(n < 4){
+			memset(tmp, 0, sizeof(tmp));
+			memcpy(tmp, tc, n*sizeof(TexCoords));
+			tc = tmp;
 		}
-		else 
-		{
-			TexCoords newSrc = {0.f,1.f};
-			memcpy(dst, &newSrc, 8);
-			dst += stride;
+		for(j = 0; j < n; j += 2){
+			// u v u v to uv _ uv _
+			I4 a = toHalf(load(&tc[j].u));
+			storei(h, ori(a, slli(swaplanes(a), 16)));
+			*(uint32*)(dst + (i+j)*stride) = h[0];
+			if(j+1 < n)
+				*(uint32*)(dst + (i+j+1)*stride) = h[2];
 		}
 	}
 }
 
 void
-uninstTexCoords(int type, TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride)
+instTexCoords(int type, uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
 {
+	if(type == VERT_HALF2){
+		instHalfTexCoords(dst, src, numVertices, stride);
+		return;
+	}
 	assert(type == VERT_FLOAT2);
-	for(uint32 i = 0; i < numVertices; i++){
-		memcpy(dst, src, 8);
-		src += stride;
-		dst++;
+	if(src == nil){
+		TexCoords defaultValue = { 0.0f, 1.0f };
+		fillStrided(dst, stride, &defaultValue, 8, numVertices);
+	}else
+		copyStrided(dst, stride, (uint8*)src, 8, 8, numVertices);
+}
+
+void
+uninstTexCoords(int type, TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride)
+{
+	if(type == VERT_HALF2){
+		for(uint32 i = 0; i < numVertices; i++){
+			dst->u = fromHalf(((uint16*)src)[0]);
+			dst->v = fromHalf(((uint16*)src)[1]);
+			src += stride;
+			dst++;
+		}
+		return;
 	}
+	assert(type == VERT_FLOAT2);
+	copyStrided((uint8*)dst, 8, src, stride, 8, numVertices);
 }
 
 bool32
 instColor(int type, uint8 *dst, RGBA *src, uint32 numVertices, uint32 stride)
 {
-	uint8 alpha = 0xFF;
-	if(type == VERT_ARGB){
-		for(uint32 i = 0; i < numVertices; i++){
-			dst[0] = src->blue;
-			dst[1] = src->green;
-			dst[2] = src->red;
-			dst[3] = src->alpha;
-			alpha &= src->alpha;
-			dst += stride;
-			src++;
-		}
-	}else if(type == VERT_RGBA){
-		for(uint32 i = 0; i < numVertices; i++){
-			dst[0] = src->red;
-			dst[1] = src->green;
-			dst[2] = src->blue;
-			dst[3] = src->alpha;
-			alpha &= src->alpha;
-			dst += stride;
-			src++;
-		}
-	}else
+	using namespace simd;
+	uint32 i;
+	uint32 c[4];
+	bool32 swap;
+	if(type == VERT_ARGB)
+		swap = 1;
+	else if(type == VERT_RGBA)
+		swap = 0;
+	else{
 		assert(0 && "unsupported color type");
-	return alpha != 0xFF;
+		return 0;
+	}
+	I4 alpha = set1i(-1);
+	for(i = 0; i+4 <= numVertices; i += 4){
+		I4 v = loadi(&src[i]);
+		alpha = andi(alpha, v);
+		if(swap)
+			v = swapRB(v);
+		if(stride == 4)
+			storei(dst + i*4, v);
+		else{
+			uint8 *d = dst + i*stride;
+			storei(c, v);
+			*(uint32*)d = c[0]; d += stride;
+			*(uint32*)d = c[1]; d += stride;
+			*(uint32*)d = c[2]; d += stride;
+			*(uint32*)d = c[3];
+		}
+	}
+	storei(c, alpha);
+	uint8 a = (c[0] & c[1] & c[2] & c[3]) >> 24;
+	for(; i < numVertices; i++){
+		uint8 *d = dst + i*stride;
+		d[0] = swap ? src[i].blue : src[i].red;
+		d[1] = src[i].green;
+		d[2] = swap ? src[i].red : src[i].blue;
+		d[3] = src[i].alpha;
+		a &= src[i].alpha;
+	}
+	return a != 0xFF;
 }
 
 void
 uninstColor(int type, RGBA *dst, uint8 *src, uint32 numVertices, uint32 stride)
 {
+	using namespace simd;
+	uint32 i;
+	uint32 c[4];
 	assert(type == VERT_ARGB);
-	for(uint32 i = 0; i < numVertices; i++){
-		dst->red = src[2];
-		dst->green = src[1];
-		dst->blue = src[0];
-		dst->alpha = src[3];
+	for(i = 0; i+4 <= numVertices; i += 4){
+		c[0] = *(uint32*)src; src += stride;
+		c[1] = *(uint32*)src; src += stride;
+		c[2] = *(uint32*)src; src += stride;
+		c[3] = *(uint32*)src; src += stride;
+		storei(&dst[i], swapRB(loadi(c)));
+	}
+	for(; i < numVertices; i++){
+		dst[i].red = src[2];
+		dst[i].green = src[1];
+		dst[i].blue = src[0];
+		dst[i].alpha = src[3];
 		src += stride;
-		dst++;
 	}
 }
 
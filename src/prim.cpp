@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -7,6 +8,7 @@
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
+#include "rwsimd.h"
 
 #define PLUGIN_ID 0
 
@@ -40,23 +42,34 @@ BBox::addPoint(V3d *point)
 void
 BBox::calculate(V3d *points, int32 n)
 {
+	using namespace simd;
+	int32 i = 0, j;
 	this->inf = points[0];
 	this->sup = points[0];
-	while(--n){
-		points++;
-		if(points->x < this->inf.x)
-			this->inf.x = points->x;
-		if(points->y < this->inf.y)
-			this->inf.y = points->y;
-		if(points->z < this->inf.z)
-			this->inf.z = points->z;
-		if(points->x > this->sup.x)
-			this->sup.x = points->x;
-		if(points->y > this->sup.y)
-			this->sup.y = points->y;
-		if(points->z > this->sup.z)
-			this->sup.z = points->z;
+	// four points are three vectors, xyzx yzxy zxyz,
+	// so the lanes always hold the same components
+	if(n >= 4){
+		const float32 *f = (const float32*)points;
+		F4 lo0 = load(f), lo1 = load(f+4), lo2 = load(f+8);
+		F4 hi0 = lo0, hi1 = lo1, hi2 = lo2;
+		for(i = 4; i+4 <= n; i += 4){
+			F4 a = load(f+i*3);
+			F4 b = load(f+i*3+4);
+			F4 c = load(f+i*3+8);
+			lo0 = min(lo0, a); hi0 = max(hi0, a);
+			lo1 = min(lo1, b); hi1 = max(hi1, b);
+			lo2 = min(lo2, c); hi2 = max(hi2, c);
+		}
+		float32 lo[12], hi[12];
+		store(lo, lo0); store(lo+4, lo1); store(lo+8, lo2);
+		store(hi, hi0); store(hi+4, hi1); store(hi+8, hi2);
+		for(j = 0; j < 4; j++){
+			this->addPoint((V3d*)&lo[j*3]);
+			this->addPoint((V3d*)&hi[j*3]);
+		}
 	}
+	for(; i < n; i++)
+		this->addPoint(&points[i]);
 }
 
 bool
@@ -67,4 +80,95 @@ BBox::containsPoint(V3d *point)
 		point->z >= this->inf.z && point->z <= this->sup.z;
 }
 
+/*
+ * Bounding sphere after Ritter: a sphere is grown to contain the points.
+ * It starts at the center of the bounding box with the radius of the
+ * box's largest half extent, no sphere can be smaller than that.
+ * In the same pass the sphere around the box center is measured,
+ * the smaller one is kept.
+ */
+
+static void
+growSphere(Sphere *s, V3d *p)
+{
+	V3d d = sub(*p, s->center);
+	float32 dist = length(d);
+	if(dist <= s->radius)
+		return;
+	float32 r = (s->radius + dist)/2.0f;
+	s->center = add(s->center, scale(d, (r - s->radius)/dist));
+	s->radius = r;
+}
+
+void
+Sphere::calculate(V3d *points, int32 n)
+{
+	using namespace simd;
+	int32 i, k;
+	BBox box;
+
+	if(n <= 0){
+		this->center.set(0.0f, 0.0f, 0.0f);
+		this->radius = 0.0f;
+		return;
+	}
+	box.calculate(points, n);
+	V3d boxCenter = scale(add(box.inf, box.sup), 0.5f);
+	V3d extent = scale(sub(box.sup, box.inf), 0.5f);
+	Sphere s;
+	s.center = boxCenter;
+	s.radius = extent.x;
+	if(extent.y > s.radius) s.radius = extent.y;
+	if(extent.z > s.radius) s.radius = extent.z;
+
+	F4 bx = set1(boxCenter.x);
+	F4 by = set1(boxCenter.y);
+	F4 bz = set1(boxCenter.z);
+	F4 bmax = zero();
+	F4 cx = set1(s.center.x);
+	F4 cy = set1(s.center.y);
+	F4 cz = set1(s.center.z);
+	F4 r2 = set1(s.radius*s.radius);
+	const float32 *f = (const float32*)points;
+	for(i = 0; i+4 < n; i += 4){
+		F4 p[4];
+		for(k = 0; k < 4; k++)
+			p[k] = load(f+(i+k)*3);
+		transpose(p[0], p[1], p[2], p[3]);
+		F4 dx = sub(p[0], bx);
+		F4 dy = sub(p[1], by);
+		F4 dz = sub(p[2], bz);
+		bmax = max(bmax, madd(dx, dx, madd(dy, dy, mul(dz, dz))));
+		dx = sub(p[0], cx);
+		dy = sub(p[1], cy);
+		dz = sub(p[2], cz);
+		F4 d2 = madd(dx, dx, madd(dy, dy, mul(dz, dz)));
+		if(movemask(cmpgt(d2, r2))){
+			for(k = 0; k < 4; k++)
+				growSphere(&s, &points[i+k]);
+			cx = set1(s.center.x);
+			cy = set1(s.center.y);
+			cz = set1(s.center.z);
+			r2 = set1(s.radius*s.radius);
+		}
+	}
+	float32 b[4];
+	store(b, bmax);
+	float32 boxRadius2 = b[0];
+	for(k = 1; k < 4; k++)
+		if(b[k] > boxRadius2) boxRadius2 = b[k];
+	for(; i < n; i++){
+		V3d d = sub(points[i], boxCenter);
+		if(dot(d, d) > boxRadius2) boxRadius2 = dot(d, d);
+		growSphere(&s, &points[i]);
+	}
+
+	float32 boxRadius = sqrtf(boxRadius2);
+	if(boxRadius <= s.radius){
+		this->center = boxCenter;
+		this->radius = boxRadius;
+	}else
+		*this = s;
+}
+
 }
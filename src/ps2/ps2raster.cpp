@@ -10,6 +10,7 @@
 #include "../rwobjects.h"
 #include "../rwengine.h"
 #include "rwps2.h"
+#include "../rwsimd.h"
 
 #define PLUGIN_ID ID_DRIVER
 
@@ -1367,10 +1368,100 @@ swizzle(uint32 x, uint32 y, uint32 logw)
 	return n | nx<<2 | ny<<(logw-1+2);
 }
 
+/*
+ * For power of two widths swizzle() repeats every 16 columns within
+ * a strip of four rows: the 16x4 texels of column group c go to
+ * two runs of 32 at 32*c and 2*w + 32*c. Rows 0 and 2 are interleaved
+ * into the first run, rows 1 and 3 into the second, and every other
+ * row has its groups of four texels swapped. The interleaving is
+ * done with byte and 16 bit zips, 4 bit texels are expanded to bytes
+ * first.
+ */
+
+static bool32
+canSwizzleStrips(int32 w, int32 h, int32 logw)
+{
+	return w == 1<<logw && w >= 16 && w <= 1024 && h%4 == 0;
+}
+
+// odd is set for strips that start at an odd multiple of four rows
+static void
+swizzleStrip8(uint8 *dst, uint8 *src, int32 w, int32 odd)
+{
+	using namespace simd;
+	for(int32 c = 0; c < w; c += 16){
+		I4 r0 = loadi(src + c);
+		I4 r1 = loadi(src + w + c);
+		I4 r2 = loadi(src + 2*w + c);
+		I4 r3 = loadi(src + 3*w + c);
+		if(odd){
+			r0 = swaplanes(r0);
+			r1 = swaplanes(r1);
+		}else{
+			r2 = swaplanes(r2);
+			r3 = swaplanes(r3);
+		}
+		I4 lo = ziplo8(r0, r2);
+		I4 hi = ziphi8(r0, r2);
+		storei(dst + 2*c, ziplo16(lo, hi));
+		storei(dst + 2*c + 16, ziphi16(lo, hi));
+		lo = ziplo8(r1, r3);
+		hi = ziphi8(r1, r3);
+		storei(dst + 2*w + 2*c, ziplo16(lo, hi));
+		storei(dst + 2*w + 2*c + 16, ziphi16(lo, hi));
+	}
+}
+
+// Zipping is a perfect shuffle, it is undone by
+// three more rounds of 16 bit zips and four of byte zips.
+static void
+unzipRun(simd::I4 *a, simd::I4 *b, uint8 *src)
+{
+	using namespace simd;
+	I4 x = loadi(src);
+	I4 y = loadi(src + 16);
+	I4 t;
+	for(int32 i = 0; i < 3; i++){
+		t = ziplo16(x, y);
+		y = ziphi16(x, y);
+		x = t;
+	}
+	for(int32 i = 0; i < 4; i++){
+		t = ziplo8(x, y);
+		y = ziphi8(x, y);
+		x = t;
+	}
+	*a = x;
+	*b = y;
+}
+
+static void
+unswizzleStrip8(uint8 *dst, uint8 *src, int32 w, int32 odd)
+{
+	using namespace simd;
+	for(int32 c = 0; c < w; c += 16){
+		I4 r0, r1, r2, r3;
+		unzipRun(&r0, &r2, src + 2*c);
+		unzipRun(&r1, &r3, src + 2*w + 2*c);
+		if(odd){
+			r0 = swaplanes(r0);
+			r1 = swaplanes(r1);
+		}else{
+			r2 = swaplanes(r2);
+			r3 = swaplanes(r3);
+		}
+		storei(dst + c, r0);
+		storei(dst + w + c, r1);
+		storei(dst + 2*w + c, r2);
+		storei(dst + 3*w + c, r3);
+	}
+}
+
 void
 unswizzleRaster(Raster *raster)
 {
 	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
+	uint8 tmpbuf2[1024*4];
 	uint32 mask;
 	int32 x, y, w, h;
 	int32 i;
@@ -1391,6 +1482,15 @@ unswizzleRaster(Raster *raster)
 	mask = (1<<(logw+2))-1;
 
 	if(raster->format & Raster::PAL4 && natras->flags & Ps2Raster::SWIZZLED4){
+		if(canSwizzleStrips(w, h, logw)){
+			for(y = 0; y < h; y += 4){
+				uint8 *strip = &px[y<<(logw-1)];
+				expandPal4(tmpbuf, 0, strip, 0, 4*w, 1);
+				unswizzleStrip8(tmpbuf2, tmpbuf, w, y>>2 & 1);
+				compressPal4(strip, 0, tmpbuf2, 0, 4*w, 1);
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			memcpy(tmpbuf, &px[y<<(logw-1)], 2*w);
 			for(i = 0; i < 4; i++)
@@ -1402,6 +1502,13 @@ unswizzleRaster(Raster *raster)
 				}
 		}
 	}else if(raster->format & Raster::PAL8 && natras->flags & Ps2Raster::SWIZZLED8){
+		if(canSwizzleStrips(w, h, logw)){
+			for(y = 0; y < h; y += 4){
+				memcpy(tmpbuf, &px[y<<logw], 4*w);
+				unswizzleStrip8(&px[y<<logw], tmpbuf, w, y>>2 & 1);
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			memcpy(tmpbuf, &px[y<<logw], 4*w);
 			for(i = 0; i < 4; i++)
@@ -1418,6 +1525,7 @@ void
 swizzleRaster(Raster *raster)
 {
 	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
+	uint8 tmpbuf2[1024*4];
 	uint32 mask;
 	int32 x, y, w, h;
 	int32 i;
@@ -1438,6 +1546,15 @@ swizzleRaster(Raster *raster)
 	mask = (1<<(logw+2))-1;
 
 	if(raster->format & Raster::PAL4 && natras->flags & Ps2Raster::SWIZZLED4){
+		if(canSwizzleStrips(w, h, logw)){
+			for(y = 0; y < h; y += 4){
+				uint8 *strip = &px[y<<(logw-1)];
+				expandPal4(tmpbuf, 0, strip, 0, 4*w, 1);
+				swizzleStrip8(tmpbuf2, tmpbuf, w, y>>2 & 1);
+				compressPal4(strip, 0, tmpbuf2, 0, 4*w, 1);
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			for(i = 0; i < 4; i++)
 				for(x = 0; x < w; x++){
@@ -1449,6 +1566,13 @@ swizzleRaster(Raster *raster)
 			memcpy(&px[y<<(logw-1)], tmpbuf, 2*w);
 		}
 	}else if(raster->format & Raster::PAL8 && natras->flags & Ps2Raster::SWIZZLED8){
+		if(canSwizzleStrips(w, h, logw)){
+			for(y = 0; y < h; y += 4){
+				memcpy(tmpbuf, &px[y<<logw], 4*w);
+				swizzleStrip8(&px[y<<logw], tmpbuf, w, y>>2 & 1);
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			for(i = 0; i < 4; i++)
 				for(x = 0; x < w; x++){
@@ -1670,15 +1794,17 @@ rasterFromImage(Raster *raster, Image *image)
 		compressPal4(out, tw/2, src, image->stride, image->width, image->height);
 	}else if(image->depth == 8){
 		copyPal8(out, tw, src, image->stride, image->width, image->height);
+	}else if(image->depth == 16){
+		for(int32 y = 0; y < image->height; y++){
+			convRow_ARGB1555_from_ABGR1555(out, src, image->width);
+			out += image->width*2;
+			src += image->stride;
+		}
 	}else{
 		for(int32 y = 0; y < image->height; y++){
 			in = src;
 			for(int32 x = 0; x < image->width; x++){
 				switch(image->depth){
-				case 16:
-					conv_ARGB1555_from_ABGR1555(out, in);
-					out += 2;
-					break;
 				case 24:
 					out[0] = in[0];
 					out[1] = in[1];
@@ -1768,6 +1894,20 @@ rasterToImage(Raster *raster)
 		expandPal4(dst, image->stride, in, tw/2, raster->width, raster->height);
 	}else if(depth == 8){
 		copyPal8(dst, image->stride, in, tw, raster->width, raster->height);
+	}else if(rasterFormat == Raster::C888){
+		for(int32 y = 0; y < image->height; y++){
+			convRow_RGB888_from_RGBA8888(dst, in, image->width);
+			in += image->width*4;
+			dst += image->stride;
+		}
+	}else if(rasterFormat == Raster::C1555 || rasterFormat == Raster::C555){
+		for(int32 y = 0; y < image->height; y++){
+			convRow_ARGB1555_from_ABGR1555(dst, in, image->width);
+			if(rasterFormat == Raster::C555)
+				convRow_ARGB1555_from_RGB555(dst, dst, image->width);
+			in += image->width*2;
+			dst += image->stride;
+		}
 	}else{
 		for(int32 y = 0; y < image->height; y++){
 			out = dst;
@@ -1780,21 +1920,6 @@ rasterToImage(Raster *raster)
 					out[3] = in[3]*255/128;
 					in += 4;
 					break;
-				case Raster::C888:
-					out[0] = in[0];
-					out[1] = in[1];
-					out[2] = in[2];
-					in += 4;
-					break;
-				case Raster::C1555:
-					conv_ARGB1555_from_ABGR1555(out, in);
-					in += 2;
-					break;
-				case Raster::C555:
-					conv_ARGB1555_from_ABGR1555(out, in);
-					out[1] |= 0x80;
-					in += 2;
-					break;
 				default:
 					assert(0 && "unknown ps2 raster format");
 					break;
@@ -272,6 +272,9 @@ struct Ps2Raster
 extern int32 nativeRasterOffset;
 void registerNativeRaster(void);
 #define GETPS2RASTEREXT(raster) PLUGINOFFSET(rw::ps2::Ps2Raster, raster, rw::ps2::nativeRasterOffset)
+// convert locked PSMT8/PSMT4 pixels between the GS and linear layouts
+void unswizzleRaster(Raster *raster);
+void swizzleRaster(Raster *raster);
 
 Texture *readNativeTexture(Stream *stream);
 void writeNativeTexture(Texture *tex, Stream *stream);
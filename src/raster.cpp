@@ -9,6 +9,7 @@
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
+#include "rwsimd.h"
 //#include "ps2/rwps2.h"
 #include "d3d/rwd3d.h"
 #include "d3d/rwxbox.h"
@@ -30,6 +31,8 @@ struct RasterGlobals
 };
 int32 rasterModuleOffset;
 
+static void initConvRows(void);
+
 #define RASTERGLOBAL(v) (PLUGINOFFSET(RasterGlobals, engine, rasterModuleOffset)->v)
 
 static void*
@@ -53,6 +56,7 @@ void
 Raster::registerModule(void)
 {
 	Engine::registerPlugin(sizeof(RasterGlobals), ID_RASTERMODULE, rasterOpen, rasterClose);
+	initConvRows();
 }
 
 Raster*
@@ -96,6 +100,8 @@ Raster::subRaster(Raster *parent, Rect *r)
 void
 Raster::destroy(void)
 {
+	if(AssetDedup::releaseRaster(this))
+		return;	// still used by another texture
 	s_plglist.destruct(this);
 	rwFree(this);
 	numAllocated--;
@@ -104,6 +110,10 @@ Raster::destroy(void)
 uint8*
 Raster::lock(int32 level, int32 lockMode)
 {
+	if(lockMode & LOCKWRITE)
+		AssetDedup::forget(this);
+	if(!TextureResidency::makeResident(this, level))
+		return nil;
 	return engine->driver[this->platform]->rasterLock(this, level, lockMode);
 }
 
@@ -128,6 +138,9 @@ Raster::unlockPalette(void)
 int32
 Raster::getNumLevels(void)
 {
+	// there's no native storage to ask
+	if(TextureResidency::isEvicted(this))
+		return TextureResidency::getNumEvictedLevels(this);
 	return engine->driver[this->platform]->rasterNumLevels(this);
 }
 
@@ -158,12 +171,81 @@ Raster::imageFindRasterFormat(Image *image, int32 type,
 		image, type, pWidth, pHeight, pDepth, pFormat);
 }
 
+// Fill the smaller levels of a raster with the images in levels.
+// The driver converts each level while it's locked, so this only works
+// for drivers whose rasterFromImage writes to a locked level.
+static bool32
+setMipmapsFromLevels(Raster *raster, Image **levels, int32 numLevels, Driver *driver)
+{
+	bool32 ret = 1;
+	for(int32 i = 0; i < numLevels && ret; i++)
+		if(raster->lock(i+1, Raster::LOCKWRITE|Raster::LOCKNOFETCH)){
+			ret = driver->rasterFromImage(raster, levels[i]);
+			raster->unlock(i+1);
+		}
+	return ret;
+}
+
+static bool32
+setMipmapsFromImage(Raster *raster, Image *image, Driver *driver)
+{
+	Image *levels[32];
+	int32 numLevels = raster->getNumLevels();
+	if(numLevels <= 1)
+		return 1;
+	numLevels = image->generateMipmaps(levels, numLevels-1, Image::mipmapFilter,
+		Image::mipmapSRGB, Image::mipmapAlphaRef);
+	bool32 ret = setMipmapsFromLevels(raster, levels, numLevels, driver);
+	for(int32 i = 0; i < numLevels; i++)
+		levels[i]->destroy();
+	return ret;
+}
+
+bool32
+Raster::needsImageMipmaps(int32 format, Image *image, int32 platform)
+{
+	if(platform == 0)
+		platform = rw::platform;
+	// palettized levels would need the same palette
+	if((format & Raster::MIPMAP) == 0 ||
+	   format & (Raster::PAL4|Raster::PAL8) || image->depth == 16)
+		return 0;
+	switch(platform){
+	case PLATFORM_D3D8:
+	case PLATFORM_D3D9:
+	case PLATFORM_GL3:
+	case PLATFORM_VULKAN:
+	case PLATFORM_XBOX:
+		return 1;
+	}
+	return 0;
+}
+
 Raster*
 Raster::setFromImage(Image *image, int32 platform)
 {
-	if(engine->driver[platform ? platform : rw::platform]->rasterFromImage(this, image))
-		return this;
-	return nil;
+	return this->setFromImages(&image, 1, platform);
+}
+
+Raster*
+Raster::setFromImages(Image **levels, int32 numLevels, int32 platform)
+{
+	if(platform == 0)
+		platform = rw::platform;
+	Driver *driver = engine->driver[platform];
+	if(!driver->rasterFromImage(this, levels[0]))
+		return nil;
+	if(needsImageMipmaps(this->format, levels[0], platform)){
+		int32 rasterLevels = this->getNumLevels();
+		bool32 ret;
+		if(numLevels >= rasterLevels)
+			ret = setMipmapsFromLevels(this, levels+1, rasterLevels-1, driver);
+		else
+			ret = setMipmapsFromImage(this, levels[0], driver);
+		if(!ret)
+			return nil;
+	}
+	return this;
 }
 
 Raster*
@@ -236,9 +318,11 @@ conv_RGBA8888_from_RGBA8888(uint8 *out, uint8 *in)
 void
 conv_BGRA8888_from_RGBA8888(uint8 *out, uint8 *in)
 {
-	out[2] = in[0];
+	// in and out may be the same
+	uint8 r = in[0];
 	out[1] = in[1];
 	out[0] = in[2];
+	out[2] = r;
 	out[3] = in[3];
 }
 
@@ -271,9 +355,11 @@ conv_RGB888_from_RGB888(uint8 *out, uint8 *in)
 void
 conv_BGR888_from_RGB888(uint8 *out, uint8 *in)
 {
-	out[2] = in[0];
+	// in and out may be the same
+	uint8 r = in[0];
 	out[1] = in[1];
 	out[0] = in[2];
+	out[2] = r;
 }
 
 void
@@ -338,51 +424,413 @@ conv_ABGR1555_from_ARGB1555(uint8 *out, uint8 *in)
 	out[0] = (in[0]&0xE0) | r;
 }
 
+#ifndef BIGENDIAN
+// Spread the four bytes of w to 16 bits each
+static uint64
+spreadBytes(uint32 w)
+{
+	uint64 t = w;
+	t = (t | t<<16) & 0x0000FFFF0000FFFFULL;
+	t = (t | t<<8) & 0x00FF00FF00FF00FFULL;
+	return t;
+}
+
+// Inverse of spreadBytes
+static uint32
+packBytes(uint64 t)
+{
+	t = (t | t>>8) & 0x0000FFFF0000FFFFULL;
+	t = (t | t>>16) & 0x00000000FFFFFFFFULL;
+	return (uint32)t;
+}
+#endif
+
+// 4 bit pixels, low nibble first. Eight pixels at a time.
+
 void
 expandPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
 	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++){
-			dst[y*dststride + x*2 + 0] = src[y*srcstride + x] & 0xF;
-			dst[y*dststride + x*2 + 1] = src[y*srcstride + x] >> 4;
+	for(y = 0; y < h; y++){
+		uint8 *d = dst + y*dststride;
+		uint8 *s = src + y*srcstride;
+		x = 0;
+#ifndef BIGENDIAN
+		for(; x+4 <= w/2; x += 4){
+			uint32 v;
+			memcpy(&v, s+x, 4);
+			uint64 t = spreadBytes(v);
+			t = (t & 0x000F000F000F000FULL) | (t & 0x00F000F000F000F0ULL)<<4;
+			memcpy(d+x*2, &t, 8);
 		}
+#endif
+		for(; x < w/2; x++){
+			d[x*2 + 0] = s[x] & 0xF;
+			d[x*2 + 1] = s[x] >> 4;
+		}
+	}
 }
 void
 compressPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
 	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++)
-			dst[y*dststride + x] = src[y*srcstride + x*2 + 0] | src[y*srcstride + x*2 + 1] << 4;
+	for(y = 0; y < h; y++){
+		uint8 *d = dst + y*dststride;
+		uint8 *s = src + y*srcstride;
+		x = 0;
+#ifndef BIGENDIAN
+		for(; x+4 <= w/2; x += 4){
+			uint64 t;
+			memcpy(&t, s+x*2, 8);
+			t = (t & 0x00FF00FF00FF00FFULL) | (t>>4 & 0x00F000F000F000F0ULL);
+			uint32 v = packBytes(t);
+			memcpy(d+x, &v, 4);
+		}
+#endif
+		for(; x < w/2; x++)
+			d[x] = s[x*2 + 0] | s[x*2 + 1] << 4;
+	}
 }
 
+// 4 bit pixels, high nibble first
+
 void
 expandPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
 	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++){
-			dst[y*dststride + x*2 + 1] = src[y*srcstride + x] & 0xF;
-			dst[y*dststride + x*2 + 0] = src[y*srcstride + x] >> 4;
+	for(y = 0; y < h; y++){
+		uint8 *d = dst + y*dststride;
+		uint8 *s = src + y*srcstride;
+		x = 0;
+#ifndef BIGENDIAN
+		for(; x+4 <= w/2; x += 4){
+			uint32 v;
+			memcpy(&v, s+x, 4);
+			uint64 t = spreadBytes(v);
+			t = (t & 0x000F000F000F000FULL)<<8 | (t>>4 & 0x000F000F000F000FULL);
+			memcpy(d+x*2, &t, 8);
 		}
+#endif
+		for(; x < w/2; x++){
+			d[x*2 + 1] = s[x] & 0xF;
+			d[x*2 + 0] = s[x] >> 4;
+		}
+	}
 }
 void
 compressPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
 	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++)
-			dst[y*dststride + x] = src[y*srcstride + x*2 + 1] | src[y*srcstride + x*2 + 0] << 4;
+	for(y = 0; y < h; y++){
+		uint8 *d = dst + y*dststride;
+		uint8 *s = src + y*srcstride;
+		x = 0;
+#ifndef BIGENDIAN
+		for(; x+4 <= w/2; x += 4){
+			uint64 t;
+			memcpy(&t, s+x*2, 8);
+			t = (t>>8 & 0x00FF00FF00FF00FFULL) | (t<<4 & 0x00F000F000F000F0ULL);
+			uint32 v = packBytes(t);
+			memcpy(d+x, &v, 4);
+		}
+#endif
+		for(; x < w/2; x++)
+			d[x] = s[x*2 + 1] | s[x*2 + 0] << 4;
+	}
 }
 
 void
 copyPal8(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
-	int32 x, y;
+	int32 y;
 	for(y = 0; y < h; y++)
-		for(x = 0; x < w; x++)
-			dst[y*dststride + x] = src[y*srcstride + x];
+		memcpy(dst + y*dststride, src + y*srcstride, w);
+}
+
+/*
+ * Row conversion.
+ * 32 and 16 bit pixels are converted 16 bytes at a time with integer
+ * vector ops, 24 bit pixels four at a time in words. Leftover pixels
+ * and big-endian builds use the single pixel functions.
+ * The R/B swaps also work in place.
+ */
+
+void convRow_RGBA8888_from_RGBA8888(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*4); }
+void convRow_RGB888_from_RGB888(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*3); }
+void convRow_ARGB1555_from_ARGB1555(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*2); }
+void convRow_8_from_8(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n); }
+
+#ifndef BIGENDIAN
+// swap bytes 0 and 2 of every word
+static simd::I4
+swapRB(simd::I4 v)
+{
+	using namespace simd;
+	return ori(andi(v, set1i(0xFF00FF00)),
+		ori(andi(srli(v, 16), set1i(0xFF)), andi(slli(v, 16), set1i(0xFF0000))));
+}
+
+// split four 24 bit pixels into words
+static void
+unpack24(uint32 *p, uint8 *in)
+{
+	uint32 w[3];
+	memcpy(w, in, 12);
+	p[0] = w[0] & 0xFFFFFF;
+	p[1] = (w[0]>>24 | w[1]<<8) & 0xFFFFFF;
+	p[2] = (w[1]>>16 | w[2]<<16) & 0xFFFFFF;
+	p[3] = w[2]>>8;
+}
+
+// inverse of unpack24, the top bytes are dropped
+static void
+pack24(uint8 *out, uint32 *p)
+{
+	uint32 w[3];
+	w[0] = (p[0] & 0xFFFFFF) | p[1]<<24;
+	w[1] = (p[1]>>8 & 0xFFFF) | p[2]<<16;
+	w[2] = (p[2]>>16 & 0xFF) | p[3]<<8;
+	memcpy(out, w, 12);
+}
+#endif
+
+void
+convRow_BGRA8888_from_RGBA8888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+4 <= n; i += 4)
+		storei(out + i*4, swapRB(loadi(in + i*4)));
+#endif
+	for(; i < n; i++)
+		conv_BGRA8888_from_RGBA8888(out + i*4, in + i*4);
+}
+
+void
+convRow_RGBA8888_from_RGB888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	for(; i+4 <= n; i += 4){
+		uint32 p[4];
+		unpack24(p, in + i*3);
+		p[0] |= 0xFF000000;
+		p[1] |= 0xFF000000;
+		p[2] |= 0xFF000000;
+		p[3] |= 0xFF000000;
+		memcpy(out + i*4, p, 16);
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGBA8888_from_RGB888(out + i*4, in + i*3);
+}
+
+void
+convRow_BGRA8888_from_RGB888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+4 <= n; i += 4){
+		uint32 p[4];
+		unpack24(p, in + i*3);
+		storei(out + i*4, ori(swapRB(loadi(p)), set1i(0xFF000000)));
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGRA8888_from_RGB888(out + i*4, in + i*3);
+}
+
+void
+convRow_BGR888_from_RGB888(uint8 *out, uint8 *in, int32 n)
+{
+	// shuffling words is no faster than bytes here
+	for(int32 i = 0; i < n; i++, in += 3, out += 3){
+		uint8 r = in[0];
+		out[1] = in[1];
+		out[0] = in[2];
+		out[2] = r;
+	}
+}
+
+void
+convRow_RGB888_from_RGBA8888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	for(; i+4 <= n; i += 4){
+		uint32 p[4];
+		memcpy(p, in + i*4, 16);
+		pack24(out + i*3, p);
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGB888_from_RGB888(out + i*3, in + i*4);
+}
+
+void
+convRow_BGR888_from_RGBA8888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+4 <= n; i += 4){
+		uint32 p[4];
+		storei(p, swapRB(loadi(in + i*4)));
+		pack24(out + i*3, p);
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGR888_from_RGB888(out + i*3, in + i*4);
+}
+
+void
+convRow_ARGB1555_from_RGB555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+8 <= n; i += 8)
+		storei(out + i*2, ori(loadi(in + i*2), set1i(0x80008000)));
+#endif
+	for(; i < n; i++)
+		conv_ARGB1555_from_RGB555(out + i*2, in + i*2);
+}
+
+void
+convRow_RGBA5551_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+8 <= n; i += 8){
+		I4 v = loadi(in + i*2);
+		storei(out + i*2, ori(andi(slli(v, 1), set1i(0xFFFEFFFE)),
+			andi(srli(v, 15), set1i(0x00010001))));
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGBA5551_from_ARGB1555(out + i*2, in + i*2);
+}
+
+void
+convRow_ARGB1555_from_RGBA5551(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+8 <= n; i += 8){
+		I4 v = loadi(in + i*2);
+		storei(out + i*2, ori(andi(srli(v, 1), set1i(0x7FFF7FFF)),
+			andi(slli(v, 15), set1i(0x80008000))));
+	}
+#endif
+	for(; i < n; i++)
+		conv_ARGB1555_from_RGBA5551(out + i*2, in + i*2);
+}
+
+void
+convRow_ABGR1555_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifndef BIGENDIAN
+	using namespace simd;
+	for(; i+8 <= n; i += 8){
+		I4 v = loadi(in + i*2);
+		storei(out + i*2, ori(andi(v, set1i(0x83E083E0)),
+			ori(andi(srli(v, 10), set1i(0x001F001F)),
+			    andi(slli(v, 10), set1i(0x7C007C00)))));
+	}
+#endif
+	for(; i < n; i++)
+		conv_ABGR1555_from_ARGB1555(out + i*2, in + i*2);
+}
+
+void
+convRow_RGBA8888_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	// same as c*0xFF/0x1F
+	static const uint8 expand5[32] = {
+		0, 8, 16, 24, 32, 41, 49, 57, 65, 74, 82, 90, 98, 106, 115, 123,
+		131, 139, 148, 156, 164, 172, 180, 189, 197, 205, 213, 222, 230, 238, 246, 255
+	};
+	for(int32 i = 0; i < n; i++, in += 2, out += 4){
+		uint32 v = in[0] | in[1]<<8;
+		out[0] = expand5[v>>10 & 0x1F];
+		out[1] = expand5[v>>5 & 0x1F];
+		out[2] = expand5[v & 0x1F];
+		out[3] = v & 0x8000 ? 0xFF : 0;
+	}
+}
+
+static ConvRowFunc convRowTable[NUM_CONVFMTS][NUM_CONVFMTS];
+
+static void
+setConvRow(int32 dst, int32 src, ConvRowFunc conv)
+{
+	convRowTable[dst][src] = conv;
+}
+
+// Filled once by Raster::registerModule, before any loader threads run
+static void
+initConvRows(void)
+{
+	setConvRow(CONVFMT_RGBA8888, CONVFMT_RGBA8888, convRow_RGBA8888_from_RGBA8888);
+	setConvRow(CONVFMT_BGRA8888, CONVFMT_BGRA8888, convRow_RGBA8888_from_RGBA8888);
+	setConvRow(CONVFMT_BGRA8888, CONVFMT_RGBA8888, convRow_BGRA8888_from_RGBA8888);
+	setConvRow(CONVFMT_RGBA8888, CONVFMT_BGRA8888, convRow_BGRA8888_from_RGBA8888);
+	setConvRow(CONVFMT_RGBA8888, CONVFMT_RGB888, convRow_RGBA8888_from_RGB888);
+	setConvRow(CONVFMT_BGRA8888, CONVFMT_BGR888, convRow_RGBA8888_from_RGB888);
+	setConvRow(CONVFMT_BGRA8888, CONVFMT_RGB888, convRow_BGRA8888_from_RGB888);
+	setConvRow(CONVFMT_RGBA8888, CONVFMT_BGR888, convRow_BGRA8888_from_RGB888);
+	setConvRow(CONVFMT_RGB888, CONVFMT_RGB888, convRow_RGB888_from_RGB888);
+	setConvRow(CONVFMT_BGR888, CONVFMT_BGR888, convRow_RGB888_from_RGB888);
+	setConvRow(CONVFMT_BGR888, CONVFMT_RGB888, convRow_BGR888_from_RGB888);
+	setConvRow(CONVFMT_RGB888, CONVFMT_BGR888, convRow_BGR888_from_RGB888);
+	setConvRow(CONVFMT_RGB888, CONVFMT_RGBA8888, convRow_RGB888_from_RGBA8888);
+	setConvRow(CONVFMT_BGR888, CONVFMT_BGRA8888, convRow_RGB888_from_RGBA8888);
+	setConvRow(CONVFMT_BGR888, CONVFMT_RGBA8888, convRow_BGR888_from_RGBA8888);
+	setConvRow(CONVFMT_RGB888, CONVFMT_BGRA8888, convRow_BGR888_from_RGBA8888);
+	setConvRow(CONVFMT_ARGB1555, CONVFMT_ARGB1555, convRow_ARGB1555_from_ARGB1555);
+	setConvRow(CONVFMT_RGBA5551, CONVFMT_RGBA5551, convRow_ARGB1555_from_ARGB1555);
+	setConvRow(CONVFMT_ABGR1555, CONVFMT_ABGR1555, convRow_ARGB1555_from_ARGB1555);
+	setConvRow(CONVFMT_RGB555, CONVFMT_RGB555, convRow_ARGB1555_from_ARGB1555);
+	setConvRow(CONVFMT_ARGB1555, CONVFMT_RGB555, convRow_ARGB1555_from_RGB555);
+	setConvRow(CONVFMT_RGBA5551, CONVFMT_ARGB1555, convRow_RGBA5551_from_ARGB1555);
+	setConvRow(CONVFMT_ARGB1555, CONVFMT_RGBA5551, convRow_ARGB1555_from_RGBA5551);
+	setConvRow(CONVFMT_ABGR1555, CONVFMT_ARGB1555, convRow_ABGR1555_from_ARGB1555);
+	setConvRow(CONVFMT_ARGB1555, CONVFMT_ABGR1555, convRow_ABGR1555_from_ARGB1555);
+	setConvRow(CONVFMT_RGBA8888, CONVFMT_ARGB1555, convRow_RGBA8888_from_ARGB1555);
+	setConvRow(CONVFMT_8, CONVFMT_8, convRow_8_from_8);
+}
+
+ConvRowFunc
+getConvRow(int32 dst, int32 src)
+{
+	if(dst < 0 || dst >= NUM_CONVFMTS || src < 0 || src >= NUM_CONVFMTS)
+		return nil;
+	return convRowTable[dst][src];
+}
+
+int32
+getImageConvFormat(Image *image)
+{
+	switch(image->depth){
+	case 32: return CONVFMT_RGBA8888;
+	case 24: return CONVFMT_RGB888;
+	case 16: return CONVFMT_ARGB1555;
+	case 8:
+	case 4: return CONVFMT_8;	// indices are bytes
+	}
+	return -1;
+}
+
+void
+convertPixels(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h, ConvRowFunc conv)
+{
+	for(int32 y = 0; y < h; y++)
+		conv(dst + y*dststride, src + y*srcstride, w);
 }
 
 
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#define PLUGIN_ID ID_RESIDENCY
+
+namespace rw {
+
+/*
+ * Texture residency.
+ * Every raster with native storage is in a list that has the most
+ * recently bound rasters first. Over budget we go through it from
+ * the back, first dropping top mip levels and then evicting whole
+ * rasters. Only rasters with a reload callback are touched since
+ * dropped or evicted levels may have to be filled again.
+ */
+
+// What setReloadTexture reads again, copied
+// since the raster may outlive its texture
+struct ReloadImage
+{
+	char name[32];
+	char mask[32];
+};
+
+struct RasterResidency
+{
+	Raster *raster;
+	LLLink inList;	// if size != 0
+	uint32 size;	// as reported by the driver
+	int32 firstLevel;	// first resident level, numLevels if evicted
+	int32 numLevels;	// only known once levels were dropped or evicted
+	uint32 lastFrame;
+	TextureResidency::ReloadCB reload;
+	void *reloadData;
+	ReloadImage *image;	// owned, nil if not set by setReloadTexture
+};
+
+static struct
+{
+	LinkList rasters;
+	uint32 budget;
+	uint32 usage;
+	int32 maxDropLevels;
+	uint32 frame;
+	bool32 busy;	// already changing residency
+} residency;
+static int32 residencyOffset;
+
+#define RESIDENCY(raster) PLUGINOFFSET(RasterResidency, raster, residencyOffset)
+#define FROMLIST(lnk) LLLinkGetData(lnk, RasterResidency, inList)
+
+static void*
+createResidency(void *object, int32 offset, int32)
+{
+	RasterResidency *r = PLUGINOFFSET(RasterResidency, object, offset);
+	r->raster = (Raster*)object;
+	r->inList.init();
+	r->size = 0;
+	r->firstLevel = 0;
+	r->numLevels = 0;
+	r->lastFrame = residency.frame;
+	r->reload = nil;
+	r->reloadData = nil;
+	r->image = nil;
+	return object;
+}
+
+static void*
+destroyResidency(void *object, int32 offset, int32)
+{
+	RasterResidency *r = PLUGINOFFSET(RasterResidency, object, offset);
+	if(r->size){
+		residency.usage -= r->size;
+		r->size = 0;
+		r->inList.remove();
+	}
+	r->reload = nil;
+	rwFree(r->image);
+	r->image = nil;
+	return object;
+}
+
+// A copy isn't resident until it's used
+static void*
+copyResidency(void *dst, void *, int32 offset, int32)
+{
+	createResidency(dst, offset, 0);
+	return dst;
+}
+
+void
+TextureResidency::registerModule(void)
+{
+	residency.rasters.init();
+	residency.maxDropLevels = 2;
+	residencyOffset = Raster::registerPlugin(sizeof(RasterResidency), ID_RESIDENCY,
+		createResidency, destroyResidency, copyResidency);
+}
+
+// Have the driver change the resident levels, reload them if they're lost.
+static bool32
+setResidentLevels(RasterResidency *r, int32 firstLevel)
+{
+	Raster *raster = r->raster;
+	Driver *driver = engine->driver[raster->platform];
+	int32 oldFirst = r->firstLevel;
+	if(firstLevel == oldFirst)
+		return 1;
+	if(driver->rasterSetResidency == nil)
+		return 0;
+	bool32 busy = residency.busy;
+	residency.busy = 1;
+	bool32 kept = driver->rasterSetResidency(raster, firstLevel, r->numLevels);
+	bool32 ret = 1;
+	if(firstLevel < r->numLevels && r->size == 0)
+		ret = 0;	// driver couldn't get the storage back
+	else{
+		r->firstLevel = firstLevel;
+		if(firstLevel < oldFirst && !kept)
+			ret = r->reload(raster, firstLevel, oldFirst-firstLevel, r->reloadData);
+	}
+	residency.busy = busy;
+	return ret;
+}
+
+static bool32
+canEvict(RasterResidency *r)
+{
+	return r->reload && r->lastFrame != residency.frame &&
+		engine->driver[r->raster->platform]->rasterSetResidency;
+}
+
+static void
+enforceBudget(void)
+{
+	LLLink *lnk, *prev;
+	RasterResidency *r;
+	int32 pass, first;
+
+	if(residency.budget == 0 || residency.busy)
+		return;
+	// drop levels before evicting anything
+	for(pass = 0; pass < 2; pass++)
+		for(lnk = residency.rasters.link.prev;
+		    lnk != residency.rasters.end() && residency.usage > residency.budget;
+		    lnk = prev){
+			prev = lnk->prev;
+			r = FROMLIST(lnk);
+			if(!canEvict(r))
+				continue;
+			if(r->firstLevel == 0)
+				r->numLevels = r->raster->getNumLevels();
+			if(pass == 0){
+				first = residency.maxDropLevels;
+				if(first > r->numLevels-1)
+					first = r->numLevels-1;
+				if(first > r->firstLevel)
+					setResidentLevels(r, first);
+			}else
+				setResidentLevels(r, r->numLevels);
+		}
+}
+
+void
+TextureResidency::setBudget(uint32 bytes)
+{
+	residency.budget = bytes;
+	enforceBudget();
+}
+
+uint32 TextureResidency::getBudget(void) { return residency.budget; }
+uint32 TextureResidency::getUsage(void) { return residency.usage; }
+void TextureResidency::setMaxDropLevels(int32 n) { residency.maxDropLevels = n; }
+
+void
+TextureResidency::setReloadCB(Raster *raster, ReloadCB cb, void *data)
+{
+	RasterResidency *r = RESIDENCY(raster);
+	if(r->image && data != r->image){
+		rwFree(r->image);
+		r->image = nil;
+	}
+	r->reload = cb;
+	r->reloadData = data;
+}
+
+static bool32
+reloadImage(Raster *raster, int32, int32, void *data)
+{
+	ReloadImage *ri = (ReloadImage*)data;
+	Image *img = Image::readMasked(ri->name, ri->mask);
+	if(img == nil)
+		return 0;
+	bool32 ret = raster->setFromImage(img) != nil;
+	img->destroy();
+	return ret;
+}
+
+void
+TextureResidency::setReloadTexture(Raster *raster, Texture *tex)
+{
+	RasterResidency *r = RESIDENCY(raster);
+	ReloadImage *ri = r->image;
+	if(ri == nil){
+		ri = rwNewT(ReloadImage, 1, MEMDUR_EVENT | ID_RESIDENCY);
+		if(ri == nil){
+			RWERROR((ERR_ALLOC, sizeof(ReloadImage)));
+			return;
+		}
+	}
+	memcpy(ri->name, tex->name, 32);
+	memcpy(ri->mask, tex->mask, 32);
+	r->image = ri;
+	setReloadCB(raster, reloadImage, ri);
+}
+
+void
+TextureResidency::reportSize(Raster *raster, uint32 size)
+{
+	RasterResidency *r = RESIDENCY(raster);
+	if(r->size == 0 && size != 0){
+		residency.rasters.add(&r->inList);
+		r->lastFrame = residency.frame;
+	}else if(r->size != 0 && size == 0)
+		r->inList.remove();
+	residency.usage += size - r->size;
+	r->size = size;
+	if(size)
+		enforceBudget();
+}
+
+void
+TextureResidency::touch(Raster *raster)
+{
+	RasterResidency *r = RESIDENCY(raster);
+	r->lastFrame = residency.frame;
+	if(r->firstLevel == r->numLevels && r->numLevels > 0)
+		makeResident(raster);
+	else if(r->size && residency.rasters.link.next != &r->inList){
+		r->inList.remove();
+		residency.rasters.add(&r->inList);
+	}
+}
+
+bool32
+TextureResidency::makeResident(Raster *raster, int32 level)
+{
+	RasterResidency *r = RESIDENCY(raster);
+	if(level >= r->firstLevel)
+		return 1;
+	r->lastFrame = residency.frame;
+	// all levels come back, partial restores aren't worth it
+	if(!setResidentLevels(r, 0))
+		return 0;
+	enforceBudget();
+	return 1;
+}
+
+bool32
+TextureResidency::isEvicted(Raster *raster)
+{
+	RasterResidency *r = RESIDENCY(raster);
+	return r->numLevels > 0 && r->firstLevel == r->numLevels;
+}
+
+int32
+TextureResidency::getNumEvictedLevels(Raster *raster)
+{
+	return isEvicted(raster) ? RESIDENCY(raster)->numLevels : 0;
+}
+
+void
+TextureResidency::update(void)
+{
+	RasterResidency *r;
+
+	enforceBudget();
+	// Bring back the levels of rasters used this frame if they fit.
+	// We can't know their size before, but each level
+	// is about four times as large as the next one.
+	if(residency.budget)
+		FORLIST(lnk, residency.rasters){
+			r = FROMLIST(lnk);
+			if(r->lastFrame != residency.frame)
+				break;
+			if(r->firstLevel == 0)
+				continue;
+			float32 grow = (float32)r->size*((float32)(1<<2*r->firstLevel)-1.0f);
+			if(residency.usage + grow <= residency.budget)
+				setResidentLevels(r, 0);
+		}
+	residency.frame++;
+}
+
+}
@@ -400,6 +400,8 @@ struct Sphere
 {
 	V3d center;
 	float32 radius;
+
+	void calculate(V3d *points, int32 n);
 };
 
 struct Plane
@@ -458,6 +460,9 @@ inline void memLittle16(void *data, uint32 size) { }
  */
 
 void makePath(char *filename);
+// Call func with the name of every entry in a directory, path is empty
+// or ends in a separator. Returns 0 if the directory can't be listed.
+int listDirectory(const char *path, void (*func)(const char *name, void *data), void *data);
 
 class Stream
 {
@@ -563,7 +568,9 @@ enum VendorID
 	// Used for rasters (platform-specific)
 	VEND_RASTER         = 10,
 	// Used for driver/device allocation tags
-	VEND_DRIVER         = 11
+	VEND_DRIVER         = 11,
+	// Extensions that only exist in librw
+	VEND_LIBRW          = 12
 };
 
 // TODO: modules (VEND_CRITERIONINT)
@@ -595,6 +602,7 @@ enum PluginID
 	ID_UVANIMDICT    = MAKEPLUGINID(VEND_CORE, 0x2B),
 
 	// Toolkit
+	ID_MORPH         = MAKEPLUGINID(VEND_CRITERIONTK, 0x05),
 	ID_SKYMIPMAP     = MAKEPLUGINID(VEND_CRITERIONTK, 0x10),
 	ID_SKIN          = MAKEPLUGINID(VEND_CRITERIONTK, 0x16),
 	ID_HANIM         = MAKEPLUGINID(VEND_CRITERIONTK, 0x1E),
@@ -605,6 +613,15 @@ enum PluginID
 	ID_ADC           = MAKEPLUGINID(VEND_CRITERIONTK, 0x34),
 	ID_UVANIMATION   = MAKEPLUGINID(VEND_CRITERIONTK, 0x35),
 
+	// librw
+	ID_OCCLUSION     = MAKEPLUGINID(VEND_LIBRW, 0x01),
+	ID_TEXTURELOAD   = MAKEPLUGINID(VEND_LIBRW, 0x02),
+	ID_RESIDENCY     = MAKEPLUGINID(VEND_LIBRW, 0x03),
+	ID_LOD           = MAKEPLUGINID(VEND_LIBRW, 0x04),
+	ID_DEDUP         = MAKEPLUGINID(VEND_LIBRW, 0x05),
+	ID_MESHLET       = MAKEPLUGINID(VEND_LIBRW, 0x06),
+	ID_BOUNDS        = MAKEPLUGINID(VEND_LIBRW, 0x07),
+
 	// World
 	ID_MESH          = MAKEPLUGINID(VEND_CRITERIONWORLD, 0x0E),
 	ID_NATIVEDATA    = MAKEPLUGINID(VEND_CRITERIONWORLD, 0x10),
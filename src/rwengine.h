@@ -86,6 +86,10 @@ struct Driver
 		int32 *width, int32 *height, int32 *depth, int32 *format);
 	bool32 (*rasterFromImage)(Raster*, Image*);
 	Image *(*rasterToImage)(Raster*);
+	// Only keep storage for levels firstLevel..numLevels-1 of a texture,
+	// none at all if firstLevel == numLevels. Returns whether levels
+	// that became resident again kept their contents. May be nil.
+	bool32 (*rasterSetResidency)(Raster*, int32 firstLevel, int32 numLevels);
 
 	static PluginList s_plglist[NUM_PLATFORMS];
 	static int32 registerPlugin(int32 platform, int32 size, uint32 id,
@@ -130,6 +134,21 @@ struct FileFunctions
 	size_t (*rwfread)(void *ptr, size_t size, size_t nmemb, void *fp);
 	size_t (*rwfwrite)(const void *ptr, size_t size, size_t nmemb, void *fp);
 	int (*rwfeof)(void *fp);
+	// may be nil, then file names are always probed with rwfopen
+	int (*rwlistdir)(const char *path, void (*func)(const char *name, void *data), void *data);
+};
+
+// Used to spread independent work items over multiple threads.
+// Jobs must not call into anything that isn't thread safe,
+// in particular they must not allocate memory.
+typedef void (*JobFunc)(void *data, int32 i);
+
+struct JobFunctions
+{
+	// Call func(data, i) for all 0 <= i < n, return when all are done
+	void  (*parallelFor)(JobFunc func, void *data, int32 n);
+	// Number of threads parallelFor may use, including the caller
+	int32 (*getNumThreads)(void);
 };
 
 struct SubSystemInfo
@@ -175,6 +194,7 @@ struct Engine
 
 	// These must always be available
 	static MemoryFunctions memfuncs;
+	static JobFunctions jobfuncs;
 	static State state;
 
 	static bool32 init(MemoryFunctions *memfuncs = nil);
@@ -235,6 +255,15 @@ extern MemoryFunctions defaultMemfuncs;
 extern MemoryFunctions managedMemfuncs;
 void printleaks(void);	// when using managed mem funcs
 
+// runs all jobs on the calling thread
+extern JobFunctions serialJobfuncs;
+// uses a pool of worker threads where available, serial otherwise
+extern JobFunctions threadedJobfuncs;
+void termJobThreads(void);	// when using threaded job funcs
+
+inline void parallelFor(JobFunc func, void *data, int32 n) { rw::Engine::jobfuncs.parallelFor(func, data, n); }
+inline int32 getNumJobThreads(void) { return rw::Engine::jobfuncs.getNumThreads(); }
+
 namespace null {
 	void beginUpdate(Camera*);
 	void endUpdate(Camera*);
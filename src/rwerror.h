@@ -8,6 +8,9 @@ struct Error
 
 void setError(Error *e);
 Error *getError(Error *e);
+// Errors set by this thread go to e instead of the global error, nil to stop.
+// For threads other than the main one.
+void captureErrors(Error *e);
 
 #define _ERRORCODE(code, ...) code
 char *dbgsprint(uint32 code, ...);
@@ -26,6 +26,52 @@ struct Object
 	}
 };
 
+struct Frame;
+
+/* Optional flattened copy of a frame hierarchy.
+ * Frames are sorted so parents always come before their children,
+ * which turns LTM synching into a single loop over arrays.
+ * While a hierarchy is compiled, Frame::ltm is not updated,
+ * LTMs have to be queried with Frame::getLTM. */
+struct FrameHierarchy
+{
+	enum {
+		// dirty flags
+		MATRIXDIRTY = 1,	// local matrix changed
+		LTMDIRTY = 2		// a parent changed
+	};
+	Frame *root;
+	int32 numFrames;
+	int32 maxFrames;
+	bool32 needsRebuild;	// topology changed
+	Frame **frames;
+	int32 *parents;		// -1 for the root
+	uint8 *dirty;
+	// Whole matrices, not split into components: getLTM hands out
+	// Matrix pointers into ltms, and each LTM needs its parent's,
+	// so the loop can't run across frames anyway.
+	Matrix *matrices;
+	Matrix *ltms;
+
+	static FrameHierarchy *create(Frame *root);
+	void destroy(void);
+	void rebuild(void);
+	void syncLTM(void);
+};
+
+/* Used to render frames at a higher rate than they are
+ * simulated at. The LTMs of the last two simulation steps are
+ * kept and blended for rendering. */
+struct FrameInterp
+{
+	Frame *frame;
+	int32 index;	// in list of interpolated frames
+	bool32 moving;	// LTM changed in last step
+	Matrix prev;
+	Matrix cur;
+	Matrix render;
+};
+
 struct Frame
 {
 	PLUGINBASE
@@ -55,6 +101,12 @@ struct Frame
 	Frame *next;
 	Frame *root;
 
+	// only set on roots of compiled hierarchies
+	FrameHierarchy *hierarchy;
+	int32 hierarchyIndex;
+
+	FrameInterp *interp;
+
 	static int32 numAllocated;
 
 	static Frame *create(void);
@@ -77,6 +129,19 @@ struct Frame
 	void updateObjects(void);
 
 
+	// Interpolation: call storeInterpolationStep after every simulation
+	// step and interpolate with the fraction of time until the next
+	// step before rendering. getRenderLTM is the LTM used for rendering.
+	void setInterpolation(bool32 enable);
+	Matrix *getRenderLTM(void) {
+		return this->interp ? &this->interp->render : this->getLTM(); }
+	static void storeInterpolationStep(void);
+	static void interpolate(float32 alpha);
+
+	// LTM pointers stay valid until the topology changes
+	FrameHierarchy *compileHierarchy(void);
+	void releaseHierarchy(void);
+
 	void syncHierarchyLTM(void);
 	void setHierarchyRoot(Frame *root);
 	Frame *cloneAndLink(void);
@@ -86,6 +151,10 @@ struct Frame
 	static void registerModule(void);
 #endif
 	static void syncDirty(void);
+	// Sync LTMs of dirty hierarchies with Engine::jobfuncs.
+	// Object sync callbacks are still called serially.
+	static void setParallelSync(bool32);	// default: false
+	static bool32 getParallelSync(void);
 };
 
 struct FrameList_
@@ -140,11 +209,29 @@ struct Image
 	void free(void);
 	void setPixels(uint8 *pixels);
 	void setPixelsDXT(int32 type, uint8 *pixels);
+	// quality of DXT compression
+	enum { DXTRANGEFIT, DXTCLUSTERFIT };
+	// used when compressed rasters are set from images
+	static int32 dxtQuality;
+	// compress to DXT1, 3 or 5, free the returned data with rwFree
+	uint8 *compressDXT(int32 type, int32 quality);
+	// mipmap filters
+	enum { MIPBOX, MIPKAISER };
+	// used when rasters with mipmaps are set from images
+	static int32 mipmapFilter;
+	static bool32 mipmapSRGB;
+	static int32 mipmapAlphaRef;	// keep alpha test coverage, 0 to disable
+	// next smaller level, always 32 bit
+	Image *createMipmap(int32 filter, bool32 srgb);
+	// all smaller levels down to 1x1, returns number of levels created
+	int32 generateMipmaps(Image **levels, int32 maxLevels, int32 filter, bool32 srgb, int32 alphaRef);
+	float32 getAlphaCoverage(int32 alphaRef);
+	void scaleAlphaCoverage(int32 alphaRef, float32 coverage);
 	void setPalette(uint8 *palette);
 	void compressPalette(void);	// turn 8 bit into 4 bit if possible
 	bool32 hasAlpha(void);
 	void convertTo32(void);
-	void palettize(int32 depth);
+	void palettize(int32 depth, bool32 dither = 0);
 	void unpalettize(bool forceAlpha = false);
 	void makeMask(void);
 	void applyMask(Image *mask);
@@ -152,6 +239,9 @@ struct Image
 	Image *extractMask(void);
 
 	static void setSearchPath(const char*);
+	// Directory listings of the search paths are cached, call this
+	// to list them again when files have been added or removed.
+	static void invalidateSearchPathCache(void);
 	static void printSearchPath(void);
 	static char *getFilename(const char*);
 	static Image *read(const char *imageName);
@@ -181,21 +271,27 @@ struct ColorQuant
 	struct Node {
 		uint32 r, g, b, a;
 		int32 numPixels;
-		Node *parent;
+		Node *parent;	// next free node when unused
 		Node *children[16];
 		LLLink link;
 
-		void destroy(void);
 		void addColor(RGBA color);
 		bool isLeaf(void) { for(int32 i = 0; i < 16; i++) if(this->children[i]) return false; return true; }
 	};
+	struct NodeBlock;
 
 	Node *root;
 	LinkList leaves;
+	int32 numLeaves;
+	NodeBlock *blocks;	// all nodes are allocated from these
+	Node *freeNodes;
+	RGBA palette[256];	// result of makePalette
+	int32 numColors;
 
 	void init(void);
 	void destroy(void);
 	Node *createNode(int32 level);
+	void destroyNode(Node *node);
 	Node *getNode(Node *root, uint32 addr, int32 level);
 	Node *findNode(Node *root, uint32 addr, int32 level);
 	void reduceNode(Node *node);
@@ -203,7 +299,8 @@ struct ColorQuant
 	uint8 findColor(RGBA color);
 	void addImage(Image *img);
 	void makePalette(int32 numColors, RGBA *colors);
-	void matchImage(uint8 *dstPixels, uint32 dstStride, Image *src);
+	// nearest palette color, optionally with ordered dithering
+	void matchImage(uint8 *dstPixels, uint32 dstStride, Image *src, bool32 dither = 0);
 };
 
 // used to emulate d3d and xbox textures
@@ -251,6 +348,11 @@ struct Raster
 	static bool32 imageFindRasterFormat(Image *image, int32 type,
 		int32 *pWidth, int32 *pHeight, int32 *pDepth, int32 *pFormat, int32 platform = 0);
 	Raster *setFromImage(Image *image, int32 platform = 0);
+	// levels[1..numLevels-1] are mipmaps of levels[0], e.g. from
+	// Image::generateMipmaps. They are generated if there are too few.
+	Raster *setFromImages(Image **levels, int32 numLevels, int32 platform = 0);
+	// whether setFromImage fills the mipmaps of such a raster from the image
+	static bool32 needsImageMipmaps(int32 format, Image *image, int32 platform = 0);
 	static Raster *createFromImage(Image *image, int32 platform = 0);
 	Image *toImage(void);
 	uint8 *lock(int32 level, int32 lockMode);
@@ -333,6 +435,47 @@ inline void conv_RGBA8888_from_BGRA8888(uint8 *out, uint8 *in) { conv_BGRA8888_f
 inline void conv_RGB888_from_BGR888(uint8 *out, uint8 *in) { conv_BGR888_from_RGB888(out, in); }
 inline void conv_ARGB1555_from_ABGR1555(uint8 *out, uint8 *in) { conv_ABGR1555_from_ARGB1555(out, in); }
 
+// Convert n pixels of a row
+typedef void (*ConvRowFunc)(uint8 *out, uint8 *in, int32 n);
+void convRow_RGBA8888_from_RGBA8888(uint8 *out, uint8 *in, int32 n);
+void convRow_BGRA8888_from_RGBA8888(uint8 *out, uint8 *in, int32 n);
+void convRow_RGBA8888_from_RGB888(uint8 *out, uint8 *in, int32 n);
+void convRow_BGRA8888_from_RGB888(uint8 *out, uint8 *in, int32 n);
+void convRow_RGB888_from_RGB888(uint8 *out, uint8 *in, int32 n);
+void convRow_BGR888_from_RGB888(uint8 *out, uint8 *in, int32 n);
+void convRow_RGB888_from_RGBA8888(uint8 *out, uint8 *in, int32 n);
+void convRow_BGR888_from_RGBA8888(uint8 *out, uint8 *in, int32 n);
+void convRow_ARGB1555_from_ARGB1555(uint8 *out, uint8 *in, int32 n);
+void convRow_ARGB1555_from_RGB555(uint8 *out, uint8 *in, int32 n);
+void convRow_RGBA5551_from_ARGB1555(uint8 *out, uint8 *in, int32 n);
+void convRow_ARGB1555_from_RGBA5551(uint8 *out, uint8 *in, int32 n);
+void convRow_RGBA8888_from_ARGB1555(uint8 *out, uint8 *in, int32 n);
+void convRow_ABGR1555_from_ARGB1555(uint8 *out, uint8 *in, int32 n);
+void convRow_8_from_8(uint8 *out, uint8 *in, int32 n);
+inline void convRow_RGBA8888_from_BGRA8888(uint8 *out, uint8 *in, int32 n) { convRow_BGRA8888_from_RGBA8888(out, in, n); }
+inline void convRow_RGB888_from_BGR888(uint8 *out, uint8 *in, int32 n) { convRow_BGR888_from_RGB888(out, in, n); }
+inline void convRow_RGB888_from_BGRA8888(uint8 *out, uint8 *in, int32 n) { convRow_BGR888_from_RGBA8888(out, in, n); }
+inline void convRow_ARGB1555_from_ABGR1555(uint8 *out, uint8 *in, int32 n) { convRow_ABGR1555_from_ARGB1555(out, in, n); }
+
+// Pixel layouts in memory for looking up row conversions
+enum {
+	CONVFMT_RGBA8888,
+	CONVFMT_BGRA8888,
+	CONVFMT_RGB888,
+	CONVFMT_BGR888,
+	CONVFMT_ARGB1555,
+	CONVFMT_RGBA5551,
+	CONVFMT_ABGR1555,
+	CONVFMT_RGB555,
+	CONVFMT_8,
+	NUM_CONVFMTS
+};
+// nil if there is no conversion
+ConvRowFunc getConvRow(int32 dst, int32 src);
+// layout of an image's pixels, -1 for none
+int32 getImageConvFormat(Image *image);
+void convertPixels(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h, ConvRowFunc conv);
+
 void expandPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 void compressPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 void expandPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
@@ -340,6 +483,15 @@ void compressPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride,
 void copyPal8(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 
 void flipDXT(int32 type, uint8 *dst, uint8 *src, uint32 width, uint32 height);
+// decompress to 32 bit RGBA
+void decompressDXT1(uint8 *dst, int32 w, int32 h, uint8 *src);
+void decompressDXT3(uint8 *dst, int32 w, int32 h, uint8 *src);
+void decompressDXT5(uint8 *dst, int32 w, int32 h, uint8 *src);
+// same as above but rows of blocks are spread over the job threads
+void decompressDXT(int32 type, uint8 *dst, int32 w, int32 h, uint8 *src);
+// compress 32 bit RGBA, rows of blocks are spread over the job threads
+void compressDXT(int32 type, int32 quality, uint8 *dst, int32 w, int32 h, uint8 *src, int32 stride);
+int32 getDXTSize(int32 type, int32 w, int32 h);
 
 
 #define IGNORERASTERIMP 0
@@ -404,9 +556,59 @@ struct Texture
 	static bool32 getMipmapping(void);
 	static bool32 getAutoMipmapping(void);
 
+	// Asynchronous loading. The texture is returned at once with the
+	// fallback raster, the image is read and mipmapped by loader threads
+	// and pumpAsync then creates the real raster on the calling thread.
+	// Memory and file functions have to be thread safe, the search path
+	// and image file formats must not change while loads are pending.
+	static Texture *readAsync(const char *name, const char *mask);
+	static Texture *asyncReadCB(const char *name, const char *mask);	// for readCB
+	static void setAsyncFallback(Raster *raster);	// default: nil, not owned by textures
+	// Create rasters for decoded images until either limit is reached,
+	// 0 means no limit. Returns the number of loads still pending.
+	static int32 pumpAsync(float32 maxSeconds, uint32 maxBytes);
+	static void finishAsync(void);	// wait for and pump all loads
+	bool32 isLoading(void);
+
 	void setMaxAnisotropy(int32 maxaniso);	// only if plugin is attached
 	int32 getMaxAnisotropy(void);
 
+#ifndef RWPUBLIC
+	static void registerModule(void);
+	static void registerAsyncModule(void);
+	static void stopAsync(void);	// cancel all loads
+#endif
+};
+
+// Keeps the native memory of texture rasters inside a budget.
+// Drivers report the size of a raster's storage and touch it when it
+// is bound. When the total is over budget the least recently bound
+// rasters that have a reload callback first lose their top mip levels
+// and are then evicted. Evicted rasters are made resident again when
+// they're bound or locked, dropped levels when there's room in update.
+struct TextureResidency
+{
+	// Fill levels firstLevel..firstLevel+numLevels-1 of the raster,
+	// writing the other levels as well is fine.
+	typedef bool32 (*ReloadCB)(Raster *raster, int32 firstLevel, int32 numLevels, void *data);
+
+	static void setBudget(uint32 bytes);	// default: 0, no budget
+	static uint32 getBudget(void);
+	static uint32 getUsage(void);	// bytes of all rasters
+	static void setMaxDropLevels(int32 n);	// default: 2, 0 never drops levels
+	static void setReloadCB(Raster *raster, ReloadCB cb, void *data);
+	// reload by reading the texture's image again, its name and mask are copied
+	static void setReloadTexture(Raster *raster, Texture *tex);
+	// Call once per frame. Rasters bound in the current frame are never evicted.
+	static void update(void);
+	static bool32 makeResident(Raster *raster, int32 level = 0);
+	static bool32 isEvicted(Raster *raster);
+	static int32 getNumEvictedLevels(Raster *raster);	// 0 if not evicted
+
+	// for drivers
+	static void reportSize(Raster *raster, uint32 size);	// 0 when the storage is freed
+	static void touch(Raster *raster);
+
 #ifndef RWPUBLIC
 	static void registerModule(void);
 #endif
@@ -469,6 +671,7 @@ struct MeshHeader
 	Mesh *getMeshes(void) { return (Mesh*)(this+1); }
 	void setupIndices(void);
 	uint32 guessNumTriangles(void);
+	uint32 getIndexChecksum(void);
 };
 
 struct Geometry;
@@ -494,6 +697,13 @@ struct Triangle
 	uint16 matId;
 };
 
+// Post-transform vertex cache efficiency of trilist meshes
+struct VertexCacheStats
+{
+	float32 acmr;	// transformed vertices per triangle, 0.5 at best
+	float32 atvr;	// transformed vertices per used vertex, 1.0 at best
+};
+
 struct MaterialList
 {
 	Material **materials;
@@ -509,6 +719,13 @@ struct MaterialList
 	uint32 streamGetSize(void);
 };
 
+// Range of vertices, e.g. changed since instancing
+struct VertexSpan
+{
+	int32 first;
+	int32 count;
+};
+
 struct Geometry
 {
 	PLUGINBASE
@@ -516,6 +733,9 @@ struct Geometry
 	Object object;
 	uint32 flags;
 	uint16 lockedSinceInst;
+	uint16 lockedRangeFlags;	// of lockedSinceInst, only dirtySpans changed
+	int32 numDirtySpans;
+	VertexSpan *dirtySpans;	// sorted and disjoint
 	int32 numTriangles;
 	int32 numVertices;
 	int32 numMorphTargets;
@@ -539,7 +759,12 @@ struct Geometry
 	void addRef(void) { this->refCount++; }
 	void destroy(void);
 	void lock(int32 lockFlags);
+	void lockRange(int32 lockFlags, int32 firstVertex, int32 count);
 	void unlock(void);
+	// Vertices an instance callback has to write for lockFlags,
+	// all of them (in *all) unless only dirty spans were locked.
+	int32 getLockedSpans(int32 lockFlags, bool32 reinstance, VertexSpan *all, VertexSpan **spans);
+	void resetLocks(void);	// after (re)instancing
 	void addMorphTargets(int32 n);
 	void calculateBoundingSphere(void);
 	bool32 hasColoredMaterial(void);
@@ -550,6 +775,14 @@ struct Geometry
 	void buildTristrips(void);	// private, used by buildMeshes
 	void correctTristripWinding(void);
 	void removeUnusedMaterials(void);
+	void getVertexCacheStats(VertexCacheStats *stats, int32 cacheSize = 16);
+	bool32 optimizeVertexCache(VertexCacheStats *before = nil, VertexCacheStats *after = nil);
+	// Plugins with per-vertex data register this to follow
+	// reordered vertices. map has the new index of every old vertex.
+	typedef void (*VertexRemapCB)(Geometry *geo, const uint16 *map);
+	static void registerVertexRemapCB(VertexRemapCB cb);
+	static bool32 optimizeOnInstance;	// optimizeVertexCache before instancing
+	static uint32 quantizeOnInstance;	// QuantizeFlags, formats used by instancing
 	static Geometry *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
@@ -596,11 +829,57 @@ struct Geometry
 
 		LOCKALL          = 0x0fff
 	};
+
+	// Where the platform can decode them, instancing uses
+	// smaller vertex formats for these attributes
+	enum QuantizeFlags
+	{
+		QUANTPOSITIONS = 0x01,	// 16 bit normalized, relative to the bounding box
+		QUANTNORMALS   = 0x02,	// octahedral or 16 bit normalized
+		QUANTTEXCOORDS = 0x04,	// half float
+		QUANTWEIGHTS   = 0x08,	// 8 bit normalized skin weights
+
+		QUANTALL       = 0x0f
+	};
 };
 
 void registerMeshPlugin(void);
 void registerNativeDataPlugin(void);
 
+// Share geometries and native textures that are read from the same data.
+// A shared geometry gets another reference, a shared native texture is
+// a new Texture with the same raster. Objects are shared only while they
+// are alive and haven't been locked since they were read.
+struct AssetDedup
+{
+	struct Stats
+	{
+		int32 numGeometries;	// read while enabled
+		int32 numSharedGeometries;
+		int32 numTextures;
+		int32 numSharedTextures;
+		uint64 geometryBytes;	// of stream data
+		uint64 geometryBytesSaved;
+		uint64 textureBytes;
+		uint64 textureBytesSaved;
+	};
+
+	static void setEnabled(bool32 enable);	// default: off
+	static bool32 isEnabled(void);
+	static void getStats(Stats *stats);
+	static void resetStats(void);
+
+	// private, used by streamRead and destroy
+	static Geometry *readGeometry(Stream *stream);
+	static Texture *readTexture(Stream *stream);
+	static bool32 releaseRaster(Raster *raster);	// TRUE if still shared
+	static void forget(Geometry *geo);
+	static void forget(Raster *raster);
+#ifndef RWPUBLIC
+	static void registerModule(void);
+#endif
+};
+
 struct Clump;
 struct World;
 
@@ -791,6 +1070,15 @@ struct Camera
 	void setViewOffset(const V2d *offset);
 	void setProjection(int32 proj);
 	int32 frustumTestSphere(const Sphere *s) const;
+	// returns SPHEREOUTSIDE, SPHEREBOUNDARY or SPHEREINSIDE as well
+	int32 frustumTestBBox(const BBox *box) const;
+	// Test many spheres or boxes at once, input is in SoA layout.
+	// Writes one result per object like the functions above.
+	void frustumTestSpheres(int32 n, const float32 *x, const float32 *y,
+		const float32 *z, const float32 *radius, uint8 *results) const;
+	void frustumTestBBoxes(int32 n, const float32 *infx, const float32 *infy,
+		const float32 *infz, const float32 *supx, const float32 *supy,
+		const float32 *supz, uint8 *results) const;
 	static Camera *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
@@ -875,6 +1163,17 @@ struct World
 	void enumerateLights(WorldLights *lightData);
 };
 
+// Static batching. Atomics are transformed by their LTMs and merged
+// into few atomics with large geometries, one for each pipeline, render
+// state and vertex format in a grid cell (no grid if cellSize is 0).
+// Merged geometries have at most 65535 vertices.
+// Skinned, morphed, native and LOD atomics can't be merged; they
+// aren't in the new clump and are counted in numSkipped.
+// The sources are left alone, the result can be written as a DFF.
+Clump *batchClump(Clump *clump, float32 cellSize, int32 *numSkipped = nil);
+// the new clump is in world space
+Clump *batchWorld(World *world, float32 cellSize, int32 *numSkipped = nil);
+
 struct TexDictionary
 {
 	PLUGINBASE
@@ -51,9 +51,18 @@ enum {
 	VERT_FLOAT4,
 	VERT_ARGB,
 	VERT_RGBA,
-	VERT_COMPNORM
+	VERT_COMPNORM,
+	VERT_HALF2,	// two half floats
+	VERT_OCTNORM,	// octahedral normal in two normalized shorts
+	VERT_UBYTE4N	// weights in normalized bytes that add up to 255
 };
 
+// NORMSHORT3 is padded to 8 bytes. Positions that don't fit
+// into [-1,1] are quantized relative to their bounding box,
+// they decode as normalized*scale + offset.
+void getQuantization(V3d *src, uint32 numVertices, V3d *scale, V3d *offset);
+void instQuantV3d(uint8 *dst, V3d *src, uint32 numVertices, uint32 stride, const V3d *scale, const V3d *offset);
+
 void instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride);
 void instV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride);
 void uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride);
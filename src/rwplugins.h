@@ -249,4 +249,283 @@ Stream *writeSkinSplitData(Stream *stream, Skin *skin);
 int32 skinSplitDataSize(Skin *skin);
 void registerSkinPlugin(void);
 
+/*
+ * Occlusion
+ */
+
+struct OcclusionGlobals
+{
+	int32 atomicOffset;
+};
+extern OcclusionGlobals occlusionGlobals;
+
+// Software occlusion culling. Occluder atomics are rasterized
+// into a small depth buffer on the CPU, other atomics are then
+// tested against it before they are rendered.
+// Depth values are stored so that larger is nearer and 0 is empty.
+struct OcclusionBuffer
+{
+	enum { TILEWIDTH = 16, TILEHEIGHT = 16 };
+	struct ScreenTri;
+
+	int32 width, height;
+	int32 tilesX, tilesY;
+	float32 *depth;
+	float32 *tileMin;	// farthest depth in each tile
+
+	Camera *camera;
+	Matrix viewMatrix;
+	int32 projection;
+	float32 nearPlane, farPlane;
+
+	// occluder triangles of this frame, binned by tile
+	ScreenTri *tris;
+	int32 numTris, maxTris;
+	int32 *binStart;	// tilesX*tilesY+1
+	int32 *binTris;
+	int32 maxBinTris;
+	V3d *verts;
+	int32 maxVerts;
+
+	// statistics
+	int32 numTested;
+	int32 numOccluded;
+
+	// width and height are rounded up to whole tiles
+	static OcclusionBuffer *create(int32 width, int32 height);
+	void destroy(void);
+	void begin(Camera *cam);
+	void addOccluder(Atomic *atomic);
+	void addOccluders(World *world);
+	void rasterize(void);
+	// return TRUE if the object may be visible
+	bool32 testBBox(const BBox *box);
+	bool32 testSphere(const Sphere *sphere);
+	bool32 testAtomic(Atomic *atomic);
+	// render the world's atomics that pass the frustum and occlusion tests
+	void renderWorld(World *world);
+
+	static void setOccluder(Atomic *atomic, bool32 occluder){
+		*PLUGINOFFSET(int32, atomic, occlusionGlobals.atomicOffset) = occluder;
+	}
+	static bool32 isOccluder(const Atomic *atomic){
+		return *PLUGINOFFSET(int32, atomic, occlusionGlobals.atomicOffset);
+	}
+};
+
+void registerOcclusionPlugin(void);
+
+/*
+ * LOD
+ */
+
+struct LODGlobals
+{
+	int32 atomicOffset;
+	float32 bias;	// > 1 keeps detailed levels longer
+};
+extern LODGlobals lodGlobals;
+
+// Reduce the triangles of a geometry to about ratio of its current number
+// by collapsing edges. Materials, texture seams and skin weights are kept.
+// Returns a new geometry or nil.
+Geometry *simplifyGeometry(Geometry *geo, float32 ratio);
+
+// Chain of geometries of decreasing detail for an atomic.
+// Level 0 is the original geometry. The level is picked from the
+// size of the bounding sphere on screen, relative to the view window.
+struct AtomicLOD
+{
+	enum { MAXLEVELS = 8 };
+
+	int32 numLevels;
+	int32 currentLevel;
+	Geometry *geometries[MAXLEVELS];
+	float32 minScreenSize[MAXLEVELS];	// use level while larger than this
+	Sphere boundingSphere;	// of level 0
+	Atomic::RenderCB renderCB;	// while hooked
+
+	// ratios of the original triangles, in decreasing order
+	static bool32 build(Atomic *atomic, int32 numLevels, const float32 *ratios);
+	static void destroy(Atomic *atomic);
+	static void setScreenSize(Atomic *atomic, int32 level, float32 size);
+	static float32 getScreenSize(Atomic *atomic, Camera *cam);
+	// set the geometry for the camera, returns the level
+	static int32 select(Atomic *atomic, Camera *cam);
+	// select automatically with the current camera before rendering
+	static void hookRender(Atomic *atomic);
+	static void unhookRender(Atomic *atomic);
+	static AtomicLOD *get(Atomic *atomic){
+		return *PLUGINOFFSET(AtomicLOD*, atomic, lodGlobals.atomicOffset);
+	}
+};
+
+void registerLODPlugin(void);
+
+/*
+ * Meshlets
+ */
+
+struct MeshletGlobals
+{
+	int32 geoOffset;
+};
+extern MeshletGlobals meshletGlobals;
+
+// Cluster of triangles that is culled as a whole
+struct Meshlet
+{
+	Sphere bound;
+	V3d coneAxis;		// average front facing normal
+	float32 coneCutoff;	// sine of the normal cone's half angle, 1 if it can't be culled
+	uint32 firstIndex;	// into the mesh's indices
+	uint32 numIndices;
+};
+
+struct MeshletRange
+{
+	uint32 firstIndex;
+	uint32 numIndices;
+};
+
+struct MeshletStats
+{
+	uint32 numMeshlets;
+	uint32 numFrustumCulled;
+	uint32 numConeCulled;
+	uint32 numTriangles;
+	uint32 numDrawnTriangles;
+};
+
+// Meshlets of all trilist meshes of a geometry.
+// They become invalid when the meshes change.
+struct Meshlets
+{
+	enum { MAXVERTICES = 64, MAXTRIANGLES = 124 };
+
+	int32 numMeshlets;
+	Meshlet *meshlets;
+	int32 numMeshes;
+	int32 *firstMeshlet;	// per mesh and one more
+	int32 serialNum;	// of the meshes, -1 if not known yet
+	uint32 totalIndices;
+	uint32 indexChecksum;	// MeshHeader::getIndexChecksum
+
+	// reorders the mesh indices, do this after any other optimization
+	static bool32 build(Geometry *geo);
+	static void destroy(Geometry *geo);
+	static Meshlets *get(Geometry *geo);
+	// Cull the meshlets of an atomic with a camera, cullMode is the
+	// render state. Until endDraw the pipelines only draw the visible
+	// ones. Returns the number of triangles to draw or -1 if the
+	// geometry has no meshlets.
+	static int32 beginDraw(Atomic *atomic, Camera *cam, int32 cullMode);
+	static void endDraw(void);
+	// called by the pipelines, -1 means draw the whole mesh
+	static int32 getDrawRanges(int32 meshIndex, MeshletRange **ranges);
+	// culls with the current camera and renders the default way
+	static void renderCB(Atomic *atomic);
+	static void getStats(MeshletStats *stats);
+	static void resetStats(void);
+};
+
+void registerMeshletPlugin(void);
+
+/*
+ * Morph
+ */
+
+struct MorphGlobals
+{
+	int32 atomicOffset;
+	int32 geoOffset;	// atomic whose blend is instanced
+};
+extern MorphGlobals morphGlobals;
+
+// Animations have a single node. Between two frames the
+// geometry goes from the first frame's target to the second's.
+struct MorphKeyFrame
+{
+	MorphKeyFrame *prev;
+	float32 time;
+	int32 target;
+};
+
+struct MorphInterpFrame
+{
+	MorphKeyFrame *keyFrame1;
+	MorphKeyFrame *keyFrame2;
+	int32 target1;
+	int32 target2;
+	float32 alpha;	// 0 is target1, 1 is target2
+};
+
+// Blending between the morph targets of an atomic's geometry.
+// The blended positions and normals are instanced into the geometry,
+// atomics that share a geometry reblend when another one was instanced.
+struct Morph
+{
+	enum { INTERPID = ID_MORPH };	// of the AnimInterpolatorInfo
+
+	AnimInterpolator *interp;
+	int32 target1;
+	int32 target2;
+	float32 alpha;
+	// last blend that was instanced
+	Geometry *blendGeometry;
+	int32 blendTarget1;
+	int32 blendTarget2;
+	float32 blendAlpha;
+
+	static bool32 setAnimation(Atomic *atomic, Animation *anim);
+	static void addTime(Atomic *atomic, float32 t);
+	// without an animation
+	static void setTargets(Atomic *atomic, int32 target1, int32 target2, float32 alpha);
+	// blend and reinstance positions and normals if anything changed
+	static void applyUpdate(Atomic *atomic);
+	static void destroy(Atomic *atomic);
+	static Morph *get(Atomic *atomic){
+		return *PLUGINOFFSET(Morph*, atomic, morphGlobals.atomicOffset);
+	}
+	// dst = a + (b-a)*alpha, large arrays are done by the job threads
+	static void blend(V3d *dst, const V3d *a, const V3d *b, int32 n, float32 alpha);
+};
+
+void registerMorphPlugin(void);
+
+/*
+ * Bounds
+ */
+
+struct BoundsGlobals
+{
+	int32 geoOffset;
+};
+extern BoundsGlobals boundsGlobals;
+
+// Boxes around a geometry and each of its meshes in geometry space,
+// they contain all morph targets. Meshes without indices have
+// an inverted box. Stored in the stream so loading doesn't have
+// to go over the vertices again.
+struct GeometryBounds
+{
+	BBox box;
+	int32 numMeshes;
+	BBox *meshBoxes;
+	int32 serialNum;	// of the meshes, -1 if not known yet
+	uint32 totalIndices;
+	uint32 indexChecksum;	// MeshHeader::getIndexChecksum
+
+	// call this again after changing vertices
+	static GeometryBounds *calculate(Geometry *geo);
+	static void destroy(Geometry *geo);
+	// calculated if there are none or the meshes changed,
+	// nil if the geometry has no vertices
+	static GeometryBounds *get(Geometry *geo);
+	// world space box around the atomic's transformed box
+	static bool32 getWorldBBox(Atomic *atomic, BBox *box);
+};
+
+void registerBoundsPlugin(void);
+
 }
@@ -0,0 +1,211 @@
+// Internal header. Thin wrappers around 4 wide float vectors
+// so the same kernel can be compiled for SSE2, NEON or plain C.
+// Masks are vectors with all bits of a lane set or clear.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RW_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RW_NEON
+#include <arm_neon.h>
+#endif
+
+namespace rw {
+namespace simd {
+
+#ifdef RW_SSE2
+
+typedef __m128 F4;
+typedef __m128i I4;
+
+inline F4 load(const float32 *p) { return _mm_loadu_ps(p); }
+inline void store(float32 *p, F4 a) { _mm_storeu_ps(p, a); }
+inline F4 set1(float32 f) { return _mm_set1_ps(f); }
+inline F4 set(float32 a, float32 b, float32 c, float32 d) { return _mm_setr_ps(a, b, c, d); }
+inline F4 zero(void) { return _mm_setzero_ps(); }
+inline F4 add(F4 a, F4 b) { return _mm_add_ps(a, b); }
+inline F4 sub(F4 a, F4 b) { return _mm_sub_ps(a, b); }
+inline F4 mul(F4 a, F4 b) { return _mm_mul_ps(a, b); }
+inline F4 min(F4 a, F4 b) { return _mm_min_ps(a, b); }
+inline F4 max(F4 a, F4 b) { return _mm_max_ps(a, b); }
+inline F4 cmplt(F4 a, F4 b) { return _mm_cmplt_ps(a, b); }
+inline F4 cmpgt(F4 a, F4 b) { return _mm_cmpgt_ps(a, b); }
+inline F4 cmpeq(F4 a, F4 b) { return _mm_cmpeq_ps(a, b); }
+inline F4 and_(F4 a, F4 b) { return _mm_and_ps(a, b); }
+inline F4 or_(F4 a, F4 b) { return _mm_or_ps(a, b); }
+inline F4 select(F4 mask, F4 a, F4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+// one bit per lane
+inline int32 movemask(F4 mask) { return _mm_movemask_ps(mask); }
+
+inline I4 loadi(const void *p) { return _mm_loadu_si128((const __m128i*)p); }
+inline void storei(void *p, I4 a) { _mm_storeu_si128((__m128i*)p, a); }
+inline I4 set1i(int32 i) { return _mm_set1_epi32(i); }
+inline I4 seti(int32 a, int32 b, int32 c, int32 d) { return _mm_setr_epi32(a, b, c, d); }
+inline I4 addi(I4 a, I4 b) { return _mm_add_epi32(a, b); }
+inline I4 andi(I4 a, I4 b) { return _mm_and_si128(a, b); }
+inline I4 ori(I4 a, I4 b) { return _mm_or_si128(a, b); }
+inline I4 cmpeqi(I4 a, I4 b) { return _mm_cmpeq_epi32(a, b); }
+inline I4 slli(I4 a, int32 n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+inline I4 srli(I4 a, int32 n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }	// logical
+inline I4 srai(I4 a, int32 n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }	// arithmetic
+// unsigned 16 bit lanes, SSE2 only has signed ones
+inline I4 minu16(I4 a, I4 b) {
+	__m128i k = _mm_set1_epi16((short)0x8000);
+	return _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(a, k), _mm_xor_si128(b, k)), k);
+}
+inline I4 maxu16(I4 a, I4 b) {
+	__m128i k = _mm_set1_epi16((short)0x8000);
+	return _mm_xor_si128(_mm_max_epi16(_mm_xor_si128(a, k), _mm_xor_si128(b, k)), k);
+}
+// interleave the low or high halves of a and b, in memory order
+inline I4 ziplo8(I4 a, I4 b) { return _mm_unpacklo_epi8(a, b); }
+inline I4 ziphi8(I4 a, I4 b) { return _mm_unpackhi_epi8(a, b); }
+inline I4 ziplo16(I4 a, I4 b) { return _mm_unpacklo_epi16(a, b); }
+inline I4 ziphi16(I4 a, I4 b) { return _mm_unpackhi_epi16(a, b); }
+inline I4 ziplo64(I4 a, I4 b) { return _mm_unpacklo_epi64(a, b); }
+inline I4 ziphi64(I4 a, I4 b) { return _mm_unpackhi_epi64(a, b); }
+// lanes 1,0,3,2
+inline I4 swaplanes(I4 a) { return _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)); }
+inline I4 toint(F4 a) { return _mm_cvttps_epi32(a); }	// truncates
+inline F4 tofloat(I4 a) { return _mm_cvtepi32_ps(a); }
+inline I4 asint(F4 a) { return _mm_castps_si128(a); }	// same bits
+inline F4 asfloat(I4 a) { return _mm_castsi128_ps(a); }
+inline F4 div(F4 a, F4 b) { return _mm_div_ps(a, b); }
+inline F4 abs(F4 a) { return _mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF))); }
+// rows to columns
+inline void transpose(F4 &a, F4 &b, F4 &c, F4 &d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+
+#elif defined(RW_NEON)
+
+typedef float32x4_t F4;
+typedef int32x4_t I4;
+
+inline F4 load(const float32 *p) { return vld1q_f32(p); }
+inline void store(float32 *p, F4 a) { vst1q_f32(p, a); }
+inline F4 set1(float32 f) { return vdupq_n_f32(f); }
+inline F4 set(float32 a, float32 b, float32 c, float32 d) { float32 f[4] = { a, b, c, d }; return vld1q_f32(f); }
+inline F4 zero(void) { return vdupq_n_f32(0.0f); }
+inline F4 add(F4 a, F4 b) { return vaddq_f32(a, b); }
+inline F4 sub(F4 a, F4 b) { return vsubq_f32(a, b); }
+inline F4 mul(F4 a, F4 b) { return vmulq_f32(a, b); }
+inline F4 min(F4 a, F4 b) { return vminq_f32(a, b); }
+inline F4 max(F4 a, F4 b) { return vmaxq_f32(a, b); }
+inline F4 cmplt(F4 a, F4 b) { return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+inline F4 cmpgt(F4 a, F4 b) { return vreinterpretq_f32_u32(vcgtq_f32(a, b)); }
+inline F4 cmpeq(F4 a, F4 b) { return vreinterpretq_f32_u32(vceqq_f32(a, b)); }
+inline F4 and_(F4 a, F4 b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+inline F4 or_(F4 a, F4 b) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+inline F4 select(F4 mask, F4 a, F4 b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+inline int32 movemask(F4 mask) {
+	uint32x4_t m = vshrq_n_u32(vreinterpretq_u32_f32(mask), 31);
+	return vgetq_lane_u32(m, 0) | vgetq_lane_u32(m, 1)<<1 |
+		vgetq_lane_u32(m, 2)<<2 | vgetq_lane_u32(m, 3)<<3;
+}
+
+inline I4 loadi(const void *p) { return vld1q_s32((const int32_t*)p); }
+inline void storei(void *p, I4 a) { vst1q_s32((int32_t*)p, a); }
+inline I4 set1i(int32 i) { return vdupq_n_s32(i); }
+inline I4 seti(int32 a, int32 b, int32 c, int32 d) { int32_t i[4] = { a, b, c, d }; return vld1q_s32(i); }
+inline I4 addi(I4 a, I4 b) { return vaddq_s32(a, b); }
+inline I4 andi(I4 a, I4 b) { return vandq_s32(a, b); }
+inline I4 ori(I4 a, I4 b) { return vorrq_s32(a, b); }
+inline I4 cmpeqi(I4 a, I4 b) { return vreinterpretq_s32_u32(vceqq_s32(a, b)); }
+inline I4 slli(I4 a, int32 n) { return vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a), vdupq_n_s32(n))); }
+inline I4 srli(I4 a, int32 n) { return vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a), vdupq_n_s32(-n))); }	// logical
+inline I4 srai(I4 a, int32 n) { return vshlq_s32(a, vdupq_n_s32(-n)); }	// arithmetic
+inline I4 minu16(I4 a, I4 b) { return vreinterpretq_s32_u16(vminq_u16(vreinterpretq_u16_s32(a), vreinterpretq_u16_s32(b))); }
+inline I4 maxu16(I4 a, I4 b) { return vreinterpretq_s32_u16(vmaxq_u16(vreinterpretq_u16_s32(a), vreinterpretq_u16_s32(b))); }
+inline I4 ziplo8(I4 a, I4 b) { return vreinterpretq_s32_s8(vzipq_s8(vreinterpretq_s8_s32(a), vreinterpretq_s8_s32(b)).val[0]); }
+inline I4 ziphi8(I4 a, I4 b) { return vreinterpretq_s32_s8(vzipq_s8(vreinterpretq_s8_s32(a), vreinterpretq_s8_s32(b)).val[1]); }
+inline I4 ziplo16(I4 a, I4 b) { return vreinterpretq_s32_s16(vzipq_s16(vreinterpretq_s16_s32(a), vreinterpretq_s16_s32(b)).val[0]); }
+inline I4 ziphi16(I4 a, I4 b) { return vreinterpretq_s32_s16(vzipq_s16(vreinterpretq_s16_s32(a), vreinterpretq_s16_s32(b)).val[1]); }
+inline I4 ziplo64(I4 a, I4 b) { return vcombine_s32(vget_low_s32(a), vget_low_s32(b)); }
+inline I4 ziphi64(I4 a, I4 b) { return vcombine_s32(vget_high_s32(a), vget_high_s32(b)); }
+inline I4 swaplanes(I4 a) { return vrev64q_s32(a); }
+inline I4 toint(F4 a) { return vcvtq_s32_f32(a); }	// truncates
+inline F4 tofloat(I4 a) { return vcvtq_f32_s32(a); }
+inline I4 asint(F4 a) { return vreinterpretq_s32_f32(a); }
+inline F4 asfloat(I4 a) { return vreinterpretq_f32_s32(a); }
+#if defined(__aarch64__) || defined(_M_ARM64)
+inline F4 div(F4 a, F4 b) { return vdivq_f32(a, b); }
+#else
+inline F4 div(F4 a, F4 b) {
+	float32x4_t r = vrecpeq_f32(b);
+	r = vmulq_f32(r, vrecpsq_f32(b, r));
+	r = vmulq_f32(r, vrecpsq_f32(b, r));
+	return vmulq_f32(a, r);
+}
+#endif
+inline F4 abs(F4 a) { return vabsq_f32(a); }
+inline void transpose(F4 &a, F4 &b, F4 &c, F4 &d) {
+	float32x4x2_t ab = vtrnq_f32(a, b);
+	float32x4x2_t cd = vtrnq_f32(c, d);
+	a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+	b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+	c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+	d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+#else
+
+union F4 { float32 f[4]; uint32 u[4]; };
+union I4 { int32 i[4]; uint32 u[4]; uint16 h[8]; uint8 b[16]; };
+
+#define RWSIMD_FOR for(int32 i_ = 0; i_ < 4; i_++)
+inline F4 load(const float32 *p) { F4 r; RWSIMD_FOR r.f[i_] = p[i_]; return r; }
+inline void store(float32 *p, F4 a) { RWSIMD_FOR p[i_] = a.f[i_]; }
+inline F4 set1(float32 f) { F4 r; RWSIMD_FOR r.f[i_] = f; return r; }
+inline F4 set(float32 a, float32 b, float32 c, float32 d) { F4 r; r.f[0] = a; r.f[1] = b; r.f[2] = c; r.f[3] = d; return r; }
+inline F4 zero(void) { return set1(0.0f); }
+inline F4 add(F4 a, F4 b) { RWSIMD_FOR a.f[i_] += b.f[i_]; return a; }
+inline F4 sub(F4 a, F4 b) { RWSIMD_FOR a.f[i_] -= b.f[i_]; return a; }
+inline F4 mul(F4 a, F4 b) { RWSIMD_FOR a.f[i_] *= b.f[i_]; return a; }
+inline F4 min(F4 a, F4 b) { RWSIMD_FOR a.f[i_] = a.f[i_] < b.f[i_] ? a.f[i_] : b.f[i_]; return a; }
+inline F4 max(F4 a, F4 b) { RWSIMD_FOR a.f[i_] = a.f[i_] > b.f[i_] ? a.f[i_] : b.f[i_]; return a; }
+inline F4 cmplt(F4 a, F4 b) { F4 r; RWSIMD_FOR r.u[i_] = a.f[i_] < b.f[i_] ? ~0u : 0; return r; }
+inline F4 cmpgt(F4 a, F4 b) { F4 r; RWSIMD_FOR r.u[i_] = a.f[i_] > b.f[i_] ? ~0u : 0; return r; }
+inline F4 cmpeq(F4 a, F4 b) { F4 r; RWSIMD_FOR r.u[i_] = a.f[i_] == b.f[i_] ? ~0u : 0; return r; }
+inline F4 and_(F4 a, F4 b) { RWSIMD_FOR a.u[i_] &= b.u[i_]; return a; }
+inline F4 or_(F4 a, F4 b) { RWSIMD_FOR a.u[i_] |= b.u[i_]; return a; }
+inline F4 select(F4 mask, F4 a, F4 b) { RWSIMD_FOR a.u[i_] = (mask.u[i_] & a.u[i_]) | (~mask.u[i_] & b.u[i_]); return a; }
+inline int32 movemask(F4 mask) { int32 m = 0; RWSIMD_FOR m |= (mask.u[i_]>>31)<<i_; return m; }
+
+inline I4 loadi(const void *p) { I4 r; RWSIMD_FOR r.i[i_] = ((const int32*)p)[i_]; return r; }
+inline void storei(void *p, I4 a) { RWSIMD_FOR ((int32*)p)[i_] = a.i[i_]; }
+inline I4 set1i(int32 i) { I4 r; RWSIMD_FOR r.i[i_] = i; return r; }
+inline I4 seti(int32 a, int32 b, int32 c, int32 d) { I4 r; r.i[0] = a; r.i[1] = b; r.i[2] = c; r.i[3] = d; return r; }
+inline I4 addi(I4 a, I4 b) { RWSIMD_FOR a.i[i_] += b.i[i_]; return a; }
+inline I4 andi(I4 a, I4 b) { RWSIMD_FOR a.u[i_] &= b.u[i_]; return a; }
+inline I4 ori(I4 a, I4 b) { RWSIMD_FOR a.u[i_] |= b.u[i_]; return a; }
+inline I4 cmpeqi(I4 a, I4 b) { RWSIMD_FOR a.u[i_] = a.i[i_] == b.i[i_] ? ~0u : 0; return a; }
+inline I4 slli(I4 a, int32 n) { RWSIMD_FOR a.u[i_] <<= n; return a; }
+inline I4 srli(I4 a, int32 n) { RWSIMD_FOR a.u[i_] >>= n; return a; }	// logical
+inline I4 srai(I4 a, int32 n) { RWSIMD_FOR a.i[i_] >>= n; return a; }	// arithmetic
+inline I4 minu16(I4 a, I4 b) { for(int32 i_ = 0; i_ < 8; i_++) a.h[i_] = a.h[i_] < b.h[i_] ? a.h[i_] : b.h[i_]; return a; }
+inline I4 maxu16(I4 a, I4 b) { for(int32 i_ = 0; i_ < 8; i_++) a.h[i_] = a.h[i_] > b.h[i_] ? a.h[i_] : b.h[i_]; return a; }
+inline I4 ziplo8(I4 a, I4 b) { I4 r; for(int32 i_ = 0; i_ < 8; i_++){ r.b[i_*2] = a.b[i_]; r.b[i_*2+1] = b.b[i_]; } return r; }
+inline I4 ziphi8(I4 a, I4 b) { I4 r; for(int32 i_ = 0; i_ < 8; i_++){ r.b[i_*2] = a.b[i_+8]; r.b[i_*2+1] = b.b[i_+8]; } return r; }
+inline I4 ziplo16(I4 a, I4 b) { I4 r; RWSIMD_FOR { r.h[i_*2] = a.h[i_]; r.h[i_*2+1] = b.h[i_]; } return r; }
+inline I4 ziphi16(I4 a, I4 b) { I4 r; RWSIMD_FOR { r.h[i_*2] = a.h[i_+4]; r.h[i_*2+1] = b.h[i_+4]; } return r; }
+inline I4 ziplo64(I4 a, I4 b) { I4 r; r.u[0] = a.u[0]; r.u[1] = a.u[1]; r.u[2] = b.u[0]; r.u[3] = b.u[1]; return r; }
+inline I4 ziphi64(I4 a, I4 b) { I4 r; r.u[0] = a.u[2]; r.u[1] = a.u[3]; r.u[2] = b.u[2]; r.u[3] = b.u[3]; return r; }
+inline I4 swaplanes(I4 a) { I4 r; r.u[0] = a.u[1]; r.u[1] = a.u[0]; r.u[2] = a.u[3]; r.u[3] = a.u[2]; return r; }
+inline I4 toint(F4 a) { I4 r; RWSIMD_FOR r.i[i_] = (int32)a.f[i_]; return r; }
+inline F4 tofloat(I4 a) { F4 r; RWSIMD_FOR r.f[i_] = (float32)a.i[i_]; return r; }
+inline I4 asint(F4 a) { I4 r; RWSIMD_FOR r.u[i_] = a.u[i_]; return r; }
+inline F4 asfloat(I4 a) { F4 r; RWSIMD_FOR r.u[i_] = a.u[i_]; return r; }
+inline F4 div(F4 a, F4 b) { RWSIMD_FOR a.f[i_] /= b.f[i_]; return a; }
+inline F4 abs(F4 a) { RWSIMD_FOR a.u[i_] &= 0x7FFFFFFF; return a; }
+inline void transpose(F4 &a, F4 &b, F4 &c, F4 &d) {
+	F4 m[4] = { a, b, c, d };
+	RWSIMD_FOR { a.f[i_] = m[i_].f[0]; b.f[i_] = m[i_].f[1]; c.f[i_] = m[i_].f[2]; d.f[i_] = m[i_].f[3]; }
+}
+#undef RWSIMD_FOR
+
+#endif
+
+// a*b + c
+inline F4 madd(F4 a, F4 b, F4 c) { return add(mul(a, b), c); }
+
+}
+}
@@ -362,6 +362,25 @@ skinClose(void *o, int32, int32)
 	return o;
 }
 
+static void
+remapSkinVertices(Geometry *geo, const uint16 *map)
+{
+	Skin *skin = Skin::get(geo);
+	if(skin == nil || skin->indices == nil || skin->weights == nil)
+		return;
+	int32 n = geo->numVertices;
+	uint8 *indices = rwNewT(uint8, n*4, MEMDUR_FUNCTION | ID_SKIN);
+	float *weights = rwNewT(float, n*4, MEMDUR_FUNCTION | ID_SKIN);
+	for(int32 i = 0; i < n; i++){
+		memcpy(&indices[map[i]*4], &skin->indices[i*4], 4);
+		memcpy(&weights[map[i]*4], &skin->weights[i*4], 4*sizeof(float));
+	}
+	memcpy(skin->indices, indices, n*4);
+	memcpy(skin->weights, weights, n*4*sizeof(float));
+	rwFree(indices);
+	rwFree(weights);
+}
+
 void
 registerSkinPlugin(void)
 {
@@ -380,6 +399,7 @@ registerSkinPlugin(void)
 	Geometry::registerPluginStream(ID_SKIN,
 	                               readSkin, writeSkin, getSizeSkin);
 	skinGlobals.geoOffset = o;
+	Geometry::registerVertexRemapCB(remapSkinVertices);
 	o = Atomic::registerPlugin(sizeof(HAnimHierarchy*),ID_SKIN,
 	                           createSkinAtm, destroySkinAtm, copySkinAtm);
 	skinGlobals.atomicOffset = o;
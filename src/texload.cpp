@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#ifndef RW_PS2
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#define RW_LOADTHREADS
+#endif
+
+#define PLUGIN_ID ID_TEXTURELOAD
+
+namespace rw {
+
+/*
+ * Asynchronous texture loading.
+ * Loader threads read, mask and mipmap the images of requests and
+ * find their raster formats. Everything that touches the driver is
+ * left to pumpAsync, which is called by the application once per frame.
+ * Without threads pumpAsync also does the decoding itself.
+ */
+
+struct LoadRequest
+{
+	Texture *texture;	// nil once the texture is destroyed
+	char name[128];
+	char mask[128];
+	bool32 mipmapping;
+	bool32 autoMipmapping;
+	int32 platform;
+
+	// set by the loader
+	Image *levels[32];	// the image and the mipmaps we need
+	int32 numLevels;	// 0 if the image couldn't be read
+	Error error;	// reported when the request is finished
+	int32 width, height, depth, format;
+	uint32 size;
+
+	LoadRequest *next;
+};
+
+struct LoadQueue
+{
+	LoadRequest *head, *tail;
+
+	void append(LoadRequest *req){
+		req->next = nil;
+		if(tail) tail->next = req;
+		else head = req;
+		tail = req;
+	}
+	LoadRequest *pop(void){
+		LoadRequest *req = head;
+		if(req){
+			head = req->next;
+			if(head == nil) tail = nil;
+		}
+		return req;
+	}
+	bool32 remove(LoadRequest *req){
+		LoadRequest **p, *prev = nil;
+		for(p = &head; *p; prev = *p, p = &(*p)->next)
+			if(*p == req){
+				*p = req->next;
+				if(tail == req) tail = prev;
+				return 1;
+			}
+		return 0;
+	}
+};
+
+enum { MAXLOADTHREADS = 4 };
+
+struct Loader
+{
+#ifdef RW_LOADTHREADS
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable decoded;
+	std::thread threads[MAXLOADTHREADS];
+	int32 numThreads;
+	bool started;
+	bool quit;
+
+	~Loader(void);
+#endif
+	// shared with the threads, only changed with mutex held
+	LoadQueue pending;
+	LoadQueue done;
+
+	// main thread only
+	int32 numRequests;	// queued and not yet pumped
+	Raster *fallback;
+};
+static Loader loader;
+static int32 textureLoadOffset;
+
+#define LOADREQUEST(tex) (*PLUGINOFFSET(LoadRequest*, tex, textureLoadOffset))
+
+static void
+decodeRequest(LoadRequest *req)
+{
+	Image *img;
+	int32 width, height, depth, format;
+
+	req->numLevels = 0;
+	req->size = 0;
+	img = Image::readMasked(req->name, req->mask);
+	if(img == nil)
+		return;
+	if(!Raster::imageFindRasterFormat(img, Raster::TEXTURE,
+	                                  &width, &height, &depth, &format, req->platform)){
+		img->destroy();
+		return;
+	}
+	if(req->mipmapping)
+		format |= Raster::MIPMAP;
+	if(req->autoMipmapping)
+		format |= Raster::AUTOMIPMAP;
+	req->width = width;
+	req->height = height;
+	req->depth = depth;
+	req->format = format;
+	req->levels[0] = img;
+	req->numLevels = 1;
+	if(Raster::needsImageMipmaps(format, img, req->platform))
+		req->numLevels += img->generateMipmaps(req->levels+1, nelem(req->levels)-1,
+			Image::mipmapFilter, Image::mipmapSRGB, Image::mipmapAlphaRef);
+	for(int32 i = 0; i < req->numLevels; i++)
+		req->size += req->levels[i]->stride*req->levels[i]->height;
+}
+
+static void
+freeRequest(LoadRequest *req)
+{
+	for(int32 i = 0; i < req->numLevels; i++)
+		req->levels[i]->destroy();
+	rwFree(req);
+	loader.numRequests--;
+}
+
+// Create the raster and hand it to the texture.
+// Returns the number of bytes uploaded.
+static uint32
+finishRequest(LoadRequest *req)
+{
+	Texture *tex = req->texture;
+	uint32 size = 0;
+	if(req->error.code)
+		setError(&req->error);
+	if(tex){
+		Raster *raster = nil;
+		if(req->numLevels > 0){
+			raster = Raster::create(req->width, req->height, req->depth, req->format, req->platform);
+			if(raster && raster->setFromImages(req->levels, req->numLevels, req->platform) == nil){
+				raster->destroy();
+				raster = nil;
+			}
+			size = req->size;
+		}
+		LOADREQUEST(tex) = nil;
+		// leave the raster alone if the application replaced it
+		if(tex->raster == loader.fallback){
+			tex->raster = raster;
+			if(raster)
+				TextureResidency::setReloadTexture(raster, tex);
+		}else if(raster)
+			raster->destroy();
+	}
+	freeRequest(req);
+	return size;
+}
+
+#ifdef RW_LOADTHREADS
+
+static void
+loaderMain(void)
+{
+	LoadRequest *req;
+
+	std::unique_lock<std::mutex> lock(loader.mutex);
+	for(;;){
+		while(!loader.quit && loader.pending.head == nil)
+			loader.wake.wait(lock);
+		if(loader.quit)
+			return;
+		req = loader.pending.pop();
+		lock.unlock();
+
+		// errors are reported on the main thread
+		captureErrors(&req->error);
+		decodeRequest(req);
+		captureErrors(nil);
+
+		lock.lock();
+		loader.done.append(req);
+		loader.decoded.notify_all();
+	}
+}
+
+static void
+startLoaderThreads(void)
+{
+	int32 n;
+	if(loader.started)
+		return;
+	n = std::thread::hardware_concurrency();
+	n = n > 2 ? n-1 : 1;
+	if(n > MAXLOADTHREADS)
+		n = MAXLOADTHREADS;
+	loader.quit = false;
+	loader.numThreads = n;
+	for(int32 i = 0; i < n; i++)
+		loader.threads[i] = std::thread(loaderMain);
+	loader.started = true;
+}
+
+static void
+stopLoaderThreads(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		if(!loader.started)
+			return;
+		loader.quit = true;
+	}
+	loader.wake.notify_all();
+	for(int32 i = 0; i < loader.numThreads; i++)
+		loader.threads[i].join();
+	loader.numThreads = 0;
+	loader.started = false;
+}
+
+Loader::~Loader(void) { stopLoaderThreads(); }
+
+static void
+queueRequest(LoadRequest *req)
+{
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		startLoaderThreads();
+		loader.pending.append(req);
+	}
+	loader.wake.notify_one();
+}
+
+static LoadRequest*
+nextDecoded(bool wait)
+{
+	std::unique_lock<std::mutex> lock(loader.mutex);
+	while(wait && loader.done.head == nil)
+		loader.decoded.wait(lock);
+	return loader.done.pop();
+}
+
+static void
+cancelRequest(LoadRequest *req)
+{
+	std::lock_guard<std::mutex> lock(loader.mutex);
+	if(loader.pending.remove(req))
+		freeRequest(req);
+	else
+		req->texture = nil;
+}
+
+typedef std::chrono::steady_clock::time_point LoadTime;
+static LoadTime getLoadTime(void) { return std::chrono::steady_clock::now(); }
+static float32 secondsSince(LoadTime t) {
+	return std::chrono::duration<float32>(std::chrono::steady_clock::now() - t).count(); }
+
+#else
+
+static void stopLoaderThreads(void) { }
+
+static void
+queueRequest(LoadRequest *req)
+{
+	loader.pending.append(req);
+}
+
+static LoadRequest*
+nextDecoded(bool)
+{
+	LoadRequest *req = loader.pending.pop();
+	if(req)
+		decodeRequest(req);
+	return req;
+}
+
+static void
+cancelRequest(LoadRequest *req)
+{
+	if(loader.pending.remove(req))
+		freeRequest(req);
+	else
+		req->texture = nil;
+}
+
+typedef clock_t LoadTime;
+static LoadTime getLoadTime(void) { return clock(); }
+static float32 secondsSince(LoadTime t) { return (float32)(clock() - t)/CLOCKS_PER_SEC; }
+
+#endif
+
+static void*
+createTextureLoad(void *object, int32 offset, int32)
+{
+	*PLUGINOFFSET(LoadRequest*, object, offset) = nil;
+	return object;
+}
+
+static void*
+destroyTextureLoad(void *object, int32 offset, int32)
+{
+	Texture *tex = (Texture*)object;
+	LoadRequest *req = *PLUGINOFFSET(LoadRequest*, object, offset);
+	if(req){
+		// the fallback isn't ours to destroy
+		if(tex->raster == loader.fallback)
+			tex->raster = nil;
+		cancelRequest(req);
+	}
+	return object;
+}
+
+static void*
+copyTextureLoad(void *dst, void*, int32 offset, int32)
+{
+	*PLUGINOFFSET(LoadRequest*, dst, offset) = nil;
+	return dst;
+}
+
+void
+Texture::registerAsyncModule(void)
+{
+	textureLoadOffset = Texture::registerPlugin(sizeof(LoadRequest*), ID_TEXTURELOAD,
+		createTextureLoad, destroyTextureLoad, copyTextureLoad);
+}
+
+void
+Texture::stopAsync(void)
+{
+	LoadRequest *req;
+	stopLoaderThreads();
+	while(req = loader.pending.pop(), req != nil ||
+	      (req = loader.done.pop(), req != nil)){
+		if(req->texture){
+			LOADREQUEST(req->texture) = nil;
+			if(req->texture->raster == loader.fallback)
+				req->texture->raster = nil;
+		}
+		freeRequest(req);
+	}
+	loader.fallback = nil;
+}
+
+void
+Texture::setAsyncFallback(Raster *raster)
+{
+	loader.fallback = raster;
+}
+
+Texture*
+Texture::asyncReadCB(const char *name, const char *mask)
+{
+	LoadRequest *req = rwNewT(LoadRequest, 1, MEMDUR_EVENT | ID_TEXTURE);
+	if(req == nil){
+		RWERROR((ERR_ALLOC, sizeof(LoadRequest)));
+		return nil;
+	}
+	Texture *tex = Texture::create(loader.fallback);
+	if(tex == nil){
+		rwFree(req);
+		return nil;
+	}
+	strncpy(tex->name, name, 32);
+	if(mask)
+		strncpy(tex->mask, mask, 32);
+
+	req->texture = tex;
+	strncpy(req->name, name, sizeof(req->name)-1);
+	req->name[sizeof(req->name)-1] = '\0';
+	strncpy(req->mask, mask ? mask : "", sizeof(req->mask)-1);
+	req->mask[sizeof(req->mask)-1] = '\0';
+	req->mipmapping = getMipmapping();
+	req->autoMipmapping = getAutoMipmapping();
+	req->platform = rw::platform;
+	req->numLevels = 0;
+	req->error.plugin = 0;
+	req->error.code = 0;
+	LOADREQUEST(tex) = req;
+	loader.numRequests++;
+	queueRequest(req);
+	return tex;
+}
+
+Texture*
+Texture::readAsync(const char *name, const char *mask)
+{
+	Texture *tex;
+	TexDictionary *txd;
+
+	if(tex = Texture::findCB(name), tex){
+		tex->addRef();
+		return tex;
+	}
+	tex = asyncReadCB(name, mask);
+	if(tex && (txd = TexDictionary::getCurrent()))
+		txd->add(tex);
+	return tex;
+}
+
+int32
+Texture::pumpAsync(float32 maxSeconds, uint32 maxBytes)
+{
+	LoadRequest *req;
+	LoadTime start = getLoadTime();
+	uint32 bytes = 0;
+
+	// always make some progress, even when the budget is tiny
+	while(req = nextDecoded(false), req != nil){
+		bytes += finishRequest(req);
+		if(maxBytes && bytes >= maxBytes)
+			break;
+		if(maxSeconds > 0.0f && secondsSince(start) >= maxSeconds)
+			break;
+	}
+	return loader.numRequests;
+}
+
+void
+Texture::finishAsync(void)
+{
+	while(loader.numRequests > 0)
+		finishRequest(nextDecoded(true));
+}
+
+bool32
+Texture::isLoading(void)
+{
+	return LOADREQUEST(this) != nil;
+}
+
+}
@@ -319,10 +319,25 @@ defaultReadCB(const char *name, const char *mask)
 
 	img = Image::readMasked(name, mask);
 	if(img){
-		tex = Texture::create(Raster::createFromImage(img));
+		Raster *raster = nil;
+		int32 width, height, depth, format;
+		if(Raster::imageFindRasterFormat(img, Raster::TEXTURE, &width, &height, &depth, &format)){
+			if(TEXTUREGLOBAL(mipmapping))
+				format |= Raster::MIPMAP;
+			if(TEXTUREGLOBAL(autoMipmapping))
+				format |= Raster::AUTOMIPMAP;
+			raster = Raster::create(width, height, depth, format);
+			if(raster && raster->setFromImage(img) == nil){
+				raster->destroy();
+				raster = nil;
+			}
+		}
+		tex = Texture::create(raster);
 		strncpy(tex->name, name, 32);
 		if(mask)
 			strncpy(tex->mask, mask, 32);
+		if(raster)
+			TextureResidency::setReloadTexture(raster, tex);
 		img->destroy();
 		return tex;
 	}else
@@ -466,6 +481,8 @@ Texture::streamGetSize(void)
 Texture*
 Texture::streamReadNative(Stream *stream)
 {
+	if(AssetDedup::isEnabled())
+		return AssetDedup::readTexture(stream);
 	if(!findChunk(stream, ID_STRUCT, nil, nil)){
 		RWERROR((ERR_CHUNK, "STRUCT"));
 		return nil;
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#define PLUGIN_ID 2
+
+namespace rw {
+
+/*
+ * Post-transform vertex cache optimization.
+ * The triangles of every trilist mesh are reordered with Tom Forsyth's
+ * linear-speed algorithm, then the vertices are renumbered in the order
+ * they are first used so vertex fetch is mostly sequential too.
+ * Tristrips are left alone, their order is part of the strip.
+ */
+
+bool32 Geometry::optimizeOnInstance;
+
+enum {
+	MAXREMAPCBS = 8,
+	CACHESIZE = 32,		// LRU cache modeled for scoring
+	MAXVALENCE = 32		// valence scores beyond this are computed
+};
+
+static Geometry::VertexRemapCB remapCBs[MAXREMAPCBS];
+static int32 numRemapCBs;
+
+static float32 cacheScores[CACHESIZE];
+static float32 valenceScores[MAXVALENCE];
+static bool scoresInitialized;
+
+void
+Geometry::registerVertexRemapCB(VertexRemapCB cb)
+{
+	for(int32 i = 0; i < numRemapCBs; i++)
+		if(remapCBs[i] == cb)
+			return;
+	assert(numRemapCBs < MAXREMAPCBS);
+	remapCBs[numRemapCBs++] = cb;
+}
+
+static void
+initScores(void)
+{
+	int32 i;
+	// the last triangle's vertices all score the same
+	// so it doesn't matter in which order it went in
+	for(i = 0; i < CACHESIZE; i++)
+		cacheScores[i] = i < 3 ? 0.75f :
+			powf(1.0f - (float32)(i-3)/(CACHESIZE-3), 1.5f);
+	// prefer vertices with few triangles left to get rid of them
+	for(i = 0; i < MAXVALENCE; i++)
+		valenceScores[i] = i == 0 ? 0.0f : 2.0f/sqrtf((float32)i);
+	scoresInitialized = true;
+}
+
+struct VCacheVertex
+{
+	int32 cachePos;		// -1 if not in cache
+	int32 numLeft;		// triangles not yet emitted
+	int32 firstTri;		// into triangle list, live ones first
+	float32 score;
+};
+
+static float32
+vertexScore(VCacheVertex *v)
+{
+	if(v->numLeft == 0)
+		return -1.0f;
+	float32 score = v->cachePos < 0 ? 0.0f : cacheScores[v->cachePos];
+	if(v->numLeft < MAXVALENCE)
+		return score + valenceScores[v->numLeft];
+	return score + 2.0f/sqrtf((float32)v->numLeft);
+}
+
+// Reorder the triangles of one trilist mesh into dst.
+// verts has an entry for every vertex of the geometry
+static void
+optimizeMesh(uint16 *dst, uint16 *indices, int32 numTris,
+	VCacheVertex *verts, int32 *triList, uint8 *emitted)
+{
+	int32 cache[CACHESIZE+3];
+	int32 newCache[CACHESIZE+3];
+	int32 cacheLen, newLen;
+	int32 i, j, k, t, n;
+	int32 numIndices = numTris*3;
+
+	// count and gather the triangles of each vertex
+	for(i = 0; i < numIndices; i++){
+		verts[indices[i]].numLeft = 0;
+		verts[indices[i]].cachePos = -1;
+		verts[indices[i]].firstTri = -1;
+	}
+	for(i = 0; i < numIndices; i++)
+		verts[indices[i]].numLeft++;
+	n = 0;
+	for(i = 0; i < numIndices; i++){
+		VCacheVertex *v = &verts[indices[i]];
+		if(v->firstTri < 0){
+			v->firstTri = n;
+			n += v->numLeft;
+			v->numLeft = 0;
+		}
+		triList[v->firstTri + v->numLeft++] = i/3;
+	}
+	for(i = 0; i < numIndices; i++)
+		verts[indices[i]].score = vertexScore(&verts[indices[i]]);
+	memset(emitted, 0, numTris);
+
+	cacheLen = 0;
+	int32 best = -1;
+	int32 cursor = 0;
+	for(n = 0; n < numTris; n++){
+		if(best < 0){
+			// nothing in the cache helps, take the next one in order
+			while(emitted[cursor])
+				cursor++;
+			best = cursor;
+		}
+		t = best;
+		emitted[t] = 1;
+		uint16 *tri = &indices[t*3];
+		*dst++ = tri[0];
+		*dst++ = tri[1];
+		*dst++ = tri[2];
+
+		// take the triangle out of its vertices' live lists
+		newLen = 0;
+		for(j = 0; j < 3; j++){
+			VCacheVertex *v = &verts[tri[j]];
+			int32 *list = &triList[v->firstTri];
+			for(k = 0; k < v->numLeft; k++)
+				if(list[k] == t){
+					list[k] = list[v->numLeft-1];
+					list[v->numLeft-1] = t;
+					v->numLeft--;
+					break;
+				}
+			// degenerate triangles have vertices twice
+			for(k = 0; k < newLen; k++)
+				if(newCache[k] == tri[j])
+					break;
+			if(k == newLen)
+				newCache[newLen++] = tri[j];
+		}
+		// the triangle's vertices go to the front of the LRU
+		for(i = 0; i < cacheLen; i++){
+			int32 vi = cache[i];
+			if(vi != tri[0] && vi != tri[1] && vi != tri[2])
+				newCache[newLen++] = vi;
+		}
+		for(i = 0; i < newLen; i++){
+			VCacheVertex *v = &verts[newCache[i]];
+			v->cachePos = i < CACHESIZE ? i : -1;
+			v->score = vertexScore(v);
+		}
+		cacheLen = newLen < CACHESIZE ? newLen : CACHESIZE;
+		memcpy(cache, newCache, cacheLen*sizeof(int32));
+
+		// find the best triangle touching the cache
+		float32 bestScore = -1.0f;
+		best = -1;
+		for(i = 0; i < cacheLen; i++){
+			VCacheVertex *v = &verts[cache[i]];
+			int32 *list = &triList[v->firstTri];
+			for(k = 0; k < v->numLeft; k++){
+				int32 lt = list[k];
+				uint16 *ltri = &indices[lt*3];
+				float32 s = verts[ltri[0]].score +
+					verts[ltri[1]].score +
+					verts[ltri[2]].score;
+				if(s > bestScore){
+					bestScore = s;
+					best = lt;
+				}
+			}
+		}
+	}
+}
+
+void
+Geometry::getVertexCacheStats(VertexCacheStats *stats, int32 cacheSize)
+{
+	MeshHeader *header = this->meshHeader;
+	stats->acmr = 0.0f;
+	stats->atvr = 0.0f;
+	if(header == nil || header->flags == MeshHeader::TRISTRIP ||
+	   header->totalIndices < 3 || this->numVertices == 0)
+		return;
+
+	// simulate a FIFO cache like the hardware has
+	int32 *fifo = rwNewT(int32, cacheSize, MEMDUR_FUNCTION | ID_GEOMETRY);
+	uint8 *used = rwNewT(uint8, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(used, 0, this->numVertices);
+	int32 misses = 0;
+	int32 numUsed = 0;
+	int32 numTris = 0;
+	Mesh *m = header->getMeshes();
+	for(uint32 i = 0; i < header->numMeshes; i++){
+		// a new draw call starts with an empty cache
+		for(int32 j = 0; j < cacheSize; j++)
+			fifo[j] = -1;
+		int32 head = 0;
+		for(uint32 j = 0; j < m[i].numIndices; j++){
+			int32 idx = m[i].indices[j];
+			int32 k;
+			for(k = 0; k < cacheSize; k++)
+				if(fifo[k] == idx)
+					break;
+			if(k == cacheSize){
+				fifo[head] = idx;
+				head = (head+1) % cacheSize;
+				misses++;
+			}
+			if(!used[idx]){
+				used[idx] = 1;
+				numUsed++;
+			}
+		}
+		numTris += m[i].numIndices/3;
+	}
+	if(numTris)
+		stats->acmr = (float32)misses/numTris;
+	if(numUsed)
+		stats->atvr = (float32)misses/numUsed;
+	rwFree(fifo);
+	rwFree(used);
+}
+
+// Move every element of a per-vertex array to its new index.
+static void
+remapArray(void *data, int32 size, const uint16 *map, int32 numVertices, uint8 *tmp)
+{
+	uint8 *src = (uint8*)data;
+	for(int32 i = 0; i < numVertices; i++)
+		memcpy(tmp + map[i]*size, src + i*size, size);
+	memcpy(src, tmp, numVertices*size);
+}
+
+bool32
+Geometry::optimizeVertexCache(VertexCacheStats *before, VertexCacheStats *after)
+{
+	MeshHeader *header = this->meshHeader;
+	int32 i, j;
+	uint32 k;
+
+	if(before)
+		this->getVertexCacheStats(before);
+	if(this->flags & NATIVE || header == nil ||
+	   header->flags == MeshHeader::TRISTRIP || header->totalIndices < 3){
+		if(after && before)
+			*after = *before;
+		else if(after)
+			this->getVertexCacheStats(after);
+		return 0;
+	}
+	if(!scoresInitialized)
+		initScores();
+
+	int32 numVerts = this->numVertices;
+	uint32 maxIndices = 0;
+	Mesh *m = header->getMeshes();
+	for(k = 0; k < header->numMeshes; k++)
+		if(m[k].numIndices > maxIndices)
+			maxIndices = m[k].numIndices;
+
+	// reorder triangles into a new index buffer
+	uint16 *indices = rwNewT(uint16, header->totalIndices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	VCacheVertex *verts = rwNewT(VCacheVertex, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	int32 *triList = rwNewT(int32, maxIndices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	uint8 *emitted = rwNewT(uint8, maxIndices/3+1, MEMDUR_FUNCTION | ID_GEOMETRY);
+	uint16 *dst = indices;
+	for(k = 0; k < header->numMeshes; k++){
+		int32 numTris = m[k].numIndices/3;
+		optimizeMesh(dst, m[k].indices, numTris, verts, triList, emitted);
+		// a stray index or two at the end shouldn't happen, keep them anyway
+		for(j = numTris*3; j < (int32)m[k].numIndices; j++)
+			dst[j] = m[k].indices[j];
+		dst += m[k].numIndices;
+	}
+	rwFree(verts);
+	rwFree(triList);
+	rwFree(emitted);
+
+	// new vertex order is first use, unused vertices go last
+	uint16 *map = rwNewT(uint16, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	uint8 *seen = rwNewT(uint8, numVerts, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(seen, 0, numVerts);
+	int32 next = 0;
+	for(k = 0; k < header->totalIndices; k++)
+		if(!seen[indices[k]]){
+			seen[indices[k]] = 1;
+			map[indices[k]] = next++;
+		}
+	for(i = 0; i < numVerts; i++)
+		if(!seen[i])
+			map[i] = next++;
+	rwFree(seen);
+	for(k = 0; k < header->totalIndices; k++)
+		indices[k] = map[indices[k]];
+
+	// reallocating gives the meshes a new serial number
+	// so instanced data is rebuilt
+	this->allocateMeshes(header->numMeshes, header->totalIndices, 0);
+	header = this->meshHeader;
+	memcpy(header->getMeshes()->indices, indices, header->totalIndices*sizeof(uint16));
+	rwFree(indices);
+
+	// triangles follow the mesh order so buildMeshes keeps it
+	if(this->triangles && (uint32)this->numTriangles*3 == header->totalIndices){
+		Triangle *tri = this->triangles;
+		m = header->getMeshes();
+		for(k = 0; k < header->numMeshes; k++){
+			uint16 matId = this->matList.findIndex(m[k].material);
+			for(j = 0; j+2 < (int32)m[k].numIndices; j += 3){
+				tri->v[0] = m[k].indices[j+0];
+				tri->v[1] = m[k].indices[j+1];
+				tri->v[2] = m[k].indices[j+2];
+				tri->matId = matId;
+				tri++;
+			}
+		}
+	}else
+		for(i = 0; i < this->numTriangles; i++)
+			for(j = 0; j < 3; j++)
+				this->triangles[i].v[j] = map[this->triangles[i].v[j]];
+
+	uint8 *tmp = rwNewT(uint8, numVerts*sizeof(V3d), MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < this->numMorphTargets; i++){
+		MorphTarget *mt = &this->morphTargets[i];
+		if(mt->vertices)
+			remapArray(mt->vertices, sizeof(V3d), map, numVerts, tmp);
+		if(mt->normals)
+			remapArray(mt->normals, sizeof(V3d), map, numVerts, tmp);
+	}
+	if(this->colors)
+		remapArray(this->colors, sizeof(RGBA), map, numVerts, tmp);
+	for(i = 0; i < this->numTexCoordSets; i++)
+		if(this->texCoords[i])
+			remapArray(this->texCoords[i], sizeof(TexCoords), map, numVerts, tmp);
+	rwFree(tmp);
+	for(i = 0; i < numRemapCBs; i++)
+		remapCBs[i](this, map);
+	rwFree(map);
+
+	this->lockedSinceInst |= LOCKALL;
+	this->lockedRangeFlags = 0;
+	if(after)
+		this->getVertexCacheStats(after);
+	return 1;
+}
+
+}
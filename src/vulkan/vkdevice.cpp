@@ -408,6 +408,8 @@ namespace rw
 		static void setRasterStageOnly(uint32 stage, Raster *raster)
 		{
 			bool32 alpha;
+			if(raster)
+				TextureResidency::touch(raster);
 			if(raster != rwStateCache.texstage[stage].raster) {
 				rwStateCache.texstage[stage].raster = raster;
 				setActiveTexture(stage);
@@ -440,6 +442,8 @@ namespace rw
 		static void setRasterStage(uint32 stage, Raster *raster)
 		{
 			bool32 alpha;
+			if(raster)
+				TextureResidency::touch(raster);
 			if(raster != rwStateCache.texstage[stage].raster) {
 				rwStateCache.texstage[stage].raster = raster;
 
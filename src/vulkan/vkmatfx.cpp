@@ -163,7 +163,7 @@ namespace rw
 		void matfxRenderCB(Atomic* atomic, InstanceDataHeader* header)
 		{
 			uint32 flags = atomic->geometry->flags;
-			setWorldMatrix(atomic->getFrame()->getLTM());
+			setWorldMatrix(atomic->getFrame()->getRenderLTM());
 			int32 vsBits = lightingCB(atomic);
 
 
@@ -75,6 +75,8 @@ namespace rw
 
 		static InstanceDataHeader* instanceMesh(rw::ObjPipeline* rwpipe, Geometry* geo)
 		{
+			if(Geometry::optimizeOnInstance)
+				geo->optimizeVertexCache();
 			InstanceDataHeader* header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
 			MeshHeader* meshh = geo->meshHeader;
 			geo->instData = header;
@@ -147,7 +149,7 @@ namespace rw
 			else if (geo->lockedSinceInst)
 				pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 1);
 
-			geo->lockedSinceInst = 0;
+			geo->resetLocks();
 		}
 
 		static void	uninstance(rw::ObjPipeline* rwpipe, Atomic* atomic)
@@ -315,23 +317,40 @@ namespace rw
 				V2d tex0;
 			};
 
+			VertexSpan all, *spans;
+			int32 i, n;
+			bool wholeBuffer = false;
+
 			// Positions
-			if (!reinstance || geo->lockedSinceInst & Geometry::LOCKVERTICES)
+			n = geo->getLockedSpans(Geometry::LOCKVERTICES, reinstance, &all, &spans);
+			if (n)
 			{
 				for (a = attribs; a->index != ATTRIB_POS; a++)
 					;
-				instV3d(VERT_FLOAT3, verts + a->offset,
-					geo->morphTargets[0].vertices,
-					header->totalNumVertex, a->stride);
+				for (i = 0; i < n; i++)
+					instV3d(VERT_FLOAT3, verts + a->offset + a->stride * spans[i].first,
+						geo->morphTargets[0].vertices + spans[i].first,
+						spans[i].count, a->stride);
 			}
 
 			// Normals
-			if ((!reinstance || geo->lockedSinceInst & Geometry::LOCKNORMALS))
+			n = geo->getLockedSpans(Geometry::LOCKNORMALS, reinstance, &all, &spans);
+			if (n && hasNormals)
+			{
+				for (a = attribs; a->index != ATTRIB_NORMAL; a++)
+					;
+				for (i = 0; i < n; i++)
+					instV3d(VERT_FLOAT3, verts + a->offset + a->stride * spans[i].first,
+						geo->morphTargets[0].normals + spans[i].first,
+						spans[i].count, a->stride);
+			}
+			else if (n)
 			{
+				// generated from the triangles, always all of them
 				for (a = attribs; a->index != ATTRIB_NORMAL; a++)
 					;
+				wholeBuffer = true;
 				instV3d(VERT_FLOAT3, verts + a->offset, geo->morphTargets[0].normals, header->totalNumVertex, a->stride);
-				if(!hasNormals) 
 				{
 					if(header->totalNumIndex > 0) {
 						auto vertexBuff = reinterpret_cast<Vertex *>(verts);
@@ -359,40 +378,73 @@ namespace rw
 			}
 
 			// Prelighting
-			if (isPrelit && (!reinstance || geo->lockedSinceInst & Geometry::LOCKPRELIGHT))
+			n = geo->getLockedSpans(Geometry::LOCKPRELIGHT, reinstance, &all, &spans);
+			if (isPrelit && n)
 			{
 				for (a = attribs; a->index != ATTRIB_COLOR; a++)
 					;
-				int           n = header->numMeshes;
-				InstanceData* inst = header->inst;
-				while (n--)
+				for (i = 0; i < n; i++)
 				{
-					assert(inst->minVert != 0xFFFFFFFF);
-					inst->vertexAlpha = setVertexClor(VERT_RGBA, 
-						verts + a->offset + a->stride * inst->minVert, 
-						geo->colors == nullptr ? nullptr : geo->colors + inst->minVert, 
-						inst->numVertices,
-						a->stride);
-					inst++;
+					int           m = header->numMeshes;
+					InstanceData* inst = header->inst;
+					while (m--)
+					{
+						assert(inst->minVert != 0xFFFFFFFF);
+						// part of the span used by this mesh
+						int32 first = std::max(spans[i].first, (int32)inst->minVert);
+						int32 end = std::min(spans[i].first + spans[i].count, (int32)(inst->minVert + inst->numVertices));
+						if (first < end)
+						{
+							bool alpha = setVertexClor(VERT_RGBA,
+								verts + a->offset + a->stride * first,
+								geo->colors == nullptr ? nullptr : geo->colors + first,
+								end - first,
+								a->stride);
+							if (end - first == (int32)inst->numVertices)
+								inst->vertexAlpha = alpha;
+							else
+								inst->vertexAlpha |= alpha;
+						}
+						inst++;
+					}
 				}
 			}
 
 			// Texture coordinates
-			for (int32 n = 0; n < geo->numTexCoordSets; n++)
+			for (int32 t = 0; t < geo->numTexCoordSets; t++)
 			{
-				if (!reinstance || geo->lockedSinceInst & (Geometry::LOCKTEXCOORDS << n))
+				n = geo->getLockedSpans(Geometry::LOCKTEXCOORDS << t, reinstance, &all, &spans);
+				if (n == 0)
+					continue;
+				for (a = attribs; a->index != ATTRIB_TEXCOORDS0 + t; a++)
+					;
+				for (i = 0; i < n; i++)
+					instTexCoords(VERT_FLOAT2, verts + a->offset + a->stride * spans[i].first,
+						geo->texCoords[t] + spans[i].first,
+						spans[i].count, a->stride);
+			}
+
+			if (header->vertexBufferGPU == nullptr)
+			{
+				header->vertexBufferGPU = maple::VertexBuffer::createRaw(
+					header->vertexBuffer,
+					header->totalNumVertex * attribs[0].stride);
+			}
+			else
+			{
+				// the buffer only takes data from its start,
+				// so stage up to the end of the last dirty span
+				n = geo->getLockedSpans(Geometry::LOCKALL, reinstance, &all, &spans);
+				if (wholeBuffer)
 				{
-					for (a = attribs; a->index != ATTRIB_TEXCOORDS0 + n; a++)
-						;
-					instTexCoords(VERT_FLOAT2, verts + a->offset,
-						geo->texCoords[n],
-						header->totalNumVertex, a->stride);
+					spans = &all;
+					n = 1;
 				}
+				if (n)
+					header->vertexBufferGPU->setData(
+						(spans[n - 1].first + spans[n - 1].count) * attribs[0].stride,
+						header->vertexBuffer);
 			}
-
-			header->vertexBufferGPU = maple::VertexBuffer::createRaw(
-				header->vertexBuffer,
-				header->totalNumVertex * attribs[0].stride);
 		}
 
 		void  defaultUninstanceCB(Geometry* geo, InstanceDataHeader* header)
@@ -121,6 +121,17 @@ namespace rw
 			textureCache.emplace_back(texture);
 			texture->buildTexture(natras->internalFormat, raster->width, raster->height, false, false, false, natras->numLevels > 1);
 			natras->maxAnisotropy = 1;
+
+			// no eviction here yet, only let the residency manager know the size
+			uint32 size = 0;
+			int32_t w = raster->width;
+			int32_t h = raster->height;
+			for(int32 i = 0; i < natras->numLevels; i++) {
+				size += w * h * natras->bpp;
+				if(w > 1) w /= 2;
+				if(h > 1) h /= 2;
+			}
+			TextureResidency::reportSize(raster, size);
 			return raster;
 		}
 
@@ -337,8 +348,25 @@ namespace rw
 		{
 			if((raster->type & 0xF) != Raster::TEXTURE) return 0;
 			VulkanRaster *natras = GET_VULKAN_RASTEREXT(raster);
-			auto vkTexture = getTexture(natras->textureId);
-			image->convertTo32();
+
+			// Unpalettize image if necessary but don't change original
+			Image *truecolimg = nil;
+			if(image->depth <= 8) {
+				truecolimg = Image::create(image->width, image->height, image->depth);
+				truecolimg->pixels = image->pixels;
+				truecolimg->stride = image->stride;
+				truecolimg->palette = image->palette;
+				truecolimg->unpalettize();
+				image = truecolimg;
+			}
+
+			// textures are always RGBA8888
+			ConvRowFunc conv = getConvRow(CONVFMT_RGBA8888, getImageConvFormat(image));
+			if(conv == nil || image->width != raster->width || image->height != raster->height) {
+				RWERROR((ERR_INVRASTER));
+				if(truecolimg) truecolimg->destroy();
+				return 0;
+			}
 			natras->hasAlpha = image->hasAlpha();
 			bool unlock = false;
 			if(raster->pixels == nil) {
@@ -347,9 +375,11 @@ namespace rw
 			}
 
 			assert(raster->pixels);
-			memcpy(raster->pixels, image->pixels, sizeof(uint32_t) * image->width * image->height);
+			convertPixels(raster->pixels, raster->stride, image->pixels, image->stride,
+			              image->width, image->height, conv);
 			if(unlock) raster->unlock(0);
 
+			if(truecolimg) truecolimg->destroy();
 			return true;
 		}
 
@@ -377,6 +407,7 @@ namespace rw
 			removeTexture(natras->textureId);
 			evictRaster(raster);
 			natras->textureId = -1;
+			TextureResidency::reportSize(raster, 0);
 #endif
 			return object;
 		}
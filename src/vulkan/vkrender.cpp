@@ -16,6 +16,10 @@
 
 #include "../rwrender.h"
 
+#include "../rwanim.h"
+
+#include "../rwplugins.h"
+
 #ifdef RW_VULKAN
 #	include "rwvk.h"
 #	include "rwvkshader.h"
@@ -77,6 +81,10 @@ namespace rw
 
 		void drawInst_simple(maple::DescriptorSet::Ptr objSet, InstanceDataHeader* header, InstanceData* inst)
 		{
+			MeshletRange *ranges;
+			int32 numRanges = Meshlets::getDrawRanges(inst - header->inst, &ranges);
+			if (numRanges == 0)
+				return;
 			auto set = getMaterialDescriptorSet(inst->material);
 			auto pipeline = getPipeline(maple::DrawType::Triangle);
 			flushCache(pipeline->getShader(), objSet);
@@ -101,7 +109,11 @@ namespace rw
 			pipeline->bind(cmdBuffer, maple::ivec4{vkGlobals.presentOffX, vkGlobals.presentOffY, vkGlobals.presentWidth, vkGlobals.presentHeight});
 			pipeline->getShader()->bindPushConstants(cmdBuffer, pipeline.get());
 			maple::RenderDevice::get()->bindDescriptorSets(pipeline.get(), cmdBuffer, {commonSet, set, objSet});
-			pipeline->drawIndexed(cmdBuffer, inst->numIndex, 1, inst->offset, 0, 0);
+			if (numRanges < 0)
+				pipeline->drawIndexed(cmdBuffer, inst->numIndex, 1, inst->offset, 0, 0);
+			else
+				for (int32 i = 0; i < numRanges; i++)
+					pipeline->drawIndexed(cmdBuffer, ranges[i].numIndices, 1, inst->offset + ranges[i].firstIndex, 0, 0);
 			pipeline->end(cmdBuffer);
 		}
 
@@ -191,7 +203,7 @@ namespace rw
 			Material* m;
 
 			uint32 flags = atomic->geometry->flags;
-			setWorldMatrix(atomic->getFrame()->getLTM());
+			setWorldMatrix(atomic->getFrame()->getRenderLTM());
 			int32 vsBits = lightingCB(atomic);
 
 			InstanceData* inst = header->inst;
@@ -0,0 +1,37 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <chrono>
+
+#include <rw.h>
+
+using namespace rw;
+
+struct Timer
+{
+	std::chrono::steady_clock::time_point start;
+
+	Timer(void) { reset(); }
+	void reset(void) { start = std::chrono::steady_clock::now(); }
+	double seconds(void) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+// print throughput of one run
+void report(const char *name, double amount, const char *unit, double seconds);
+// read a whole file, free with rwFree
+uint8 *readFile(const char *filename, uint32 *size);
+
+int benchDXT(int argc, char *argv[]);
+int benchMipmap(int argc, char *argv[]);
+int benchConv(int argc, char *argv[]);
+int benchPS2Swizzle(int argc, char *argv[]);
+int benchXboxSwizzle(int argc, char *argv[]);
+int benchVCache(int argc, char *argv[]);
+int benchDedup(int argc, char *argv[]);
+int benchMeshlet(int argc, char *argv[]);
+int benchInstance(int argc, char *argv[]);
+int benchBounds(int argc, char *argv[]);
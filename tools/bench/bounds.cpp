@@ -0,0 +1,151 @@
+#include "bench.h"
+
+// Bounding volumes of a large geometry.
+// The vertices of a lumpy sphere are split into a few meshes.
+// The old sphere around the box center, which was scalar, is compared
+// with the vectorized box and Ritter kernels, and reading the geometry
+// with and without the stored boxes is timed.
+
+enum {
+	NUMU = 1024,
+	NUMV = 512,
+	NUMMESHES = 8,
+	NUMRUNS = 20
+};
+
+static Geometry*
+makeLumpySphere(void)
+{
+	int32 i, j;
+	int32 numVerts = (NUMU+1)*(NUMV+1);
+	Geometry *geo = Geometry::create(numVerts, NUMU*NUMV*2, Geometry::POSITIONS);
+	for(i = 0; i < NUMMESHES; i++){
+		Material *mat = Material::create();
+		geo->matList.appendMaterial(mat);
+		mat->destroy();
+	}
+	MorphTarget *mt = &geo->morphTargets[0];
+	for(i = 0; i <= NUMV; i++)
+		for(j = 0; j <= NUMU; j++){
+			float32 th = M_PI*i/NUMV;
+			float32 ph = 2.0f*M_PI*j/NUMU;
+			float32 r = 10.0f + 2.0f*sinf(th*5.0f)*cosf(ph*3.0f);
+			// squashed and off center
+			mt->vertices[i*(NUMU+1) + j].set(r*sinf(th)*cosf(ph)*1.5f + 3.0f,
+				r*sinf(th)*sinf(ph), r*cosf(th)*0.5f);
+		}
+	Triangle *t = geo->triangles;
+	for(i = 0; i < NUMV; i++)
+		for(j = 0; j < NUMU; j++){
+			int32 v00 = i*(NUMU+1) + j;
+			int32 v01 = v00 + 1;
+			int32 v10 = v00 + NUMU+1;
+			int32 v11 = v10 + 1;
+			int32 m = j*NUMMESHES/NUMU;
+			t->v[0] = v00; t->v[1] = v01; t->v[2] = v10; t->matId = m; t++;
+			t->v[0] = v01; t->v[1] = v11; t->v[2] = v10; t->matId = m; t++;
+		}
+	geo->buildMeshes();
+	return geo;
+}
+
+// what MorphTarget::calculateBoundingSphere used to do
+static Sphere
+oldBoundingSphere(V3d *v, int32 n)
+{
+	Sphere sphere;
+	V3d min = {  1000000.0f,  1000000.0f,  1000000.0f };
+	V3d max = { -1000000.0f, -1000000.0f, -1000000.0f };
+	for(int32 j = 0; j < n; j++){
+		if(v->x > max.x) max.x = v->x;
+		if(v->x < min.x) min.x = v->x;
+		if(v->y > max.y) max.y = v->y;
+		if(v->y < min.y) min.y = v->y;
+		if(v->z > max.z) max.z = v->z;
+		if(v->z < min.z) min.z = v->z;
+		v++;
+	}
+	sphere.center = scale(add(min, max), 1/2.0f);
+	max = sub(max, sphere.center);
+	sphere.radius = length(max);
+	return sphere;
+}
+
+static double
+timeRead(uint8 *data, uint32 size)
+{
+	Timer t;
+	for(int32 i = 0; i < NUMRUNS; i++){
+		StreamMemory mem;
+		mem.open(data, size);
+		findChunk(&mem, ID_GEOMETRY, nil, nil);
+		Geometry *geo = Geometry::streamRead(&mem);
+		mem.close();
+		GeometryBounds::get(geo);
+		geo->destroy();
+	}
+	return t.seconds();
+}
+
+int
+benchBounds(int, char *[])
+{
+	int32 i;
+	Geometry *geo = makeLumpySphere();
+	V3d *verts = geo->morphTargets[0].vertices;
+	int32 n = geo->numVertices;
+	double mverts = (double)n*NUMRUNS/1e6;
+	printf("%d vertices, %d meshes\n", n, geo->meshHeader->numMeshes);
+
+	Sphere s;
+	Timer t;
+	for(i = 0; i < NUMRUNS; i++)
+		s = oldBoundingSphere(verts, n);
+	report("sphere scalar box center", mverts, "Mvert", t.seconds());
+	printf("radius %.3f\n", s.radius);
+	t.reset();
+	for(i = 0; i < NUMRUNS; i++)
+		s = geo->morphTargets[0].calculateBoundingSphere();
+	report("sphere ritter", mverts, "Mvert", t.seconds());
+	printf("radius %.3f\n", s.radius);
+
+	BBox box;
+	t.reset();
+	for(i = 0; i < NUMRUNS; i++){
+		box.initialize(&verts[0]);
+		for(int32 j = 1; j < n; j++)
+			box.addPoint(&verts[j]);
+	}
+	report("box scalar", mverts, "Mvert", t.seconds());
+	t.reset();
+	for(i = 0; i < NUMRUNS; i++)
+		box.calculate(verts, n);
+	report("box", mverts, "Mvert", t.seconds());
+
+	t.reset();
+	for(i = 0; i < NUMRUNS; i++)
+		GeometryBounds::calculate(geo);
+	report("geometry and mesh boxes", mverts, "Mvert", t.seconds());
+
+	// stream with and without the boxes
+	uint32 size = geo->streamGetSize() + 1024;
+	uint8 *withBounds = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *without = rwNewT(uint8, size, MEMDUR_EVENT);
+	StreamMemory mem;
+	mem.open(withBounds, 0, size);
+	geo->streamWrite(&mem);
+	uint32 sizeWith = mem.getLength();
+	mem.close();
+	GeometryBounds::destroy(geo);
+	mem.open(without, 0, size);
+	geo->streamWrite(&mem);
+	uint32 sizeWithout = mem.getLength();
+	mem.close();
+	report("read, boxes calculated", mverts, "Mvert", timeRead(without, sizeWithout));
+	report("read, boxes stored", mverts, "Mvert", timeRead(withBounds, sizeWith));
+
+	rwFree(withBounds);
+	rwFree(without);
+	geo->destroy();
+	return 0;
+}
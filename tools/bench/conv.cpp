@@ -0,0 +1,84 @@
+#include "bench.h"
+
+// Raster pixel format conversion, one pixel at a time
+// against whole rows, on a random 1024x1024 image.
+
+struct Conversion
+{
+	const char *name;
+	void (*pixel)(uint8 *out, uint8 *in);
+	ConvRowFunc row;
+	int32 outbpp, inbpp;
+};
+
+static Conversion conversions[] = {
+	{ "BGRA8888 <- RGBA8888", conv_BGRA8888_from_RGBA8888, convRow_BGRA8888_from_RGBA8888, 4, 4 },
+	{ "RGBA8888 <- RGB888", conv_RGBA8888_from_RGB888, convRow_RGBA8888_from_RGB888, 4, 3 },
+	{ "BGRA8888 <- RGB888", conv_BGRA8888_from_RGB888, convRow_BGRA8888_from_RGB888, 4, 3 },
+	{ "BGR888 <- RGB888", conv_BGR888_from_RGB888, convRow_BGR888_from_RGB888, 3, 3 },
+	{ "ARGB1555 <- RGB555", conv_ARGB1555_from_RGB555, convRow_ARGB1555_from_RGB555, 2, 2 },
+	{ "RGBA5551 <- ARGB1555", conv_RGBA5551_from_ARGB1555, convRow_RGBA5551_from_ARGB1555, 2, 2 },
+	{ "ARGB1555 <- RGBA5551", conv_ARGB1555_from_RGBA5551, convRow_ARGB1555_from_RGBA5551, 2, 2 },
+	{ "ABGR1555 <- ARGB1555", conv_ABGR1555_from_ARGB1555, convRow_ABGR1555_from_ARGB1555, 2, 2 },
+	{ "RGBA8888 <- ARGB1555", conv_RGBA8888_from_ARGB1555, convRow_RGBA8888_from_ARGB1555, 4, 2 },
+};
+
+#define SIZE 1024
+
+static double
+runPixel(Conversion *c, uint8 *dst, uint8 *src, int32 reps)
+{
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		for(int32 y = 0; y < SIZE; y++){
+			uint8 *out = dst + y*SIZE*4;
+			uint8 *in = src + y*SIZE*4;
+			for(int32 x = 0; x < SIZE; x++){
+				c->pixel(out, in);
+				out += c->outbpp;
+				in += c->inbpp;
+			}
+		}
+	return t.seconds();
+}
+
+static double
+runRow(Conversion *c, uint8 *dst, uint8 *src, int32 reps)
+{
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		convertPixels(dst, SIZE*4, src, SIZE*4, SIZE, SIZE, c->row);
+	return t.seconds();
+}
+
+int
+benchConv(int argc, char *argv[])
+{
+	int32 size = SIZE*SIZE*4;
+	uint8 *src = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *dst = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *ref = rwNewT(uint8, size, MEMDUR_EVENT);
+	srand(1);
+	for(int32 i = 0; i < size; i++)
+		src[i] = rand();
+	int32 reps = 20;
+	double pixels = (double)SIZE*SIZE*reps;
+
+	char name[64];
+	for(uint32 i = 0; i < nelem(conversions); i++){
+		Conversion *c = &conversions[i];
+		memset(ref, 0, size);
+		memset(dst, 0, size);
+		snprintf(name, sizeof(name), "%s pixel", c->name);
+		report(name, pixels/1e6, "Mpixel", runPixel(c, ref, src, reps));
+		snprintf(name, sizeof(name), "%s row", c->name);
+		report(name, pixels/1e6, "Mpixel", runRow(c, dst, src, reps));
+		if(memcmp(ref, dst, size) != 0)
+			printf("%s: row conversion differs\n", c->name);
+	}
+
+	rwFree(src);
+	rwFree(dst);
+	rwFree(ref);
+	return 0;
+}
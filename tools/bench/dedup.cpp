@@ -0,0 +1,88 @@
+#include "bench.h"
+
+// Load DFF and TXD files with asset deduplication and report how much
+// of their geometry and native texture data was shared.
+// Files are loaded in order, every TXD becomes the current dictionary
+// for the DFFs that follow it.
+
+static TexDictionary *txds[256];
+static Clump *clumps[1024];
+static int32 numTxds, numClumps;
+
+static void
+loadFile(const char *filename)
+{
+	StreamFile in;
+	ChunkHeaderInfo header;
+	if(in.open(filename, "rb") == nil){
+		fprintf(stderr, "%s: can't open\n", filename);
+		return;
+	}
+	if(readChunkHeaderInfo(&in, &header)){
+		if(header.type == ID_TEXDICTIONARY && numTxds < (int32)nelem(txds)){
+			TexDictionary *txd = TexDictionary::streamRead(&in);
+			if(txd){
+				txds[numTxds++] = txd;
+				TexDictionary::setCurrent(txd);
+			}
+		}else if(header.type == ID_CLUMP && numClumps < (int32)nelem(clumps)){
+			Clump *c = Clump::streamRead(&in);
+			if(c)
+				clumps[numClumps++] = c;
+		}
+	}
+	in.close();
+}
+
+static void
+unloadAll(void)
+{
+	int32 i;
+	for(i = 0; i < numClumps; i++)
+		clumps[i]->destroy();
+	TexDictionary::setCurrent(nil);
+	for(i = 0; i < numTxds; i++)
+		txds[i]->destroy();
+	numClumps = 0;
+	numTxds = 0;
+}
+
+static double
+loadAll(int argc, char *argv[], bool32 dedup)
+{
+	AssetDedup::setEnabled(dedup);
+	Timer t;
+	for(int i = 0; i < argc; i++)
+		loadFile(argv[i]);
+	double secs = t.seconds();
+	AssetDedup::setEnabled(0);
+	return secs;
+}
+
+int
+benchDedup(int argc, char *argv[])
+{
+	AssetDedup::Stats s;
+
+	if(argc == 0)
+		return 1;
+	Texture::setLoadTextures(0);
+
+	double secs = loadAll(argc, argv, 0);
+	printf("%d clumps, %d texture dictionaries\n", numClumps, numTxds);
+	report("load", argc, "files", secs);
+	unloadAll();
+
+	AssetDedup::resetStats();
+	secs = loadAll(argc, argv, 1);
+	report("load with dedup", argc, "files", secs);
+	AssetDedup::getStats(&s);
+	printf("geometries: %d of %d shared, %.1f of %.1f KB saved\n",
+		s.numSharedGeometries, s.numGeometries,
+		s.geometryBytesSaved/1024.0, s.geometryBytes/1024.0);
+	printf("textures:   %d of %d shared, %.1f of %.1f KB saved\n",
+		s.numSharedTextures, s.numTextures,
+		s.textureBytesSaved/1024.0, s.textureBytes/1024.0);
+	unloadAll();
+	return 0;
+}
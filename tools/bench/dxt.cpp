@@ -0,0 +1,433 @@
+#include "bench.h"
+
+// DXT decompression and compression, serial and on all job threads.
+// Without arguments random blocks are decoded,
+// otherwise all mip levels of the given DDS files.
+// The decoded levels are then compressed again.
+// Decoding is checked against the old per-texel decoders first.
+
+struct DXTLevel
+{
+	int32 type;
+	int32 width, height;
+	uint8 *data;
+	uint8 *alloc;	// to be freed, only set on one level per file
+	uint8 *texels;	// decoded RGBA
+};
+
+static DXTLevel levels[256];
+static int32 numLevels;
+
+static int32
+dxtSize(int32 type, int32 w, int32 h)
+{
+	return ((w+3)/4) * ((h+3)/4) * (type == 1 ? 8 : 16);
+}
+
+static void
+addDDS(const char *filename)
+{
+	uint32 size;
+	uint8 *data = readFile(filename, &size);
+	if(data == nil || size < 128 || memcmp(data, "DDS ", 4) != 0){
+		fprintf(stderr, "%s: can't read DDS\n", filename);
+		rwFree(data);
+		return;
+	}
+	int32 h = *(int32*)&data[12];
+	int32 w = *(int32*)&data[16];
+	int32 mips = *(int32*)&data[28];
+	int32 type;
+	if(memcmp(&data[84], "DXT1", 4) == 0) type = 1;
+	else if(memcmp(&data[84], "DXT3", 4) == 0) type = 3;
+	else if(memcmp(&data[84], "DXT5", 4) == 0) type = 5;
+	else{
+		fprintf(stderr, "%s: not DXT1/3/5\n", filename);
+		rwFree(data);
+		return;
+	}
+	if(mips < 1) mips = 1;
+	uint32 offset = 128;
+	for(int32 i = 0; i < mips && numLevels < (int32)nelem(levels); i++){
+		int32 n = dxtSize(type, w, h);
+		if(offset + n > size)
+			break;
+		levels[numLevels].type = type;
+		levels[numLevels].width = w;
+		levels[numLevels].height = h;
+		levels[numLevels].data = data + offset;
+		levels[numLevels].alloc = i == 0 ? data : nil;
+		numLevels++;
+		offset += n;
+		w = w > 1 ? w/2 : 1;
+		h = h > 1 ? h/2 : 1;
+	}
+	if(offset == 128)
+		rwFree(data);
+}
+
+static void
+addRandom(int32 type, int32 w, int32 h)
+{
+	int32 n = dxtSize(type, w, h);
+	uint8 *data = rwNewT(uint8, n, MEMDUR_EVENT);
+	srand(type);
+	for(int32 i = 0; i < n; i++)
+		data[i] = rand();
+	levels[numLevels].type = type;
+	levels[numLevels].width = w;
+	levels[numLevels].height = h;
+	levels[numLevels].data = data;
+	levels[numLevels].alloc = data;
+	numLevels++;
+}
+
+// The old decoders, for reference.
+// They only handle sizes that are multiples of four.
+
+static void
+refDecompressDXT1(uint8 *adst, int32 w, int32 h, uint8 *src)
+{
+	/* j loops through old texels
+	 * x and y loop through new texels */
+	int32 x = 0, y = 0;
+	uint32 c[4][4];
+	uint8 idx[16];
+	uint8 (*dst)[4] = (uint8(*)[4])adst;
+	for(int32 j = 0; j < w*h/2; j += 8){
+		/* calculate colors */
+		uint32 col0 = *((uint16*)&src[j+0]);
+		uint32 col1 = *((uint16*)&src[j+2]);
+		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
+		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
+		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
+		c[0][3] = 0xFF;
+
+		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
+		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
+		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
+		c[1][3] = 0xFF;
+		if(col0 > col1){
+			c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
+			c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
+			c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
+			c[2][3] = 0xFF;
+
+			c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
+			c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
+			c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
+			c[3][3] = 0xFF;
+		}else{
+			c[2][0] = (c[0][0] + c[1][0])/2;
+			c[2][1] = (c[0][1] + c[1][1])/2;
+			c[2][2] = (c[0][2] + c[1][2])/2;
+			c[2][3] = 0xFF;
+
+			c[3][0] = 0x00;
+			c[3][1] = 0x00;
+			c[3][2] = 0x00;
+			c[3][3] = 0x00;
+		}
+
+		/* make index list */
+		uint32 indices = *((uint32*)&src[j+4]);
+		for(int32 k = 0; k < 16; k++){
+			idx[k] = indices & 0x3;
+			indices >>= 2;
+		}
+
+		/* write bytes */
+		for(uint32 l = 0; l < 4; l++)
+			for(uint32 k = 0; k < 4; k++){
+				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
+				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
+				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
+				dst[(y+l)*w + x+k][3] = c[idx[l*4+k]][3];
+			}
+		x += 4;
+		if(x >= w){
+			y += 4;
+			x = 0;
+		}
+	}
+}
+
+static void
+refDecompressDXT3(uint8 *adst, int32 w, int32 h, uint8 *src)
+{
+	/* j loops through old texels
+	 * x and y loop through new texels */
+	int32 x = 0, y = 0;
+	uint32 c[4][4];
+	uint8 idx[16];
+	uint8 a[16];
+	uint8 (*dst)[4] = (uint8(*)[4])adst;
+	for(int32 j = 0; j < w*h; j += 16){
+		/* calculate colors */
+		uint32 col0 = *((uint16*)&src[j+8]);
+		uint32 col1 = *((uint16*)&src[j+10]);
+		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
+		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
+		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
+
+		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
+		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
+		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
+
+		c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
+		c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
+		c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
+
+		c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
+		c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
+		c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
+
+		/* make index list */
+		uint32 indices = *((uint32*)&src[j+12]);
+		for(int32 k = 0; k < 16; k++){
+			idx[k] = indices & 0x3;
+			indices >>= 2;
+		}
+		uint64 alphas = *((uint64*)&src[j+0]);
+		for(int32 k = 0; k < 16; k++){
+			a[k] = (alphas & 0xF)*17;
+			alphas >>= 4;
+		}
+
+		/* write bytes */
+		for(uint32 l = 0; l < 4; l++)
+			for(uint32 k = 0; k < 4; k++){
+				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
+				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
+				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
+				dst[(y+l)*w + x+k][3] = a[l*4+k];
+			}
+		x += 4;
+		if(x >= w){
+			y += 4;
+			x = 0;
+		}
+	}
+}
+
+static void
+refDecompressDXT5(uint8 *adst, int32 w, int32 h, uint8 *src)
+{
+	/* j loops through old texels
+	 * x and y loop through new texels */
+	int32 x = 0, y = 0;
+	uint32 c[4][4];
+	uint32 a[8];
+	uint8 idx[16];
+	uint8 aidx[16];
+	uint8 (*dst)[4] = (uint8(*)[4])adst;
+	for(int32 j = 0; j < w*h; j += 16){
+		/* calculate colors */
+		uint32 col0 = *((uint16*)&src[j+8]);
+		uint32 col1 = *((uint16*)&src[j+10]);
+		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
+		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
+		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
+
+		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
+		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
+		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
+		if(col0 > col1){
+			c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
+			c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
+			c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
+
+			c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
+			c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
+			c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
+		}else{
+			c[2][0] = (c[0][0] + c[1][0])/2;
+			c[2][1] = (c[0][1] + c[1][1])/2;
+			c[2][2] = (c[0][2] + c[1][2])/2;
+
+			c[3][0] = 0x00;
+			c[3][1] = 0x00;
+			c[3][2] = 0x00;
+		}
+
+		a[0] = src[j+0];
+		a[1] = src[j+1];
+		if(a[0] > a[1]){
+			a[2] = (6*a[0] + 1*a[1])/7;
+			a[3] = (5*a[0] + 2*a[1])/7;
+			a[4] = (4*a[0] + 3*a[1])/7;
+			a[5] = (3*a[0] + 4*a[1])/7;
+			a[6] = (2*a[0] + 5*a[1])/7;
+			a[7] = (1*a[0] + 6*a[1])/7;
+		}else{
+			a[2] = (4*a[0] + 1*a[1])/5;
+			a[3] = (3*a[0] + 2*a[1])/5;
+			a[4] = (2*a[0] + 3*a[1])/5;
+			a[5] = (1*a[0] + 4*a[1])/5;
+			a[6] = 0;
+			a[7] = 0xFF;
+		}
+
+		/* make index list */
+		uint32 indices = *((uint32*)&src[j+12]);
+		for(int32 k = 0; k < 16; k++){
+			idx[k] = indices & 0x3;
+			indices >>= 2;
+		}
+		// only 6 indices
+		uint64 alphas = *((uint64*)&src[j+2]);
+		for(int32 k = 0; k < 16; k++){
+			aidx[k] = alphas & 0x7;
+			alphas >>= 3;
+		}
+
+		/* write bytes */
+		for(uint32 l = 0; l < 4; l++)
+			for(uint32 k = 0; k < 4; k++){
+				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
+				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
+				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
+				dst[(y+l)*w + x+k][3] = a[aidx[l*4+k]];
+			}
+		x += 4;
+		if(x >= w){
+			y += 4;
+			x = 0;
+		}
+	}
+}
+
+static int32
+checkDecoders(void)
+{
+	int32 numBad = 0;
+	for(int32 i = 0; i < numLevels; i++){
+		DXTLevel *l = &levels[i];
+		if(l->width % 4 || l->height % 4)
+			continue;
+		int32 size = l->width*l->height*4;
+		uint8 *out = rwNewT(uint8, size, MEMDUR_EVENT);
+		uint8 *ref = rwNewT(uint8, size, MEMDUR_EVENT);
+		decompressDXT(l->type, out, l->width, l->height, l->data);
+		switch(l->type){
+		case 1: refDecompressDXT1(ref, l->width, l->height, l->data); break;
+		case 3: refDecompressDXT3(ref, l->width, l->height, l->data); break;
+		case 5: refDecompressDXT5(ref, l->width, l->height, l->data); break;
+		}
+		if(memcmp(out, ref, size) != 0){
+			printf("DXT%d %dx%d: mismatch\n", l->type, l->width, l->height);
+			numBad++;
+		}
+		rwFree(out);
+		rwFree(ref);
+	}
+	printf("results %s\n", numBad ? "DIFFER" : "ok");
+	return numBad;
+}
+
+static double
+run(bool threaded, uint8 *dst, int32 reps)
+{
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		for(int32 i = 0; i < numLevels; i++){
+			DXTLevel *l = &levels[i];
+			if(threaded)
+				decompressDXT(l->type, dst, l->width, l->height, l->data);
+			else switch(l->type){
+			case 1: decompressDXT1(dst, l->width, l->height, l->data); break;
+			case 3: decompressDXT3(dst, l->width, l->height, l->data); break;
+			case 5: decompressDXT5(dst, l->width, l->height, l->data); break;
+			}
+		}
+	return t.seconds();
+}
+
+static double
+runCompress(int32 quality, uint8 *dst, int32 reps)
+{
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		for(int32 i = 0; i < numLevels; i++){
+			DXTLevel *l = &levels[i];
+			compressDXT(l->type, quality, dst, l->width, l->height,
+				l->texels, l->width*4);
+		}
+	return t.seconds();
+}
+
+static double
+compressError(uint8 *dst)
+{
+	double err = 0.0, n = 0.0;
+	for(int32 i = 0; i < numLevels; i++){
+		DXTLevel *l = &levels[i];
+		int32 size = l->width*l->height*4;
+		uint8 *tmp = rwNewT(uint8, size, MEMDUR_EVENT);
+		compressDXT(l->type, Image::DXTCLUSTERFIT, dst, l->width, l->height,
+			l->texels, l->width*4);
+		decompressDXT(l->type, tmp, l->width, l->height, dst);
+		for(int32 j = 0; j < size; j++){
+			int32 d = tmp[j] - l->texels[j];
+			err += d*d;
+		}
+		n += size;
+		rwFree(tmp);
+	}
+	return sqrt(err/n);
+}
+
+int
+benchDXT(int argc, char *argv[])
+{
+	for(int i = 0; i < argc; i++)
+		addDDS(argv[i]);
+	if(argc == 0){
+		addRandom(1, 1024, 1024);
+		addRandom(3, 1024, 1024);
+		addRandom(5, 1024, 1024);
+	}
+	if(numLevels == 0)
+		return 1;
+
+	double texels = 0.0;
+	int32 maxTexels = 0;
+	for(int32 i = 0; i < numLevels; i++){
+		int32 n = levels[i].width*levels[i].height;
+		texels += n;
+		maxTexels = n > maxTexels ? n : maxTexels;
+	}
+	uint8 *dst = rwNewT(uint8, maxTexels*4, MEMDUR_EVENT);
+	int32 reps = (int32)(50e6/texels) + 1;
+
+	printf("%d levels, %.0f texels, %d reps\n", numLevels, texels, reps);
+	int32 numBad = checkDecoders();
+	report("decompress serial", texels*reps/1e6, "Mtexel", run(false, dst, reps));
+	Engine::jobfuncs = threadedJobfuncs;
+	printf("%d job threads\n", getNumJobThreads());
+	report("decompress threaded", texels*reps/1e6, "Mtexel", run(true, dst, reps));
+	Engine::jobfuncs = serialJobfuncs;
+
+	for(int32 i = 0; i < numLevels; i++){
+		DXTLevel *l = &levels[i];
+		l->texels = rwNewT(uint8, l->width*l->height*4, MEMDUR_EVENT);
+		decompressDXT(l->type, l->texels, l->width, l->height, l->data);
+	}
+	// compression is a lot slower
+	reps = (int32)(2e6/texels) + 1;
+	printf("%d reps\n", reps);
+	report("compress range fit", texels*reps/1e6, "Mtexel", runCompress(Image::DXTRANGEFIT, dst, reps));
+	report("compress cluster fit", texels/1e6, "Mtexel", runCompress(Image::DXTCLUSTERFIT, dst, 1));
+	Engine::jobfuncs = threadedJobfuncs;
+	report("compress range fit threaded", texels*reps/1e6, "Mtexel", runCompress(Image::DXTRANGEFIT, dst, reps));
+	report("compress cluster fit threaded", texels/1e6, "Mtexel", runCompress(Image::DXTCLUSTERFIT, dst, 1));
+	Engine::jobfuncs = serialJobfuncs;
+	printf("round trip rmse %.2f\n", compressError(dst));
+
+	rwFree(dst);
+	for(int32 i = 0; i < numLevels; i++){
+		rwFree(levels[i].texels);
+		rwFree(levels[i].alloc);
+	}
+	return numBad != 0;
+}
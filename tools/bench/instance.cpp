@@ -0,0 +1,262 @@
+#include "bench.h"
+
+// Vertex instancing kernels of pipeline.cpp on a million vertex mesh,
+// interleaved into a D3D style vertex of 36 bytes:
+// position, color, texture coordinates and normal.
+// The old scalar loops are kept here as reference; all results are
+// compared against them before they're timed.
+
+enum {
+	NUMVERTS = 1000000,
+	NUMINDICES = 3000000,
+	STRIDE = 36,
+	OFF_POS = 0,
+	OFF_COLOR = 12,
+	OFF_TEX = 16,
+	OFF_NORMAL = 24,
+	REPS = 20
+};
+
+static void
+refFindMinVert(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
+{
+	uint32 min = 0xFFFFFFFF;
+	uint32 max = 0;
+	while(numIndices--){
+		if(*indices < min)
+			min = *indices;
+		if(*indices > max)
+			max = *indices;
+		indices++;
+	}
+	uint32 num = max - min + 1;
+	if(min > max){
+		min = 0;
+		num = 0;
+	}
+	*minVert = min;
+	*numVertices = num;
+}
+
+static void
+refInstV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
+{
+	if(type == VERT_FLOAT3)
+		for(uint32 i = 0; i < numVertices; i++){
+			memcpy(dst, src, 12);
+			dst += stride;
+			src++;
+		}
+	else
+		for(uint32 i = 0; i < numVertices; i++){
+			uint32 n = ((((uint32)(int32)(src->z * 511.0f)) & 0x3ff) << 22) |
+				((((uint32)(int32)(src->y * 1023.0f)) & 0x7ff) << 11) |
+				((((uint32)(int32)(src->x * 1023.0f)) & 0x7ff) << 0);
+			*(uint32*)dst = n;
+			dst += stride;
+			src++;
+		}
+}
+
+static void
+refUninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
+{
+	if(type == VERT_FLOAT3)
+		for(uint32 i = 0; i < numVertices; i++){
+			memcpy(dst, src, 12);
+			src += stride;
+			dst++;
+		}
+	else
+		for(uint32 i = 0; i < numVertices; i++){
+			uint32 n = *(uint32*)src;
+			int32 normal[3];
+			normal[0] = n & 0x7FF;
+			normal[1] = (n >> 11) & 0x7FF;
+			normal[2] = (n >> 22) & 0x3FF;
+			if(normal[0] & 0x400) normal[0] |= ~0x7FF;
+			if(normal[1] & 0x400) normal[1] |= ~0x7FF;
+			if(normal[2] & 0x200) normal[2] |= ~0x3FF;
+			dst->x = normal[0] / 1023.0f;
+			dst->y = normal[1] / 1023.0f;
+			dst->z = normal[2] / 511.0f;
+			src += stride;
+			dst++;
+		}
+}
+
+static void
+refInstTexCoords(uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
+{
+	for(uint32 i = 0; i < numVertices; i++){
+		memcpy(dst, src, 8);
+		dst += stride;
+		src++;
+	}
+}
+
+static void
+refUninstTexCoords(TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride)
+{
+	for(uint32 i = 0; i < numVertices; i++){
+		memcpy(dst, src, 8);
+		src += stride;
+		dst++;
+	}
+}
+
+static bool32
+refInstColor(uint8 *dst, RGBA *src, uint32 numVertices, uint32 stride)
+{
+	uint8 alpha = 0xFF;
+	for(uint32 i = 0; i < numVertices; i++){
+		dst[0] = src->blue;
+		dst[1] = src->green;
+		dst[2] = src->red;
+		dst[3] = src->alpha;
+		alpha &= src->alpha;
+		dst += stride;
+		src++;
+	}
+	return alpha != 0xFF;
+}
+
+static void
+refUninstColor(RGBA *dst, uint8 *src, uint32 numVertices, uint32 stride)
+{
+	for(uint32 i = 0; i < numVertices; i++){
+		dst->red = src[2];
+		dst->green = src[1];
+		dst->blue = src[0];
+		dst->alpha = src[3];
+		src += stride;
+		dst++;
+	}
+}
+
+static int32 numBad;
+
+static void
+compare(const char *name, const void *a, const void *b, uint32 size)
+{
+	if(memcmp(a, b, size) != 0){
+		printf("%s: mismatch\n", name);
+		numBad++;
+	}
+}
+
+static void
+timed(const char *name, double secs)
+{
+	report(name, (double)NUMVERTS*REPS/1e6, "Mvert", secs);
+}
+
+#define TIME(name, stmt) { Timer t; for(int32 r = 0; r < REPS; r++) { stmt; } timed(name, t.seconds()); }
+
+int
+benchInstance(int, char *[])
+{
+	int32 i;
+	V3d *pos = rwNewT(V3d, NUMVERTS, MEMDUR_EVENT);
+	V3d *nrm = rwNewT(V3d, NUMVERTS, MEMDUR_EVENT);
+	RGBA *col = rwNewT(RGBA, NUMVERTS, MEMDUR_EVENT);
+	TexCoords *tex = rwNewT(TexCoords, NUMVERTS, MEMDUR_EVENT);
+	uint16 *indices = rwNewT(uint16, NUMINDICES, MEMDUR_EVENT);
+	uint8 *verts = rwNewT(uint8, NUMVERTS*STRIDE, MEMDUR_EVENT);
+	uint8 *refVerts = rwNewT(uint8, NUMVERTS*STRIDE, MEMDUR_EVENT);
+	V3d *outV3d = rwNewT(V3d, NUMVERTS, MEMDUR_EVENT);
+	V3d *refV3d = rwNewT(V3d, NUMVERTS, MEMDUR_EVENT);
+	TexCoords *outTex = rwNewT(TexCoords, NUMVERTS, MEMDUR_EVENT);
+	TexCoords *refTex = rwNewT(TexCoords, NUMVERTS, MEMDUR_EVENT);
+	RGBA *outCol = rwNewT(RGBA, NUMVERTS, MEMDUR_EVENT);
+	RGBA *refCol = rwNewT(RGBA, NUMVERTS, MEMDUR_EVENT);
+
+	srand(1);
+	for(i = 0; i < NUMVERTS; i++){
+		pos[i].set(rand()/(float32)RAND_MAX*200.0f - 100.0f, i*0.01f, 3.0f);
+		V3d n = { rand()/(float32)RAND_MAX - 0.5f, rand()/(float32)RAND_MAX - 0.5f, rand()/(float32)RAND_MAX - 0.5f };
+		nrm[i] = normalize(n);
+		col[i] = makeRGBA(rand(), rand(), rand(), i == NUMVERTS/2 ? 0x80 : 0xFF);
+		tex[i].u = rand()/(float32)RAND_MAX;
+		tex[i].v = i*0.001f;
+	}
+	for(i = 0; i < NUMINDICES; i++)
+		indices[i] = 1000 + rand()%60000;
+
+	memset(verts, 0, NUMVERTS*STRIDE);
+	memset(refVerts, 0, NUMVERTS*STRIDE);
+
+	// check results first
+	uint32 min, refMin;
+	int32 num, refNum;
+	// odd sizes and offsets to catch the tails
+	for(i = 0; i < 40; i++){
+		findMinVertAndNumVertices(indices+i, i*7+1, &min, &num);
+		refFindMinVert(indices+i, i*7+1, &refMin, &refNum);
+		if(min != refMin || num != refNum){
+			printf("findMinVertAndNumVertices: mismatch\n");
+			numBad++;
+		}
+	}
+	bool32 alpha = instColor(VERT_ARGB, verts+OFF_COLOR, col, NUMVERTS-1, STRIDE);
+	bool32 refAlpha = refInstColor(refVerts+OFF_COLOR, col, NUMVERTS-1, STRIDE);
+	if(alpha != refAlpha || !alpha){
+		printf("instColor alpha: mismatch\n");
+		numBad++;
+	}
+	instV3d(VERT_FLOAT3, verts+OFF_POS, pos, NUMVERTS-3, STRIDE);
+	refInstV3d(VERT_FLOAT3, refVerts+OFF_POS, pos, NUMVERTS-3, STRIDE);
+	instTexCoords(VERT_FLOAT2, verts+OFF_TEX, tex, NUMVERTS-2, STRIDE);
+	refInstTexCoords(refVerts+OFF_TEX, tex, NUMVERTS-2, STRIDE);
+	instV3d(VERT_COMPNORM, verts+OFF_NORMAL, nrm, NUMVERTS-1, STRIDE);
+	refInstV3d(VERT_COMPNORM, refVerts+OFF_NORMAL, nrm, NUMVERTS-1, STRIDE);
+	compare("instancing", verts, refVerts, NUMVERTS*STRIDE);
+
+	uninstV3d(VERT_FLOAT3, outV3d, verts+OFF_POS, NUMVERTS, STRIDE);
+	refUninstV3d(VERT_FLOAT3, refV3d, verts+OFF_POS, NUMVERTS, STRIDE);
+	compare("uninstV3d FLOAT3", outV3d, refV3d, NUMVERTS*sizeof(V3d));
+	uninstV3d(VERT_COMPNORM, outV3d, verts+OFF_NORMAL, NUMVERTS-1, STRIDE);
+	refUninstV3d(VERT_COMPNORM, refV3d, verts+OFF_NORMAL, NUMVERTS-1, STRIDE);
+	compare("uninstV3d COMPNORM", outV3d, refV3d, NUMVERTS*sizeof(V3d));
+	uninstTexCoords(VERT_FLOAT2, outTex, verts+OFF_TEX, NUMVERTS-3, STRIDE);
+	refUninstTexCoords(refTex, verts+OFF_TEX, NUMVERTS-3, STRIDE);
+	compare("uninstTexCoords", outTex, refTex, (NUMVERTS-3)*sizeof(TexCoords));
+	uninstColor(VERT_ARGB, outCol, verts+OFF_COLOR, NUMVERTS-2, STRIDE);
+	refUninstColor(refCol, verts+OFF_COLOR, NUMVERTS-2, STRIDE);
+	compare("uninstColor", outCol, refCol, (NUMVERTS-2)*sizeof(RGBA));
+	printf("results %s\n", numBad ? "DIFFER" : "ok");
+
+	TIME("min/max index reference", refFindMinVert(indices, NUMINDICES, &min, &num));
+	TIME("min/max index", findMinVertAndNumVertices(indices, NUMINDICES, &min, &num));
+	TIME("instV3d FLOAT3 reference", refInstV3d(VERT_FLOAT3, refVerts+OFF_POS, pos, NUMVERTS, STRIDE));
+	TIME("instV3d FLOAT3", instV3d(VERT_FLOAT3, verts+OFF_POS, pos, NUMVERTS, STRIDE));
+	TIME("instV3d COMPNORM reference", refInstV3d(VERT_COMPNORM, refVerts+OFF_NORMAL, nrm, NUMVERTS, STRIDE));
+	TIME("instV3d COMPNORM", instV3d(VERT_COMPNORM, verts+OFF_NORMAL, nrm, NUMVERTS, STRIDE));
+	TIME("instTexCoords reference", refInstTexCoords(refVerts+OFF_TEX, tex, NUMVERTS, STRIDE));
+	TIME("instTexCoords", instTexCoords(VERT_FLOAT2, verts+OFF_TEX, tex, NUMVERTS, STRIDE));
+	TIME("instColor reference", refInstColor(refVerts+OFF_COLOR, col, NUMVERTS, STRIDE));
+	TIME("instColor", instColor(VERT_ARGB, verts+OFF_COLOR, col, NUMVERTS, STRIDE));
+	TIME("uninstV3d FLOAT3 reference", refUninstV3d(VERT_FLOAT3, refV3d, verts+OFF_POS, NUMVERTS, STRIDE));
+	TIME("uninstV3d FLOAT3", uninstV3d(VERT_FLOAT3, outV3d, verts+OFF_POS, NUMVERTS, STRIDE));
+	TIME("uninstV3d COMPNORM reference", refUninstV3d(VERT_COMPNORM, refV3d, verts+OFF_NORMAL, NUMVERTS, STRIDE));
+	TIME("uninstV3d COMPNORM", uninstV3d(VERT_COMPNORM, outV3d, verts+OFF_NORMAL, NUMVERTS, STRIDE));
+	TIME("uninstTexCoords reference", refUninstTexCoords(refTex, verts+OFF_TEX, NUMVERTS, STRIDE));
+	TIME("uninstTexCoords", uninstTexCoords(VERT_FLOAT2, outTex, verts+OFF_TEX, NUMVERTS, STRIDE));
+	TIME("uninstColor reference", refUninstColor(refCol, verts+OFF_COLOR, NUMVERTS, STRIDE));
+	TIME("uninstColor", uninstColor(VERT_ARGB, outCol, verts+OFF_COLOR, NUMVERTS, STRIDE));
+
+	rwFree(pos);
+	rwFree(nrm);
+	rwFree(col);
+	rwFree(tex);
+	rwFree(indices);
+	rwFree(verts);
+	rwFree(refVerts);
+	rwFree(outV3d);
+	rwFree(refV3d);
+	rwFree(outTex);
+	rwFree(refTex);
+	rwFree(outCol);
+	rwFree(refCol);
+	return numBad != 0;
+}
@@ -0,0 +1,87 @@
+#include "bench.h"
+
+// Headless benchmarks of CPU side code paths.
+// Run as: bench name [args...]
+
+struct Benchmark
+{
+	const char *name;
+	int (*func)(int argc, char *argv[]);
+	const char *usage;
+};
+
+static Benchmark benchmarks[] = {
+	{ "dxt", benchDXT, "[file.dds ...]" },
+	{ "mipmap", benchMipmap, "[image ...]" },
+	{ "conv", benchConv, "" },
+	{ "ps2swizzle", benchPS2Swizzle, "" },
+	{ "xboxswizzle", benchXboxSwizzle, "" },
+	{ "vcache", benchVCache, "[-w] [file.dff ...]" },
+	{ "dedup", benchDedup, "file.txd|file.dff ..." },
+	{ "meshlet", benchMeshlet, "" },
+	{ "instance", benchInstance, "" },
+	{ "bounds", benchBounds, "" },
+};
+
+void
+report(const char *name, double amount, const char *unit, double seconds)
+{
+	printf("%-32s %10.3f ms %10.2f %s/s\n", name, seconds*1000.0, amount/seconds, unit);
+}
+
+uint8*
+readFile(const char *filename, uint32 *size)
+{
+	FILE *f = fopen(filename, "rb");
+	if(f == nil)
+		return nil;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8 *data = rwNewT(uint8, *size, MEMDUR_EVENT);
+	if(fread(data, 1, *size, f) != *size){
+		rwFree(data);
+		data = nil;
+	}
+	fclose(f);
+	return data;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s benchmark [args]\n", argv0);
+	for(uint32 i = 0; i < nelem(benchmarks); i++)
+		fprintf(stderr, "\t%s %s\n", benchmarks[i].name, benchmarks[i].usage);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if(argc < 2){
+		usage(argv[0]);
+		return 1;
+	}
+
+	Engine::init();
+	registerMeshPlugin();
+	registerMeshletPlugin();
+	registerBoundsPlugin();
+	Engine::open(nil);
+	Engine::start();
+
+	int ret = 1;
+	uint32 i;
+	for(i = 0; i < nelem(benchmarks); i++)
+		if(strcmp(argv[1], benchmarks[i].name) == 0){
+			ret = benchmarks[i].func(argc-2, argv+2);
+			break;
+		}
+	if(i == nelem(benchmarks))
+		usage(argv[0]);
+
+	Engine::stop();
+	Engine::close();
+	Engine::term();
+	return ret;
+}
@@ -0,0 +1,152 @@
+#include "bench.h"
+
+// Meshlet generation and culling.
+// A hilly terrain made of tiles is seen by a camera flying in a circle
+// over it. Every frame all tiles are culled as whole atomics and
+// by meshlets, and the triangles that would be drawn are counted.
+
+enum {
+	GRIDSIZE = 255,	// quads per tile side, 256*256 vertices
+	NUMTILES = 4,	// per side
+	NUMFRAMES = 240
+};
+
+static float32
+height(float32 x, float32 y)
+{
+	return 12.0f*sinf(x*0.031f)*cosf(y*0.027f) + 4.0f*sinf((x+y)*0.11f);
+}
+
+static Geometry*
+makeTile(float32 x0, float32 y0)
+{
+	int32 n = GRIDSIZE;
+	int32 i, j;
+	Geometry *geo = Geometry::create((n+1)*(n+1), n*n*2,
+		Geometry::POSITIONS | Geometry::NORMALS | Geometry::TEXTURED);
+	Material *mat = Material::create();
+	geo->matList.appendMaterial(mat);
+	mat->destroy();
+	MorphTarget *mt = &geo->morphTargets[0];
+	for(i = 0; i <= n; i++)
+		for(j = 0; j <= n; j++){
+			int32 v = i*(n+1) + j;
+			float32 x = x0 + j, y = y0 + i;
+			mt->vertices[v].set(j, i, height(x, y));
+			V3d nrm = { height(x-0.5f, y) - height(x+0.5f, y),
+			            height(x, y-0.5f) - height(x, y+0.5f), 1.0f };
+			mt->normals[v] = normalize(nrm);
+			geo->texCoords[0][v].u = (float32)j/n;
+			geo->texCoords[0][v].v = (float32)i/n;
+		}
+	Triangle *t = geo->triangles;
+	for(i = 0; i < n; i++)
+		for(j = 0; j < n; j++){
+			int32 v00 = i*(n+1) + j;
+			int32 v01 = v00 + 1;
+			int32 v10 = v00 + n+1;
+			int32 v11 = v10 + 1;
+			t->v[0] = v00; t->v[1] = v01; t->v[2] = v10; t->matId = 0; t++;
+			t->v[0] = v01; t->v[1] = v11; t->v[2] = v10; t->matId = 0; t++;
+		}
+	geo->buildMeshes();
+	geo->calculateBoundingSphere();
+	return geo;
+}
+
+static void
+placeCamera(Camera *cam, int32 frame)
+{
+	float32 size = GRIDSIZE*NUMTILES;
+	float32 a = frame*2.0f*M_PI/NUMFRAMES;
+	V3d pos = { size/2 + cosf(a)*size/3, size/2 + sinf(a)*size/3, 0.0f };
+	pos.z = height(pos.x, pos.y) + 25.0f;
+	V3d dir = { -sinf(a), cosf(a), -0.3f };
+	V3d up = { 0.0f, 0.0f, 1.0f };
+	Frame *f = cam->getFrame();
+	f->matrix.lookAt(dir, up);
+	f->matrix.pos = pos;
+	f->updateObjects();
+	Frame::syncDirty();
+}
+
+int
+benchMeshlet(int, char *[])
+{
+	Atomic *atomics[NUMTILES*NUMTILES];
+	Geometry *geos[NUMTILES*NUMTILES];
+	int32 i, j, f;
+
+	Clump *clump = Clump::create();
+	clump->setFrame(Frame::create());
+	for(i = 0; i < NUMTILES; i++)
+		for(j = 0; j < NUMTILES; j++){
+			int32 k = i*NUMTILES + j;
+			V3d pos = { (float32)j*GRIDSIZE, (float32)i*GRIDSIZE, 0.0f };
+			Frame *frm = Frame::create();
+			frm->translate(&pos, COMBINEREPLACE);
+			clump->getFrame()->addChild(frm);
+			geos[k] = makeTile(pos.x, pos.y);
+			atomics[k] = Atomic::create();
+			atomics[k]->setGeometry(geos[k], 0);
+			atomics[k]->setFrame(frm);
+			clump->addAtomic(atomics[k]);
+			geos[k]->destroy();
+		}
+
+	Camera *cam = Camera::create();
+	cam->setFrame(Frame::create());
+	cam->setNearPlane(0.5f);
+	cam->setFarPlane(500.0f);
+	// 70 degrees horizontally, no frame buffer for setFOV
+	V2d window = { 0.7f, 0.7f*9.0f/16.0f };
+	cam->setViewWindow(&window);
+
+	double tris = 0.0;
+	int32 numMeshlets = 0;
+	Timer t;
+	for(i = 0; i < NUMTILES*NUMTILES; i++){
+		Meshlets::build(geos[i]);
+		tris += geos[i]->numTriangles;
+	}
+	double secs = t.seconds();
+	for(i = 0; i < NUMTILES*NUMTILES; i++)
+		numMeshlets += Meshlets::get(geos[i])->numMeshlets;
+	printf("%d tiles, %.0f triangles, %d meshlets, %.1f triangles per meshlet\n",
+		NUMTILES*NUMTILES, tris, numMeshlets, tris/numMeshlets);
+	report("build", tris/1e6, "Mtri", secs);
+
+	// whole atomics against the frustum
+	double atomicTris = 0.0;
+	for(f = 0; f < NUMFRAMES; f++){
+		placeCamera(cam, f);
+		for(i = 0; i < NUMTILES*NUMTILES; i++)
+			if(cam->frustumTestSphere(atomics[i]->getWorldBoundingSphere()) != Camera::SPHEREOUTSIDE)
+				atomicTris += geos[i]->numTriangles;
+	}
+
+	MeshletStats stats;
+	Meshlets::resetStats();
+	secs = 0.0;
+	for(f = 0; f < NUMFRAMES; f++){
+		placeCamera(cam, f);
+		t.reset();
+		for(i = 0; i < NUMTILES*NUMTILES; i++){
+			Meshlets::beginDraw(atomics[i], cam, CULLBACK);
+			Meshlets::endDraw();
+		}
+		secs += t.seconds();
+	}
+	Meshlets::getStats(&stats);
+	report("cull", stats.numMeshlets/1e6, "Mmeshlet", secs);
+	printf("triangles per frame: %.0f all, %.0f atomics, %.0f meshlets\n",
+		tris, atomicTris/NUMFRAMES, (double)stats.numDrawnTriangles/NUMFRAMES);
+	printf("meshlets culled: %.1f%% frustum, %.1f%% cone\n",
+		100.0*stats.numFrustumCulled/stats.numMeshlets,
+		100.0*stats.numConeCulled/stats.numMeshlets);
+
+	cam->getFrame()->destroy();
+	cam->destroy();
+	clump->destroy();
+	return 0;
+}
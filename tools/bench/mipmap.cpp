@@ -0,0 +1,91 @@
+#include "bench.h"
+
+// Mipmap chain generation with the different filters,
+// serial and on all job threads.
+// Without arguments a random 2048x2048 image is used,
+// otherwise the given image files.
+
+static Image *images[64];
+static int32 numImages;
+
+static Image*
+makeRandom(int32 w, int32 h)
+{
+	Image *img = Image::create(w, h, 32);
+	img->allocate();
+	srand(w);
+	for(int32 y = 0; y < h; y++)
+		for(int32 x = 0; x < w*4; x++)
+			img->pixels[y*img->stride + x] = rand();
+	return img;
+}
+
+static double
+run(int32 filter, bool32 srgb, int32 alphaRef, int32 reps)
+{
+	Image *levels[32];
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		for(int32 i = 0; i < numImages; i++){
+			int32 n = images[i]->generateMipmaps(levels, nelem(levels), filter, srgb, alphaRef);
+			for(int32 j = 0; j < n; j++)
+				levels[j]->destroy();
+		}
+	return t.seconds();
+}
+
+static void
+runAll(const char *suffix, double texels, int32 reps)
+{
+	static struct {
+		const char *name;
+		int32 filter;
+		bool32 srgb;
+		int32 alphaRef;
+	} configs[] = {
+		{ "box", Image::MIPBOX, 0, 0 },
+		{ "box srgb", Image::MIPBOX, 1, 0 },
+		{ "box srgb coverage", Image::MIPBOX, 1, 128 },
+		{ "kaiser", Image::MIPKAISER, 0, 0 },
+		{ "kaiser srgb", Image::MIPKAISER, 1, 0 },
+	};
+	char name[64];
+	for(uint32 i = 0; i < nelem(configs); i++){
+		snprintf(name, sizeof(name), "%s%s", configs[i].name, suffix);
+		report(name, texels*reps/1e6, "Mtexel",
+			run(configs[i].filter, configs[i].srgb, configs[i].alphaRef, reps));
+	}
+}
+
+int
+benchMipmap(int argc, char *argv[])
+{
+	for(int i = 0; i < argc && numImages < (int32)nelem(images); i++){
+		Image *img = Image::read(argv[i]);
+		if(img == nil){
+			fprintf(stderr, "%s: can't read image\n", argv[i]);
+			continue;
+		}
+		images[numImages++] = img;
+	}
+	if(argc == 0)
+		images[numImages++] = makeRandom(2048, 2048);
+	if(numImages == 0)
+		return 1;
+
+	double texels = 0.0;
+	for(int32 i = 0; i < numImages; i++)
+		texels += images[i]->width*images[i]->height;
+	int32 reps = (int32)(8e6/texels) + 1;
+
+	printf("%d images, %.0f texels, %d reps\n", numImages, texels, reps);
+	runAll("", texels, reps);
+	Engine::jobfuncs = threadedJobfuncs;
+	printf("%d job threads\n", getNumJobThreads());
+	runAll(" threaded", texels, reps);
+	Engine::jobfuncs = serialJobfuncs;
+
+	for(int32 i = 0; i < numImages; i++)
+		images[i]->destroy();
+	return 0;
+}
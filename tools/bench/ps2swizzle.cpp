@@ -0,0 +1,119 @@
+#include "bench.h"
+
+// PS2 PSMT8 and PSMT4 swizzling as done on raster lock and unlock.
+// The result is checked against the texel by texel address
+// calculation and a swizzle/unswizzle round trip.
+
+static uint32
+refSwizzle(uint32 x, uint32 y, uint32 logw)
+{
+#define X(n) ((x>>(n))&1)
+#define Y(n) ((y>>(n))&1)
+	uint32 nx, ny, n;
+	x ^= (Y(1)^Y(2))<<2;
+	nx = (x&7) | ((x>>1)&~7);
+	ny = (y&1) | ((y>>1)&~1);
+	n = Y(1) | X(3)<<1;
+	return n | nx<<2 | ny<<(logw-1+2);
+#undef X
+#undef Y
+}
+
+// unswizzle a whole w*h texture of 8 or 4 bit texels
+static void
+refUnswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 depth)
+{
+	int32 logw = 0;
+	for(int32 i = 1; i < w; i *= 2) logw++;
+	uint32 mask = (1<<(logw+2))-1;
+	for(int32 y = 0; y < h; y += 4){
+		uint8 *strip = depth == 4 ? &src[y<<(logw-1)] : &src[y<<logw];
+		for(int32 i = 0; i < 4; i++)
+			for(int32 x = 0; x < w; x++){
+				uint32 a = ((y+i)<<logw)+x;
+				uint32 s = refSwizzle(x, y+i, logw)&mask;
+				if(depth == 8)
+					dst[a] = strip[s];
+				else{
+					uint8 c = s & 1 ? strip[s>>1] >> 4 : strip[s>>1] & 0xF;
+					dst[a>>1] = a & 1 ? (dst[a>>1]&0xF) | c<<4 : (dst[a>>1]&0xF0) | c;
+				}
+			}
+	}
+}
+
+static Raster*
+makeRaster(int32 w, int32 h, int32 depth)
+{
+	int32 format = Raster::TEXTURE | Raster::C8888 |
+		(depth == 4 ? Raster::PAL4 : Raster::PAL8);
+	Raster *ras = Raster::create(w, h, depth, format, PLATFORM_PS2);
+	if(ras == nil)
+		return nil;
+	ps2::Ps2Raster *natras = GETPS2RASTEREXT(ras);
+	natras->flags |= depth == 4 ? ps2::Ps2Raster::SWIZZLED4 : ps2::Ps2Raster::SWIZZLED8;
+	return ras;
+}
+
+static bool
+check(int32 w, int32 h, int32 depth)
+{
+	Raster *ras = makeRaster(w, h, depth);
+	if(ras == nil)
+		return false;
+	int32 size = w*h*depth/8;
+	uint8 *orig = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *ref = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *px = ras->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+	for(int32 i = 0; i < size; i++)
+		px[i] = orig[i] = rand();
+	refUnswizzle(ref, orig, w, h, depth);
+	ps2::unswizzleRaster(ras);
+	bool ok = memcmp(px, ref, size) == 0;
+	ps2::swizzleRaster(ras);
+	ok = ok && memcmp(px, orig, size) == 0;
+	ras->unlock(0);
+	ras->destroy();
+	rwFree(orig);
+	rwFree(ref);
+	if(!ok)
+		printf("%dx%d %d bit: mismatch\n", w, h, depth);
+	return ok;
+}
+
+static double
+run(Raster *ras, bool unswizzle, int32 reps)
+{
+	ras->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		if(unswizzle)
+			ps2::unswizzleRaster(ras);
+		else
+			ps2::swizzleRaster(ras);
+	double s = t.seconds();
+	ras->unlock(0);
+	return s;
+}
+
+int
+benchPS2Swizzle(int argc, char *argv[])
+{
+	int32 bad = 0;
+	for(int32 depth = 4; depth <= 8; depth += 4)
+		for(int32 w = depth == 4 ? 32 : 16; w <= 1024; w *= 2)
+			for(int32 h = 4; h <= 256; h *= 4)
+				if(!check(w, h, depth))
+					bad++;
+	printf("round trip %s\n", bad ? "FAILED" : "ok");
+
+	int32 reps = 50;
+	for(int32 depth = 8; depth >= 4; depth -= 4){
+		Raster *ras = makeRaster(1024, 1024, depth);
+		double texels = 1024.0*1024.0*reps;
+		report(depth == 8 ? "PSMT8 unswizzle" : "PSMT4 unswizzle", texels/1e6, "Mtexel", run(ras, true, reps));
+		report(depth == 8 ? "PSMT8 swizzle" : "PSMT4 swizzle", texels/1e6, "Mtexel", run(ras, false, reps));
+		ras->destroy();
+	}
+	return bad != 0;
+}
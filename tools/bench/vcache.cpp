@@ -0,0 +1,159 @@
+#include "bench.h"
+
+// Vertex cache optimization of trilist geometry.
+// Without arguments a grid with shuffled triangles and vertices is used,
+// otherwise all atomics of the given DFF files.
+// With -w the optimized clumps are written next to the originals
+// as file.dff.vc, which makes this an offline conversion step.
+
+static Geometry *geometries[1024];
+static int32 numGeometries;
+
+static Geometry*
+makeGrid(int32 n)
+{
+	int32 numVerts = (n+1)*(n+1);
+	int32 numTris = n*n*2;
+	int32 i, j;
+	Geometry *geo = Geometry::create(numVerts, numTris, Geometry::POSITIONS | Geometry::NORMALS | Geometry::TEXTURED);
+	Material *mat = Material::create();
+	geo->matList.appendMaterial(mat);
+	mat->destroy();
+	MorphTarget *mt = &geo->morphTargets[0];
+
+	// random vertex numbering
+	int32 *order = rwNewT(int32, numVerts, MEMDUR_EVENT);
+	for(i = 0; i < numVerts; i++)
+		order[i] = i;
+	srand(1);
+	for(i = numVerts-1; i > 0; i--){
+		j = rand() % (i+1);
+		int32 tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+	}
+	for(i = 0; i <= n; i++)
+		for(j = 0; j <= n; j++){
+			int32 v = order[i*(n+1) + j];
+			mt->vertices[v].set(j, i, 0.0f);
+			mt->normals[v].set(0.0f, 0.0f, 1.0f);
+			geo->texCoords[0][v].u = (float32)j/n;
+			geo->texCoords[0][v].v = (float32)i/n;
+		}
+	Triangle *t = geo->triangles;
+	for(i = 0; i < n; i++)
+		for(j = 0; j < n; j++){
+			int32 v00 = order[i*(n+1) + j];
+			int32 v01 = order[i*(n+1) + j+1];
+			int32 v10 = order[(i+1)*(n+1) + j];
+			int32 v11 = order[(i+1)*(n+1) + j+1];
+			t->v[0] = v00; t->v[1] = v01; t->v[2] = v10; t->matId = 0; t++;
+			t->v[0] = v01; t->v[1] = v11; t->v[2] = v10; t->matId = 0; t++;
+		}
+	for(i = numTris-1; i > 0; i--){
+		j = rand() % (i+1);
+		Triangle tmp = geo->triangles[i];
+		geo->triangles[i] = geo->triangles[j];
+		geo->triangles[j] = tmp;
+	}
+	rwFree(order);
+	geo->buildMeshes();
+	return geo;
+}
+
+static Clump*
+readClump(const char *filename)
+{
+	StreamFile in;
+	if(in.open(filename, "rb") == nil)
+		return nil;
+	Clump *c = nil;
+	if(findChunk(&in, ID_CLUMP, nil, nil))
+		c = Clump::streamRead(&in);
+	in.close();
+	return c;
+}
+
+static void
+writeClump(Clump *c, const char *filename)
+{
+	char name[256];
+	StreamFile out;
+	snprintf(name, sizeof(name), "%s.vc", filename);
+	if(out.open(name, "wb") == nil){
+		fprintf(stderr, "%s: can't write\n", name);
+		return;
+	}
+	c->streamWrite(&out);
+	out.close();
+}
+
+static void
+addGeometry(Geometry *geo)
+{
+	for(int32 i = 0; i < numGeometries; i++)
+		if(geometries[i] == geo)
+			return;
+	if(numGeometries < (int32)nelem(geometries))
+		geometries[numGeometries++] = geo;
+}
+
+int
+benchVCache(int argc, char *argv[])
+{
+	Clump *clumps[64];
+	const char *names[64];
+	int32 numClumps = 0;
+	bool write = false;
+	int32 i;
+
+	for(i = 0; i < argc; i++){
+		if(strcmp(argv[i], "-w") == 0){
+			write = true;
+			continue;
+		}
+		Clump *c = readClump(argv[i]);
+		if(c == nil){
+			fprintf(stderr, "%s: can't read clump\n", argv[i]);
+			continue;
+		}
+		if(numClumps == (int32)nelem(clumps)){
+			c->destroy();
+			break;
+		}
+		FORLIST(lnk, c->atomics)
+			addGeometry(Atomic::fromClump(lnk)->geometry);
+		names[numClumps] = argv[i];
+		clumps[numClumps++] = c;
+	}
+	if(numClumps == 0 && argc == 0)
+		addGeometry(makeGrid(180));
+	if(numGeometries == 0)
+		return 1;
+
+	double tris = 0.0;
+	VertexCacheStats before, after, total0 = { 0.0f, 0.0f }, total1 = { 0.0f, 0.0f };
+	Timer t;
+	for(i = 0; i < numGeometries; i++){
+		Geometry *geo = geometries[i];
+		geo->optimizeVertexCache(&before, &after);
+		tris += geo->numTriangles;
+		total0.acmr += before.acmr*geo->numTriangles;
+		total1.acmr += after.acmr*geo->numTriangles;
+		total0.atvr += before.atvr*geo->numTriangles;
+		total1.atvr += after.atvr*geo->numTriangles;
+	}
+	double secs = t.seconds();
+	printf("%d geometries, %.0f triangles\n", numGeometries, tris);
+	printf("acmr %.3f -> %.3f, atvr %.3f -> %.3f\n",
+		total0.acmr/tris, total1.acmr/tris,
+		total0.atvr/tris, total1.atvr/tris);
+	report("optimize", tris/1e6, "Mtri", secs);
+
+	for(i = 0; i < numClumps; i++){
+		if(write)
+			writeClump(clumps[i], names[i]);
+		clumps[i]->destroy();
+	}
+	if(argc == 0)
+		geometries[0]->destroy();
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include "bench.h"
+
+// Xbox Morton order swizzling against the old per-texel version,
+// plus a check of the image -> raster -> image round trip.
+
+static void
+refUnswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp)
+{
+	uint32 maskU = 0;
+	uint32 maskV = 0;
+	int32 i = 1;
+	int32 j = 1;
+	int32 c;
+	do{
+		c = 0;
+		if(i < w){
+			maskU |= j;
+			j <<= 1;
+			c = j;
+		}
+		if(i < h){
+			maskV |= j;
+			j <<= 1;
+			c = j;
+		}
+		i <<= 1;
+	}while(c);
+	int32 x, y, u, v;
+	v = 0;
+	for(y = 0; y < h; y++){
+		u = 0;
+		for(x = 0; x < w; x++){
+			memcpy(&dst[(y*w + x)*bpp], &src[(u|v)*bpp], bpp);
+			u = (u - maskU) & maskU;
+		}
+		v = (v - maskV) & maskV;
+	}
+}
+
+static bool
+check(int32 w, int32 h, int32 bpp)
+{
+	int32 size = w*h*bpp;
+	uint8 *src = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *ref = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *lin = rwNewT(uint8, size, MEMDUR_EVENT);
+	uint8 *back = rwNewT(uint8, size, MEMDUR_EVENT);
+	for(int32 i = 0; i < size; i++)
+		src[i] = rand();
+	refUnswizzle(ref, src, w, h, bpp);
+	xbox::unswizzle(lin, src, w, h, bpp);
+	bool ok = memcmp(lin, ref, size) == 0;
+	xbox::swizzle(back, lin, w, h, bpp);
+	ok = ok && memcmp(back, src, size) == 0;
+	rwFree(src);
+	rwFree(ref);
+	rwFree(lin);
+	rwFree(back);
+	if(!ok)
+		printf("%dx%d %d bpp: mismatch\n", w, h, bpp);
+	return ok;
+}
+
+static bool
+checkRaster(int32 depth)
+{
+	Image *img = Image::create(64, 32, depth);
+	img->allocate();
+	for(int32 i = 0; i < img->stride*img->height; i++)
+		img->pixels[i] = depth == 8 ? rand() : rand() | 0x80;
+	if(depth == 8)
+		for(int32 i = 0; i < 256*4; i++)
+			img->palette[i] = rand();
+	bool ok = false;
+	Raster *ras = Raster::createFromImage(img, PLATFORM_XBOX);
+	if(ras){
+		Image *back = ras->toImage();
+		ok = back && back->depth == img->depth &&
+			memcmp(back->pixels, img->pixels, img->stride*img->height) == 0;
+		if(back)
+			back->destroy();
+		ras->destroy();
+	}
+	img->destroy();
+	if(!ok)
+		printf("%d bit raster round trip failed\n", depth);
+	return ok;
+}
+
+static double
+run(void (*f)(uint8*, uint8*, int32, int32, int32), uint8 *dst, uint8 *src, int32 size, int32 bpp, int32 reps)
+{
+	Timer t;
+	for(int32 r = 0; r < reps; r++)
+		f(dst, src, size, size, bpp);
+	return t.seconds();
+}
+
+int
+benchXboxSwizzle(int argc, char *argv[])
+{
+	int32 bad = 0;
+	for(int32 bpp = 1; bpp <= 4; bpp *= 2)
+		for(int32 w = 1; w <= 512; w *= 2)
+			for(int32 h = 1; h <= 512; h *= 4)
+				if(!check(w, h, bpp))
+					bad++;
+	if(!checkRaster(32)) bad++;
+	if(!checkRaster(16)) bad++;
+	if(!checkRaster(8)) bad++;
+	printf("round trip %s\n", bad ? "FAILED" : "ok");
+
+	const int32 size = 2048;
+	int32 reps = 10;
+	uint8 *src = rwNewT(uint8, size*size*4, MEMDUR_EVENT);
+	uint8 *dst = rwNewT(uint8, size*size*4, MEMDUR_EVENT);
+	memset(src, 0x55, size*size*4);
+	double texels = (double)size*size*reps/1e6;
+	char name[64];
+	for(int32 bpp = 1; bpp <= 4; bpp *= 2){
+		snprintf(name, sizeof(name), "%d bpp unswizzle old", bpp);
+		report(name, texels, "Mtexel", run(refUnswizzle, dst, src, size, bpp, reps));
+		snprintf(name, sizeof(name), "%d bpp unswizzle", bpp);
+		report(name, texels, "Mtexel", run(xbox::unswizzle, dst, src, size, bpp, reps));
+		snprintf(name, sizeof(name), "%d bpp swizzle", bpp);
+		report(name, texels, "Mtexel", run(xbox::swizzle, dst, src, size, bpp, reps));
+	}
+	rwFree(src);
+	rwFree(dst);
+	return bad != 0;
+}